@@ -0,0 +1,434 @@
+%% -------------------------------------------------------------------
+%%
+%% bdberl: Throughput and latency benchmark
+%%
+%% Permission is hereby granted, free of charge, to any person obtaining a copy
+%% of this software and associated documentation files (the "Software"), to deal
+%% in the Software without restriction, including without limitation the rights
+%% to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+%% copies of the Software, and to permit persons to whom the Software is
+%% furnished to do so, subject to the following conditions:
+%%
+%% The above copyright notice and this permission notice shall be included in
+%% all copies or substantial portions of the Software.
+%%
+%% THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+%% IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+%% FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+%% AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+%% LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+%% OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+%% THE SOFTWARE.
+%%
+%% -------------------------------------------------------------------
+-module(bdberl_bench).
+
+%% Runs a configurable workload against the driver and appends one CSV row
+%% per operation (plus an `all' row) to the output file, so runs against
+%% different driver builds can be compared.
+%%
+%% Configuration is a proplist (see bench/bdberl_bench.config):
+%%
+%%   {label, string()}              Name of the run in the output
+%%   {output, string()}             CSV file; the header is written when it is new
+%%   {db, string()}                 Database file name
+%%   {db_type, btree | hash}
+%%   {db_opts, list()}              Options for bdberl:open/3, e.g. [{h_hash, xxh64}]
+%%   {duration_secs, integer()}
+%%   {clients, integer()}           Number of client processes
+%%   {mix, [{Op, Weight}]}          Op = get | put | del | update
+%%   {keys, integer()}              Size of the key space
+%%   {key_dist, uniform | {zipf, Theta}}
+%%   {key_size, Size}               Bytes; integer() | {uniform, Min, Max}
+%%   {value_size, Size}             Bytes; Size = integer() | {uniform, Min, Max}
+%%                                  | {exponential, Mean}
+%%   {txn, boolean()}               Wrap every operation in a transaction
+%%   {rate, unlimited | integer()}  Total open-loop arrival rate in ops/s
+%%   {prepopulate, boolean()}       Write every key once before measuring
+%%
+%% With a rate each client issues requests at exponentially distributed
+%% intervals and latency is measured from the intended start time, so time
+%% spent queued behind a slow request is counted. Without one the clients
+%% run closed-loop as fast as the driver answers.
+
+-export([main/1, run/1, default_config/0]).
+
+%% Shared with the other benchmarks in bench/
+-export([zipf_init/2, zipf_next/1, histo_add/2, histo_merge/2, histo_stats/1,
+         fmt/1, join/1, timestamp/0]).
+
+-record(client, {name, type, db, mix, keys, zipf, key_size, value_size, value_pool, txn,
+                 interval, deadline, ops = [], errors = []}).
+
+%% Latency histogram: log-linear buckets of usecs, 8 per power of two
+-define(SUB_BITS, 3).
+
+default_config() ->
+    [{label, "default"},
+     {output, "bench/results.csv"},
+     {db, "bench.db"},
+     {db_type, btree},
+     {db_opts, []},
+     {duration_secs, 30},
+     {clients, 16},
+     {mix, [{get, 80}, {put, 20}]},
+     {keys, 100000},
+     {key_dist, uniform},
+     {key_size, 16},
+     {value_size, 100},
+     {txn, false},
+     {rate, unlimited},
+     {prepopulate, true}].
+
+%% Entry point for `make bench'; Args is [ConfigFile] or []
+main([]) ->
+    run([]);
+main([File | _]) ->
+    {ok, Terms} = file:consult(File),
+    run(Terms).
+
+run(Overrides) ->
+    Config = lists:ukeymerge(1, lists:ukeysort(1, Overrides), lists:ukeysort(1, default_config())),
+    Get = fun(Key) -> proplists:get_value(Key, Config) end,
+
+    {ok, Db} = bdberl:open(Get(db), Get(db_type), [create | Get(db_opts)]),
+    Zipf = case Get(key_dist) of
+               uniform      -> undefined;
+               {zipf, Theta} -> zipf_init(Get(keys), Theta)
+           end,
+    Proto = #client{name = Get(db),
+                    type = Get(db_type),
+                    db = Db,
+                    mix = mix_table(Get(mix)),
+                    keys = Get(keys),
+                    zipf = Zipf,
+                    key_size = Get(key_size),
+                    value_size = Get(value_size),
+                    value_pool = random_bytes(1024 * 1024),
+                    txn = Get(txn)},
+    case Get(prepopulate) of
+        true  -> prepopulate(Proto);
+        false -> ok
+    end,
+
+    Clients = Get(clients),
+    Interval = case Get(rate) of
+                   unlimited -> undefined;
+                   Rate      -> 1000000 * Clients / Rate   % Mean usecs between a client's requests
+               end,
+    Start = os:timestamp(),
+    Deadline = add_usecs(Start, Get(duration_secs) * 1000000),
+    Self = self(),
+    Pids = [spawn_link(fun() -> client_init(Self, Proto#client{interval = Interval,
+                                                                deadline = Deadline}) end)
+            || _ <- lists:seq(1, Clients)],
+    Results = [receive {bench_result, Pid, Ops, Errors} -> {Ops, Errors} end || Pid <- Pids],
+    Elapsed = timer:now_diff(os:timestamp(), Start) / 1000000,
+    ok = bdberl:close(Db),
+
+    Rows = summarize(Results, Elapsed),
+    write_csv(Get(output), Get(label), Config, Rows),
+    print_rows(Get(label), Rows),
+    {ok, Rows}.
+
+
+%% ====================================================================
+%% Clients
+%% ====================================================================
+
+client_init(Owner, Client) ->
+    {A1, A2, A3} = now(),
+    random:seed(A1, A2, A3),
+    %% Each process talks to the driver through its own port, which must open the
+    %% database itself; the driver hands back the same reference
+    Db = Client#client.db,
+    {ok, Db} = bdberl:open(Client#client.name, Client#client.type),
+    Final = client_loop(Client, os:timestamp()),
+    Owner ! {bench_result, self(), Final#client.ops, Final#client.errors}.
+
+client_loop(#client{deadline = Deadline} = Client, Next) ->
+    case timer:now_diff(Next, Deadline) >= 0 of
+        true ->
+            Client;
+        false ->
+            %% Open-loop clients wait for the scheduled arrival time; latency is
+            %% measured from it even if the previous request overran
+            Start = case Client#client.interval of
+                        undefined ->
+                            os:timestamp();
+                        _ ->
+                            case timer:now_diff(Next, os:timestamp()) of
+                                Wait when Wait > 1000 -> timer:sleep(Wait div 1000);
+                                _                     -> ok
+                            end,
+                            Next
+                    end,
+            Op = choose_op(Client#client.mix),
+            Result = run_op(Op, Client),
+            Usecs = timer:now_diff(os:timestamp(), Start),
+            Client1 = record(Op, Result, Usecs, Client),
+            client_loop(Client1, next_arrival(Client, Start))
+    end.
+
+next_arrival(#client{interval = undefined}, _Start) ->
+    os:timestamp();
+next_arrival(#client{interval = Mean}, Start) ->
+    add_usecs(Start, round(-Mean * math:log(1.0 - random:uniform()))).
+
+run_op(Op, #client{txn = false} = Client) ->
+    do_op(Op, Client);
+run_op(put, #client{txn = true, db = Db} = Client) ->
+    %% put_commit saves a separate round trip for the commit
+    case bdberl:txn_begin() of
+        ok ->
+            bdberl:put_commit(Db, key(Client), value(Client));
+        {error, _} = BeginError ->
+            %% e.g. overloaded; counted like any other error and retried next round
+            BeginError
+    end;
+run_op(update, Client) ->
+    %% update/3 runs its own transaction
+    do_op(update, Client);
+run_op(Op, #client{txn = true} = Client) ->
+    case bdberl:txn_begin() of
+        ok ->
+            case do_op(Op, Client) of
+                {error, _} = OpError ->
+                    bdberl:txn_abort(),
+                    OpError;
+                Result ->
+                    case bdberl:txn_commit() of
+                        ok          -> Result;
+                        CommitError -> CommitError
+                    end
+            end;
+        {error, _} = BeginError ->
+            BeginError
+    end.
+
+do_op(get, #client{db = Db} = Client) ->
+    bdberl:get(Db, key(Client));
+do_op(put, #client{db = Db} = Client) ->
+    bdberl:put(Db, key(Client), value(Client));
+do_op(del, #client{db = Db} = Client) ->
+    bdberl:del(Db, key(Client));
+do_op(update, #client{db = Db} = Client) ->
+    Value = value(Client),
+    bdberl:update(Db, key(Client), fun(_Key, _Old) -> Value end).
+
+record(Op, {error, Reason}, _Usecs, #client{errors = Errors} = Client) ->
+    Client#client{errors = orddict:update_counter({Op, Reason}, 1, Errors)};
+record(Op, _Result, Usecs, #client{ops = Ops} = Client) ->
+    Histo = case lists:keyfind(Op, 1, Ops) of
+                {Op, H} -> H;
+                false   -> []
+            end,
+    Client#client{ops = lists:keystore(Op, 1, Ops, {Op, histo_add(Usecs, Histo)})}.
+
+
+%% ====================================================================
+%% Workload generation
+%% ====================================================================
+
+prepopulate(#client{db = Db, keys = Keys} = Client) ->
+    lists:foreach(fun(N) -> ok = bdberl:put(Db, make_key(N, Client), value(Client)) end,
+                  lists:seq(1, Keys)).
+
+mix_table(Mix) ->
+    Total = lists:sum([W || {_, W} <- Mix]),
+    {_, Table} = lists:foldl(fun({Op, W}, {Acc, T}) -> {Acc + W, [{Acc + W, Op} | T]} end,
+                             {0, []}, Mix),
+    {Total, lists:reverse(Table)}.
+
+choose_op({Total, Table}) ->
+    N = random:uniform(Total),
+    hd([Op || {Upto, Op} <- Table, N =< Upto]).
+
+key(#client{zipf = undefined, keys = Keys} = Client) ->
+    make_key(random:uniform(Keys), Client);
+key(#client{zipf = Zipf} = Client) ->
+    make_key(zipf_next(Zipf), Client).
+
+%% Keys are N padded or truncated to the configured size. A {uniform, Min, Max}
+%% key size is spread over the key space so a given N always maps to the same key.
+make_key(N, #client{key_size = Size}) ->
+    Bin = list_to_binary(integer_to_list(N)),
+    pad(Bin, key_length(N, Size)).
+
+key_length(_N, Size) when is_integer(Size) ->
+    Size;
+key_length(N, {uniform, Min, Max}) ->
+    Min + N rem (Max - Min + 1).
+
+pad(Bin, Size) when size(Bin) >= Size ->
+    <<Part:Size/binary, _/binary>> = Bin,
+    Part;
+pad(Bin, Size) ->
+    <<Bin/binary, 0:((Size - size(Bin)) * 8)>>.
+
+value(#client{value_size = Size, value_pool = Pool}) ->
+    Len = erlang:min(sample_size(Size), size(Pool)),
+    Offset = random:uniform(size(Pool) - Len + 1) - 1,
+    <<_:Offset/binary, Value:Len/binary, _/binary>> = Pool,
+    Value.
+
+%% Draw a length in bytes from a size spec
+sample_size(Size) when is_integer(Size) ->
+    Size;
+sample_size({uniform, Min, Max}) ->
+    Min + random:uniform(Max - Min + 1) - 1;
+sample_size({exponential, Mean}) ->
+    erlang:max(1, round(-Mean * math:log(1.0 - random:uniform()))).
+
+%% Values are slices of one random block so generating them costs nothing
+random_bytes(Size) ->
+    list_to_binary([random:uniform(256) - 1 || _ <- lists:seq(1, Size)]).
+
+%% Zipfian key choice (Gray et al., "Quickly Generating Billion-Record
+%% Synthetic Databases"); rank 1 is the hottest key
+zipf_init(N, Theta) ->
+    ZetaN = zeta(N, Theta),
+    Zeta2 = zeta(2, Theta),
+    Alpha = 1 / (1 - Theta),
+    Eta = (1 - math:pow(2 / N, 1 - Theta)) / (1 - Zeta2 / ZetaN),
+    {N, Theta, Alpha, ZetaN, Eta}.
+
+zipf_next({N, Theta, Alpha, ZetaN, Eta}) ->
+    U = random:uniform(),
+    UZ = U * ZetaN,
+    if
+        UZ < 1 -> 1;
+        UZ < 1 + math:pow(0.5, Theta) -> 2;
+        true -> erlang:min(N, 1 + trunc(N * math:pow(Eta * U - Eta + 1, Alpha)))
+    end.
+
+zeta(N, Theta) ->
+    lists:foldl(fun(I, Acc) -> Acc + 1 / math:pow(I, Theta) end, 0.0, lists:seq(1, N)).
+
+
+%% ====================================================================
+%% Histograms and reporting
+%% ====================================================================
+
+histo_add(Usecs, Histo) ->
+    orddict:update_counter(bucket(Usecs), 1, Histo).
+
+bucket(V) when V < (1 bsl ?SUB_BITS) ->
+    V;
+bucket(V) ->
+    Exp = msb(V, 0),
+    Shift = Exp - ?SUB_BITS,
+    (V bsr Shift) bsl Shift.           % Lower bound of the bucket in usecs
+
+msb(1, N) -> N;
+msb(V, N) -> msb(V bsr 1, N + 1).
+
+histo_merge(A, B) ->
+    orddict:merge(fun(_, X, Y) -> X + Y end, A, B).
+
+%% Upper bound of the bucket holding the requested percentile
+percentile(Histo, Count, Pct) ->
+    Target = erlang:max(1, round(Count * Pct / 100)),
+    percentile(Histo, Target, 0, 0).
+
+percentile([], _Target, _Seen, Last) ->
+    Last;
+percentile([{Bucket, N} | Rest], Target, Seen, _Last) ->
+    case Seen + N >= Target of
+        true  -> bucket_upper(Bucket);
+        false -> percentile(Rest, Target, Seen + N, Bucket)
+    end.
+
+bucket_upper(B) when B < (1 bsl ?SUB_BITS) ->
+    B;
+bucket_upper(B) ->
+    B + (1 bsl (msb(B, 0) - ?SUB_BITS)) - 1.
+
+summarize(Results, Elapsed) ->
+    AllOps = lists:foldl(fun({Ops, _}, Acc) ->
+                                 lists:foldl(fun({Op, H}, A) ->
+                                                     orddict:update(Op, fun(H0) -> histo_merge(H0, H) end, H, A)
+                                             end, Acc, Ops)
+                         end, [], Results),
+    AllErrors = lists:foldl(fun({_, Errors}, Acc) ->
+                                    orddict:merge(fun(_, X, Y) -> X + Y end, Errors, Acc)
+                            end, [], Results),
+    Total = lists:foldl(fun({_, H}, Acc) -> histo_merge(H, Acc) end, [], AllOps),
+    [row(Op, H, errors_for(Op, AllErrors), Elapsed) || {Op, H} <- AllOps] ++
+        [row(all, Total, lists:sum([N || {_, N} <- AllErrors]), Elapsed)].
+
+errors_for(Op, Errors) ->
+    lists:sum([N || {{O, _}, N} <- Errors, O =:= Op]).
+
+row(Op, Histo, Errors, Elapsed) ->
+    Stats = histo_stats(Histo),
+    Count = proplists:get_value(count, Stats),
+    [{op, Op},
+     {count, Count},
+     {errors, Errors},
+     {ops_per_sec, Count / Elapsed} | tl(Stats)].
+
+%% [{count, N}, {mean_us, F}, {p50_us, N}, {p90_us, N}, {p99_us, N}, {p999_us, N}, {max_us, N}]
+histo_stats(Histo) ->
+    Count = lists:sum([N || {_, N} <- Histo]),
+    Sum = lists:sum([B * N || {B, N} <- Histo]),
+    Max = case Histo of
+              [] -> 0;
+              _  -> bucket_upper(element(1, lists:last(Histo)))
+          end,
+    [{count, Count},
+     {mean_us, Sum / erlang:max(Count, 1)},
+     {p50_us, percentile(Histo, Count, 50)},
+     {p90_us, percentile(Histo, Count, 90)},
+     {p99_us, percentile(Histo, Count, 99)},
+     {p999_us, percentile(Histo, Count, 99.9)},
+     {max_us, Max}].
+
+-define(CSV_COLUMNS, [op, count, errors, ops_per_sec, mean_us, p50_us, p90_us, p99_us,
+                      p999_us, max_us]).
+
+write_csv(File, Label, Config, Rows) ->
+    ok = filelib:ensure_dir(File),
+    New = not filelib:is_regular(File),
+    {ok, Fd} = file:open(File, [append]),
+    case New of
+        true ->
+            io:format(Fd, "timestamp,label,clients,txn,rate,key_dist,~s~n",
+                      [join([atom_to_list(C) || C <- ?CSV_COLUMNS])]);
+        false ->
+            ok
+    end,
+    Prefix = [timestamp(), Label,
+              fmt(proplists:get_value(clients, Config)),
+              fmt(proplists:get_value(txn, Config)),
+              fmt(proplists:get_value(rate, Config)),
+              fmt(proplists:get_value(key_dist, Config))],
+    [io:format(Fd, "~s~n", [join(Prefix ++ [fmt(proplists:get_value(C, Row)) || C <- ?CSV_COLUMNS])])
+     || Row <- Rows],
+    file:close(Fd).
+
+print_rows(Label, Rows) ->
+    io:format("~s~n~-8s ~10s ~8s ~12s ~10s ~8s ~8s ~8s ~8s ~8s~n",
+              [Label, "op", "count", "errors", "ops/s", "mean", "p50", "p90", "p99", "p999", "max"]),
+    [io:format("~-8s ~10B ~8B ~12.1f ~10.1f ~8B ~8B ~8B ~8B ~8B~n",
+               [atom_to_list(proplists:get_value(op, R)) | [proplists:get_value(C, R) || C <- tl(?CSV_COLUMNS)]])
+     || R <- Rows],
+    ok.
+
+fmt(V) when is_float(V)   -> io_lib:format("~.2f", [V]);
+fmt(V) when is_integer(V) -> integer_to_list(V);
+fmt(V) when is_atom(V)    -> atom_to_list(V);
+fmt(V) when is_list(V)    -> V;
+fmt(V)                    -> lists:flatten(io_lib:format("\"~w\"", [V])).  % Quoted; terms contain commas
+
+timestamp() ->
+    {{Y, Mo, D}, {H, Mi, S}} = calendar:universal_time(),
+    io_lib:format("~4..0B-~2..0B-~2..0BT~2..0B:~2..0B:~2..0BZ", [Y, Mo, D, H, Mi, S]).
+
+join([])       -> [];
+join([H])      -> H;
+join([H | T])  -> [H, "," | join(T)].
+
+add_usecs({Mega, Secs, Micro}, Usecs) ->
+    Total = (Mega * 1000000 + Secs) * 1000000 + Micro + Usecs,
+    {Total div 1000000000000, (Total div 1000000) rem 1000000, Total rem 1000000}.
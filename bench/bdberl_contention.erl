@@ -0,0 +1,303 @@
+%% -------------------------------------------------------------------
+%%
+%% bdberl: Hot-key contention benchmark
+%%
+%% Permission is hereby granted, free of charge, to any person obtaining a copy
+%% of this software and associated documentation files (the "Software"), to deal
+%% in the Software without restriction, including without limitation the rights
+%% to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+%% copies of the Software, and to permit persons to whom the Software is
+%% furnished to do so, subject to the following conditions:
+%%
+%% The above copyright notice and this permission notice shall be included in
+%% all copies or substantial portions of the Software.
+%%
+%% THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+%% IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+%% FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+%% AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+%% LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+%% OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+%% THE SOFTWARE.
+%%
+%% -------------------------------------------------------------------
+-module(bdberl_contention).
+
+%% Runs counter-increment transactions against a small, skewed key space and
+%% reports what contention costs: committed txn/s, deadlock and
+%% lock_not_granted rates, and how many attempts transaction/4 needed per
+%% commit. Each combination of key_dist, txn_keys and mode in the
+%% configuration is run in turn and appended as one CSV row.
+%%
+%% Configuration is a proplist (see bench/bdberl_contention.config):
+%%
+%%   {label, string()}
+%%   {output, string()}                 CSV file; the header is written when it is new
+%%   {db, string()}                     Database file name; truncated before each run
+%%   {duration_secs, integer()}         Length of each run
+%%   {clients, integer()}
+%%   {keys, integer()}                  Size of the key space
+%%   {key_dist, [uniform | {zipf, Theta}]}
+%%   {txn_keys, [integer()]}            Keys incremented per transaction
+%%   {key_order, random | sorted}       sorted takes locks in key order (no cycles)
+%%   {hold_ms, integer()}               Sleep between the reads and writes of a txn
+%%   {retries, integer() | infinity}    Passed to transaction/4
+%%   {txn_opts, [atom()]}               Passed to txn_begin, e.g. [txn_nowait]
+%%   {modes, [Mode]}
+%%
+%% Modes:
+%%
+%%   update      bdberl:update/3, the driver's read-modify-write path. It
+%%               always touches one key, so it only runs when txn_keys is 1.
+%%   rmw         transaction/4 reading every key with [rmw] before writing,
+%%               so the write lock is taken up front
+%%   read_write  transaction/4 with plain reads, so each write has to upgrade
+%%               a read lock -- the classic conversion deadlock
+%%
+%% New paths for contended updates (an in-driver increment or compare-and-swap,
+%% say) belong in run_txn/2 as further modes so they are measured the same way.
+%%
+%% Deadlocks and lock_not_granted errors are read from bdberl:db_counters/1.
+%% Every such error aborts one attempt, so for update attempts are taken as
+%% commits + lock errors; the transaction modes count their fun invocations.
+%% After each run every counter is summed and compared with the increments
+%% that were committed, so lost_updates should always be 0.
+
+-export([main/1, run/1, default_config/0]).
+
+-record(client, {db, mode, keys, zipf, txn_keys, key_order, hold_ms, retries, txn_opts,
+                 deadline, commits = 0, failed = [], increments = 0, fun_calls = 0, histo = []}).
+
+default_config() ->
+    [{label, "contention"},
+     {output, "bench/contention.csv"},
+     {db, "contention.db"},
+     {duration_secs, 20},
+     {clients, 16},
+     {keys, 1000},
+     {key_dist, [uniform, {zipf, 0.99}]},
+     {txn_keys, [1, 4]},
+     {key_order, random},
+     {hold_ms, 0},
+     {retries, 100},
+     {txn_opts, []},
+     {modes, [update, rmw, read_write]}].
+
+%% Entry point for `make contention-bench'; Args is [ConfigFile] or []
+main([]) ->
+    run([]);
+main([File | _]) ->
+    {ok, Terms} = file:consult(File),
+    run(Terms).
+
+run(Overrides) ->
+    Config = lists:ukeymerge(1, lists:ukeysort(1, Overrides), lists:ukeysort(1, default_config())),
+    Get = fun(Key) -> proplists:get_value(Key, Config) end,
+    Rows = [run_one(Config, Dist, TxnKeys, Mode)
+            || Dist <- as_list(Get(key_dist)),
+               TxnKeys <- as_list(Get(txn_keys)),
+               Mode <- Get(modes),
+               Mode =/= update orelse TxnKeys =:= 1],
+    print_rows(Get(label), Rows),
+    {ok, Rows}.
+
+run_one(Config, Dist, TxnKeys, Mode) ->
+    Get = fun(Key) -> proplists:get_value(Key, Config) end,
+    {ok, Db} = bdberl:open(Get(db), btree),
+    ok = bdberl:truncate(Db),
+    Keys = Get(keys),
+    Zipf = case Dist of
+               uniform       -> undefined;
+               {zipf, Theta} -> bdberl_bench:zipf_init(Keys, Theta)
+           end,
+    {ok, Before} = bdberl:db_counters(Db),
+
+    Clients = Get(clients),
+    Start = os:timestamp(),
+    Deadline = add_usecs(Start, Get(duration_secs) * 1000000),
+    Proto = #client{db = Db, mode = Mode, keys = Keys, zipf = Zipf, txn_keys = TxnKeys,
+                    key_order = Get(key_order), hold_ms = Get(hold_ms),
+                    retries = Get(retries), txn_opts = Get(txn_opts), deadline = Deadline},
+    Self = self(),
+    Pids = [spawn_link(fun() -> client_init(Self, Get(db), Proto) end)
+            || _ <- lists:seq(1, Clients)],
+    Results = [receive {contention_result, Pid, C} -> C end || Pid <- Pids],
+    Elapsed = timer:now_diff(os:timestamp(), Start) / 1000000,
+
+    {ok, After} = bdberl:db_counters(Db),
+    Stored = sum_counters(Db, Keys),
+    ok = bdberl:close(Db),
+
+    Counter = fun(Name) -> proplists:get_value(Name, After) - proplists:get_value(Name, Before) end,
+    Commits = lists:sum([C#client.commits || C <- Results]),
+    Failed = lists:foldl(fun(C, Acc) -> orddict:merge(fun(_, X, Y) -> X + Y end, C#client.failed, Acc) end,
+                         [], Results),
+    FailedCount = lists:sum([N || {_, N} <- Failed]),
+    Increments = lists:sum([C#client.increments || C <- Results]),
+    FunCalls = lists:sum([C#client.fun_calls || C <- Results]),
+    Deadlocks = Counter(deadlocks),
+    NotGranted = Counter(lock_not_granted),
+    Attempts = case Mode of
+                   update -> Commits + Deadlocks + NotGranted;
+                   _      -> FunCalls
+               end,
+    Histo = lists:foldl(fun(C, Acc) -> bdberl_bench:histo_merge(C#client.histo, Acc) end,
+                        [], Results),
+    Stats = bdberl_bench:histo_stats(Histo),
+    Row = [{key_dist, dist_name(Dist)},
+           {txn_keys, TxnKeys},
+           {mode, Mode},
+           {clients, Clients},
+           {commits, Commits},
+           {txn_per_sec, Commits / Elapsed},
+           {deadlocks_per_sec, Deadlocks / Elapsed},
+           {not_granted_per_sec, NotGranted / Elapsed},
+           {attempts_per_commit, Attempts / erlang:max(Commits, 1)},
+           {failed, FailedCount},
+           {lost_updates, Increments - Stored} | tl(Stats)],
+    write_csv(Get(output), Get(label), Row),
+    Row.
+
+dist_name(uniform)       -> "uniform";
+dist_name({zipf, Theta}) -> lists:flatten(io_lib:format("zipf-~.2f", [float(Theta)])).
+
+as_list(L) when is_list(L) -> L;
+as_list(V)                 -> [V].
+
+
+%% ====================================================================
+%% Clients
+%% ====================================================================
+
+client_init(Owner, Name, #client{db = Db} = Client) ->
+    {A1, A2, A3} = now(),
+    random:seed(A1, A2, A3),
+    {ok, Db} = bdberl:open(Name, btree),
+    put(fun_calls, 0),
+    Final = client_loop(Client),
+    Owner ! {contention_result, self(), Final#client{fun_calls = get(fun_calls)}}.
+
+client_loop(#client{deadline = Deadline} = Client) ->
+    case timer:now_diff(os:timestamp(), Deadline) >= 0 of
+        true ->
+            Client;
+        false ->
+            Keys = pick_keys(Client),
+            Start = os:timestamp(),
+            Result = run_txn(Keys, Client),
+            Usecs = timer:now_diff(os:timestamp(), Start),
+            client_loop(record(Result, length(Keys), Usecs, Client))
+    end.
+
+pick_keys(#client{txn_keys = N, key_order = Order} = Client) ->
+    Keys = [key(Client) || _ <- lists:seq(1, N)],
+    case Order of
+        random -> Keys;
+        sorted -> lists:usort(Keys)
+    end.
+
+key(#client{zipf = undefined, keys = Keys}) ->
+    random:uniform(Keys);
+key(#client{zipf = Zipf}) ->
+    bdberl_bench:zipf_next(Zipf).
+
+run_txn([Key], #client{mode = update, db = Db, retries = Retries, txn_opts = Opts}) ->
+    bdberl:update(Db, Key, fun(_K, Value) -> incr(Value) end, undefined, Retries, Opts);
+run_txn(Keys, #client{mode = Mode, db = Db, retries = Retries, txn_opts = Opts,
+                      hold_ms = Hold}) ->
+    GetOpts = case Mode of
+                  rmw        -> [rmw];
+                  read_write -> []
+              end,
+    F = fun() ->
+                put(fun_calls, get(fun_calls) + 1),
+                Read = [{Key, read(Db, Key, GetOpts)} || Key <- Keys],
+                hold(Hold),
+                %% A key picked twice is incremented twice
+                lists:foldl(fun({Key, Value}, Written) ->
+                                    Current = case orddict:find(Key, Written) of
+                                                  {ok, V} -> V;
+                                                  error   -> Value
+                                              end,
+                                    New = incr(Current),
+                                    bdberl:put_r(Db, Key, New),
+                                    orddict:store(Key, New, Written)
+                            end, [], Read),
+                ok
+        end,
+    bdberl:transaction(F, Retries, Opts).
+
+read(Db, Key, Opts) ->
+    case bdberl:get_r(Db, Key, Opts) of
+        not_found -> not_found;
+        {ok, V}   -> V
+    end.
+
+incr(not_found) -> 1;
+incr(N)         -> N + 1.
+
+hold(0)  -> ok;
+hold(Ms) -> timer:sleep(Ms).
+
+record({ok, _}, NKeys, Usecs, #client{commits = C, increments = I, histo = H} = Client) ->
+    Client#client{commits = C + 1, increments = I + NKeys,
+                  histo = bdberl_bench:histo_add(Usecs, H)};
+record({error, Reason}, _NKeys, _Usecs, #client{failed = F} = Client) ->
+    Client#client{failed = orddict:update_counter(reason(Reason), 1, F)}.
+
+reason({transaction_failed, _}) -> transaction_failed;
+reason(Reason)                  -> Reason.
+
+sum_counters(Db, Keys) ->
+    lists:sum([case bdberl:get(Db, K) of
+                   {ok, V}   -> V;
+                   not_found -> 0
+               end || K <- lists:seq(1, Keys)]).
+
+
+%% ====================================================================
+%% Reporting
+%% ====================================================================
+
+-define(CSV_COLUMNS, [key_dist, txn_keys, mode, clients, commits, txn_per_sec,
+                      deadlocks_per_sec, not_granted_per_sec, attempts_per_commit, failed,
+                      lost_updates, mean_us, p50_us, p90_us, p99_us, p999_us, max_us]).
+
+write_csv(File, Label, Row) ->
+    ok = filelib:ensure_dir(File),
+    New = not filelib:is_regular(File),
+    {ok, Fd} = file:open(File, [append]),
+    case New of
+        true ->
+            io:format(Fd, "timestamp,label,~s~n",
+                      [bdberl_bench:join([atom_to_list(C) || C <- ?CSV_COLUMNS])]);
+        false ->
+            ok
+    end,
+    Fields = [bdberl_bench:fmt(proplists:get_value(C, Row)) || C <- ?CSV_COLUMNS],
+    io:format(Fd, "~s~n", [bdberl_bench:join([bdberl_bench:timestamp(), Label | Fields])]),
+    file:close(Fd).
+
+print_rows(Label, Rows) ->
+    io:format("~s~n~-14s ~4s ~-10s ~10s ~10s ~10s ~10s ~9s ~6s ~5s ~8s ~8s~n",
+              [Label, "key_dist", "keys", "mode", "txn/s", "dlock/s", "nogrant/s",
+               "att/commit", "failed", "lost", "p50", "p99", "max"]),
+    [io:format("~-14s ~4B ~-10s ~10.1f ~10.1f ~10.1f ~10.2f ~9B ~6B ~5B ~8B ~8B~n",
+               [proplists:get_value(key_dist, R),
+                proplists:get_value(txn_keys, R),
+                atom_to_list(proplists:get_value(mode, R)),
+                proplists:get_value(txn_per_sec, R),
+                proplists:get_value(deadlocks_per_sec, R),
+                proplists:get_value(not_granted_per_sec, R),
+                proplists:get_value(attempts_per_commit, R),
+                proplists:get_value(failed, R),
+                proplists:get_value(lost_updates, R),
+                proplists:get_value(p50_us, R),
+                proplists:get_value(p99_us, R),
+                proplists:get_value(max_us, R)])
+     || R <- Rows],
+    ok.
+
+add_usecs({Mega, Secs, Micro}, Usecs) ->
+    Total = (Mega * 1000000 + Secs) * 1000000 + Micro + Usecs,
+    {Total div 1000000000000, (Total div 1000000) rem 1000000, Total rem 1000000}.
@@ -0,0 +1,375 @@
+%% -------------------------------------------------------------------
+%%
+%% bdberl: Capture replay
+%%
+%% Permission is hereby granted, free of charge, to any person obtaining a copy
+%% of this software and associated documentation files (the "Software"), to deal
+%% in the Software without restriction, including without limitation the rights
+%% to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+%% copies of the Software, and to permit persons to whom the Software is
+%% furnished to do so, subject to the following conditions:
+%%
+%% The above copyright notice and this permission notice shall be included in
+%% all copies or substantial portions of the Software.
+%%
+%% THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+%% IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+%% FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+%% AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+%% LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+%% OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+%% THE SOFTWARE.
+%%
+%% -------------------------------------------------------------------
+-module(bdberl_replay).
+
+%% Replays a request capture (see bdberl:capture_start/1) against the
+%% environment in DB_HOME, which should be a scratch directory, and reports
+%% the latency of every operation type.
+%%
+%% Each captured port is replayed by its own process and port, so requests
+%% from one port keep their order and transactions, and requests from
+%% different ports overlap as they did originally. Requests are issued at
+%% their captured offsets divided by the speed: 1.0 reproduces the original
+%% timing, 10.0 runs ten times faster and 0 issues every request as soon as
+%% the previous one on its port completes. Latency is measured from the time
+%% a request was issued; how far behind schedule the replay fell is reported
+%% as max_lag_ms.
+%%
+%% Only value sizes are captured, so values are random bytes of the same
+%% encoded size. Databases are opened with `create' since the scratch
+%% environment starts empty; a database opened before the capture started is
+%% replayed under the name "dbref_N.db".
+%%
+%% Options:
+%%
+%%   {speed, number()}          Default 1.0
+%%   {label, string()}
+%%   {output, string()}         CSV file, default bench/replay.csv
+
+-export([main/1, run/2, read_capture/1]).
+
+-include("../include/bdberl.hrl").
+
+-record(req, {ts, port, cmd, dbref, flags, key, value_size}).
+
+-record(worker, {dbs, refs = [], base, t0, speed, pool, histos = [], errors = [],
+                 max_lag = 0}).
+
+%% Entry point for `make replay'; Args is [CaptureFile] or [CaptureFile, Speed]
+main([File]) ->
+    run(File, []);
+main([File, Speed | _]) ->
+    run(File, [{speed, to_number(Speed)}]).
+
+run(File, Opts) ->
+    Speed = proplists:get_value(speed, Opts, 1.0),
+    Label = proplists:get_value(label, Opts, filename:basename(File)),
+    Output = proplists:get_value(output, Opts, "bench/replay.csv"),
+
+    {ok, Reqs} = read_capture(File),
+    Dbs = [{R#req.dbref, {binary_to_list(R#req.key), db_type(R#req.value_size)}}
+           || R <- Reqs, R#req.cmd =:= ?CMD_OPEN_DB],
+    T0 = case Reqs of
+             []          -> 0;
+             [First | _] -> First#req.ts
+         end,
+    Ports = group_by_port(Reqs),
+    io:format("Replaying ~B requests from ~B ports at speed ~p~n",
+              [length(Reqs), length(Ports), Speed]),
+
+    Pool = list_to_binary([random:uniform(256) - 1 || _ <- lists:seq(1, 1024 * 1024)]),
+    Self = self(),
+    Pids = [spawn_link(fun() -> worker_init(Self, PortReqs) end) || {_, PortReqs} <- Ports],
+    Base = os:timestamp(),
+    Proto = #worker{dbs = Dbs, base = Base, t0 = T0, speed = Speed, pool = Pool},
+    [Pid ! {go, Proto} || Pid <- Pids],
+    Results = [receive {replay_result, Pid, W} -> W end || Pid <- Pids],
+    Elapsed = timer:now_diff(os:timestamp(), Base) / 1000000,
+
+    Rows = summarize(Results, Elapsed),
+    write_csv(Output, Label, Speed, Rows),
+    print_rows(Label, Rows),
+    {ok, Rows}.
+
+%% Read a capture file into a list of #req{} in arrival order
+read_capture(File) ->
+    case file:read_file(File) of
+        {ok, <<"BDBC", 1:32/native, _Start:64/native, Records/bytes>>} ->
+            {ok, lists:keysort(#req.ts, decode_records(Records, []))};
+        {ok, _} ->
+            {error, bad_capture_file};
+        Error ->
+            Error
+    end.
+
+decode_records(<<Ts:64/native, Port:32/native, Cmd:32/native, DbRef:32/signed-native,
+                 Flags:32/native, KeySize:32/native, ValueSize:32/native,
+                 Key:KeySize/bytes, Rest/bytes>>, Acc) ->
+    decode_records(Rest, [#req{ts = Ts, port = Port, cmd = Cmd, dbref = DbRef, flags = Flags,
+                               key = Key, value_size = ValueSize} | Acc]);
+decode_records(_Truncated, Acc) ->
+    lists:reverse(Acc).
+
+group_by_port(Reqs) ->
+    Dict = lists:foldl(fun(R, D) -> dict:append(R#req.port, R, D) end, dict:new(), Reqs),
+    lists:sort(dict:to_list(Dict)).
+
+
+%% ====================================================================
+%% Workers
+%% ====================================================================
+
+worker_init(Owner, Reqs) ->
+    receive
+        {go, W} ->
+            {A1, A2, A3} = now(),
+            random:seed(A1, A2, A3),
+            Final = lists:foldl(fun replay/2, W, Reqs),
+            %% A capture can end in the middle of a transaction
+            catch bdberl:cursor_close(),
+            catch bdberl:txn_abort(),
+            Owner ! {replay_result, self(), Final}
+    end.
+
+replay(R, W) ->
+    Lag = wait_until(R, W),
+    Start = os:timestamp(),
+    {Op, Result, W1} = issue(R, W),
+    Usecs = timer:now_diff(os:timestamp(), Start),
+    record(Op, Result, Usecs, W1#worker{max_lag = erlang:max(Lag, W1#worker.max_lag)}).
+
+%% Sleep until the request is due; returns how late it is in usecs
+wait_until(_R, #worker{speed = Speed}) when Speed =< 0 ->
+    0;
+wait_until(R, #worker{base = Base, t0 = T0, speed = Speed}) ->
+    Due = round((R#req.ts - T0) / Speed),
+    Now = timer:now_diff(os:timestamp(), Base),
+    case Due - Now of
+        Wait when Wait > 1000 ->
+            timer:sleep(Wait div 1000),
+            0;
+        Wait when Wait >= 0 ->
+            0;
+        Late ->
+            -Late
+    end.
+
+issue(#req{cmd = ?CMD_OPEN_DB, dbref = Ref, key = Name, flags = Flags, value_size = Type}, W) ->
+    Result = bdberl:open(binary_to_list(Name), db_type(Type),
+                         [create | flags_to_opts(Flags, open_flags())]),
+    W1 = case Result of
+             {ok, NewRef} -> W#worker{refs = orddict:store(Ref, NewRef, W#worker.refs)};
+             _            -> W
+         end,
+    {open, Result, W1};
+issue(#req{cmd = ?CMD_CLOSE_DB, dbref = Ref} = R, W) ->
+    {Db, W1} = db(R, W),
+    {close, bdberl:close(Db), W1#worker{refs = orddict:erase(Ref, W1#worker.refs)}};
+issue(#req{cmd = ?CMD_TXN_BEGIN, flags = Flags}, W) ->
+    {txn_begin, bdberl:txn_begin(flags_to_opts(Flags, txn_begin_flags())), W};
+issue(#req{cmd = ?CMD_TXN_COMMIT, flags = Flags}, W) ->
+    {txn_commit, bdberl:txn_commit(flags_to_opts(Flags, txn_commit_flags())), W};
+issue(#req{cmd = ?CMD_TXN_ABORT}, W) ->
+    {txn_abort, bdberl:txn_abort(), W};
+issue(#req{cmd = ?CMD_GET, key = Key, flags = Flags} = R, W) ->
+    {Db, W1} = db(R, W),
+    {get, bdberl:get(Db, key(Key), flags_to_opts(Flags, read_flags())), W1};
+issue(#req{cmd = ?CMD_PUT, key = Key, flags = Flags} = R, W) ->
+    {Db, W1} = db(R, W),
+    {put, bdberl:put(Db, key(Key), value(R, W), put_opts(Flags)), W1};
+issue(#req{cmd = ?CMD_PUT_COMMIT, key = Key, flags = Flags} = R, W) ->
+    {Db, W1} = db(R, W),
+    {put_commit, bdberl:put_commit(Db, key(Key), value(R, W), put_opts(Flags)), W1};
+issue(#req{cmd = ?CMD_DEL, key = Key} = R, W) ->
+    {Db, W1} = db(R, W),
+    {del, bdberl:del(Db, key(Key)), W1};
+issue(#req{cmd = ?CMD_CURSOR_OPEN} = R, W) ->
+    {Db, W1} = db(R, W),
+    {cursor_open, bdberl:cursor_open(Db), W1};
+issue(#req{cmd = ?CMD_CURSOR_GET, key = Key, flags = Flags}, W) ->
+    K = case Key of
+            <<>> -> undefined;
+            _    -> key(Key)
+        end,
+    {cursor_get, bdberl:cursor_get(K, cursor_opts(Flags)), W};
+issue(#req{cmd = ?CMD_CURSOR_CURR}, W) ->
+    {cursor_current, bdberl:cursor_current(), W};
+issue(#req{cmd = ?CMD_CURSOR_NEXT}, W) ->
+    {cursor_next, bdberl:cursor_next(), W};
+issue(#req{cmd = ?CMD_CURSOR_PREV}, W) ->
+    {cursor_prev, bdberl:cursor_prev(), W};
+issue(#req{cmd = ?CMD_CURSOR_COUNT}, W) ->
+    {cursor_count, bdberl:cursor_count(), W};
+issue(#req{cmd = ?CMD_CURSOR_CLOSE}, W) ->
+    {cursor_close, bdberl:cursor_close(), W};
+issue(#req{cmd = ?CMD_TRUNCATE, dbref = -1}, W) ->
+    {truncate, bdberl:truncate(), W};
+issue(#req{cmd = ?CMD_TRUNCATE} = R, W) ->
+    {Db, W1} = db(R, W),
+    {truncate, bdberl:truncate(Db), W1};
+issue(#req{cmd = ?CMD_REMOVE_DB, key = Name}, W) ->
+    {delete_database, bdberl:delete_database(binary_to_list(Name)), W};
+issue(#req{cmd = Cmd}, W) ->
+    {{unsupported, Cmd}, {error, unsupported}, W}.
+
+%% Map a captured dbref to one opened by this worker, opening the database
+%% the first time this port uses it
+db(#req{dbref = Ref}, #worker{refs = Refs, dbs = Dbs} = W) ->
+    case orddict:find(Ref, Refs) of
+        {ok, Db} ->
+            {Db, W};
+        error ->
+            {Name, Type} = proplists:get_value(Ref, Dbs,
+                                               {"dbref_" ++ integer_to_list(Ref) ++ ".db", btree}),
+            {ok, Db} = bdberl:open(Name, Type),
+            {Db, W#worker{refs = orddict:store(Ref, Db, Refs)}}
+    end.
+
+%% Keys are captured in external term format
+key(Bin) ->
+    case catch binary_to_term(Bin) of
+        {'EXIT', _} -> Bin;
+        Term        -> Term
+    end.
+
+%% A binary whose term is as big as the captured value. The captured size
+%% covers the put's framing: a 4 byte CRC-32 for crc32 databases,
+%% ?BDBERL_FRAME_ROOM bytes of room for the versioned header on databases with
+%% another checksum, and nothing for raw puts. A binary's term adds 6 bytes of
+%% external term header.
+value(#req{value_size = Size, flags = Flags}, #worker{pool = Pool}) ->
+    Len = erlang:min(erlang:max(Size - put_framing(Flags) - 6, 0), size(Pool)),
+    Offset = random:uniform(size(Pool) - Len + 1) - 1,
+    <<_:Offset/binary, Value:Len/binary, _/binary>> = Pool,
+    Value.
+
+put_framing(Flags) when Flags band ?BDBERL_OPT_RAW =/= 0    -> 0;
+put_framing(Flags) when Flags band ?BDBERL_OPT_FRAMED =/= 0 -> ?BDBERL_FRAME_ROOM;
+put_framing(_Flags)                                         -> 4.
+
+db_type(?DB_TYPE_HASH)  -> hash;
+db_type(?DB_TYPE_RECNO) -> recno;
+db_type(?DB_TYPE_QUEUE) -> queue;
+db_type(_)              -> btree.
+
+%% Recover option atoms from captured flags. BDB reuses bit values between
+%% calls, so each call has its own table.
+flags_to_opts(Flags, Table) ->
+    [Opt || {Opt, Bit} <- Table, Flags band Bit =:= Bit].
+
+open_flags() ->
+    [{multiversion, ?DB_MULTIVERSION}, {no_mmap, ?DB_NOMMAP},
+     {read_uncommitted, ?DB_READ_UNCOMMITTED}].
+
+txn_begin_flags() ->
+    [{read_committed, ?DB_READ_COMMITTED}, {read_uncommitted, ?DB_READ_UNCOMMITTED},
+     {txn_no_sync, ?DB_TXN_NOSYNC}, {txn_no_wait, ?DB_TXN_NOWAIT},
+     {txn_snapshot, ?DB_TXN_SNAPSHOT}, {txn_sync, ?DB_TXN_SYNC}, {txn_wait, ?DB_TXN_WAIT},
+     {txn_write_nosync, ?DB_TXN_WRITE_NOSYNC}].
+
+txn_commit_flags() ->
+    [{txn_no_sync, ?DB_TXN_NOSYNC}, {txn_sync, ?DB_TXN_SYNC},
+     {txn_write_nosync, ?DB_TXN_WRITE_NOSYNC}].
+
+read_flags() ->
+    [{read_committed, ?DB_READ_COMMITTED}, {read_uncommitted, ?DB_READ_UNCOMMITTED},
+     {rmw, ?DB_RMW}].
+
+%% The low byte of put and cursor flags is an operation code rather than bits
+put_opts(Flags) ->
+    [Opt || {Opt, Code} <- [{append, ?DB_APPEND}, {no_duplicate, ?DB_NODUPDATA},
+                            {no_overwrite, ?DB_NOOVERWRITE}],
+            Flags band 16#ff =:= Code].
+
+cursor_opts(Flags) ->
+    Codes = [{db_current, ?DB_CURRENT}, {db_first, ?DB_FIRST}, {db_get_both, ?DB_GET_BOTH},
+             {db_get_both_range, ?DB_GET_BOTH_RANGE}, {db_last, ?DB_LAST},
+             {db_next, ?DB_NEXT}, {db_next_dup, ?DB_NEXT_DUP},
+             {db_next_nodup, ?DB_NEXT_NODUP}, {db_prev, ?DB_PREV},
+             {db_prev_dup, ?DB_PREV_DUP}, {db_prev_nodup, ?DB_PREV_NODUP},
+             {db_set, ?DB_SET}, {db_set_range, ?DB_SET_RANGE}],
+    [Opt || {Opt, Code} <- Codes, Flags band 16#ff =:= Code] ++
+        flags_to_opts(Flags band (bnot 16#ff), read_flags()).
+
+record(Op, {error, Reason}, _Usecs, #worker{errors = Errors} = W) ->
+    W#worker{errors = orddict:update_counter({Op, Reason}, 1, Errors)};
+record(Op, _Result, Usecs, #worker{histos = Histos} = W) ->
+    H = case orddict:find(Op, Histos) of
+            {ok, H0} -> H0;
+            error    -> []
+        end,
+    W#worker{histos = orddict:store(Op, bdberl_bench:histo_add(Usecs, H), Histos)}.
+
+
+%% ====================================================================
+%% Reporting
+%% ====================================================================
+
+summarize(Results, Elapsed) ->
+    Histos = lists:foldl(fun(W, Acc) ->
+                                 orddict:merge(fun(_, A, B) -> bdberl_bench:histo_merge(A, B) end,
+                                               W#worker.histos, Acc)
+                         end, [], Results),
+    Errors = lists:foldl(fun(W, Acc) -> orddict:merge(fun(_, A, B) -> A + B end,
+                                                      W#worker.errors, Acc)
+                         end, [], Results),
+    MaxLag = lists:max([0 | [W#worker.max_lag || W <- Results]]),
+    Ops = lists:usort([Op || {Op, _} <- Histos] ++ [Op || {{Op, _}, _} <- Errors]),
+    [row(Op, histo(Op, Histos), lists:sum([N || {{O, _}, N} <- Errors, O =:= Op]),
+         Elapsed, MaxLag) || Op <- Ops].
+
+histo(Op, Histos) ->
+    case orddict:find(Op, Histos) of
+        {ok, H} -> H;
+        error   -> []
+    end.
+
+row(Op, Histo, Errors, Elapsed, MaxLag) ->
+    Stats = bdberl_bench:histo_stats(Histo),
+    Count = proplists:get_value(count, Stats),
+    [{op, Op},
+     {count, Count},
+     {errors, Errors},
+     {ops_per_sec, Count / Elapsed},
+     {max_lag_ms, MaxLag div 1000} | tl(Stats)].
+
+-define(CSV_COLUMNS, [op, count, errors, ops_per_sec, mean_us, p50_us, p90_us, p99_us,
+                      p999_us, max_us, max_lag_ms]).
+
+write_csv(File, Label, Speed, Rows) ->
+    ok = filelib:ensure_dir(File),
+    New = not filelib:is_regular(File),
+    {ok, Fd} = file:open(File, [append]),
+    case New of
+        true ->
+            io:format(Fd, "timestamp,label,speed,~s~n",
+                      [bdberl_bench:join([atom_to_list(C) || C <- ?CSV_COLUMNS])]);
+        false ->
+            ok
+    end,
+    [io:format(Fd, "~s~n", [bdberl_bench:join([bdberl_bench:timestamp(), Label,
+                                               bdberl_bench:fmt(Speed) |
+                                               [bdberl_bench:fmt(proplists:get_value(C, Row))
+                                                || C <- ?CSV_COLUMNS]])])
+     || Row <- Rows],
+    file:close(Fd).
+
+print_rows(Label, Rows) ->
+    io:format("~s~n~-16s ~10s ~8s ~12s ~10s ~8s ~8s ~8s ~8s ~8s~n",
+              [Label, "op", "count", "errors", "ops/s", "mean", "p50", "p90", "p99", "p999", "max"]),
+    [io:format("~-16s ~10B ~8B ~12.1f ~10.1f ~8B ~8B ~8B ~8B ~8B~n",
+               [bdberl_bench:fmt(proplists:get_value(op, R)) |
+                [proplists:get_value(C, R) || C <- [count, errors, ops_per_sec, mean_us, p50_us,
+                                                    p90_us, p99_us, p999_us, max_us]]])
+     || R <- Rows],
+    case Rows of
+        [Row | _] -> io:format("max lag ~B ms~n", [proplists:get_value(max_lag_ms, Row)]);
+        []        -> ok
+    end.
+
+to_number(S) ->
+    case catch list_to_float(S) of
+        {'EXIT', _} -> float(list_to_integer(S));
+        F           -> F
+    end.
@@ -0,0 +1,63 @@
+/* -------------------------------------------------------------------
+ *
+ * bdberl: Atoms used in replies
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ------------------------------------------------------------------- */
+
+#include <string.h>
+
+#include "bdberl_drv.h"
+#include "bdberl_atoms.h"
+
+ErlDrvTermData G_ATOMS[ATOM_COUNT];
+
+#define BDBERL_ATOM_NAME(name) #name,
+const char* G_ATOM_NAMES[ATOM_COUNT] = { BDBERL_ATOMS(BDBERL_ATOM_NAME) };
+#undef BDBERL_ATOM_NAME
+
+void bdberl_atoms_init(void)
+{
+    int i;
+    for (i = 0; i < ATOM_COUNT; i++)
+    {
+        G_ATOMS[i] = driver_mk_atom((char*)G_ATOM_NAMES[i]);
+    }
+}
+
+ErlDrvTermData bdberl_rc_to_atom(int rc)
+{
+    switch (rc)
+    {
+#define BDBERL_RC_ATOM(code, name) case code: return ATOM(name);
+        BDBERL_RC_ATOMS(BDBERL_RC_ATOM)
+#undef BDBERL_RC_ATOM
+    default:
+    {
+        // Anything else is an errno, which are only named by erl_errno_id
+        char *error = erl_errno_id(rc);
+        if (error != NULL && strcmp("unknown", error) != 0)
+        {
+            return driver_mk_atom(error);
+        }
+        return 0;
+    }
+    }
+}
@@ -0,0 +1,165 @@
+/* -------------------------------------------------------------------
+ *
+ * bdberl: Atoms used in replies
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ------------------------------------------------------------------- */
+#ifndef _BDBERL_ATOMS
+#define _BDBERL_ATOMS
+
+#include "erl_driver.h"
+
+/**
+ * Every atom the driver puts in a reply or logger message. driver_mk_atom hashes the name
+ * and looks it up in the VM's atom table on each call; these are looked up once by
+ * bdberl_atoms_init at DRIVER_INIT and read back with ATOM(name), which is an array load.
+ * Build with -DBDBERL_NO_ATOM_CACHE to go back to a lookup per use, e.g. to measure the
+ * per-reply difference with DRV_CFLAGS=-DBDBERL_NO_ATOM_CACHE make bench.
+ */
+#define BDBERL_ATOMS(X)                                                                            \
+    /* Replies */                                                                                  \
+    X(ok) X(error) X(unknown) X(verified) X(term) X(raw) X(true) X(false) X(dirinfo) X(fstat)      \
+    X(type) X(name) X(btree) X(recno) X(hash) X(queue) X(service) X(txn) X(tid) X(status)          \
+    X(aborted) X(committed) X(prepared) X(running) X(undefined)                                    \
+    /* Logger messages */                                                                          \
+    X(bdb_slow_op) X(bdb_lock_stats) X(bdb_checkpoint_stats) X(bdb_trickle_stats)                  \
+    X(bdb_error_log) X(bdb_info_log) X(bdb_event_notify)                                           \
+    /* Errors, see bdberl_rc_to_atom */                                                            \
+    X(max_dbs) X(async_pending) X(invalid_db) X(transaction_open) X(no_txn) X(cursor_open)         \
+    X(no_cursor) X(db_active) X(invalid_cmd) X(invalid_db_type) X(invalid_value) X(overloaded)     \
+    X(invalid_option) X(format_mismatch) X(invalid_key) X(buffer_small) X(do_not_index)          \
+    X(foreign_conflict)                                                                            \
+    X(key_empty) X(key_exist) X(deadlock) X(lock_not_granted) X(log_buffer_full) X(not_found)      \
+    X(old_version) X(page_not_found) X(run_recovery) X(verify_bad) X(version_mismatch)             \
+    /* Latency tags and histograms */                                                              \
+    X(get) X(put) X(put_commit) X(del) X(txn_begin) X(txn_commit) X(txn_abort) X(cursor_curr)      \
+    X(cursor_next) X(cursor_prev) X(cursor_get) X(cursor_put) X(cursor_del) X(cursor_count)        \
+    X(truncate) X(stat) X(count) X(min) X(mean) X(p50) X(p90) X(p99) X(p999) X(max)                \
+    /* Database counters and driver_info */                                                        \
+    X(gets) X(get_hits) X(get_misses) X(puts) X(dels) X(cursor_steps) X(bytes_read)                \
+    X(bytes_written) X(crc_failures) X(deadlocks) X(databases_size) X(deadlock_interval)           \
+    X(trickle_interval) X(trickle_percentage) X(checkpoint_interval) X(num_general_threads)        \
+    X(num_txn_threads) X(general_jobs_pending) X(general_jobs_active) X(txn_jobs_pending)          \
+    X(txn_jobs_active) X(max_general_pending) X(max_txn_pending) X(max_read_pending)               \
+    X(max_write_pending) X(max_stat_pending) X(sample_interval) X(sample_slots)                    \
+    X(trace_entries) X(slow_op_usecs) X(capture_buffer_kb) X(capture_records)                      \
+    X(capture_dropped) X(crc32_impl) X(crc32c_impl) X(lock_stat_interval) X(lock_failures)         \
+    X(lock_failure_usecs) X(deadlock_rate) X(lock_wait_rate) X(lock_nowait_rate)                   \
+    X(lock_timeout_rate) X(txn_timeout_rate) X(lock_request_rate)                                  \
+    /* BDB statistics fields, see bdberl_stats.c */                                                \
+    X(magic) X(version) X(metaflags) X(nkeys) X(ndata) X(pagecnt) X(pagesize) X(minkey)            \
+    X(re_len) X(re_pad) X(levels) X(int_pg) X(leaf_pg) X(dup_pg) X(over_pg) X(empty_pg)            \
+    X(free) X(int_pgfree) X(leaf_pgfree) X(dup_pgfree) X(over_pgfree) X(ffactor) X(buckets)        \
+    X(bfree) X(bigpages) X(big_bfree) X(overflows) X(ovfl_free) X(dup) X(dup_free) X(id)           \
+    X(cur_maxid) X(maxlocks) X(maxlockers) X(maxobjects) X(partitions) X(nmodes) X(nlockers)       \
+    X(nlocks) X(maxnlocks) X(maxhlocks) X(locksteals) X(maxlsteals) X(maxnlockers) X(nobjects)     \
+    X(maxnobjects) X(maxhobjects) X(objectsteals) X(maxosteals) X(nrequests) X(nreleases)          \
+    X(nupgrade) X(ndowngrade) X(lock_wait) X(lock_nowait) X(ndeadlocks) X(locktimeout)             \
+    X(nlocktimeouts) X(txntimeout) X(ntxntimeouts) X(part_wait) X(part_nowait)                     \
+    X(part_max_wait) X(part_max_nowait) X(objs_wait) X(objs_nowait) X(lockers_wait)                \
+    X(lockers_nowait) X(region_wait) X(region_nowait) X(hash_len) X(regsize) X(mode)               \
+    X(lg_bsize) X(lg_size) X(wc_bytes) X(wc_mbytes) X(record) X(w_bytes) X(w_mbytes) X(wcount)     \
+    X(wcount_fill) X(rcount) X(scount) X(cur_file) X(cur_offset) X(disk_file) X(disk_offset)       \
+    X(maxcommitperflush) X(mincommitperflush) X(map) X(cache_hit) X(cache_miss) X(page_create)     \
+    X(page_in) X(page_out) X(gbytes) X(bytes) X(ncache) X(max_ncache) X(mmapsize) X(maxopenfd)     \
+    X(maxwrite) X(maxwrite_sleep) X(pages) X(ro_evict) X(rw_evict) X(page_trickle)                 \
+    X(page_clean) X(page_dirty) X(hash_buckets) X(hash_searches) X(hash_longest)                   \
+    X(hash_examined) X(hash_nowait) X(hash_wait) X(hash_max_nowait) X(hash_max_wait)               \
+    X(mvcc_frozen) X(mvcc_thawed) X(mvcc_freed) X(alloc) X(alloc_buckets) X(alloc_max_buckets)     \
+    X(alloc_pages) X(alloc_max_pages) X(io_wait) X(mutex_align) X(mutex_tas_spins)                 \
+    X(mutex_cnt) X(mutex_free) X(mutex_inuse) X(mutex_inuse_max) X(txnid) X(parentid) X(pid)       \
+    X(lsn) X(read_lsn) X(mvcc_ref) X(nrestores) X(last_ckp) X(time_ckp) X(last_txnid)              \
+    X(maxtxns) X(naborts) X(nbegins) X(ncommits) X(nactive) X(nsnapshot) X(maxnactive)             \
+    X(maxnsnapshot) X(bt_compress) X(h_hash) X(default) X(xxh64)                                  \
+    /* Value cache, see bdberl_cache.h */                                                          \
+    X(value_cache_hits) X(value_cache_misses) X(value_cache_evictions) X(value_cache_entries)      \
+    X(value_cache_bytes)                                                                           \
+    /* Key filter, see bdberl_filter.h */                                                          \
+    X(key_filter_rejects) X(key_filter_false_positives) X(key_filter_counters)                     \
+    X(key_filter_counters_set) X(key_filter_bytes)
+
+/**
+ * Names of the driver's own error codes and the BDB codes without an errno, for
+ * bdberl_rc_to_atom_str and bdberl_rc_to_atom. Expanded where bdberl_drv.h and db.h are
+ * included.
+ */
+#define BDBERL_RC_ATOMS(X)                                                                         \
+    /* bdberl driver errors */                                                                     \
+    X(ERROR_MAX_DBS, max_dbs)                                                                      \
+    X(ERROR_ASYNC_PENDING, async_pending)                                                          \
+    X(ERROR_INVALID_DBREF, invalid_db)                                                             \
+    X(ERROR_TXN_OPEN, transaction_open)                                                            \
+    X(ERROR_NO_TXN, no_txn)                                                                        \
+    X(ERROR_CURSOR_OPEN, cursor_open)                                                              \
+    X(ERROR_NO_CURSOR, no_cursor)                                                                  \
+    X(ERROR_DB_ACTIVE, db_active)                                                                  \
+    X(ERROR_INVALID_CMD, invalid_cmd)                                                              \
+    X(ERROR_INVALID_DB_TYPE, invalid_db_type)                                                      \
+    X(ERROR_INVALID_VALUE, invalid_value)                                                          \
+    X(ERROR_OVERLOADED, overloaded)                                                                \
+    X(ERROR_INVALID_OPTION, invalid_option)                                                        \
+    X(ERROR_FORMAT_MISMATCH, format_mismatch)                                                      \
+    X(ERROR_INVALID_KEY, invalid_key)                                                              \
+    /* bonafide BDB errors */                                                                      \
+    X(DB_BUFFER_SMALL, buffer_small)                                                               \
+    X(DB_DONOTINDEX, do_not_index)                                                                 \
+    X(DB_FOREIGN_CONFLICT, foreign_conflict)                                                       \
+    X(DB_KEYEMPTY, key_empty)                                                                      \
+    X(DB_KEYEXIST, key_exist)                                                                      \
+    X(DB_LOCK_DEADLOCK, deadlock)                                                                  \
+    X(DB_LOCK_NOTGRANTED, lock_not_granted)                                                        \
+    X(DB_LOG_BUFFER_FULL, log_buffer_full)                                                         \
+    X(DB_NOTFOUND, not_found)                                                                      \
+    X(DB_OLD_VERSION, old_version)                                                                 \
+    X(DB_PAGE_NOTFOUND, page_not_found)                                                            \
+    X(DB_RUNRECOVERY, run_recovery)                                                                \
+    X(DB_VERIFY_BAD, verify_bad)                                                                   \
+    X(DB_VERSION_MISMATCH, version_mismatch)
+
+#define BDBERL_ATOM_ENUM(name) ATOM_##name,
+typedef enum
+{
+    BDBERL_ATOMS(BDBERL_ATOM_ENUM)
+    ATOM_COUNT
+} BdberlAtom;
+#undef BDBERL_ATOM_ENUM
+
+extern ErlDrvTermData G_ATOMS[ATOM_COUNT];
+extern const char* G_ATOM_NAMES[ATOM_COUNT];
+
+#ifdef BDBERL_NO_ATOM_CACHE
+#  define ATOM_AT(atom) driver_mk_atom((char*)G_ATOM_NAMES[atom])
+#else
+#  define ATOM_AT(atom) (G_ATOMS[atom])
+#endif
+#define ATOM(name) ATOM_AT(ATOM_##name)
+
+/**
+ * Prototypes in bdberl_atoms.c
+ */
+void bdberl_atoms_init(void);
+
+/**
+ * The atom for an rc from BDB or the driver, as named by bdberl_rc_to_atom_str; 0 when the
+ * rc has no name
+ */
+ErlDrvTermData bdberl_rc_to_atom(int rc);
+
+#endif // _BDBERL_ATOMS
@@ -0,0 +1,344 @@
+/* -------------------------------------------------------------------
+ *
+ * bdberl: Per-database cache of verified values
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ------------------------------------------------------------------- */
+
+#include <string.h>
+
+#include "erl_driver.h"
+#include "bdberl_cache.h"
+#include "bdberl_xxhash.h"
+
+#define CACHE_MIN_BUCKETS 64
+
+typedef struct
+{
+    ErlDrvMutex* lock;
+    CacheEntry** buckets;
+    unsigned int bucket_mask;
+    unsigned int count;
+    uint64_t bytes;
+    uint64_t budget;
+    CacheEntry* hand;               /* Next entry CLOCK looks at; NULL when empty */
+    volatile unsigned int epoch;    /* Bumped by every invalidation */
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t fills;
+    uint64_t evictions;
+    uint64_t invalidations;
+} CacheShard;
+
+struct ValueCache
+{
+    CacheShard shards[CACHE_SHARDS];
+};
+
+static inline CacheShard* shard_of(ValueCache* cache, uint64_t hash)
+{
+    return &(cache->shards[hash >> 60]);
+}
+
+static inline uint64_t entry_bytes(CacheEntry* e)
+{
+    return sizeof(CacheEntry) + e->key_size + e->value_size;
+}
+
+static void unlink_entry(CacheShard* shard, CacheEntry* e);
+static void grow_buckets(CacheShard* shard);
+
+
+ValueCache* bdberl_cache_create(unsigned int budget_bytes)
+{
+    ValueCache* cache = driver_alloc(sizeof(ValueCache));
+    memset(cache, '\0', sizeof(ValueCache));
+
+    int i;
+    for (i = 0; i < CACHE_SHARDS; i++)
+    {
+        CacheShard* shard = &(cache->shards[i]);
+        shard->lock = erl_drv_mutex_create("bdberl_drv: cache shard");
+        shard->budget = budget_bytes / CACHE_SHARDS;
+        shard->bucket_mask = CACHE_MIN_BUCKETS - 1;
+        shard->buckets = driver_alloc(sizeof(CacheEntry*) * CACHE_MIN_BUCKETS);
+        memset(shard->buckets, '\0', sizeof(CacheEntry*) * CACHE_MIN_BUCKETS);
+    }
+    return cache;
+}
+
+void bdberl_cache_free(ValueCache* cache)
+{
+    if (cache == NULL)
+    {
+        return;
+    }
+
+    bdberl_cache_clear(cache);
+    int i;
+    for (i = 0; i < CACHE_SHARDS; i++)
+    {
+        driver_free(cache->shards[i].buckets);
+        erl_drv_mutex_destroy(cache->shards[i].lock);
+    }
+    driver_free(cache);
+}
+
+uint64_t bdberl_cache_hash(const void* key, unsigned int key_size)
+{
+    return bdberl_xxh64((const unsigned char*)key, key_size, 0);
+}
+
+CacheEntry* bdberl_cache_get(ValueCache* cache, uint64_t hash, const void* key,
+                             unsigned int key_size)
+{
+    CacheShard* shard = shard_of(cache, hash);
+    erl_drv_mutex_lock(shard->lock);
+    CacheEntry* e = shard->buckets[hash & shard->bucket_mask];
+    while (e != NULL &&
+           (e->hash != hash || e->key_size != key_size || memcmp(e->data, key, key_size) != 0))
+    {
+        e = e->next;
+    }
+    if (e != NULL)
+    {
+        e->referenced = 1;
+        __sync_fetch_and_add(&(e->refs), 1);
+        shard->hits++;
+    }
+    else
+    {
+        shard->misses++;
+    }
+    erl_drv_mutex_unlock(shard->lock);
+    return e;
+}
+
+void bdberl_cache_release(CacheEntry* entry)
+{
+    if (__sync_sub_and_fetch(&(entry->refs), 1) == 0)
+    {
+        driver_free(entry);
+    }
+}
+
+unsigned int bdberl_cache_epoch(ValueCache* cache, uint64_t hash)
+{
+    CacheShard* shard = shard_of(cache, hash);
+    erl_drv_mutex_lock(shard->lock);
+    unsigned int epoch = shard->epoch;
+    erl_drv_mutex_unlock(shard->lock);
+    return epoch;
+}
+
+void bdberl_cache_fill(ValueCache* cache, uint64_t hash, unsigned int epoch,
+                       const void* key, unsigned int key_size,
+                       const void* value, unsigned int value_size, int verified)
+{
+    CacheShard* shard = shard_of(cache, hash);
+    uint64_t size = sizeof(CacheEntry) + (uint64_t)key_size + value_size;
+    if (size > shard->budget / 4)
+    {
+        return;
+    }
+
+    // Copy outside the lock; most fills are of keys no one else is filling
+    CacheEntry* e = driver_alloc(size);
+    e->hash = hash;
+    e->refs = 1;
+    e->key_size = key_size;
+    e->value_size = value_size;
+    e->referenced = 0;
+    e->verified = verified ? 1 : 0;
+    memcpy(e->data, key, key_size);
+    memcpy(e->data + key_size, value, value_size);
+
+    erl_drv_mutex_lock(shard->lock);
+    if (shard->epoch != epoch)
+    {
+        erl_drv_mutex_unlock(shard->lock);
+        driver_free(e);
+        return;
+    }
+
+    // Another reader may have filled the key first; the newer copy is as good
+    CacheEntry** prev = &(shard->buckets[hash & shard->bucket_mask]);
+    while (*prev != NULL)
+    {
+        CacheEntry* old = *prev;
+        if (old->hash == hash && old->key_size == key_size &&
+            memcmp(old->data, key, key_size) == 0)
+        {
+            unlink_entry(shard, old);
+            break;
+        }
+        prev = &(old->next);
+    }
+
+    // Make room with CLOCK: referenced entries get their bit cleared and another lap
+    while (shard->bytes + size > shard->budget && shard->hand != NULL)
+    {
+        CacheEntry* victim = shard->hand;
+        if (victim->referenced)
+        {
+            victim->referenced = 0;
+            shard->hand = victim->clock_next;
+            continue;
+        }
+        unlink_entry(shard, victim);
+        shard->evictions++;
+    }
+
+    unsigned int b = hash & shard->bucket_mask;
+    e->next = shard->buckets[b];
+    shard->buckets[b] = e;
+
+    // New entries go just behind the hand so they get a full lap before being looked at
+    if (shard->hand == NULL)
+    {
+        e->clock_next = e;
+        e->clock_prev = e;
+        shard->hand = e;
+    }
+    else
+    {
+        e->clock_next = shard->hand;
+        e->clock_prev = shard->hand->clock_prev;
+        e->clock_prev->clock_next = e;
+        shard->hand->clock_prev = e;
+    }
+    shard->count++;
+    shard->bytes += size;
+    shard->fills++;
+    if (shard->count > shard->bucket_mask + 1)
+    {
+        grow_buckets(shard);
+    }
+    erl_drv_mutex_unlock(shard->lock);
+}
+
+void bdberl_cache_invalidate(ValueCache* cache, uint64_t hash)
+{
+    CacheShard* shard = shard_of(cache, hash);
+    erl_drv_mutex_lock(shard->lock);
+    shard->epoch++;
+    shard->invalidations++;
+    CacheEntry* e = shard->buckets[hash & shard->bucket_mask];
+    while (e != NULL)
+    {
+        CacheEntry* next = e->next;
+        if (e->hash == hash)
+        {
+            unlink_entry(shard, e);
+        }
+        e = next;
+    }
+    erl_drv_mutex_unlock(shard->lock);
+}
+
+void bdberl_cache_clear(ValueCache* cache)
+{
+    int i;
+    for (i = 0; i < CACHE_SHARDS; i++)
+    {
+        CacheShard* shard = &(cache->shards[i]);
+        erl_drv_mutex_lock(shard->lock);
+        shard->epoch++;
+        shard->invalidations++;
+        while (shard->hand != NULL)
+        {
+            unlink_entry(shard, shard->hand);
+        }
+        erl_drv_mutex_unlock(shard->lock);
+    }
+}
+
+void bdberl_cache_stats(ValueCache* cache, CacheStats* stats)
+{
+    memset(stats, '\0', sizeof(CacheStats));
+    int i;
+    for (i = 0; i < CACHE_SHARDS; i++)
+    {
+        CacheShard* shard = &(cache->shards[i]);
+        erl_drv_mutex_lock(shard->lock);
+        stats->hits += shard->hits;
+        stats->misses += shard->misses;
+        stats->fills += shard->fills;
+        stats->evictions += shard->evictions;
+        stats->invalidations += shard->invalidations;
+        stats->entries += shard->count;
+        stats->bytes += shard->bytes;
+        erl_drv_mutex_unlock(shard->lock);
+    }
+}
+
+
+// Take e out of its hash chain and the CLOCK ring and drop the cache's reference. Readers
+// still holding one free it on release. Shard lock held.
+static void unlink_entry(CacheShard* shard, CacheEntry* e)
+{
+    CacheEntry** prev = &(shard->buckets[e->hash & shard->bucket_mask]);
+    while (*prev != e)
+    {
+        prev = &((*prev)->next);
+    }
+    *prev = e->next;
+
+    if (e->clock_next == e)
+    {
+        shard->hand = NULL;
+    }
+    else
+    {
+        e->clock_prev->clock_next = e->clock_next;
+        e->clock_next->clock_prev = e->clock_prev;
+        if (shard->hand == e)
+        {
+            shard->hand = e->clock_next;
+        }
+    }
+    shard->count--;
+    shard->bytes -= entry_bytes(e);
+    bdberl_cache_release(e);
+}
+
+// Double the hash table once it averages more than one entry a bucket. Shard lock held.
+static void grow_buckets(CacheShard* shard)
+{
+    unsigned int size = (shard->bucket_mask + 1) * 2;
+    CacheEntry** buckets = driver_alloc(sizeof(CacheEntry*) * size);
+    memset(buckets, '\0', sizeof(CacheEntry*) * size);
+
+    unsigned int b;
+    for (b = 0; b <= shard->bucket_mask; b++)
+    {
+        CacheEntry* e = shard->buckets[b];
+        while (e != NULL)
+        {
+            CacheEntry* next = e->next;
+            e->next = buckets[e->hash & (size - 1)];
+            buckets[e->hash & (size - 1)] = e;
+            e = next;
+        }
+    }
+    driver_free(shard->buckets);
+    shard->buckets = buckets;
+    shard->bucket_mask = size - 1;
+}
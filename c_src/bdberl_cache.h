@@ -0,0 +1,109 @@
+/* -------------------------------------------------------------------
+ *
+ * bdberl: Per-database cache of verified values
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ------------------------------------------------------------------- */
+#ifndef _BDBERL_CACHE
+#define _BDBERL_CACHE
+
+#include <stdint.h>
+
+/**
+ * Values read by gets, keyed by the key bytes of the request, so hot keys can be answered
+ * from the port's control call without a trip through the thread pool and BDB. Entries
+ * hold the reply payload, already verified and inflated.
+ *
+ * The cache is split into CACHE_SHARDS shards by key hash, each with its own lock, hash
+ * table and CLOCK ring, and each held to an equal part of the byte budget. Entries are
+ * reference counted so a hit can be sent after the shard lock is released.
+ *
+ * Writers call bdberl_cache_invalidate once their change is visible in BDB. A reader that
+ * misses takes bdberl_cache_epoch before it reads BDB and passes it to bdberl_cache_fill,
+ * which drops the value if the shard saw an invalidation in between, so a value read
+ * before a write can't be cached after the write has invalidated it.
+ */
+#define CACHE_SHARDS 16
+
+typedef struct CacheEntry
+{
+    struct CacheEntry* next;        /* Hash chain */
+    struct CacheEntry* clock_next;  /* CLOCK ring */
+    struct CacheEntry* clock_prev;
+    uint64_t hash;
+    volatile unsigned int refs;     /* One for the cache while linked, one per reader */
+    unsigned int key_size;
+    unsigned int value_size;
+    unsigned char referenced;       /* CLOCK bit, set by hits */
+    unsigned char verified;         /* Value is the payload past a checked header */
+    unsigned char data[];           /* Key, then value */
+} CacheEntry;
+
+typedef struct
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t fills;
+    uint64_t evictions;
+    uint64_t invalidations;
+    uint64_t entries;
+    uint64_t bytes;                 /* Entry overhead included */
+} CacheStats;
+
+typedef struct ValueCache ValueCache;
+
+#define CACHE_ENTRY_VALUE(e) ((e)->data + (e)->key_size)
+
+/**
+ * Prototypes in bdberl_cache.c
+ */
+ValueCache* bdberl_cache_create(unsigned int budget_bytes);
+void        bdberl_cache_free(ValueCache* cache);
+
+uint64_t    bdberl_cache_hash(const void* key, unsigned int key_size);
+
+/**
+ * Entry for the key with a reference taken, or NULL; counts a hit or a miss. Give the
+ * reference back with bdberl_cache_release.
+ */
+CacheEntry* bdberl_cache_get(ValueCache* cache, uint64_t hash, const void* key,
+                             unsigned int key_size);
+void        bdberl_cache_release(CacheEntry* entry);
+
+unsigned int bdberl_cache_epoch(ValueCache* cache, uint64_t hash);
+
+/**
+ * Copy a value read from BDB into the cache, replacing any entry for the key, unless the
+ * shard has been invalidated since epoch or the entry would take more than a quarter of
+ * the shard's budget
+ */
+void bdberl_cache_fill(ValueCache* cache, uint64_t hash, unsigned int epoch,
+                       const void* key, unsigned int key_size,
+                       const void* value, unsigned int value_size, int verified);
+
+/**
+ * Drop every entry whose key hashes to hash, or every entry of the cache
+ */
+void bdberl_cache_invalidate(ValueCache* cache, uint64_t hash);
+void bdberl_cache_clear(ValueCache* cache);
+
+void bdberl_cache_stats(ValueCache* cache, CacheStats* stats);
+
+#endif // _BDBERL_CACHE
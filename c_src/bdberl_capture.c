@@ -0,0 +1,400 @@
+/* -------------------------------------------------------------------
+ *
+ * bdberl: Request capture
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ------------------------------------------------------------------- */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "bdberl_drv.h"
+#include "bdberl_capture.h"
+
+#define CAPTURE_FLUSH_USECS 100000
+
+typedef struct
+{
+    char* data;
+    unsigned int used;
+} CaptureBuffer;
+
+// A capture_start or capture_stop waiting for the writer thread
+typedef struct CaptureRequest
+{
+    struct CaptureRequest* next;
+    char* path;                 /* NULL to stop */
+    ErlDrvPort port;
+    ErlDrvTermData pid;
+} CaptureRequest;
+
+// G_CAPTURE_FILE_LOCK serializes writes to G_CAPTURE_FP and is always taken before
+// G_CAPTURE_LOCK. Recording only takes G_CAPTURE_LOCK and never touches the file.
+static ErlDrvTid     G_CAPTURE_THREAD    = 0;
+static ErlDrvMutex*  G_CAPTURE_LOCK      = 0;
+static ErlDrvMutex*  G_CAPTURE_FILE_LOCK = 0;
+static FILE*         G_CAPTURE_FP        = 0;
+static volatile int  G_CAPTURE_ACTIVE    = 0;
+
+static CaptureBuffer G_CAPTURE_BUFFERS[2];
+static unsigned int  G_CAPTURE_CURRENT   = 0;   /* Buffer records are appended to */
+static unsigned int  G_CAPTURE_SIZE      = 0;
+
+static uint64_t      G_CAPTURE_RECORDS   = 0;
+static uint64_t      G_CAPTURE_DROPPED   = 0;
+
+// Requests from the control call, oldest first, and the one the writer is working on;
+// G_CAPTURE_REQUEST_LOCK is never held across file I/O
+static ErlDrvMutex*    G_CAPTURE_REQUEST_LOCK = 0;
+static CaptureRequest* G_CAPTURE_REQUESTS     = 0;
+static CaptureRequest* G_CAPTURE_IN_FLIGHT    = 0;
+
+static void* capture_writer(void* arg);
+static CaptureRequest* next_request(void);
+static void answer_request(CaptureRequest* req, int rc);
+static CaptureRequest* take_requests(void);
+static void flush_buffers(void);
+static uint64_t wall_usecs(void);
+
+
+void bdberl_capture_init(unsigned int buffer_bytes)
+{
+    G_CAPTURE_SIZE = buffer_bytes;
+    G_CAPTURE_CURRENT = 0;
+    int i;
+    for (i = 0; i < 2; i++)
+    {
+        G_CAPTURE_BUFFERS[i].data = driver_alloc(buffer_bytes);
+        G_CAPTURE_BUFFERS[i].used = 0;
+    }
+    G_CAPTURE_LOCK = erl_drv_mutex_create("bdberl_drv: G_CAPTURE_LOCK");
+    G_CAPTURE_FILE_LOCK = erl_drv_mutex_create("bdberl_drv: G_CAPTURE_FILE_LOCK");
+    G_CAPTURE_REQUEST_LOCK = erl_drv_mutex_create("bdberl_drv: G_CAPTURE_REQUEST_LOCK");
+    erl_drv_thread_create("bdberl_drv_capture", &G_CAPTURE_THREAD, &capture_writer, 0, 0);
+}
+
+void bdberl_capture_finish(void)
+{
+    if (G_CAPTURE_LOCK == NULL)
+    {
+        return;
+    }
+
+    // The writer exits once the utility pipe is closed
+    if (G_CAPTURE_THREAD != 0)
+    {
+        erl_drv_thread_join(G_CAPTURE_THREAD, 0);
+        G_CAPTURE_THREAD = 0;
+    }
+
+    bdberl_capture_close();
+
+    // Every port is gone by now, so requests the writer never got to have no one to answer
+    CaptureRequest* req = take_requests();
+    while (req != NULL)
+    {
+        CaptureRequest* next = req->next;
+        driver_free(req);
+        req = next;
+    }
+
+    int i;
+    for (i = 0; i < 2; i++)
+    {
+        driver_free(G_CAPTURE_BUFFERS[i].data);
+        G_CAPTURE_BUFFERS[i].data = NULL;
+    }
+    erl_drv_mutex_destroy(G_CAPTURE_REQUEST_LOCK);
+    erl_drv_mutex_destroy(G_CAPTURE_FILE_LOCK);
+    erl_drv_mutex_destroy(G_CAPTURE_LOCK);
+    G_CAPTURE_REQUEST_LOCK = NULL;
+    G_CAPTURE_FILE_LOCK = NULL;
+    G_CAPTURE_LOCK = NULL;
+}
+
+int bdberl_capture_open(const char* path)
+{
+    if (G_CAPTURE_LOCK == NULL)
+    {
+        return EINVAL;
+    }
+
+    bdberl_capture_close();
+
+    erl_drv_mutex_lock(G_CAPTURE_FILE_LOCK);
+    FILE* fp = fopen(path, "wb");
+    if (fp == NULL)
+    {
+        int rc = errno;
+        erl_drv_mutex_unlock(G_CAPTURE_FILE_LOCK);
+        return rc;
+    }
+
+    uint32_t version = CAPTURE_VERSION;
+    uint64_t start = wall_usecs();
+    fwrite(CAPTURE_MAGIC, 4, 1, fp);
+    fwrite(&version, sizeof(version), 1, fp);
+    fwrite(&start, sizeof(start), 1, fp);
+
+    erl_drv_mutex_lock(G_CAPTURE_LOCK);
+    G_CAPTURE_FP = fp;
+    G_CAPTURE_ACTIVE = 1;
+    erl_drv_mutex_unlock(G_CAPTURE_LOCK);
+    erl_drv_mutex_unlock(G_CAPTURE_FILE_LOCK);
+    return 0;
+}
+
+void bdberl_capture_close(void)
+{
+    if (G_CAPTURE_LOCK == NULL)
+    {
+        return;
+    }
+
+    erl_drv_mutex_lock(G_CAPTURE_FILE_LOCK);
+    erl_drv_mutex_lock(G_CAPTURE_LOCK);
+    G_CAPTURE_ACTIVE = 0;
+    erl_drv_mutex_unlock(G_CAPTURE_LOCK);
+
+    if (G_CAPTURE_FP != NULL)
+    {
+        flush_buffers();
+        fclose(G_CAPTURE_FP);
+        G_CAPTURE_FP = NULL;
+    }
+    erl_drv_mutex_unlock(G_CAPTURE_FILE_LOCK);
+}
+
+void bdberl_capture_request(const char* path, ErlDrvPort port, ErlDrvTermData pid)
+{
+    if (G_CAPTURE_LOCK == NULL)
+    {
+        bdberl_send_rc(port, pid, EINVAL);
+        return;
+    }
+
+    // The path is copied in behind the request
+    unsigned int path_size = path ? strlen(path) + 1 : 0;
+    CaptureRequest* req = driver_alloc(sizeof(CaptureRequest) + path_size);
+    req->next = NULL;
+    req->path = NULL;
+    if (path)
+    {
+        req->path = (char*)(req + 1);
+        memcpy(req->path, path, path_size);
+    }
+    req->port = port;
+    req->pid = pid;
+
+    erl_drv_mutex_lock(G_CAPTURE_REQUEST_LOCK);
+    CaptureRequest** tail = &G_CAPTURE_REQUESTS;
+    while (*tail != NULL)
+    {
+        tail = &((*tail)->next);
+    }
+    *tail = req;
+    erl_drv_mutex_unlock(G_CAPTURE_REQUEST_LOCK);
+}
+
+void bdberl_capture_forget(ErlDrvPort port)
+{
+    if (G_CAPTURE_REQUEST_LOCK == NULL)
+    {
+        return;
+    }
+
+    erl_drv_mutex_lock(G_CAPTURE_REQUEST_LOCK);
+    CaptureRequest** link = &G_CAPTURE_REQUESTS;
+    while (*link != NULL)
+    {
+        CaptureRequest* req = *link;
+        if (req->port == port)
+        {
+            *link = req->next;
+            driver_free(req);
+        }
+        else
+        {
+            link = &(req->next);
+        }
+    }
+
+    // The writer answers under the lock, so once this is cleared it won't
+    if (G_CAPTURE_IN_FLIGHT != NULL && G_CAPTURE_IN_FLIGHT->port == port)
+    {
+        G_CAPTURE_IN_FLIGHT->port = NULL;
+    }
+    erl_drv_mutex_unlock(G_CAPTURE_REQUEST_LOCK);
+}
+
+int bdberl_capture_enabled(void)
+{
+    return G_CAPTURE_ACTIVE;
+}
+
+void bdberl_capture_record(unsigned int port_id, int cmd, int dbref, unsigned int flags,
+                           const void* key, unsigned int key_size, unsigned int value_size)
+{
+    if (!G_CAPTURE_ACTIVE)
+    {
+        return;
+    }
+
+    struct
+    {
+        uint64_t timestamp;
+        uint32_t port;
+        int32_t  cmd;
+        int32_t  dbref;
+        uint32_t flags;
+        uint32_t key_size;
+        uint32_t value_size;
+    } rec = { wall_usecs(), port_id, cmd, dbref, flags, key_size, value_size };
+    unsigned int size = CAPTURE_RECORD_SIZE + key_size;
+
+    erl_drv_mutex_lock(G_CAPTURE_LOCK);
+    CaptureBuffer* buf = &(G_CAPTURE_BUFFERS[G_CAPTURE_CURRENT]);
+    if (buf->used + size > G_CAPTURE_SIZE)
+    {
+        G_CAPTURE_DROPPED++;
+    }
+    else if (G_CAPTURE_ACTIVE)          /* May have been closed while we waited */
+    {
+        memcpy(buf->data + buf->used, &rec, CAPTURE_RECORD_SIZE);
+        if (key_size > 0)
+        {
+            memcpy(buf->data + buf->used + CAPTURE_RECORD_SIZE, key, key_size);
+        }
+        buf->used += size;
+        G_CAPTURE_RECORDS++;
+    }
+    erl_drv_mutex_unlock(G_CAPTURE_LOCK);
+}
+
+void bdberl_capture_counts(uint64_t* records, uint64_t* dropped)
+{
+    *records = 0;
+    *dropped = 0;
+    if (G_CAPTURE_LOCK == NULL)
+    {
+        return;
+    }
+
+    erl_drv_mutex_lock(G_CAPTURE_LOCK);
+    *records = G_CAPTURE_RECORDS;
+    *dropped = G_CAPTURE_DROPPED;
+    erl_drv_mutex_unlock(G_CAPTURE_LOCK);
+}
+
+
+static void* capture_writer(void* arg)
+{
+    do
+    {
+        // Starts and stops first, in the order they were asked for
+        CaptureRequest* req;
+        while ((req = next_request()) != NULL)
+        {
+            int rc = 0;
+            if (req->path)
+            {
+                rc = bdberl_capture_open(req->path);
+            }
+            else
+            {
+                bdberl_capture_close();
+            }
+            answer_request(req, rc);
+        }
+
+        erl_drv_mutex_lock(G_CAPTURE_FILE_LOCK);
+        if (G_CAPTURE_FP != NULL)
+        {
+            flush_buffers();
+        }
+        erl_drv_mutex_unlock(G_CAPTURE_FILE_LOCK);
+    } while (!util_thread_usleep(CAPTURE_FLUSH_USECS));
+
+    DBG("Capture writer exiting.\n");
+    return 0;
+}
+
+// Unlink the oldest pending request and mark it in flight
+static CaptureRequest* next_request(void)
+{
+    erl_drv_mutex_lock(G_CAPTURE_REQUEST_LOCK);
+    CaptureRequest* req = G_CAPTURE_REQUESTS;
+    if (req != NULL)
+    {
+        G_CAPTURE_REQUESTS = req->next;
+    }
+    G_CAPTURE_IN_FLIGHT = req;
+    erl_drv_mutex_unlock(G_CAPTURE_REQUEST_LOCK);
+    return req;
+}
+
+// Send the result of the request in flight, unless its port has stopped meanwhile
+static void answer_request(CaptureRequest* req, int rc)
+{
+    erl_drv_mutex_lock(G_CAPTURE_REQUEST_LOCK);
+    if (req->port != NULL)
+    {
+        bdberl_send_rc(req->port, req->pid, rc);
+    }
+    G_CAPTURE_IN_FLIGHT = NULL;
+    erl_drv_mutex_unlock(G_CAPTURE_REQUEST_LOCK);
+    driver_free(req);
+}
+
+// Unlink the pending requests, oldest first
+static CaptureRequest* take_requests(void)
+{
+    erl_drv_mutex_lock(G_CAPTURE_REQUEST_LOCK);
+    CaptureRequest* req = G_CAPTURE_REQUESTS;
+    G_CAPTURE_REQUESTS = NULL;
+    erl_drv_mutex_unlock(G_CAPTURE_REQUEST_LOCK);
+    return req;
+}
+
+// Swap buffers and append the filled one to the file; called with G_CAPTURE_FILE_LOCK held.
+// The spare buffer is always empty here since only this function drains it.
+static void flush_buffers(void)
+{
+    erl_drv_mutex_lock(G_CAPTURE_LOCK);
+    CaptureBuffer* full = &(G_CAPTURE_BUFFERS[G_CAPTURE_CURRENT]);
+    G_CAPTURE_CURRENT = 1 - G_CAPTURE_CURRENT;
+    erl_drv_mutex_unlock(G_CAPTURE_LOCK);
+
+    if (full->used > 0)
+    {
+        fwrite(full->data, full->used, 1, G_CAPTURE_FP);
+        fflush(G_CAPTURE_FP);
+        full->used = 0;
+    }
+}
+
+static uint64_t wall_usecs(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
@@ -0,0 +1,91 @@
+/* -------------------------------------------------------------------
+ *
+ * bdberl: Request capture
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ------------------------------------------------------------------- */
+#ifndef _BDBERL_CAPTURE
+#define _BDBERL_CAPTURE
+
+#include <stdint.h>
+
+#include "erl_driver.h"
+
+/**
+ * Capture file format. All integers are native endian.
+ *
+ *   Header:  << "BDBC", Version:32, StartUsecs:64 >>
+ *   Record:  << Timestamp:64, Port:32, Cmd:32, DbRef:32, Flags:32, KeyLen:32, ValueLen:32,
+ *               Key:KeyLen/bytes >>
+ *
+ * Timestamp is the wall clock in usecs since the epoch when the request reached the driver.
+ * Port numbers the originating port from 1 in the order ports were opened. Key holds the
+ * encoded key for data commands and the file name for CMD_OPEN_DB, whose record is written
+ * once the database is open so that DbRef is known (ValueLen carries the DBTYPE). Only the
+ * size of values is kept.
+ */
+#define CAPTURE_MAGIC           "BDBC"
+#define CAPTURE_VERSION         1
+#define CAPTURE_HEADER_SIZE     16
+#define CAPTURE_RECORD_SIZE     32      /* Fixed part of a record */
+
+/**
+ * Prototypes in bdberl_capture.c
+ */
+
+/**
+ * Start the writer thread. Records are copied into one of two buffers of buffer_bytes each;
+ * the writer swaps them every 100ms and appends the full one to the file. Records that do
+ * not fit while the writer is behind are dropped and counted.
+ */
+void bdberl_capture_init(unsigned int buffer_bytes);
+void bdberl_capture_finish(void);
+
+/**
+ * Start capturing into path, replacing any capture in progress. Returns 0 or an errno value.
+ * Does file I/O and waits on the writer; use bdberl_capture_request from the control call.
+ */
+int  bdberl_capture_open(const char* path);
+
+/**
+ * Stop capturing; everything recorded so far is written out before this returns
+ */
+void bdberl_capture_close(void);
+
+/**
+ * Start capturing into path, or stop if path is NULL, from the control call. The writer
+ * thread opens or closes the file on its next pass and sends the result to pid as
+ * bdberl_send_rc does, so the caller never waits on the disk.
+ */
+void bdberl_capture_request(const char* path, ErlDrvPort port, ErlDrvTermData pid);
+
+/**
+ * Drop the requests of a port that is stopping, so the writer never answers a closed port
+ */
+void bdberl_capture_forget(ErlDrvPort port);
+
+int  bdberl_capture_enabled(void);
+
+void bdberl_capture_record(unsigned int port_id, int cmd, int dbref, unsigned int flags,
+                           const void* key, unsigned int key_size, unsigned int value_size);
+
+void bdberl_capture_counts(uint64_t* records, uint64_t* dropped);
+
+#endif // _BDBERL_CAPTURE
@@ -5,8 +5,36 @@
  *
  * ------------------------------------------------------------------- */
 
+#include <string.h>
+
 #include "bdberl_crc32.h"
 
+/**
+ * Three implementations of the same reflected CRC-32 (zlib, erlang:crc32):
+ *
+ *   bytewise -- one table lookup per byte; the original implementation
+ *   slice8   -- eight 256 entry tables, one lookup per byte but eight bytes per step
+ *   pclmul   -- carry-less multiply folding (Intel, "Fast CRC Computation for Generic
+ *               Polynomials Using PCLMULQDQ Instruction"), 64 bytes per step, with slice8
+ *               for the tail
+ *
+ * bdberl_crc32_init builds the slice8 tables and points bdberl_crc32 at the fastest one the
+ * CPU supports. Until then bdberl_crc32 uses bytewise.
+ *
+ * CRC-32C (Castagnoli, as in iSCSI and ext4) is computed with the SSE4.2 crc32 instruction
+ * when the CPU has it and with slice8 tables otherwise.
+ *
+ * Define BDBERL_NO_PCLMUL to leave out the pclmul and sse42 implementations.
+ */
+#if !defined(BDBERL_NO_PCLMUL) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define BDBERL_PCLMUL 1
+#  include <cpuid.h>
+#  include <emmintrin.h>
+#  include <smmintrin.h>
+#  include <nmmintrin.h>
+#  include <wmmintrin.h>
+#endif
+
 /*****************************************************************/
 /*                                                               */
 /* CRC LOOKUP TABLE                                              */
@@ -102,12 +130,366 @@ static uint32_t crctable[256] =
 #define INIT_REFLECTED  0xFFFFFFFF
 #define XOROT 0xFFFFFFFF
 
+#define CRC32C_POLY_REFLECTED 0x82F63B78
+
+static uint32_t slice_tables[8][256];
+static uint32_t crc32c_tables[8][256];
+
+static void build_slice_tables(uint32_t tables[8][256]);
+static uint32_t slice8_update(uint32_t tables[8][256], uint32_t crc,
+                              const unsigned char* buf, unsigned int len);
+static uint32_t crc32_update_bytewise(uint32_t crc, const unsigned char* buf, unsigned int len);
+static uint32_t crc32_update_slice8(uint32_t crc, const unsigned char* buf, unsigned int len);
+static uint32_t crc32c_update_bitwise(uint32_t crc, const unsigned char* buf, unsigned int len);
+static uint32_t crc32c_update_slice8(uint32_t crc, const unsigned char* buf, unsigned int len);
+
+static uint32_t (*G_CRC32_UPDATE)(uint32_t, const unsigned char*, unsigned int) =
+    crc32_update_bytewise;
+static const char* G_CRC32_IMPL = "bytewise";
+
+static uint32_t (*G_CRC32C_UPDATE)(uint32_t, const unsigned char*, unsigned int) =
+    crc32c_update_bitwise;
+static const char* G_CRC32C_IMPL = "bitwise";
+
+#ifdef BDBERL_PCLMUL
+static uint32_t crc32_update_pclmul(uint32_t crc, const unsigned char* buf, unsigned int len);
+static uint32_t crc32c_update_sse42(uint32_t crc, const unsigned char* buf, unsigned int len);
+#endif
+
+
+void bdberl_crc32_init(void)
+{
+    memcpy(slice_tables[0], crctable, sizeof(crctable));
+    build_slice_tables(slice_tables);
+
+    unsigned int i, bit;
+    for (i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+        for (bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY_REFLECTED : crc >> 1;
+        }
+        crc32c_tables[0][i] = crc;
+    }
+    build_slice_tables(crc32c_tables);
+
+    if (bdberl_crc32_have_pclmul())
+    {
+#ifdef BDBERL_PCLMUL
+        G_CRC32_UPDATE = crc32_update_pclmul;
+        G_CRC32_IMPL = "pclmul";
+#endif
+    }
+    else
+    {
+        G_CRC32_UPDATE = crc32_update_slice8;
+        G_CRC32_IMPL = "slice8";
+    }
+
+    if (bdberl_crc32c_have_sse42())
+    {
+#ifdef BDBERL_PCLMUL
+        G_CRC32C_UPDATE = crc32c_update_sse42;
+        G_CRC32C_IMPL = "sse42";
+#endif
+    }
+    else
+    {
+        G_CRC32C_UPDATE = crc32c_update_slice8;
+        G_CRC32C_IMPL = "slice8";
+    }
+}
+
+const char* bdberl_crc32_impl(void)
+{
+    return G_CRC32_IMPL;
+}
+
+const char* bdberl_crc32c_impl(void)
+{
+    return G_CRC32C_IMPL;
+}
+
+int bdberl_crc32_have_pclmul(void)
+{
+#ifdef BDBERL_PCLMUL
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    {
+        return (ecx & bit_PCLMUL) && (ecx & bit_SSE4_1);
+    }
+#endif
+    return 0;
+}
+
+int bdberl_crc32c_have_sse42(void)
+{
+#ifdef BDBERL_PCLMUL
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    {
+        return (ecx & bit_SSE4_2) != 0;
+    }
+#endif
+    return 0;
+}
+
 // Here is the reflected form:
 uint32_t bdberl_crc32(const unsigned char *blk_adr, unsigned int blk_len)
 {
-    
-    uint32_t crc = INIT_REFLECTED;
-    while (blk_len--)
-        crc = crctable[(crc ^ *blk_adr++) & 0xFFL] ^ (crc >> 8);
-    return crc ^ XOROT;
+    return G_CRC32_UPDATE(INIT_REFLECTED, blk_adr, blk_len) ^ XOROT;
+}
+
+uint32_t bdberl_crc32_bytewise(const unsigned char *blk_adr, unsigned int blk_len)
+{
+    return crc32_update_bytewise(INIT_REFLECTED, blk_adr, blk_len) ^ XOROT;
+}
+
+uint32_t bdberl_crc32_slice8(const unsigned char *blk_adr, unsigned int blk_len)
+{
+    return crc32_update_slice8(INIT_REFLECTED, blk_adr, blk_len) ^ XOROT;
+}
+
+uint32_t bdberl_crc32_pclmul(const unsigned char *blk_adr, unsigned int blk_len)
+{
+#ifdef BDBERL_PCLMUL
+    return crc32_update_pclmul(INIT_REFLECTED, blk_adr, blk_len) ^ XOROT;
+#else
+    return bdberl_crc32_slice8(blk_adr, blk_len);
+#endif
+}
+
+uint32_t bdberl_crc32c(const unsigned char *blk_adr, unsigned int blk_len)
+{
+    return G_CRC32C_UPDATE(INIT_REFLECTED, blk_adr, blk_len) ^ XOROT;
+}
+
+uint32_t bdberl_crc32c_slice8(const unsigned char *blk_adr, unsigned int blk_len)
+{
+    return crc32c_update_slice8(INIT_REFLECTED, blk_adr, blk_len) ^ XOROT;
+}
+
+
+// Table k maps a byte to its CRC followed by k zero bytes; table 0 is filled in by the caller
+static void build_slice_tables(uint32_t tables[8][256])
+{
+    unsigned int i, k;
+    for (i = 0; i < 256; i++)
+    {
+        for (k = 1; k < 8; k++)
+        {
+            uint32_t prev = tables[k - 1][i];
+            tables[k][i] = (prev >> 8) ^ tables[0][prev & 0xFF];
+        }
+    }
+}
+
+static uint32_t crc32_update_bytewise(uint32_t crc, const unsigned char* buf, unsigned int len)
+{
+    while (len--)
+        crc = crctable[(crc ^ *buf++) & 0xFFL] ^ (crc >> 8);
+    return crc;
+}
+
+static uint32_t crc32_update_slice8(uint32_t crc, const unsigned char* buf, unsigned int len)
+{
+    return slice8_update(slice_tables, crc, buf, len);
+}
+
+static uint32_t crc32c_update_slice8(uint32_t crc, const unsigned char* buf, unsigned int len)
+{
+    return slice8_update(crc32c_tables, crc, buf, len);
+}
+
+// Only used until bdberl_crc32_init has built the tables
+static uint32_t crc32c_update_bitwise(uint32_t crc, const unsigned char* buf, unsigned int len)
+{
+    unsigned int bit;
+    while (len--)
+    {
+        crc ^= *buf++;
+        for (bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY_REFLECTED : crc >> 1;
+        }
+    }
+    return crc;
+}
+
+static uint32_t slice8_update(uint32_t tables[8][256], uint32_t crc,
+                              const unsigned char* buf, unsigned int len)
+{
+    // Words are assembled a byte at a time so this works on either byte order; compilers turn
+    // it into a single load on little endian machines
+    while (len >= 8)
+    {
+        uint32_t one = crc ^ ((uint32_t)buf[0] | ((uint32_t)buf[1] << 8) |
+                              ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24));
+        uint32_t two = (uint32_t)buf[4] | ((uint32_t)buf[5] << 8) |
+                       ((uint32_t)buf[6] << 16) | ((uint32_t)buf[7] << 24);
+        crc = tables[7][one & 0xFF] ^
+              tables[6][(one >> 8) & 0xFF] ^
+              tables[5][(one >> 16) & 0xFF] ^
+              tables[4][one >> 24] ^
+              tables[3][two & 0xFF] ^
+              tables[2][(two >> 8) & 0xFF] ^
+              tables[1][(two >> 16) & 0xFF] ^
+              tables[0][two >> 24];
+        buf += 8;
+        len -= 8;
+    }
+    while (len--)
+        crc = tables[0][(crc ^ *buf++) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+#ifdef BDBERL_PCLMUL
+
+// Folding constants for the reflected polynomial 0x04C11DB7, from the end of the Intel paper:
+// x^(4*128+32) mod P and x^(4*128-32) mod P, then the same for one 128 bit lane, then the
+// 64 -> 32 bit fold and the Barrett reduction constants (P' and mu)
+static const uint64_t K1K2[2] __attribute__((aligned(16))) = { 0x0154442bd4ULL, 0x01c6e41596ULL };
+static const uint64_t K3K4[2] __attribute__((aligned(16))) = { 0x01751997d0ULL, 0x00ccaa009eULL };
+static const uint64_t K5K0[2] __attribute__((aligned(16))) = { 0x0163cd6124ULL, 0x0000000000ULL };
+static const uint64_t POLY[2] __attribute__((aligned(16))) = { 0x01db710641ULL, 0x01f7011641ULL };
+
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_fold_pclmul(uint32_t crc, const unsigned char* buf, unsigned int len)
+{
+    // len is a multiple of 16 and at least 64
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128((const __m128i*)(buf + 0x00));
+    x2 = _mm_loadu_si128((const __m128i*)(buf + 0x10));
+    x3 = _mm_loadu_si128((const __m128i*)(buf + 0x20));
+    x4 = _mm_loadu_si128((const __m128i*)(buf + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+    x0 = _mm_load_si128((const __m128i*)K1K2);
+    buf += 64;
+    len -= 64;
+
+    // Fold four lanes in parallel, 64 bytes at a time
+    while (len >= 64)
+    {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+        y5 = _mm_loadu_si128((const __m128i*)(buf + 0x00));
+        y6 = _mm_loadu_si128((const __m128i*)(buf + 0x10));
+        y7 = _mm_loadu_si128((const __m128i*)(buf + 0x20));
+        y8 = _mm_loadu_si128((const __m128i*)(buf + 0x30));
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+        buf += 64;
+        len -= 64;
+    }
+
+    // Fold the four lanes into one
+    x0 = _mm_load_si128((const __m128i*)K3K4);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    // Fold the remaining 16 byte blocks into the lane
+    while (len >= 16)
+    {
+        x2 = _mm_loadu_si128((const __m128i*)buf);
+
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+        buf += 16;
+        len -= 16;
+    }
+
+    // Fold 128 bits down to 64
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+
+    x0 = _mm_loadl_epi64((const __m128i*)K5K0);
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction down to 32 bits
+    x0 = _mm_load_si128((const __m128i*)POLY);
+
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+static uint32_t crc32_update_pclmul(uint32_t crc, const unsigned char* buf, unsigned int len)
+{
+    // Folding has a fixed setup and reduction cost; below a few blocks slice8 is faster
+    if (len >= 64)
+    {
+        unsigned int chunk = len & ~15U;
+        crc = crc32_fold_pclmul(crc, buf, chunk);
+        buf += chunk;
+        len -= chunk;
+    }
+    return crc32_update_slice8(crc, buf, len);
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_update_sse42(uint32_t crc, const unsigned char* buf, unsigned int len)
+{
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+    while (len >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, buf, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+        buf += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)crc64;
+#endif
+    while (len >= 4)
+    {
+        uint32_t word;
+        memcpy(&word, buf, 4);
+        crc = _mm_crc32_u32(crc, word);
+        buf += 4;
+        len -= 4;
+    }
+    while (len--)
+    {
+        crc = _mm_crc32_u8(crc, *buf++);
+    }
+    return crc;
 }
+
+#endif // BDBERL_PCLMUL
@@ -9,6 +9,40 @@
 
 #include <stdint.h>
 
+/**
+ * Build the lookup tables and select the fastest implementation this CPU supports. Call
+ * once before any thread uses bdberl_crc32; the slice8 and pclmul variants below need it.
+ */
+void bdberl_crc32_init(void);
+
+/**
+ * Name of the implementation bdberl_crc32 uses: "bytewise", "slice8" or "pclmul"
+ */
+const char* bdberl_crc32_impl(void);
+
+/**
+ * Name of the implementation bdberl_crc32c uses: "bitwise", "slice8" or "sse42"
+ */
+const char* bdberl_crc32c_impl(void);
+
 uint32_t bdberl_crc32(const unsigned char *blk_adr, unsigned int blk_len);
 
+/**
+ * The individual implementations, for benchmarks and cross-checks. All return the same
+ * value as erlang:crc32/1. bdberl_crc32_pclmul falls back to slice8 when built without it,
+ * so check bdberl_crc32_have_pclmul before calling it on a CPU that may lack PCLMULQDQ.
+ */
+uint32_t bdberl_crc32_bytewise(const unsigned char *blk_adr, unsigned int blk_len);
+uint32_t bdberl_crc32_slice8(const unsigned char *blk_adr, unsigned int blk_len);
+uint32_t bdberl_crc32_pclmul(const unsigned char *blk_adr, unsigned int blk_len);
+int bdberl_crc32_have_pclmul(void);
+
+/**
+ * CRC-32C (Castagnoli polynomial 0x1EDC6F41), used for value checksums on databases opened
+ * with {checksum, crc32c}
+ */
+uint32_t bdberl_crc32c(const unsigned char *blk_adr, unsigned int blk_len);
+uint32_t bdberl_crc32c_slice8(const unsigned char *blk_adr, unsigned int blk_len);
+int bdberl_crc32c_have_sse42(void);
+
 #endif // _BDBERL_CRC32
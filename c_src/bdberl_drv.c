@@ -47,7 +47,15 @@
 
 #include "hive_hash.h"
 #include "bdberl_drv.h"
+#include "bdberl_atoms.h"
 #include "bdberl_stats.h"
+#include "bdberl_sampler.h"
+#include "bdberl_trace.h"
+#include "bdberl_capture.h"
+#include "bdberl_probes.h"
+#include "bdberl_term_cmp.h"
+#include "bdberl_key.h"
+#include "bdberl_xxhash.h"
 #include "bin_helper.h"
 
 /**
@@ -98,7 +106,19 @@ ErlDrvEntry bdberl_drv_entry =
 static int check_non_neg_env(char *env, unsigned int *val_ptr);
 static int check_pos_env(char *env, unsigned int *val_ptr);
 
-static int open_database(const char* name, DBTYPE type, unsigned int flags, PortData* data, int* dbref_res);
+static int parse_db_options(char* inbuf, int inbuf_sz, int offset, DbOptions* options);
+static int configure_database(DB* db, DBTYPE type, DbOptions* options);
+static void start_filter_build(DB* db, DbOptions* options);
+static void do_build_key_filter(void* arg);
+static int scan_key_hashes(FilterBuild* build, uint64_t** hashes_res, unsigned int* count_res);
+static void cancel_filter_build(DbOptions* options);
+static void pause_filter_build(DbOptions* options);
+static void resume_filter_build(DbOptions* options);
+static void free_filter_build(FilterBuild* build);
+static int term_order_compare(DB* db, const DBT* a, const DBT* b);
+static u_int32_t xxh64_hash(DB* db, const void* bytes, u_int32_t length);
+static int open_database(const char* name, DBTYPE type, unsigned int flags, DbOptions* options,
+                         PortData* data, int* dbref_res);
 static int close_database(int dbref, unsigned flags, PortData* data);
 static void check_all_databases_closed();
 
@@ -118,6 +138,19 @@ static void do_async_cursor_cnp(void* arg);
 static void do_async_truncate(void* arg);
 static void do_sync_data_dirs_info(PortData *p);
 static void do_sync_driver_info(PortData *d);
+static void do_sync_latency_stats(PortData *d, unsigned int flags);
+static void do_sync_db_counters(PortData *d, int dbref);
+static void update_db_counters(PortData* d, int dbref, int op, int rc, DBT* key, DBT* value);
+static void trace_op(PortData* d, int dbref, int in_txn, int rc, DBT* key, DBT* value);
+static void capture_request(PortData* d, unsigned int cmd, char* inbuf, int inbuf_sz);
+static int cached_get(PortData* d, int dbref, char* inbuf);
+static void invalidate_cached(PortData* d, int dbref, DBT* key);
+static int filtered_get(PortData* d, int dbref, char* inbuf);
+static void filter_put(int dbref, DBT* key);
+static void unfilter_deleted(PortData* d, int dbref, KeyFilter* filter, DBT* key);
+static void add_txn_write(PortData* d, int dbref, int op, uint64_t hash);
+static void apply_txn_writes(PortData* d);
+static void finish_txn_writes(PortData* d, int commit_rc);
 
 static int send_dir_info(ErlDrvPort port, ErlDrvTermData pid, const char *path);
 
@@ -129,6 +162,7 @@ static int del_portref(int dbref, ErlDrvPort port);
 
 static int alloc_dbref();
 static void abort_txn(PortData* d);
+static void release_async(PortData* d);
 
 static void* driver_calloc(unsigned int size);
 
@@ -181,6 +215,30 @@ static unsigned int G_DEADLOCK_CHECK_ACTIVE   = 1;
 static unsigned int G_DEADLOCK_CHECK_INTERVAL = 100;  /* 100 milliseconds */
 
 
+/**
+ * Lock telemetry gathered by the deadlock checker. Totals accumulate from startup. Every
+ * G_LOCK_STAT_INTERVAL seconds the checker also samples lock_stat and turns the deltas into
+ * per-second rates, which are published through driver_info and the logger. Totals are
+ * updated with atomic adds; the rates are protected by G_LOCK_TELEMETRY_MUTEX.
+ */
+typedef struct
+{
+    uint64_t deadlocks;           /* Lock requests rejected by lock_detect */
+    uint64_t lock_failures;       /* Worker ops that returned DB_LOCK_DEADLOCK/NOTGRANTED */
+    uint64_t lock_failure_usecs;  /* Time those ops spent in BDB before failing */
+    double   deadlock_rate;
+    double   lock_wait_rate;      /* st_lock_wait -- requests that had to wait */
+    double   lock_nowait_rate;    /* st_lock_nowait -- requests refused rather than wait */
+    double   lock_timeout_rate;   /* st_nlocktimeouts */
+    double   txn_timeout_rate;    /* st_ntxntimeouts */
+    double   lock_request_rate;   /* st_nrequests */
+} LockTelemetry;
+
+static LockTelemetry G_LOCK_TELEMETRY;
+static ErlDrvMutex*  G_LOCK_TELEMETRY_MUTEX = 0;
+static unsigned int  G_LOCK_STAT_INTERVAL   = 10;   /* Seconds between lock_stat samples */
+
+
 /**
  * Trickle writer for dirty pages. We run a single thread per VM to perform background
  * trickling of dirty pages to disk. G_TRICKLE_INTERVAL is the time between runs in seconds.
@@ -228,6 +286,76 @@ static unsigned int G_NUM_TXN_THREADS = 16;
 static TPool* G_TPOOL_GENERAL = NULL;
 static TPool* G_TPOOL_TXNS    = NULL;
 
+/**
+ * Admission control -- maximum number of queued jobs per pool and per request class before
+ * new requests are refused with ERROR_OVERLOADED. Zero means unbounded.
+ */
+static unsigned int G_MAX_GENERAL_PENDING = 0;
+static unsigned int G_MAX_TXN_PENDING     = 0;
+static unsigned int G_MAX_READ_PENDING    = 0;
+static unsigned int G_MAX_WRITE_PENDING   = 0;
+static unsigned int G_MAX_STAT_PENDING    = 0;
+
+/**
+ * Background stats sampler -- snapshots the env and pool counters every G_SAMPLE_INTERVAL
+ * seconds into a ring of G_SAMPLE_SLOTS samples, optionally mirrored to a rotating file.
+ */
+static unsigned int G_SAMPLE_INTERVAL = 10;             /* Seconds between samples */
+static unsigned int G_SAMPLE_SLOTS    = 360;            /* One hour at the default interval */
+static unsigned int G_SAMPLE_FILE_KB  = 1024;           /* Size at which the file is rotated */
+
+/**
+ * Operation tracing -- every data operation is recorded in a G_TRACE_ENTRIES ring owned by
+ * the worker thread that ran it, and any that take longer than G_SLOW_OP_USECS from enqueue
+ * to completion are reported to the logger.
+ */
+static unsigned int G_TRACE_ENTRIES = 256;              /* Entries per worker thread */
+static unsigned int G_SLOW_OP_USECS = 1000000;          /* One second */
+
+/**
+ * Request capture -- when a capture file is open every data and transaction request is
+ * appended to it for later replay (see bdberl_capture.h). Ports are numbered from
+ * G_PORT_SEQ so records can be grouped by the port that issued them.
+ */
+static unsigned int G_CAPTURE_BUFFER_KB = 1024;         /* Each of the two record buffers */
+static unsigned int G_PORT_SEQ = 0;
+
+/**
+ * Latency histogram tags for async commands. The pools record queue wait and service time
+ * per tag; names are the atoms reported by CMD_LATENCY_STATS.
+ */
+#define LATENCY_GET           0
+#define LATENCY_PUT           1
+#define LATENCY_PUT_COMMIT    2
+#define LATENCY_DEL           3
+#define LATENCY_TXN_BEGIN     4
+#define LATENCY_TXN_COMMIT    5
+#define LATENCY_TXN_ABORT     6
+#define LATENCY_CURSOR_CURR   7
+#define LATENCY_CURSOR_NEXT   8
+#define LATENCY_CURSOR_PREV   9
+#define LATENCY_CURSOR_GET   10
+#define LATENCY_CURSOR_PUT   11
+#define LATENCY_CURSOR_DEL   12
+#define LATENCY_CURSOR_COUNT 13
+#define LATENCY_TRUNCATE     14
+#define LATENCY_STAT         15
+#define LATENCY_TAGS         16
+
+static const BdberlAtom G_LATENCY_TAG_ATOMS[LATENCY_TAGS] = {
+    ATOM_get, ATOM_put, ATOM_put_commit, ATOM_del, ATOM_txn_begin, ATOM_txn_commit,
+    ATOM_txn_abort, ATOM_cursor_curr, ATOM_cursor_next, ATOM_cursor_prev, ATOM_cursor_get,
+    ATOM_cursor_put, ATOM_cursor_del, ATOM_cursor_count, ATOM_truncate, ATOM_stat
+};
+
+
+/**
+ * Replies that never change, filled in at DRIVER_INIT. driver_send_term only reads the
+ * spec, so every thread can send from the same copy.
+ */
+static ErlDrvTermData G_REPLY_OK[2];
+static ErlDrvTermData G_REPLY_NOT_FOUND[2];
+
 
 #define LOCK_DATABASES(P)                                               \
     do                                                                  \
@@ -269,6 +397,14 @@ DRIVER_INIT(bdberl_drv)
         DB_USE_ENVIRON |        /* Use DB_HOME environment variable */
         DB_THREAD;              /* Make the environment free-threaded */
 
+    // Pick the CRC-32 implementation before any thread checks a value
+    bdberl_crc32_init();
+
+    // Intern reply atoms before anything can send a message
+    bdberl_atoms_init();
+    G_REPLY_OK[0] = ERL_DRV_ATOM;        G_REPLY_OK[1] = ATOM(ok);
+    G_REPLY_NOT_FOUND[0] = ERL_DRV_ATOM; G_REPLY_NOT_FOUND[1] = ATOM(not_found);
+
     // Check for environment flag which indicates we want to use DB_SYSTEM_MEM
     char value[1];
     size_t value_size = sizeof(value);
@@ -344,6 +480,11 @@ DRIVER_INIT(bdberl_drv)
         // Set the deadlock interval
         check_pos_env("BDBERL_DEADLOCK_CHECK_INTERVAL", &G_DEADLOCK_CHECK_INTERVAL);
 
+        // Set how often the deadlock checker samples lock_stat for telemetry
+        check_pos_env("BDBERL_LOCK_STAT_INTERVAL", &G_LOCK_STAT_INTERVAL);
+        memset(&G_LOCK_TELEMETRY, '\0', sizeof(G_LOCK_TELEMETRY));
+        G_LOCK_TELEMETRY_MUTEX = erl_drv_mutex_create("bdberl_drv: G_LOCK_TELEMETRY_MUTEX");
+
         // Initialize default page size
         unsigned int page_size;
         if (check_pos_env("BDBERL_PAGE_SIZE", &page_size))
@@ -384,6 +525,11 @@ DRIVER_INIT(bdberl_drv)
         erl_drv_thread_create("bdberl_drv_checkpointer", &G_CHECKPOINT_THREAD,
                               &checkpointer, 0, 0);
 
+        // Per-thread trace rings must exist before any worker runs
+        check_pos_env("BDBERL_TRACE_ENTRIES", &G_TRACE_ENTRIES);
+        check_pos_env("BDBERL_SLOW_OP_USECS", &G_SLOW_OP_USECS);
+        bdberl_trace_init(G_TRACE_ENTRIES);
+
         // Startup our thread pools
         check_pos_env("BDBERL_NUM_GENERAL_THREADS", &G_NUM_GENERAL_THREADS);
         G_TPOOL_GENERAL = bdberl_tpool_start(G_NUM_GENERAL_THREADS);
@@ -391,6 +537,47 @@ DRIVER_INIT(bdberl_drv)
         check_pos_env("BDBERL_NUM_TXN_THREADS", &G_NUM_TXN_THREADS);
         G_TPOOL_TXNS    = bdberl_tpool_start(G_NUM_TXN_THREADS);
 
+        // Queue limits for admission control. Each pool may be bounded as a whole and the
+        // general pool may additionally be bounded per class of request. Unset means unbounded.
+        check_pos_env("BDBERL_MAX_GENERAL_PENDING", &G_MAX_GENERAL_PENDING);
+        check_pos_env("BDBERL_MAX_TXN_PENDING", &G_MAX_TXN_PENDING);
+        check_pos_env("BDBERL_MAX_READ_PENDING", &G_MAX_READ_PENDING);
+        check_pos_env("BDBERL_MAX_WRITE_PENDING", &G_MAX_WRITE_PENDING);
+        check_pos_env("BDBERL_MAX_STAT_PENDING", &G_MAX_STAT_PENDING);
+        bdberl_tpool_set_max_pending(G_TPOOL_GENERAL, G_MAX_GENERAL_PENDING);
+        bdberl_tpool_set_max_pending(G_TPOOL_TXNS, G_MAX_TXN_PENDING);
+        bdberl_tpool_set_class_max_pending(G_TPOOL_GENERAL, TPOOL_CLASS_READ, G_MAX_READ_PENDING);
+        bdberl_tpool_set_class_max_pending(G_TPOOL_GENERAL, TPOOL_CLASS_WRITE, G_MAX_WRITE_PENDING);
+        bdberl_tpool_set_class_max_pending(G_TPOOL_GENERAL, TPOOL_CLASS_STAT, G_MAX_STAT_PENDING);
+
+        // Startup the stats sampler. BDBERL_SAMPLE_FILE names an optional file that also
+        // receives every sample.
+        check_pos_env("BDBERL_SAMPLE_INTERVAL", &G_SAMPLE_INTERVAL);
+        check_pos_env("BDBERL_SAMPLE_SLOTS", &G_SAMPLE_SLOTS);
+        check_pos_env("BDBERL_SAMPLE_FILE_KB", &G_SAMPLE_FILE_KB);
+        char sample_file[4096];
+        size_t sample_file_size = sizeof(sample_file);
+        int have_sample_file = (erl_drv_getenv("BDBERL_SAMPLE_FILE", sample_file,
+                                               &sample_file_size) == 0);
+        bdberl_sampler_start(G_SAMPLE_INTERVAL, G_SAMPLE_SLOTS,
+                             have_sample_file ? sample_file : NULL, G_SAMPLE_FILE_KB * 1024,
+                             G_TPOOL_GENERAL, G_TPOOL_TXNS);
+
+        // Startup the capture writer; BDBERL_CAPTURE_FILE starts capturing right away
+        check_pos_env("BDBERL_CAPTURE_BUFFER_KB", &G_CAPTURE_BUFFER_KB);
+        bdberl_capture_init(G_CAPTURE_BUFFER_KB * 1024);
+        char capture_file[4096];
+        size_t capture_file_size = sizeof(capture_file);
+        if (erl_drv_getenv("BDBERL_CAPTURE_FILE", capture_file, &capture_file_size) == 0)
+        {
+            int rc = bdberl_capture_open(capture_file);
+            if (rc != 0)
+            {
+                fprintf(stderr, "Unable to open capture file \"%s\": %s\n",
+                        capture_file, strerror(rc));
+            }
+        }
+
         // Initialize logging lock and refs
         G_LOG_RWLOCK = erl_drv_rwlock_create("bdberl_drv: G_LOG_RWLOCK");
         G_LOG_PORT   = 0;
@@ -427,6 +614,9 @@ static ErlDrvData bdberl_drv_start(ErlDrvPort port, char* buffer)
     // Save the caller/owner PID
     d->port_owner = driver_connected(port);
 
+    // Number the port for request capture
+    d->port_id = __sync_add_and_fetch(&G_PORT_SEQ, 1);
+
     // Allocate an initial buffer for work purposes
     d->work_buffer = driver_alloc(4096);
     d->work_buffer_sz = 4096;
@@ -445,6 +635,9 @@ static void bdberl_drv_stop(ErlDrvData handle)
 
     DBG("Stopping port %p\n", d->port);
 
+    // Capture starts and stops still waiting for the writer have no one to answer now
+    bdberl_capture_forget(d->port);
+
     // Grab the port lock, in case we have an async job running
     erl_drv_mutex_lock(d->port_lock);
 
@@ -517,12 +710,19 @@ static void bdberl_drv_stop(ErlDrvData handle)
 
     // Release the port instance data
     driver_free(d->work_buffer);
+    if (d->txn_writes)
+    {
+        driver_free(d->txn_writes);
+    }
     driver_free(handle);
 }
 
 static void bdberl_drv_finish()
 {
     DBG("BDB DRIVER FINISHING");
+    // Stop sampling before the pools it reports on go away
+    bdberl_sampler_stop();
+
     // Stop the thread pools
     if (G_TPOOL_GENERAL != NULL)
     {
@@ -536,6 +736,9 @@ static void bdberl_drv_finish()
         G_TPOOL_TXNS = NULL;
     }
 
+    // With the workers gone nothing records into the trace rings any more
+    bdberl_trace_finish();
+
     // Signal the utility threads time is up
     G_TRICKLE_ACTIVE = 0;
     G_DEADLOCK_CHECK_ACTIVE = 0;
@@ -562,6 +765,12 @@ static void bdberl_drv_finish()
         G_CHECKPOINT_THREAD = 0;
     }
 
+    // Wait for the sampler to shutdown
+    bdberl_sampler_join();
+
+    // Wait for the capture writer and write out anything still buffered
+    bdberl_capture_finish();
+
     // Close the reader fd on the pipe now utility threads are closed
     if (G_BDBERL_PIPE[0] != -1)
     {
@@ -594,6 +803,12 @@ static void bdberl_drv_finish()
         G_DATABASES_NAMES = NULL;
     }
 
+    if (G_LOCK_TELEMETRY_MUTEX != NULL)
+    {
+        erl_drv_mutex_destroy(G_LOCK_TELEMETRY_MUTEX);
+        G_LOCK_TELEMETRY_MUTEX = NULL;
+    }
+
     // Release the logging rwlock
     if (G_LOG_RWLOCK != NULL)
     {
@@ -609,22 +824,35 @@ static int bdberl_drv_control(ErlDrvData handle, unsigned int cmd,
                               char** outbuf, int outbuf_sz)
 {
     PortData* d = (PortData*)handle;
+    BDBERL_PROBE2(command, d->port, cmd);
+    if (bdberl_capture_enabled())
+    {
+        capture_request(d, cmd, inbuf, inbuf_sz);
+    }
     switch(cmd)
     {
     case CMD_OPEN_DB:
     {
         // Extract the type code and filename from the inbuf
-        // Inbuf is: <<Flags:32/unsigned, Type:8, Name/bytes, 0:8>>
+        // Inbuf is: <<Flags:32/unsigned, Type:8, Name/bytes, 0:8, Options/bytes>>
         unsigned flags = UNPACK_INT(inbuf, 0);
         DBTYPE type = (DBTYPE) UNPACK_BYTE(inbuf, 4);
         char* name = UNPACK_STRING(inbuf, 5);
         int dbref;
-        int rc = open_database(name, type, flags, d, &dbref);
+        DbOptions options;
+        int rc = parse_db_options(inbuf, inbuf_sz, 5 + strnlen(name, inbuf_sz - 5) + 1, &options);
+        if (rc == 0)
+        {
+            rc = open_database(name, type, flags, &options, d, &dbref);
+        }
 
         // Queue up a message for bdberl:open to process
         if (rc == 0) // success: send {ok, DbRef}
         {
-            ErlDrvTermData response[] = { ERL_DRV_ATOM, driver_mk_atom("ok"),
+            // Captured once the dbref is known so replay can map it back to the name
+            bdberl_capture_record(d->port_id, cmd, dbref, flags, name, strlen(name), type);
+
+            ErlDrvTermData response[] = { ERL_DRV_ATOM, ATOM(ok),
                                           ERL_DRV_INT,  dbref,
                                           ERL_DRV_TUPLE, 2};
             driver_send_term(d->port, d->port_owner,
@@ -663,10 +891,10 @@ static int bdberl_drv_control(ErlDrvData handle, unsigned int cmd,
         // Setup async command and schedule it on the txns threadpool
         d->async_op = cmd;
         d->async_flags = UNPACK_INT(inbuf, 0);
-        bdberl_txn_tpool_run(&do_async_txnop, d, 0, &d->async_job);
+        int rc = bdberl_txn_tpool_run(&do_async_txnop, d, 0, &d->async_job);
 
         // Outbuf is <<Rc:32>>
-        RETURN_INT(0, outbuf);
+        RETURN_INT(rc, outbuf);
     }
     case CMD_TXN_COMMIT:
     case CMD_TXN_ABORT:
@@ -680,10 +908,10 @@ static int bdberl_drv_control(ErlDrvData handle, unsigned int cmd,
         {
             d->async_flags = UNPACK_INT(inbuf, 0);
         }
-        bdberl_txn_tpool_run(&do_async_txnop, d, 0, &d->async_job);
+        int rc = bdberl_txn_tpool_run(&do_async_txnop, d, 0, &d->async_job);
 
         // Outbuf is <<Rc:32>>
-        RETURN_INT(0, outbuf);
+        RETURN_INT(rc, outbuf);
     }
     case CMD_PUT:
     case CMD_GET:
@@ -707,6 +935,13 @@ static int bdberl_drv_control(ErlDrvData handle, unsigned int cmd,
         // the underlying handle disappearing since we have a reference.
         if (bdberl_has_dbref(d, dbref))
         {
+            // Hot keys are answered from the value cache, and keys the key filter rules
+            // out with not_found, without a trip through the pool
+            if (cmd == CMD_GET && (cached_get(d, dbref, inbuf) || filtered_get(d, dbref, inbuf)))
+            {
+                RETURN_INT(0, outbuf);
+            }
+
             // If the working buffer is large enough, copy the data to put/get into it. Otherwise, realloc
             // until it is large enough
             if (d->work_buffer_sz < inbuf_sz)
@@ -742,11 +977,11 @@ static int bdberl_drv_control(ErlDrvData handle, unsigned int cmd,
             default:
               assert(cmd);
             }
-            bdberl_general_tpool_run(fn, d, 0, &d->async_job);
+            int rc = bdberl_general_tpool_run(fn, d, 0, &d->async_job);
 
-            // Let caller know that the operation is in progress
-            // Outbuf is: <<0:32>>
-            RETURN_INT(0, outbuf);
+            // Let caller know that the operation is in progress (or was refused)
+            // Outbuf is: <<Rc:32>>
+            RETURN_INT(rc, outbuf);
         }
         else
         {
@@ -781,7 +1016,9 @@ static int bdberl_drv_control(ErlDrvData handle, unsigned int cmd,
         {
             // Grab the database handle and open the cursor
             DB* db = G_DATABASES[dbref].db;
-            int rc = db->cursor(db, d->txn, &(d->cursor), flags);
+            int rc = db->cursor(db, d->txn, &(d->cursor), flags & ~BDBERL_OPT_MASK);
+            d->cursor_dbref = dbref;
+            d->cursor_options = flags & BDBERL_OPT_MASK;
             bdberl_send_rc(d->port, d->port_owner, rc);
             RETURN_INT(0, outbuf);
         }
@@ -835,11 +1072,11 @@ static int bdberl_drv_control(ErlDrvData handle, unsigned int cmd,
             assert(cmd);
         }
         // Now schedule the operation to run
-        bdberl_general_tpool_run(fn, d, 0, &d->async_job);
+        int rc = bdberl_general_tpool_run(fn, d, 0, &d->async_job);
 
         // Let caller know operation is in progress
-        // Outbuf is: <<0:32>>
-        RETURN_INT(0, outbuf);
+        // Outbuf is: <<Rc:32>>
+        RETURN_INT(rc, outbuf);
     }
     case CMD_CURSOR_CURR:
     case CMD_CURSOR_NEXT:
@@ -850,10 +1087,10 @@ static int bdberl_drv_control(ErlDrvData handle, unsigned int cmd,
 
         // Schedule the operation
         d->async_op = cmd;
-        bdberl_general_tpool_run(&do_async_cursor_cnp, d, 0, &d->async_job);
+        int rc = bdberl_general_tpool_run(&do_async_cursor_cnp, d, 0, &d->async_job);
 
         // Let caller know operation is in progress
-        RETURN_INT(0, outbuf);
+        RETURN_INT(rc, outbuf);
     }
     case CMD_CURSOR_COUNT:
     {
@@ -862,11 +1099,11 @@ static int bdberl_drv_control(ErlDrvData handle, unsigned int cmd,
 
         // Schedule the operation
         d->async_op = cmd;
-        bdberl_general_tpool_run(&do_async_cursor_count, d, 0, &d->async_job);
+        int rc = bdberl_general_tpool_run(&do_async_cursor_count, d, 0, &d->async_job);
 
         // Let caller know operation is in progress
-        // Outbuf is: <<0:32>>
-        RETURN_INT(0, outbuf);
+        // Outbuf is: <<Rc:32>>
+        RETURN_INT(rc, outbuf);
     }
     case CMD_CURSOR_CLOSE:
     {
@@ -915,11 +1152,11 @@ static int bdberl_drv_control(ErlDrvData handle, unsigned int cmd,
             // Mark the port as busy and then schedule the appropriate async operation
             d->async_op = cmd;
             d->async_dbref = dbref;
-            bdberl_general_tpool_run(&do_async_truncate, d, 0, &d->async_job);
+            int rc = bdberl_general_tpool_run(&do_async_truncate, d, 0, &d->async_job);
 
             // Let caller know that the operation is in progress
-            // Outbuf is: <<0:32>>
-            RETURN_INT(0, outbuf);
+            // Outbuf is: <<Rc:32>>
+            RETURN_INT(rc, outbuf);
         }
         else
         {
@@ -1012,6 +1249,49 @@ static int bdberl_drv_control(ErlDrvData handle, unsigned int cmd,
         // Outbuf is: <<0:32>>
         RETURN_INT(0, outbuf);
     }
+    case CMD_DB_COUNTERS:
+    {
+        FAIL_IF_ASYNC_PENDING(d, outbuf);
+
+        // Inbuf is: <<DbRef:32>> -- DbRef of -1 reports all open databases
+        do_sync_db_counters(d, UNPACK_INT(inbuf, 0));
+
+        // Outbuf is: <<0:32>>
+        RETURN_INT(0, outbuf);
+    }
+    case CMD_LATENCY_STATS:
+    {
+        FAIL_IF_ASYNC_PENDING(d, outbuf);
+
+        // Inbuf is: <<Flags:32>>
+        do_sync_latency_stats(d, UNPACK_INT(inbuf, 0));
+
+        // Outbuf is: <<0:32>>
+        RETURN_INT(0, outbuf);
+    }
+    case CMD_TRACE_DUMP:
+    {
+        // Outbuf is the dump described in bdberl_trace.h
+        BinHelper bh;
+        bdberl_trace_dump(&bh);
+        RETURN_BH(bh, outbuf);
+    }
+    case CMD_SAMPLES:
+    {
+        // Inbuf is: <<MaxSamples:32>> -- 0 for everything in the ring
+        // Outbuf is the series described in bdberl_sampler.h
+        BinHelper bh;
+        bdberl_sampler_series(&bh, UNPACK_INT(inbuf, 0));
+        RETURN_BH(bh, outbuf);
+    }
+    case CMD_CAPTURE:
+    {
+        // Inbuf is: <<Enable:32, Path/bytes, 0:8>> -- the path is ignored when disabling.
+        // The capture writer opens or closes the file and replies.
+        bdberl_capture_request(UNPACK_INT(inbuf, 0) ? UNPACK_STRING(inbuf, 4) : NULL,
+                               d->port, d->port_owner);
+        RETURN_INT(0, outbuf);
+    }
     }
     *outbuf = 0;
     return 0;
@@ -1093,137 +1373,725 @@ DB* bdberl_lookup_dbref(int dbref)
     return G_DATABASES[dbref].db;
 }
 
-void bdberl_general_tpool_run(TPoolJobFunc main_fn, PortData* d, TPoolJobFunc cancel_fn,
-    TPoolJob** job_ptr)
+Database* bdberl_lookup_database(int dbref)
+{
+    assert(G_DATABASES != NULL);
+    assert(dbref >= 0);
+    assert(dbref < G_DATABASES_SIZE);
+    assert(G_DATABASES[dbref].db != NULL);
+    return &G_DATABASES[dbref];
+}
+
+// Map an async command onto the admission class it is counted against
+static unsigned int async_op_class(int op)
+{
+    switch(op)
+    {
+    case CMD_GET:
+    case CMD_CURSOR_GET:
+    case CMD_CURSOR_CURR:
+    case CMD_CURSOR_NEXT:
+    case CMD_CURSOR_PREV:
+    case CMD_CURSOR_COUNT:
+        return TPOOL_CLASS_READ;
+    case CMD_PUT:
+    case CMD_PUT_COMMIT:
+    case CMD_DEL:
+    case CMD_CURSOR_PUT:
+    case CMD_CURSOR_DEL:
+    case CMD_TRUNCATE:
+        return TPOOL_CLASS_WRITE;
+    case CMD_TXN_BEGIN:
+        return TPOOL_CLASS_TXN;
+    case CMD_TXN_COMMIT:
+    case CMD_TXN_ABORT:
+        return TPOOL_CLASS_TXN_END;
+    default:
+        return TPOOL_CLASS_STAT;
+    }
+}
+
+// Map an async command onto the latency histogram it is recorded against
+static unsigned int async_op_tag(int op)
+{
+    switch(op)
+    {
+    case CMD_GET:          return LATENCY_GET;
+    case CMD_PUT:          return LATENCY_PUT;
+    case CMD_PUT_COMMIT:   return LATENCY_PUT_COMMIT;
+    case CMD_DEL:          return LATENCY_DEL;
+    case CMD_TXN_BEGIN:    return LATENCY_TXN_BEGIN;
+    case CMD_TXN_COMMIT:   return LATENCY_TXN_COMMIT;
+    case CMD_TXN_ABORT:    return LATENCY_TXN_ABORT;
+    case CMD_CURSOR_CURR:  return LATENCY_CURSOR_CURR;
+    case CMD_CURSOR_NEXT:  return LATENCY_CURSOR_NEXT;
+    case CMD_CURSOR_PREV:  return LATENCY_CURSOR_PREV;
+    case CMD_CURSOR_GET:   return LATENCY_CURSOR_GET;
+    case CMD_CURSOR_PUT:   return LATENCY_CURSOR_PUT;
+    case CMD_CURSOR_DEL:   return LATENCY_CURSOR_DEL;
+    case CMD_CURSOR_COUNT: return LATENCY_CURSOR_COUNT;
+    case CMD_TRUNCATE:     return LATENCY_TRUNCATE;
+    default:               return LATENCY_STAT;
+    }
+}
+
+// Schedule the port's pending async_op on a pool. If the pool refuses the job the port is
+// released again and ERROR_OVERLOADED is returned for the caller to hand back synchronously.
+static int tpool_run(TPool* tpool, TPoolJobFunc main_fn, PortData* d, TPoolJob** job_ptr)
 {
-    d->async_pool = G_TPOOL_GENERAL;
-    bdberl_tpool_run(d->async_pool, main_fn, d, NULL, job_ptr);
+    d->async_pool = tpool;
+    int rc = bdberl_tpool_run(tpool, async_op_class(d->async_op), async_op_tag(d->async_op),
+                              main_fn, d, NULL, job_ptr);
+    if (rc != 0)
+    {
+        DBG("threadid %p port %p: refused op %d - %s\n", erl_drv_thread_self(), d->port,
+            d->async_op, bdberl_rc_to_atom_str(rc));
+
+        // The job never ran, so there is no async__entry for an async__exit to pair with
+        release_async(d);
+    }
+    return rc;
 }
 
-void bdberl_txn_tpool_run(TPoolJobFunc main_fn, PortData* d, TPoolJobFunc cancel_fn,
+int bdberl_general_tpool_run(TPoolJobFunc main_fn, PortData* d, TPoolJobFunc cancel_fn,
     TPoolJob** job_ptr)
 {
-    d->async_pool = G_TPOOL_TXNS;
-    bdberl_tpool_run(d->async_pool, main_fn, d, NULL, job_ptr);
+    return tpool_run(G_TPOOL_GENERAL, main_fn, d, job_ptr);
 }
 
-static int open_database(const char* name, DBTYPE type, unsigned int flags, PortData* data, int* dbref_res)
+int bdberl_txn_tpool_run(TPoolJobFunc main_fn, PortData* d, TPoolJobFunc cancel_fn,
+    TPoolJob** job_ptr)
 {
-    *dbref_res = -1;
+    return tpool_run(G_TPOOL_TXNS, main_fn, d, job_ptr);
+}
 
-    LOCK_DATABASES(data->port);
+// Options follow the name in CMD_OPEN_DB as << Tag:8, Len:8, Value:Len/bytes >>
+static int parse_db_options(char* inbuf, int inbuf_sz, int offset, DbOptions* options)
+{
+    memset(options, '\0', sizeof(DbOptions));
+    options->checksum = VALUE_CHECKSUM_CRC32;
+    options->verify = VERIFY_DRIVER;
 
-    // Look up the database by name in our hash table
-    Database* database = (Database*)hive_hash_get(G_DATABASES_NAMES, name);
-    if (database)
+    while (offset < inbuf_sz)
     {
-        // Convert the database pointer into a dbref
-        int dbref = database - G_DATABASES;
-
-        // Great, the database was previously opened by someone else. Add it to our
-        // list of refs, and if it's a new addition also register this port with the
-        // Database structure in G_DATABASES
-        if (add_dbref(data, dbref))
+        if (offset + 2 > inbuf_sz)
         {
-            // Add a reference to this port
-            add_portref(dbref, data->port);
-
-            // Release RW lock and return the ref
-            UNLOCK_DATABASES(data->port);
-            *dbref_res = dbref;
-            return 0;
+            return ERROR_INVALID_OPTION;
         }
-        else
+        unsigned char tag = UNPACK_BYTE(inbuf, offset);
+        unsigned int len = UNPACK_BYTE(inbuf, offset + 1);
+        offset += 2;
+        if (len == DB_OPTION_LEN_EXT)
         {
-            // Already in our list of opened databases -- unlock and return the reference
-            UNLOCK_DATABASES(data->port);
-            *dbref_res = dbref;
-            return 0;
+            if (offset + 4 > inbuf_sz)
+            {
+                return ERROR_INVALID_OPTION;
+            }
+            len = UNPACK_INT(inbuf, offset);
+            offset += 4;
         }
-    }
-    else
-    {
-        // Database hasn't been created while we were waiting on write lock, so
-        // create/open it
-
-        // Find the first available slot in G_DATABASES; the index will be our
-        // reference for database operations
-        int dbref = alloc_dbref();
-        if (dbref < 0)
+        unsigned char* value = (unsigned char*)inbuf + offset;
+        if (len > (unsigned int)(inbuf_sz - offset))
         {
-            // No more slots available
-            UNLOCK_DATABASES(data->port);
-            return ERROR_MAX_DBS;
+            return ERROR_INVALID_OPTION;
         }
 
-        // Create the DB handle
-        DB* db = NULL;
-        DBGCMD(data, "db_create(&db, %p, 0);\n", G_DB_ENV);
-        int rc = db_create(&db, G_DB_ENV, 0);
-        DBGCMD(data, " = %s (%d) db = %p\n", rc == 0 ? "ok" : bdberl_rc_to_atom_str(rc), rc, db);
-        if (rc != 0)
+        switch (tag)
         {
-            // Failure while creating the database handle -- drop our lock and return
-            // the code
-            UNLOCK_DATABASES(data->port);
-            return rc;
-        }
-
-        // If a custom page size has been specified, try to use it
-        if (G_PAGE_SIZE > 0)
+        case DB_OPTION_CHECKSUM:
+            if (len != 1 || value[0] > VALUE_CHECKSUM_MAX)
+            {
+                return ERROR_INVALID_OPTION;
+            }
+            options->checksum = value[0];
+            break;
+        case DB_OPTION_VERIFY:
+            if (len != 1 || value[0] > VERIFY_END_TO_END)
+            {
+                return ERROR_INVALID_OPTION;
+            }
+            options->verify = value[0];
+            break;
+        case DB_OPTION_FORMAT:
+            if (len != 1 || value[0] > FORMAT_RAW)
+            {
+                return ERROR_INVALID_OPTION;
+            }
+            options->format = value[0];
+            break;
+        case DB_OPTION_COMPRESS:
+            if (len != 1 || value[0] > COMPRESS_LZ)
+            {
+                return ERROR_INVALID_OPTION;
+            }
+            options->compress = value[0];
+            break;
+        case DB_OPTION_DICT:
+            options->dict_data = value;
+            options->dict_size = len;
+            break;
+        case DB_OPTION_BT_COMPRESS:
+            if (len != 1)
+            {
+                return ERROR_INVALID_OPTION;
+            }
+            options->bt_compress = value[0] != 0;
+            break;
+        case DB_OPTION_PAGE_SIZE:
+        case DB_OPTION_BT_MINKEY:
+        case DB_OPTION_H_FFACTOR:
+        case DB_OPTION_H_NELEM:
+        case DB_OPTION_RE_LEN:
         {
-            if (db->set_pagesize(db, G_PAGE_SIZE) != 0)
+            if (len != 4)
             {
-                bdb_errcall(G_DB_ENV, "\n", "Failed to set page size.");
+                return ERROR_INVALID_OPTION;
+            }
+            unsigned int n = UNPACK_INT(value, 0);
+            switch (tag)
+            {
+            case DB_OPTION_PAGE_SIZE: options->page_size = n; break;
+            case DB_OPTION_BT_MINKEY: options->bt_minkey = n; break;
+            case DB_OPTION_H_FFACTOR: options->h_ffactor = n; break;
+            case DB_OPTION_H_NELEM:   options->h_nelem = n; break;
+            default:                  options->re_len = n; break;
             }
+            break;
         }
-
-        flags |= DB_AUTO_COMMIT;
-
-        // Attempt to open our database
-        DBGCMD(data, "db->open(%p, 0, '%s', 0, %x, %08x, 0);\n", db, name, type, flags);
-        rc = db->open(db, 0, name, 0, type, flags, 0);
-        DBGCMDRC(data, rc);
-        if (rc != 0)
-        {
-            // Failure while opening the database -- cleanup the handle, drop the lock
-            // and return
-            db->close(db, 0);
-            UNLOCK_DATABASES(data->port);
-            return rc;
+        case DB_OPTION_DUP:
+            if (len != 1 || value[0] > DUP_SORTED)
+            {
+                return ERROR_INVALID_OPTION;
+            }
+            options->dup = value[0];
+            break;
+        case DB_OPTION_KEY_ORDER:
+            if (len != 1 || value[0] > KEY_ORDER_TERM)
+            {
+                return ERROR_INVALID_OPTION;
+            }
+            options->key_order = value[0];
+            break;
+        case DB_OPTION_KEY_CODEC:
+            if (len != 1 || value[0] > KEY_CODEC_ORDERED)
+            {
+                return ERROR_INVALID_OPTION;
+            }
+            options->key_codec = value[0];
+            break;
+        case DB_OPTION_H_HASH:
+            if (len != 1 || value[0] > H_HASH_XXH64)
+            {
+                return ERROR_INVALID_OPTION;
+            }
+            options->h_hash = value[0];
+            break;
+        case DB_OPTION_VALUE_CACHE:
+            if (len != 4)
+            {
+                return ERROR_INVALID_OPTION;
+            }
+            options->cache_size = UNPACK_INT(value, 0);
+            break;
+        case DB_OPTION_KEY_FILTER:
+            if (len != 4)
+            {
+                return ERROR_INVALID_OPTION;
+            }
+            options->filter_capacity = UNPACK_INT(value, 0);
+            break;
+        default:
+            return ERROR_INVALID_OPTION;
         }
+        offset += len;
+    }
 
-        // Database is open. Store all the data into the allocated ref
-        assert(db != NULL);
-        G_DATABASES[dbref].db = db;
-        G_DATABASES[dbref].name = strdup(name);
-        G_DATABASES[dbref].ports = driver_calloc(sizeof(PortList));
-        G_DATABASES[dbref].ports->port = data->port;
-
-        // Make entry in hash table of names
-        hive_hash_add(G_DATABASES_NAMES, G_DATABASES[dbref].name, &(G_DATABASES[dbref]));
-
-        // Drop the write lock
-        UNLOCK_DATABASES(data->port);
-
-        // Add the dbref to the port list
-        add_dbref(data, dbref);
-        *dbref_res = dbref;
-        return 0;
+    // Raw values may have no header to flag compression in, and raw keys are not terms.
+    // Encoded keys already sort in term order and are not ext terms for the comparator.
+    if ((options->compress != COMPRESS_NONE || options->key_order == KEY_ORDER_TERM ||
+         options->key_codec == KEY_CODEC_ORDERED) && options->format == FORMAT_RAW)
+    {
+        return ERROR_INVALID_OPTION;
+    }
+    if (options->key_codec == KEY_CODEC_ORDERED && options->key_order == KEY_ORDER_TERM)
+    {
+        return ERROR_INVALID_OPTION;
     }
+    return 0;
 }
 
-static int close_database(int dbref, unsigned flags, PortData* data)
+// Physical layout of a new database handle, set before DB->open. Most of these only take
+// effect when the database is created and are read back from the file afterwards; BDB
+// rejects those that don't suit the access method with EINVAL.
+static int configure_database(DB* db, DBTYPE type, DbOptions* options)
 {
-    // Remove this database from our list
-    if (del_dbref(data, dbref))
+    int rc = 0;
+    if (options->page_size > 0)
     {
-        // Something was actually deleted from our list -- now we need to disassociate the
-        // calling port with the global database structure.
-        LOCK_DATABASES(data->port);
-
-        assert(G_DATABASES[dbref].db != 0);
-        assert(G_DATABASES[dbref].ports != 0);
+        rc = db->set_pagesize(db, options->page_size);
+    }
+    if (rc == 0 && options->bt_minkey > 0)
+    {
+        rc = db->set_bt_minkey(db, options->bt_minkey);
+    }
+    if (rc == 0 && options->h_ffactor > 0)
+    {
+        rc = db->set_h_ffactor(db, options->h_ffactor);
+    }
+    if (rc == 0 && options->h_nelem > 0)
+    {
+        rc = db->set_h_nelem(db, options->h_nelem);
+    }
+    if (rc == 0 && options->re_len > 0)
+    {
+        rc = db->set_re_len(db, options->re_len);
+    }
+    if (rc == 0 && options->dup != DUP_NONE)
+    {
+        rc = db->set_flags(db, options->dup == DUP_SORTED ? DB_DUPSORT : DB_DUP);
+    }
+
+    // Prefix and delta compression of btree pages; only btrees have it, and it is
+    // recorded in the database when it is created
+    if (rc == 0 && options->bt_compress)
+    {
+        rc = type == DB_BTREE ? db->set_bt_compress(db, NULL, NULL) : ERROR_INVALID_OPTION;
+    }
+
+    if (rc == 0 && options->key_order == KEY_ORDER_TERM)
+    {
+        rc = type == DB_BTREE ? db->set_bt_compare(db, &term_order_compare) : ERROR_INVALID_OPTION;
+    }
+
+    if (rc == 0 && options->h_hash == H_HASH_XXH64)
+    {
+        rc = type == DB_HASH ? db->set_h_hash(db, &xxh64_hash) : ERROR_INVALID_OPTION;
+    }
+    return rc;
+}
+
+static int term_order_compare(DB* db, const DBT* a, const DBT* b)
+{
+    return bdberl_term_compare(a->data, a->size, b->data, b->size);
+}
+
+// XXH64 of the key folded to the 32 bits BDB takes the bucket from. It spreads any key set
+// like a random function and reads eight bytes at a time, where FNV-1 goes byte by byte and
+// spreads keys evenly only when they run in sequence.
+static u_int32_t xxh64_hash(DB* db, const void* bytes, u_int32_t length)
+{
+    uint64_t h = bdberl_xxh64((const unsigned char*)bytes, length, 0);
+    return (u_int32_t)(h ^ (h >> 32));
+}
+
+// Queue the scan that fills a newly opened database's key filter; see FilterBuild. If the
+// pool is too busy to take it the database runs without a filter until it is next opened.
+static void start_filter_build(DB* db, DbOptions* options)
+{
+    FilterBuild* build = driver_calloc(sizeof(FilterBuild));
+    build->lock = erl_drv_mutex_create("bdberl_filter_build_lock");
+    build->state_cv = erl_drv_cond_create("bdberl_filter_build_cv");
+    build->db = db;
+    build->options = options;
+    build->state = FILTER_BUILD_QUEUED;
+    options->filter_build = build;
+
+    TPoolJob* job = NULL;
+    if (bdberl_tpool_run(G_TPOOL_GENERAL, TPOOL_CLASS_STAT, LATENCY_STAT,
+                         &do_build_key_filter, build, NULL, &job) != 0)
+    {
+        bdb_errcall(G_DB_ENV, "\n", "Key filter build refused; the database runs unfiltered.");
+        options->filter_build = NULL;
+        free_filter_build(build);
+    }
+}
+
+// Build a key filter from the keys on disk and the puts logged while reading them, sized
+// for the capacity asked for or twice the keys found, whichever is more, so a full
+// database still has room to grow.
+static void do_build_key_filter(void* arg)
+{
+    FilterBuild* build = (FilterBuild*)arg;
+
+    // A close that got in first left the build for us to free
+    erl_drv_mutex_lock(build->lock);
+    while (build->paused > 0 && !build->canceled)
+    {
+        erl_drv_cond_wait(build->state_cv, build->lock);
+    }
+    if (build->canceled)
+    {
+        erl_drv_mutex_unlock(build->lock);
+        free_filter_build(build);
+        return;
+    }
+    build->state = FILTER_BUILD_RUNNING;
+    erl_drv_mutex_unlock(build->lock);
+
+    uint64_t* hashes = NULL;
+    unsigned int count = 0;
+    int rc = scan_key_hashes(build, &hashes, &count);
+
+    erl_drv_mutex_lock(build->lock);
+    if (rc == 0 && !build->canceled)
+    {
+        uint64_t capacity = ((uint64_t)count + build->pending_count) * 2;
+        if (capacity < build->options->filter_capacity)
+        {
+            capacity = build->options->filter_capacity;
+        }
+        KeyFilter* filter = bdberl_filter_create(capacity);
+        unsigned int i;
+        for (i = 0; i < count; i++)
+        {
+            bdberl_filter_add(filter, hashes[i]);
+        }
+        for (i = 0; i < build->pending_count; i++)
+        {
+            bdberl_filter_add(filter, build->pending[i]);
+        }
+
+        // Counters before the pointer, so no get finds the filter half filled
+        __sync_synchronize();
+        build->options->filter = filter;
+    }
+    else if (rc != 0)
+    {
+        DBG("key filter scan failed - %s (%d)\n", bdberl_rc_to_atom_str(rc), rc);
+    }
+    if (build->pending)
+    {
+        driver_free(build->pending);
+        build->pending = NULL;
+    }
+    build->pending_count = 0;
+    build->state = FILTER_BUILD_DONE;
+    erl_drv_cond_broadcast(build->state_cv);
+    erl_drv_mutex_unlock(build->lock);
+
+    if (hashes)
+    {
+        driver_free(hashes);
+    }
+}
+
+// Hash the keys of a database, leaving the values on their pages. The scan reads in a
+// transaction that never waits on a lock, so a writer holding a page can't stall it, and
+// with it a close waiting on the build. On a lock conflict it backs off and carries on from
+// the last key it read in a btree, or starts over in the other layouts, which can't seek to
+// a key; after FILTER_SCAN_RETRIES conflicts without a key read between them it gives up.
+static int scan_key_hashes(FilterBuild* build, uint64_t** hashes_res, unsigned int* count_res)
+{
+    DBTYPE type;
+    int resume = build->db->get_type(build->db, &type) == 0 && type == DB_BTREE;
+
+    DBT key, value;
+    memset(&key, '\0', sizeof(DBT));
+    memset(&value, '\0', sizeof(DBT));
+    key.flags = DB_DBT_REALLOC;
+    value.flags = DB_DBT_PARTIAL;
+
+    // Copy of the last key read, where a resumed scan picks up
+    char* last = NULL;
+    unsigned int last_size = 0;
+    unsigned int last_room = 0;
+
+    uint64_t* hashes = NULL;
+    unsigned int count = 0;
+    unsigned int size = 0;
+    unsigned int retries = 0;
+    int rc;
+    do
+    {
+        if (!resume)
+        {
+            count = 0;
+        }
+        DB_TXN* txn = NULL;
+        DBC* cursor = NULL;
+        rc = G_DB_ENV->txn_begin(G_DB_ENV, NULL, &txn, DB_READ_COMMITTED | DB_TXN_NOWAIT);
+        if (rc == 0)
+        {
+            rc = build->db->cursor(build->db, txn, &cursor, 0);
+        }
+
+        // Seek back to the last key read; it was hashed already if it is still there
+        int unread = 0;
+        if (rc == 0 && resume && count > 0)
+        {
+            key.data = driver_realloc(key.data, last_size);
+            memcpy(key.data, last, last_size);
+            key.size = last_size;
+            rc = cursor->get(cursor, &key, &value, DB_SET_RANGE);
+            unread = rc == 0 &&
+                (key.size != last_size || memcmp(key.data, last, last_size) != 0);
+        }
+
+        while (rc == 0 && !build->canceled &&
+               (unread || (rc = cursor->get(cursor, &key, &value, DB_NEXT_NODUP)) == 0))
+        {
+            unread = 0;
+            if (count == size)
+            {
+                size = size ? size * 2 : 1024;
+                hashes = driver_realloc(hashes, sizeof(uint64_t) * size);
+            }
+            hashes[count++] = bdberl_filter_hash(key.data, key.size);
+            if (resume)
+            {
+                if (key.size > last_room)
+                {
+                    last_room = key.size;
+                    last = driver_realloc(last, last_room);
+                }
+                memcpy(last, key.data, key.size);
+                last_size = key.size;
+                retries = 0;
+            }
+        }
+        if (cursor)
+        {
+            cursor->close(cursor);
+        }
+        if (txn)
+        {
+            txn->abort(txn);
+        }
+    } while ((rc == DB_LOCK_DEADLOCK || rc == DB_LOCK_NOTGRANTED) && !build->canceled &&
+             ++retries < FILTER_SCAN_RETRIES && util_thread_usleep(1000) == 0);
+
+    if (key.data)
+    {
+        driver_free(key.data);
+    }
+    if (last)
+    {
+        driver_free(last);
+    }
+    *hashes_res = hashes;
+    *count_res = count;
+    return rc == DB_NOTFOUND ? 0 : rc;
+}
+
+// Stop a database's key filter build ahead of closing it. A build still queued is left for
+// its job to free; a running one stops at its next key, and the close waits for that.
+static void cancel_filter_build(DbOptions* options)
+{
+    FilterBuild* build = options->filter_build;
+    if (build == NULL)
+    {
+        return;
+    }
+    options->filter_build = NULL;
+
+    erl_drv_mutex_lock(build->lock);
+    build->canceled = 1;
+    if (build->state == FILTER_BUILD_QUEUED)
+    {
+        erl_drv_cond_broadcast(build->state_cv);
+        erl_drv_mutex_unlock(build->lock);
+        return;
+    }
+    while (build->state == FILTER_BUILD_RUNNING)
+    {
+        erl_drv_cond_wait(build->state_cv, build->lock);
+    }
+    erl_drv_mutex_unlock(build->lock);
+    free_filter_build(build);
+}
+
+// Keep a database's key filter scan from running across a truncate, waiting for one under
+// way to finish. Puts logged meanwhile are still added, so the filter misses none of them.
+static void pause_filter_build(DbOptions* options)
+{
+    FilterBuild* build = options->filter_build;
+    if (build == NULL)
+    {
+        return;
+    }
+
+    erl_drv_mutex_lock(build->lock);
+    while (build->state == FILTER_BUILD_RUNNING)
+    {
+        erl_drv_cond_wait(build->state_cv, build->lock);
+    }
+    build->paused++;
+    erl_drv_mutex_unlock(build->lock);
+}
+
+static void resume_filter_build(DbOptions* options)
+{
+    FilterBuild* build = options->filter_build;
+    if (build == NULL)
+    {
+        return;
+    }
+
+    erl_drv_mutex_lock(build->lock);
+    build->paused--;
+    erl_drv_cond_broadcast(build->state_cv);
+    erl_drv_mutex_unlock(build->lock);
+}
+
+static void free_filter_build(FilterBuild* build)
+{
+    if (build == NULL)
+    {
+        return;
+    }
+    if (build->pending)
+    {
+        driver_free(build->pending);
+    }
+    erl_drv_cond_destroy(build->state_cv);
+    erl_drv_mutex_destroy(build->lock);
+    driver_free(build);
+}
+
+static int open_database(const char* name, DBTYPE type, unsigned int flags, DbOptions* options,
+                         PortData* data, int* dbref_res)
+{
+    *dbref_res = -1;
+
+    LOCK_DATABASES(data->port);
+
+    // Look up the database by name in our hash table
+    Database* database = (Database*)hive_hash_get(G_DATABASES_NAMES, name);
+    if (database)
+    {
+        // Convert the database pointer into a dbref
+        int dbref = database - G_DATABASES;
+
+        // Great, the database was previously opened by someone else. Add it to our
+        // list of refs, and if it's a new addition also register this port with the
+        // Database structure in G_DATABASES
+        if (add_dbref(data, dbref))
+        {
+            // Add a reference to this port
+            add_portref(dbref, data->port);
+
+            // Release RW lock and return the ref
+            UNLOCK_DATABASES(data->port);
+            *dbref_res = dbref;
+            return 0;
+        }
+        else
+        {
+            // Already in our list of opened databases -- unlock and return the reference
+            UNLOCK_DATABASES(data->port);
+            *dbref_res = dbref;
+            return 0;
+        }
+    }
+    else
+    {
+        // Database hasn't been created while we were waiting on write lock, so
+        // create/open it
+
+        // Find the first available slot in G_DATABASES; the index will be our
+        // reference for database operations
+        int dbref = alloc_dbref();
+        if (dbref < 0)
+        {
+            // No more slots available
+            UNLOCK_DATABASES(data->port);
+            return ERROR_MAX_DBS;
+        }
+
+        // Create the DB handle
+        DB* db = NULL;
+        DBGCMD(data, "db_create(&db, %p, 0);\n", G_DB_ENV);
+        int rc = db_create(&db, G_DB_ENV, 0);
+        DBGCMD(data, " = %s (%d) db = %p\n", rc == 0 ? "ok" : bdberl_rc_to_atom_str(rc), rc, db);
+        if (rc != 0)
+        {
+            // Failure while creating the database handle -- drop our lock and return
+            // the code
+            UNLOCK_DATABASES(data->port);
+            return rc;
+        }
+
+        // If a custom page size has been specified, try to use it
+        if (G_PAGE_SIZE > 0 && options->page_size == 0)
+        {
+            if (db->set_pagesize(db, G_PAGE_SIZE) != 0)
+            {
+                bdb_errcall(G_DB_ENV, "\n", "Failed to set page size.");
+            }
+        }
+
+        // Apply the layout asked for at open; a bad value fails the open
+        rc = configure_database(db, type, options);
+        if (rc != 0)
+        {
+            db->close(db, 0);
+            UNLOCK_DATABASES(data->port);
+            return rc;
+        }
+
+        flags |= DB_AUTO_COMMIT;
+
+        // Attempt to open our database
+        DBGCMD(data, "db->open(%p, 0, '%s', 0, %x, %08x, 0);\n", db, name, type, flags);
+        rc = db->open(db, 0, name, 0, type, flags, 0);
+        DBGCMDRC(data, rc);
+        if (rc != 0)
+        {
+            // Failure while opening the database -- cleanup the handle, drop the lock
+            // and return
+            db->close(db, 0);
+            UNLOCK_DATABASES(data->port);
+            return rc;
+        }
+
+        // Database is open. Store all the data into the allocated ref
+        assert(db != NULL);
+        G_DATABASES[dbref].db = db;
+        G_DATABASES[dbref].name = strdup(name);
+        G_DATABASES[dbref].ports = driver_calloc(sizeof(PortList));
+        G_DATABASES[dbref].ports->port = data->port;
+        G_DATABASES[dbref].options = *options;
+        G_DATABASES[dbref].options.dict_data = NULL;
+        if (options->compress == COMPRESS_LZ)
+        {
+            G_DATABASES[dbref].options.dict = bdberl_lz_dict_create(options->dict_data,
+                                                                    options->dict_size);
+        }
+        if (options->cache_size > 0)
+        {
+            G_DATABASES[dbref].options.cache = bdberl_cache_create(options->cache_size);
+        }
+        G_DATABASES[dbref].options.filter = NULL;
+        G_DATABASES[dbref].options.filter_build = NULL;
+        if (options->filter_capacity > 0)
+        {
+            start_filter_build(db, &(G_DATABASES[dbref].options));
+        }
+
+        // Make entry in hash table of names
+        hive_hash_add(G_DATABASES_NAMES, G_DATABASES[dbref].name, &(G_DATABASES[dbref]));
+
+        // Drop the write lock
+        UNLOCK_DATABASES(data->port);
+
+        // Add the dbref to the port list
+        add_dbref(data, dbref);
+        *dbref_res = dbref;
+        return 0;
+    }
+}
+
+static int close_database(int dbref, unsigned flags, PortData* data)
+{
+    // Remove this database from our list
+    if (del_dbref(data, dbref))
+    {
+        // Something was actually deleted from our list -- now we need to disassociate the
+        // calling port with the global database structure.
+        LOCK_DATABASES(data->port);
+
+        assert(G_DATABASES[dbref].db != 0);
+        assert(G_DATABASES[dbref].ports != 0);
 
         // Now disassociate this port from the database's port list
         assert(del_portref(dbref, data->port) == 1);
@@ -1234,6 +2102,9 @@ static int close_database(int dbref, unsigned flags, PortData* data)
         int rc = ERROR_NONE;
         if (database->ports == 0)
         {
+            // The key filter scan reads through the handle, so it has to stop first
+            cancel_filter_build(&(database->options));
+
             // Close out the BDB handle
             DBGCMD(data, "database->db->close(%p, %08x) (for dbref %d)\n", database->db, flags, dbref);
             rc = database->db->close(database->db, flags);
@@ -1242,6 +2113,9 @@ static int close_database(int dbref, unsigned flags, PortData* data)
             // Remove the entry from the names map
             hive_hash_remove(G_DATABASES_NAMES, database->name);
             free((char*)database->name);
+            bdberl_lz_dict_free(database->options.dict);
+            bdberl_cache_free(database->options.cache);
+            bdberl_filter_free(database->options.filter);
 
             // Zero out the whole record
             memset(database, '\0', sizeof(Database));
@@ -1277,10 +2151,19 @@ static void check_all_databases_closed()
 
         if (database->db != NULL)
         {
+            // The pools have stopped, so no key filter build is running or ever will
             int flags = 0;
             DBG("final db->close(%p, %08x) (for dbref %d)", database->db, flags, dbref);
             rc = database->db->close(database->db, flags);
             DBG(" = %s (%d)\n", rc == 0 ? "ok" : bdberl_rc_to_atom_str(rc), rc);
+            bdberl_lz_dict_free(database->options.dict);
+            database->options.dict = NULL;
+            bdberl_cache_free(database->options.cache);
+            database->options.cache = NULL;
+            bdberl_filter_free(database->options.filter);
+            database->options.filter = NULL;
+            free_filter_build(database->options.filter_build);
+            database->options.filter_build = NULL;
         }
     }
 
@@ -1298,6 +2181,7 @@ static void abort_txn(PortData* d)
         DBGCMDRC(d, rc);
         d->txn = NULL;
     }
+    d->txn_writes_count = 0;
 }
 
 static int delete_database(const char* name, PortData *data)
@@ -1380,12 +2264,28 @@ static void get_info(int target, void* values, BinHelper* bh)
         bin_helper_push_string(bh, dir); // Will convert NULL pointer to "<null>"
         break;
     }
+    case SYSP_TPOOL_LOAD_GET:
+    {
+        // Outbuf is: <<0:32, GeneralLoad/binary, TxnLoad/binary>> -- see bdberl_tpool_load
+        bin_helper_init(bh);
+        bin_helper_push_int32(bh, 0);
+        bdberl_tpool_load(G_TPOOL_GENERAL, bh);
+        bdberl_tpool_load(G_TPOOL_TXNS, bh);
+        break;
+    }
     }
 }
 
+// Called by the do_async_* workers when they are done, pairing the async__entry they fired
 void bdberl_async_cleanup(PortData* d)
 {
-    // Release the port for another operation
+    BDBERL_PROBE2(async__exit, d->port, d->async_op);
+    release_async(d);
+}
+
+// Release the port for another operation
+static void release_async(PortData* d)
+{
     d->work_buffer_offset = 0;
     erl_drv_mutex_lock(d->port_lock);
     d->async_dbref = -1;
@@ -1409,33 +2309,9 @@ char *bdberl_rc_to_atom_str(int rc)
     {
         switch (rc)
         {
-            // bdberl driver errors
-            case ERROR_MAX_DBS:       return "max_dbs";
-            case ERROR_ASYNC_PENDING: return "async_pending";
-            case ERROR_INVALID_DBREF: return "invalid_db";
-            case ERROR_TXN_OPEN:      return "transaction_open";
-            case ERROR_NO_TXN:        return "no_txn";
-            case ERROR_CURSOR_OPEN:   return "cursor_open";
-            case ERROR_NO_CURSOR:     return "no_cursor";
-            case ERROR_DB_ACTIVE:     return "db_active";
-            case ERROR_INVALID_CMD:   return "invalid_cmd";
-            case ERROR_INVALID_DB_TYPE: return "invalid_db_type";
-            case ERROR_INVALID_VALUE: return "invalid_value";
-            // bonafide BDB errors
-            case DB_BUFFER_SMALL:     return "buffer_small";
-            case DB_DONOTINDEX:       return "do_not_index";
-            case DB_FOREIGN_CONFLICT: return "foreign_conflict";
-            case DB_KEYEMPTY:         return "key_empty";
-            case DB_KEYEXIST:         return "key_exist";
-            case DB_LOCK_DEADLOCK:    return "deadlock";
-            case DB_LOCK_NOTGRANTED:  return "lock_not_granted";
-            case DB_LOG_BUFFER_FULL:  return "log_buffer_full";
-            case DB_NOTFOUND:         return "not_found";
-            case DB_OLD_VERSION:      return "old_version";
-            case DB_PAGE_NOTFOUND:    return "page_not_found";
-            case DB_RUNRECOVERY:      return "run_recovery";
-            case DB_VERIFY_BAD:       return "verify_bad";
-            case DB_VERSION_MISMATCH: return "version_mismatch";
+#define RC_ATOM_STR(code, name) case code: return #name;
+            BDBERL_RC_ATOMS(RC_ATOM_STR)
+#undef RC_ATOM_STR
             default:                  return NULL;
         }
     }
@@ -1474,7 +2350,7 @@ static int send_dir_info(ErlDrvPort port, ErlDrvTermData pid, const char *path)
         unsigned int mbyte_avail = (unsigned int) (svfs.f_bavail / blocks_per_mbyte);
         int path_len = strlen(path);
 
-        ErlDrvTermData response[] = { ERL_DRV_ATOM,  driver_mk_atom("dirinfo"),
+        ErlDrvTermData response[] = { ERL_DRV_ATOM,  ATOM(dirinfo),
                                       ERL_DRV_STRING, (ErlDrvTermData) path, path_len,
                                       // send fsid as a binary as will only be used
                                       // to compare which physical filesystem is on
@@ -1492,18 +2368,18 @@ static int send_dir_info(ErlDrvPort port, ErlDrvTermData pid, const char *path)
 static void send_error_response(ErlDrvPort port, ErlDrvTermData pid, int rc)
 {
     // See if this is a standard errno that we have an erlang code for
-    char *error = bdberl_rc_to_atom_str(rc);
-    if (error != NULL)
+    ErlDrvTermData error = bdberl_rc_to_atom(rc);
+    if (error != 0)
     {
-        ErlDrvTermData response[] = { ERL_DRV_ATOM,  driver_mk_atom("error"),
-                                      ERL_DRV_ATOM,  driver_mk_atom(error),
+        ErlDrvTermData response[] = { ERL_DRV_ATOM,  ATOM(error),
+                                      ERL_DRV_ATOM,  error,
                                       ERL_DRV_TUPLE, 2};
         driver_send_term(port, pid, response, sizeof(response) / sizeof(response[0]));
     }
     else
     {
-        ErlDrvTermData response[] = { ERL_DRV_ATOM, driver_mk_atom("error"),
-                                      ERL_DRV_ATOM, driver_mk_atom("unknown"),
+        ErlDrvTermData response[] = { ERL_DRV_ATOM, ATOM(error),
+                                      ERL_DRV_ATOM, ATOM(unknown),
                                       ERL_DRV_INT,  rc,
                                       ERL_DRV_TUPLE, 2,
                                       ERL_DRV_TUPLE, 2};
@@ -1519,8 +2395,7 @@ void bdberl_send_rc(ErlDrvPort port, ErlDrvTermData pid, int rc)
     // response code.
     if (rc == 0)
     {
-        ErlDrvTermData response[] = {ERL_DRV_ATOM, driver_mk_atom("ok")};
-        driver_send_term(port, pid, response, sizeof(response) / sizeof(response[0]));
+        driver_send_term(port, pid, G_REPLY_OK, 2);
     }
     else
     {
@@ -1557,7 +2432,7 @@ static void async_cleanup_and_send_uint32(PortData* d, int rc, unsigned int valu
     // Notify port of result
     if (rc == 0)
     {
-        ErlDrvTermData response[] = { ERL_DRV_ATOM, driver_mk_atom("ok"),
+        ErlDrvTermData response[] = { ERL_DRV_ATOM, ATOM(ok),
                                       ERL_DRV_UINT, value,
                                       ERL_DRV_TUPLE, 2};
         driver_send_term(port, pid, response, sizeof(response) / sizeof(response[0]));
@@ -1568,7 +2443,144 @@ static void async_cleanup_and_send_uint32(PortData* d, int rc, unsigned int valu
     }
 }
 
-static void async_cleanup_and_send_kv(PortData* d, int rc, DBT* key, DBT* value)
+// Requests carry BDBERL_OPT_RAW exactly when their database is raw
+static int check_db_format(int dbref, unsigned int options)
+{
+    int raw = (options & BDBERL_OPT_RAW) != 0;
+    return raw == (G_DATABASES[dbref].options.format == FORMAT_RAW) ? 0 : ERROR_FORMAT_MISMATCH;
+}
+
+// Keys of KEY_CODEC_ORDERED databases are stored in the bdberl_key encoding. Swap the
+// term_to_binary key of a request for its encoding; *encoded is the buffer to free after.
+static int encode_request_key(int dbref, DBT* key, unsigned char** encoded)
+{
+    *encoded = NULL;
+    if (G_DATABASES[dbref].options.key_codec != KEY_CODEC_ORDERED)
+    {
+        return 0;
+    }
+    unsigned int size = 0;
+    *encoded = bdberl_key_encode(key->data, key->size, &size);
+    if (*encoded == NULL)
+    {
+        return ERROR_INVALID_KEY;
+    }
+    key->data = *encoded;
+    key->size = size;
+    return 0;
+}
+
+// And back to term_to_binary for a key read from the database
+static int decode_reply_key(int dbref, DBT* key, unsigned char** decoded)
+{
+    *decoded = NULL;
+    if (G_DATABASES[dbref].options.key_codec != KEY_CODEC_ORDERED)
+    {
+        return 0;
+    }
+    unsigned int size = 0;
+    *decoded = bdberl_key_decode(key->data, key->size, &size);
+    if (*decoded == NULL)
+    {
+        return ERROR_INVALID_KEY;
+    }
+    key->data = *decoded;
+    key->size = size;
+    return 0;
+}
+
+// Check a value read from dbref in the layout its database uses and work out the reply:
+// *reply_offset is where the part sent starts (zero when a term database leaves the check
+// to the caller) and raw databases swap BDBERL_OPT_DECODE for BDBERL_OPT_RAW in *options.
+// Compressed values are inflated into a new buffer that replaces value->data; the DBT is
+// left with DB_DBT_MALLOC set so the caller frees it as it frees values BDB allocated.
+static int verify_read_value(int dbref, DBT* value, unsigned int* reply_offset,
+                             unsigned int* options)
+{
+    DbOptions* db_options = &(G_DATABASES[dbref].options);
+    unsigned int payload_offset = 0;
+    int ok;
+    if (db_options->format == FORMAT_RAW)
+    {
+        ok = bdberl_value_verify_raw(value->data, value->size, db_options->checksum,
+                                     &payload_offset);
+        *reply_offset = payload_offset;
+        *options = (*options & ~BDBERL_OPT_DECODE) | BDBERL_OPT_RAW;
+    }
+    else
+    {
+        ok = bdberl_value_verify(value->data, value->size, &payload_offset);
+        if (ok && bdberl_value_is_compressed(value->data, value->size))
+        {
+            unsigned int size = 0;
+            unsigned char* inflated = bdberl_value_inflate(value->data, value->size,
+                                                           db_options->dict, &size);
+            if (inflated == NULL)
+            {
+                return ERROR_INVALID_VALUE;
+            }
+            if (value->flags & DB_DBT_MALLOC)
+            {
+                driver_free(value->data);
+            }
+            value->data = inflated;
+            value->size = size;
+            value->flags |= DB_DBT_MALLOC;
+            payload_offset = VALUE_HEADER_BASE;
+        }
+        *reply_offset = db_options->verify == VERIFY_DRIVER ? payload_offset : 0;
+    }
+    return ok ? 0 : ERROR_INVALID_VALUE;
+}
+
+// Values from raw databases (BDBERL_OPT_RAW in options) are sent as {raw, Key, Value}.
+// Otherwise a verified value has had its checksum checked by the driver; the reply is
+// {verified, Key, Payload} with the checksum prefix or header stripped, or {term, Key, Value}
+// with both decoded when BDBERL_OPT_DECODE is in options. Otherwise the reply is
+// {ok, Key, Value} with the stored value for the caller to check.
+static void send_kv(ErlDrvPort port, ErlDrvTermData pid, int rc, DBT* key,
+                    const char* data, unsigned int size, int verified, unsigned int options)
+{
+    if (rc == 0)
+    {
+#ifdef ERL_DRV_EXT2TERM
+        if (verified && (options & BDBERL_OPT_DECODE))
+        {
+            // Decoded straight into the receiver's heap. The send fails if either binary is
+            // not a valid external term (possible with checksum none); fall through to the
+            // binary reply so the caller gets badarg from binary_to_term instead of no reply.
+            ErlDrvTermData response[] = { ERL_DRV_ATOM, ATOM(term),
+                                          ERL_DRV_EXT2TERM, (ErlDrvTermData)key->data, (ErlDrvUInt)key->size,
+                                          ERL_DRV_EXT2TERM, (ErlDrvTermData)data, (ErlDrvUInt)size,
+                                          ERL_DRV_TUPLE, 3};
+            if (driver_send_term(port, pid, response, sizeof(response) / sizeof(response[0])) > 0)
+            {
+                return;
+            }
+        }
+#endif
+        ErlDrvTermData tag = (options & BDBERL_OPT_RAW) ? ATOM(raw) :
+            verified ? ATOM(verified) : ATOM(ok);
+        ErlDrvTermData response[] = { ERL_DRV_ATOM, tag,
+                                      ERL_DRV_BUF2BINARY, (ErlDrvTermData)key->data, (ErlDrvUInt)key->size,
+                                      ERL_DRV_BUF2BINARY, (ErlDrvTermData)data, (ErlDrvUInt)size,
+                                      ERL_DRV_TUPLE, 3};
+        driver_send_term(port, pid, response, sizeof(response) / sizeof(response[0]));
+    }
+    else if (rc == DB_NOTFOUND)
+    {
+        driver_send_term(port, pid, G_REPLY_NOT_FOUND, 2);
+    }
+    else
+    {
+        send_error_response(port, pid, rc);
+    }
+}
+
+// Reply as send_kv does with the value from payload_offset on; a non-zero payload_offset
+// means the value has been verified by the worker
+static void async_cleanup_and_send_kv(PortData* d, int rc, DBT* key, DBT* value,
+                                      unsigned int payload_offset, unsigned int options)
 {
     // Save the port and pid references -- we need copies independent from the PortData
     // structure. Once we release the port_lock after clearing the cmd, it's possible that
@@ -1581,22 +2593,230 @@ static void async_cleanup_and_send_kv(PortData* d, int rc, DBT* key, DBT* value)
     bdberl_async_cleanup(d);
 
     // Notify port of result
-    if (rc == 0)
+    send_kv(port, pid, rc, key, rc == 0 ? (char*)value->data + payload_offset : NULL,
+            rc == 0 ? value->size - payload_offset : 0, payload_offset != 0, options);
+}
+
+// Answer a get from the database's value cache, in the control call. Gets inside a
+// transaction must see its own writes and gets with BDB flags ask for locking or isolation
+// the cache can't give, so both go to BDB; so do misses, which fill the cache on the way
+// back. Returns 1 if the reply has been sent.
+static int cached_get(PortData* d, int dbref, char* inbuf)
+{
+    // Inbuf is: << DbRef:32, Flags:32, KeyLen:32, Key:KeyLen >>
+    ValueCache* cache = G_DATABASES[dbref].options.cache;
+    unsigned int flags = UNPACK_INT(inbuf, 4);
+    unsigned int options = flags & BDBERL_OPT_MASK;
+    if (cache == NULL || d->txn || (flags & ~BDBERL_OPT_MASK) || check_db_format(dbref, options))
     {
-        ErlDrvTermData response[] = { ERL_DRV_ATOM, driver_mk_atom("ok"),
-                                      ERL_DRV_BUF2BINARY, (ErlDrvTermData)key->data, (ErlDrvUInt)key->size,
-                                      ERL_DRV_BUF2BINARY, (ErlDrvTermData)value->data, (ErlDrvUInt)value->size,
-                                      ERL_DRV_TUPLE, 3};
-        driver_send_term(port, pid, response, sizeof(response) / sizeof(response[0]));
+        return 0;
     }
-    else if (rc == DB_NOTFOUND)
+
+    DBT key;
+    memset(&key, '\0', sizeof(DBT));
+    key.size = UNPACK_INT(inbuf, 8);
+    key.data = UNPACK_BLOB(inbuf, 12);
+    CacheEntry* entry = bdberl_cache_get(cache, bdberl_cache_hash(key.data, key.size),
+                                         key.data, key.size);
+    if (entry == NULL)
     {
-        ErlDrvTermData response[] = { ERL_DRV_ATOM, driver_mk_atom("not_found") };
-        driver_send_term(port, pid, response, sizeof(response) / sizeof(response[0]));
+        return 0;
+    }
+
+    if (G_DATABASES[dbref].options.format == FORMAT_RAW)
+    {
+        options &= ~BDBERL_OPT_DECODE;
+    }
+    send_kv(d->port, d->port_owner, 0, &key, (char*)CACHE_ENTRY_VALUE(entry),
+            entry->value_size, entry->verified, options);
+
+    DbCounters* counters = &(G_DATABASES[dbref].counters);
+    DB_COUNTER_ADD(counters, gets, 1);
+    DB_COUNTER_ADD(counters, get_hits, 1);
+    DB_COUNTER_ADD(counters, bytes_read, key.size + entry->value_size);
+    bdberl_cache_release(entry);
+    return 1;
+}
+
+// Drop a key written to dbref from its value cache, or everything in it if key is NULL. Call
+// once the write is visible in BDB. Writes inside a transaction are not visible to other
+// readers until it commits, so those are held for apply_txn_writes.
+static void invalidate_cached(PortData* d, int dbref, DBT* key)
+{
+    ValueCache* cache = G_DATABASES[dbref].options.cache;
+    if (cache == NULL)
+    {
+        return;
+    }
+
+    uint64_t hash = key ? bdberl_cache_hash(key->data, key->size) : 0;
+    if (d->txn == NULL)
+    {
+        if (key)
+        {
+            bdberl_cache_invalidate(cache, hash);
+        }
+        else
+        {
+            bdberl_cache_clear(cache);
+        }
+        return;
+    }
+
+    add_txn_write(d, dbref, key ? TXN_WRITE_INVALIDATE : TXN_WRITE_CLEAR, hash);
+}
+
+// Answer a get of a key dbref's key filter rules out with not_found, in the control call.
+// Gets in a transaction or with flags such as DB_RMW go to BDB, which locks the absent key
+// for them. Returns 1 if the reply has been sent.
+static int filtered_get(PortData* d, int dbref, char* inbuf)
+{
+    // Inbuf is: << DbRef:32, Flags:32, KeyLen:32, Key:KeyLen >>
+    KeyFilter* filter = G_DATABASES[dbref].options.filter;
+    unsigned int flags = UNPACK_INT(inbuf, 4);
+    unsigned int options = flags & BDBERL_OPT_MASK;
+    if (filter == NULL || d->txn || (flags & ~BDBERL_OPT_MASK) || check_db_format(dbref, options))
+    {
+        return 0;
+    }
+
+    // The filter holds keys as they are stored
+    DBT key;
+    memset(&key, '\0', sizeof(DBT));
+    key.size = UNPACK_INT(inbuf, 8);
+    key.data = UNPACK_BLOB(inbuf, 12);
+    unsigned char* encoded_key = NULL;
+    if (encode_request_key(dbref, &key, &encoded_key) != 0)
+    {
+        return 0;
+    }
+    int absent = !bdberl_filter_may_contain(filter, bdberl_filter_hash(key.data, key.size));
+    driver_free(encoded_key);
+    if (!absent)
+    {
+        return 0;
+    }
+
+    driver_send_term(d->port, d->port_owner, G_REPLY_NOT_FOUND, 2);
+    DbCounters* counters = &(G_DATABASES[dbref].counters);
+    DB_COUNTER_ADD(counters, gets, 1);
+    DB_COUNTER_ADD(counters, get_misses, 1);
+    return 1;
+}
+
+// Put a key, as stored, into dbref's key filter ahead of writing it to BDB, so no reader
+// finds the key there but not here. While the filter is being built the key is logged for
+// the build to add instead.
+static void filter_put(int dbref, DBT* key)
+{
+    DbOptions* options = &(G_DATABASES[dbref].options);
+    KeyFilter* filter = options->filter;
+    FilterBuild* build = options->filter_build;
+    if (filter == NULL && build == NULL)
+    {
+        return;
+    }
+
+    uint64_t hash = bdberl_filter_hash(key->data, key->size);
+    if (filter == NULL)
+    {
+        // The build publishes under its lock, so the filter is either there now or the
+        // build has yet to take the pending keys. A build that gave up takes none.
+        erl_drv_mutex_lock(build->lock);
+        filter = options->filter;
+        if (filter == NULL && build->state != FILTER_BUILD_DONE)
+        {
+            if (build->pending_count == build->pending_size)
+            {
+                build->pending_size = build->pending_size ? build->pending_size * 2 : 256;
+                build->pending = driver_realloc(build->pending,
+                                                sizeof(uint64_t) * build->pending_size);
+            }
+            build->pending[build->pending_count++] = hash;
+        }
+        erl_drv_mutex_unlock(build->lock);
+    }
+    if (filter)
+    {
+        bdberl_filter_add(filter, hash);
+    }
+}
+
+// Take a deleted key, as stored, out of the key filter dbref had published when the delete
+// began; as with invalidate_cached, deletes inside a transaction wait for it to commit.
+// Removing the key any earlier would let a get skip BDB while the key can still be read
+// there. A filter published later may never have had the key, as the build's scan may have
+// passed its place after the delete, so the key is left in it as a false positive rather
+// than taking counts that belong to other keys.
+static void unfilter_deleted(PortData* d, int dbref, KeyFilter* filter, DBT* key)
+{
+    if (filter == NULL)
+    {
+        return;
+    }
+
+    uint64_t hash = bdberl_filter_hash(key->data, key->size);
+    if (d->txn == NULL)
+    {
+        bdberl_filter_remove(filter, hash);
     }
     else
     {
-        send_error_response(port, pid, rc);
+        add_txn_write(d, dbref, TXN_WRITE_UNFILTER, hash);
+    }
+}
+
+static void add_txn_write(PortData* d, int dbref, int op, uint64_t hash)
+{
+    if (d->txn_writes_count == d->txn_writes_size)
+    {
+        d->txn_writes_size = d->txn_writes_size ? d->txn_writes_size * 2 : 16;
+        d->txn_writes = driver_realloc(d->txn_writes, sizeof(TxnWrite) * d->txn_writes_size);
+    }
+    TxnWrite* w = &(d->txn_writes[d->txn_writes_count++]);
+    w->dbref = dbref;
+    w->op = op;
+    w->hash = hash;
+}
+
+// The port's transaction has committed; drop what it wrote from the value caches and take
+// what it deleted out of the key filters
+static void apply_txn_writes(PortData* d)
+{
+    unsigned int i;
+    for (i = 0; i < d->txn_writes_count; i++)
+    {
+        TxnWrite* w = &(d->txn_writes[i]);
+        DbOptions* options = &(G_DATABASES[w->dbref].options);
+        switch (w->op)
+        {
+        case TXN_WRITE_INVALIDATE:
+            bdberl_cache_invalidate(options->cache, w->hash);
+            break;
+        case TXN_WRITE_CLEAR:
+            bdberl_cache_clear(options->cache);
+            break;
+        case TXN_WRITE_UNFILTER:
+            bdberl_filter_remove(options->filter, w->hash);
+            break;
+        }
+    }
+    d->txn_writes_count = 0;
+}
+
+
+// The port's transaction has ended in a commit that returned commit_rc. BDB aborts a
+// transaction whose commit fails, so its deletes never happened and must not come out of
+// the key filters.
+static void finish_txn_writes(PortData* d, int commit_rc)
+{
+    if (commit_rc == 0)
+    {
+        apply_txn_writes(d);
+    }
+    else
+    {
+        d->txn_writes_count = 0;
     }
 }
 
@@ -1605,11 +2825,14 @@ static void do_async_put(void* arg)
 {
     // Payload is: <<DbRef:32, Flags:32, KeyLen:32, Key:KeyLen, ValLen:32, Val:ValLen>>
     PortData* d = (PortData*)arg;
+    BDBERL_PROBE2(async__entry, d->port, d->async_op);
 
     // Get the database reference and flags from the payload
     int dbref = UNPACK_INT(d->work_buffer, 0);
     DB* db = bdberl_lookup_dbref(dbref);
     unsigned int flags = UNPACK_INT(d->work_buffer, 4);
+    unsigned int options = flags & BDBERL_OPT_MASK;
+    flags &= ~BDBERL_OPT_MASK;
 
     // Setup DBTs
     DBT key;
@@ -1623,18 +2846,90 @@ static void do_async_put(void* arg)
     value.size = UNPACK_INT(d->work_buffer, 12 + key.size);
     value.data = UNPACK_BLOB(d->work_buffer, 12 + key.size + 4);
 
-    // Check CRC in value payload - first 4 bytes are CRC of rest of bytes
-    assert(value.size >= 4);
-    uint32_t calc_crc32 = bdberl_crc32(value.data+4, value.size-4);
-    uint32_t buf_crc32 = *(uint32_t*) value.data;
+    int rc = check_db_format(dbref, options);
+    int checksum = G_DATABASES[dbref].options.checksum;
+    unsigned char* stored = NULL;
+    DBT request_key = key;
+    unsigned char* encoded_key = NULL;
+    if (rc == 0)
+    {
+        rc = encode_request_key(dbref, &key, &encoded_key);
+    }
+    if (rc == 0 && (options & BDBERL_OPT_RAW))
+    {
+        // Raw values arrive bare; frame them here unless the database stores them as given
+        unsigned int header_size = bdberl_value_raw_header_size(checksum);
+        if (header_size)
+        {
+            stored = driver_alloc(header_size + value.size);
+            memcpy(stored + header_size, value.data, value.size);
+            bdberl_value_write_header(stored, checksum, value.size);
+            value.data = stored;
+            value.size += header_size;
+        }
+    }
+    else if (rc == 0 && (options & BDBERL_OPT_FRAMED))
+    {
+        // The caller left room for the header and no CRC-32 to check; frame the term in place
+        unsigned char* payload = (unsigned char*)value.data + BDBERL_FRAME_ROOM;
+        unsigned int payload_size = value.size - BDBERL_FRAME_ROOM;
+        if (value.size <= BDBERL_FRAME_ROOM)
+        {
+            rc = ERROR_INVALID_VALUE;
+        }
+        else if (G_DATABASES[dbref].options.compress == COMPRESS_LZ &&
+                 (stored = bdberl_value_compress(payload, payload_size, checksum,
+                                                 G_DATABASES[dbref].options.dict,
+                                                 &value.size)) != NULL)
+        {
+            value.data = stored;
+        }
+        else
+        {
+            unsigned int header_size = bdberl_value_header_size(checksum);
+            value.data = payload - header_size;
+            value.size = header_size + payload_size;
+            bdberl_value_write_header(value.data, checksum, payload_size);
+        }
+    }
+    else if (rc == 0)
+    {
+        // Check CRC in value payload - first 4 bytes are CRC of rest of bytes
+        assert(value.size >= 4);
+        uint32_t calc_crc32 = bdberl_crc32(value.data+4, value.size-4);
+        uint32_t buf_crc32 = *(uint32_t*) value.data;
+        if (calc_crc32 != buf_crc32)
+        {
+            DBGCMD(d, "CRC-32 error on put data - buffer %08X calculated %08X.\n", buf_crc32, calc_crc32);
+            rc = ERROR_INVALID_VALUE;
+        }
+        // Compressed values go behind the versioned header whatever the checksum, unless
+        // they don't shrink
+        else if (G_DATABASES[dbref].options.compress == COMPRESS_LZ &&
+                 (stored = bdberl_value_compress((unsigned char*)value.data + 4, value.size - 4,
+                                                 checksum, G_DATABASES[dbref].options.dict,
+                                                 &value.size)) != NULL)
+        {
+            value.data = stored;
+        }
+        // Databases with another checksum store the term behind the versioned header instead
+        else if (checksum != VALUE_CHECKSUM_CRC32)
+        {
+            unsigned int header_size = bdberl_value_header_size(checksum);
+            unsigned int payload_size = value.size - 4;
+            stored = driver_alloc(header_size + payload_size);
+            memcpy(stored + header_size, (char*)value.data + 4, payload_size);
+            bdberl_value_write_header(stored, checksum, payload_size);
+            value.data = stored;
+            value.size = header_size + payload_size;
+        }
+    }
 
-    int rc;
-    if (calc_crc32 != buf_crc32)
+    if (rc == 0)
     {
-        DBGCMD(d, "CRC-32 error on put data - buffer %08X calculated %08X.\n", buf_crc32, calc_crc32);
-        rc = ERROR_INVALID_VALUE;
+        filter_put(dbref, &key);
     }
-    else
+    if (rc == 0)
     {
         // Execute the actual put. All databases are opened with AUTO_COMMIT, so if msg->port->txn
         // is NULL, the put will still be atomic
@@ -1643,6 +2938,12 @@ static void do_async_put(void* arg)
         rc = db->put(db, d->txn, &key, &value, flags);
         DBGCMDRC(d, rc);
     }
+    if (rc == 0)
+    {
+        invalidate_cached(d, dbref, &request_key);
+    }
+    update_db_counters(d, dbref, d->async_op, rc, &key, &value);
+    int in_txn = (d->txn != 0);
 
     // If any error occurs while we have a txn action, abort it
     if (d->txn && rc)
@@ -1657,6 +2958,18 @@ static void do_async_put(void* arg)
 
         // Regardless of the txn commit outcome, we still need to invalidate the transaction
         d->txn = 0;
+        finish_txn_writes(d, rc);
+    }
+
+    // Traced after the commit, which is usually where a slow put_commit spends its time
+    trace_op(d, dbref, in_txn, rc, &key, &value);
+    if (stored)
+    {
+        driver_free(stored);
+    }
+    if (encoded_key)
+    {
+        driver_free(encoded_key);
     }
 
     bdberl_async_cleanup_and_send_rc(d, rc);
@@ -1666,13 +2979,16 @@ static void do_async_get(void* arg)
 {
     // Payload is: << DbRef:32, Flags:32, KeyLen:32, Key:KeyLen >>
     PortData* d = (PortData*)arg;
+    BDBERL_PROBE2(async__entry, d->port, d->async_op);
 
     // Get the database object, using the provided ref
     int dbref = UNPACK_INT(d->work_buffer, 0);
     DB* db = bdberl_lookup_dbref(dbref);
 
-    // Extract operation flags
+    // Extract operation flags, keeping the driver's own options apart
     unsigned flags = UNPACK_INT(d->work_buffer, 4);
+    unsigned int options = flags & BDBERL_OPT_MASK;
+    flags &= ~BDBERL_OPT_MASK;
 
     // Setup DBTs
     DBT key;
@@ -1687,22 +3003,52 @@ static void do_async_get(void* arg)
     // Allocate a buffer for the output value
     value.flags = DB_DBT_MALLOC;
 
-    int rc = db->get(db, d->txn, &key, &value, flags);
+    // The reply carries the key as it was asked for, whatever is stored
+    DBT request_key = key;
+    unsigned char* encoded_key = NULL;
+    int rc = check_db_format(dbref, options);
+    if (rc == 0)
+    {
+        rc = encode_request_key(dbref, &key, &encoded_key);
+    }
 
-    // Check CRC - first 4 bytes are CRC of rest of bytes
+    // A get cached_get could have answered fills the cache, unless a write to the key may
+    // have landed between reading BDB and filling; see bdberl_cache.h
+    ValueCache* cache = G_DATABASES[dbref].options.cache;
+    int fill = cache != NULL && d->txn == NULL && flags == 0;
+    uint64_t hash = 0;
+    unsigned int epoch = 0;
+    if (rc == 0 && fill)
+    {
+        hash = bdberl_cache_hash(request_key.data, request_key.size);
+        epoch = bdberl_cache_epoch(cache, hash);
+    }
     if (rc == 0)
     {
-        assert(value.size >= 4);
-        uint32_t calc_crc32 = bdberl_crc32(value.data+4, value.size-4);
-        uint32_t buf_crc32 = *(uint32_t*) value.data;
+        rc = db->get(db, d->txn, &key, &value, flags);
+    }
 
-        if (calc_crc32 != buf_crc32)
-        {
-            DBGCMD(d, "CRC-32 error on get data - buffer %08X calculated %08X.\n",
-                   buf_crc32, calc_crc32);
-            rc = ERROR_INVALID_VALUE;
-        }
+    // Every plain get of a filtered database went past filtered_get on the way here, bar the
+    // odd one that started while the filter was still being built
+    if (rc == DB_NOTFOUND && d->txn == NULL && flags == 0 && G_DATABASES[dbref].options.filter)
+    {
+        bdberl_filter_false_positive(G_DATABASES[dbref].options.filter);
+    }
+
+    // Check the value's checksum in the layout it was written in
+    unsigned int payload_offset = 0;
+    if (rc == 0 && (rc = verify_read_value(dbref, &value, &payload_offset, &options)) != 0)
+    {
+        DBGCMD(d, "Checksum error on get data - %u bytes.\n", value.size);
+    }
+    if (rc == 0 && fill)
+    {
+        bdberl_cache_fill(cache, hash, epoch, request_key.data, request_key.size,
+                          (char*)value.data + payload_offset, value.size - payload_offset,
+                          payload_offset != 0);
     }
+    update_db_counters(d, dbref, CMD_GET, rc, &key, &value);
+    trace_op(d, dbref, d->txn != 0, rc, &key, &value);
 
     // Cleanup transaction as necessary
     if (rc && rc != DB_NOTFOUND && d->txn)
@@ -1711,23 +3057,30 @@ static void do_async_get(void* arg)
         d->txn = 0;
     }
 
-    async_cleanup_and_send_kv(d, rc, &key, &value);
+    async_cleanup_and_send_kv(d, rc, &request_key, &value, payload_offset, options);
 
     // Finally, clean up value buffer (driver_send_term made a copy)
     driver_free(value.data);
+    if (encoded_key)
+    {
+        driver_free(encoded_key);
+    }
 }
 
 static void do_async_del(void* arg)
 {
     // Payload is: << DbRef:32, Flags:32, KeyLen:32, Key:KeyLen >>
     PortData* d = (PortData*)arg;
+    BDBERL_PROBE2(async__entry, d->port, d->async_op);
 
     // Get the database object, using the provided ref
     int dbref = UNPACK_INT(d->work_buffer, 0);
     DB* db = bdberl_lookup_dbref(dbref);
 
-    // Extract operation flags
+    // Extract operation flags, keeping the driver's own options apart
     unsigned flags = UNPACK_INT(d->work_buffer, 4);
+    unsigned int options = flags & BDBERL_OPT_MASK;
+    flags &= ~BDBERL_OPT_MASK;
 
     // Setup DBTs
     DBT key;
@@ -1737,7 +3090,29 @@ static void do_async_del(void* arg)
     key.size = UNPACK_INT(d->work_buffer, 8);
     key.data = UNPACK_BLOB(d->work_buffer, 12);
 
-    int rc = db->del(db, d->txn, &key, flags);
+    DBT request_key = key;
+    unsigned char* encoded_key = NULL;
+    int rc = check_db_format(dbref, options);
+    if (rc == 0)
+    {
+        rc = encode_request_key(dbref, &key, &encoded_key);
+    }
+    KeyFilter* filter = G_DATABASES[dbref].options.filter;
+    if (rc == 0)
+    {
+        rc = db->del(db, d->txn, &key, flags);
+    }
+    if (rc == 0)
+    {
+        invalidate_cached(d, dbref, &request_key);
+        unfilter_deleted(d, dbref, filter, &key);
+    }
+    update_db_counters(d, dbref, CMD_DEL, rc, &key, NULL);
+    trace_op(d, dbref, d->txn != 0, rc, &key, NULL);
+    if (encoded_key)
+    {
+        driver_free(encoded_key);
+    }
 
     // Cleanup transaction as necessary
     if (rc && rc != DB_NOTFOUND && d->txn)
@@ -1752,6 +3127,7 @@ static void do_async_del(void* arg)
 static void do_async_txnop(void* arg)
 {
     PortData* d = (PortData*)arg;
+    BDBERL_PROBE2(async__entry, d->port, d->async_op);
 
     // Execute the actual begin/commit/abort
     int rc = 0;
@@ -1761,6 +3137,9 @@ static void do_async_txnop(void* arg)
         rc = G_DB_ENV->txn_begin(G_DB_ENV, 0, &(d->txn), d->async_flags);
         DBGCMD(d, "rc = %s (%d) d->txn = %p\n", rc == 0 ? "ok" : bdberl_rc_to_atom_str(rc), rc, d->txn);
 
+        // Writes of an earlier transaction that aborted were never visible
+        d->txn_writes_count = 0;
+
     }
     else if (d->async_op == CMD_TXN_COMMIT)
     {
@@ -1769,6 +3148,7 @@ static void do_async_txnop(void* arg)
         rc = d->txn->commit(d->txn, d->async_flags);
         DBGCMDRC(d, rc);
         d->txn = 0;
+        finish_txn_writes(d, rc);
     }
     else
     {
@@ -1776,6 +3156,7 @@ static void do_async_txnop(void* arg)
         abort_txn(d);
     }
 
+    trace_op(d, -1, d->async_op != CMD_TXN_BEGIN, rc, NULL, NULL);
     bdberl_async_cleanup_and_send_rc(d, rc);
 }
 
@@ -1783,6 +3164,7 @@ static void do_async_txnop(void* arg)
 static void do_async_cursor_put(void* arg)
 {
     PortData* d = (PortData*)arg;
+    BDBERL_PROBE2(async__entry, d->port, d->async_op);
     assert(d->cursor != NULL);
     DBGCMD(d, "cursor_put/2 not yet implemented...\n"); /* TODO: implement this. */
     bdberl_async_cleanup_and_send_rc(d, ERROR_DB_ACTIVE);
@@ -1793,10 +3175,13 @@ static void do_async_cursor_get(void* arg)
 {
     // Payload is: << Flags:32, KeyLen:32, Key:KeyLen >>
     PortData* d = (PortData*)arg;
+    BDBERL_PROBE2(async__entry, d->port, d->async_op);
     assert(d->cursor != NULL);
 
     // Extract operation flags
     unsigned flags = UNPACK_INT(d->work_buffer, 0);
+    unsigned int options = (flags & BDBERL_OPT_MASK) | d->cursor_options;
+    flags &= ~BDBERL_OPT_MASK;
 
     // Setup DBTs
     DBT key;
@@ -1811,28 +3196,35 @@ static void do_async_cursor_get(void* arg)
     // Allocate a buffer for the output value
     value.flags = DB_DBT_MALLOC;
 
-    // Execute the operation
-    DBGCMD(d, "d->cursor->get(%p, %p, %p, %08X\n);", d->cursor, &key, &value, flags);
-    int rc = d->cursor->get(d->cursor, &key, &value, flags);
-    DBGCMDRC(d, rc);
+    // Execute the operation; a key in the wrong format, or one the key codec can't encode,
+    // is refused without touching the cursor, which stays usable
+    unsigned char* encoded_key = NULL;
+    unsigned char* decoded_key = NULL;
+    int rc = check_db_format(d->cursor_dbref, options);
+    int usable = rc == 0 && (rc = encode_request_key(d->cursor_dbref, &key, &encoded_key)) == 0;
+    if (usable)
+    {
+        DBGCMD(d, "d->cursor->get(%p, %p, %p, %08X\n);", d->cursor, &key, &value, flags);
+        rc = d->cursor->get(d->cursor, &key, &value, flags);
+        DBGCMDRC(d, rc);
+    }
 
-    // Check CRC - first 4 bytes are CRC of rest of bytes
+    // Check the value's checksum in the layout it was written in
+    unsigned int payload_offset = 0;
+    if (rc == 0 &&
+        (rc = verify_read_value(d->cursor_dbref, &value, &payload_offset, &options)) != 0)
+    {
+        DBGCMD(d, "Checksum error on cursor get data - %u bytes.\n", value.size);
+    }
+    update_db_counters(d, d->cursor_dbref, CMD_CURSOR_GET, rc, &key, &value);
+    trace_op(d, d->cursor_dbref, d->txn != 0, rc, &key, &value);
     if (rc == 0)
     {
-        assert(value.size >= 4);
-        uint32_t calc_crc32 = bdberl_crc32(value.data+4, value.size-4);
-        uint32_t buf_crc32 = *(uint32_t*) value.data;
-
-        if (calc_crc32 != buf_crc32)
-        {
-            DBGCMD(d, "CRC-32 error on get data - buffer %08X calculated %08X.\n",
-                   buf_crc32, calc_crc32);
-            rc = ERROR_INVALID_VALUE;
-        }
+        rc = decode_reply_key(d->cursor_dbref, &key, &decoded_key);
     }
 
     // Cleanup cursor as necessary
-    if (rc && rc != DB_NOTFOUND && d->txn)
+    if (rc && rc != DB_NOTFOUND && usable && d->txn)
     {
         DBG("cursor flags=%d rc=%d\n", flags, rc);
 
@@ -1841,16 +3233,25 @@ static void do_async_cursor_get(void* arg)
         abort_txn(d);
     }
 
-    async_cleanup_and_send_kv(d, rc, &key, &value);
+    async_cleanup_and_send_kv(d, rc, &key, &value, payload_offset, options);
 
     // Finally, clean up value buffer (driver_send_term made a copy)
     driver_free(value.data);
+    if (encoded_key)
+    {
+        driver_free(encoded_key);
+    }
+    if (decoded_key)
+    {
+        driver_free(decoded_key);
+    }
 }
 
 
 static void do_async_cursor_del(void* arg)
 {
     PortData* d = (PortData*)arg;
+    BDBERL_PROBE2(async__entry, d->port, d->async_op);
     assert(d->cursor != NULL);
     DBGCMD(d, "cursor_del/2 not yet implemented...\n"); /* TODO: implement this. */
     bdberl_async_cleanup_and_send_rc(d, ERROR_DB_ACTIVE);
@@ -1860,6 +3261,7 @@ static void do_async_cursor_del(void* arg)
 static void do_async_cursor_count(void* arg)
 {
     PortData* d = (PortData*)arg;
+    BDBERL_PROBE2(async__entry, d->port, d->async_op);
     assert(d->cursor != NULL);
 
     // Place to store the record count.
@@ -1878,6 +3280,7 @@ static void do_async_cursor_cnp(void* arg)
 {
     // Payload is: << DbRef:32, Flags:32, KeyLen:32, Key:KeyLen >>
     PortData* d = (PortData*)arg;
+    BDBERL_PROBE2(async__entry, d->port, d->async_op);
     assert(d->cursor != NULL);
 
     // Setup DBTs
@@ -1888,6 +3291,7 @@ static void do_async_cursor_cnp(void* arg)
 
     // Determine what type of cursor get to perform
     int flags = 0;
+    unsigned int options = d->cursor_options;
     switch (d->async_op)
     {
     case CMD_CURSOR_NEXT:
@@ -1903,17 +3307,18 @@ static void do_async_cursor_cnp(void* arg)
     int rc = d->cursor->get(d->cursor, &key, &value, flags);
     DBGCMDRC(d, rc);
 
-    // Check CRC - first 4 bytes are CRC of rest of bytes
+    // Check the value's checksum in the layout it was written in
+    unsigned int payload_offset = 0;
     if (rc == 0)
     {
-        assert(value.size >= 4);
-        uint32_t calc_crc32 = bdberl_crc32(value.data+4, value.size-4);
-        uint32_t file_crc32 = *(uint32_t*) value.data;
-
-        if (calc_crc32 != file_crc32)
-        {
-            rc = ERROR_INVALID_VALUE;
-        }
+        rc = verify_read_value(d->cursor_dbref, &value, &payload_offset, &options);
+    }
+    update_db_counters(d, d->cursor_dbref, d->async_op, rc, &key, &value);
+    trace_op(d, d->cursor_dbref, d->txn != 0, rc, &key, &value);
+    unsigned char* decoded_key = NULL;
+    if (rc == 0)
+    {
+        rc = decode_reply_key(d->cursor_dbref, &key, &decoded_key);
     }
 
     // Cleanup as necessary; any sort of failure means we need to close the cursor and abort
@@ -1927,13 +3332,24 @@ static void do_async_cursor_cnp(void* arg)
         abort_txn(d);
     }
 
-    async_cleanup_and_send_kv(d, rc, &key, &value);
+    async_cleanup_and_send_kv(d, rc, &key, &value, payload_offset, options);
+
+    // The value belongs to the cursor unless it was inflated
+    if (value.flags & DB_DBT_MALLOC)
+    {
+        driver_free(value.data);
+    }
+    if (decoded_key)
+    {
+        driver_free(decoded_key);
+    }
 }
 
 static void do_async_truncate(void* arg)
 {
     // Payload is: <<DbRef:32>>
     PortData* d = (PortData*)arg;
+    BDBERL_PROBE2(async__entry, d->port, d->async_op);
 
     // Get the database reference and flags from the payload
     int rc = 0;
@@ -1953,13 +3369,16 @@ static void do_async_truncate(void* arg)
                 u_int32_t count = 0;
 
                 DBGCMD(d, "db->truncate(%p, %p, %p, 0) dbref=%d\n", db, d->txn, &count, i);
+                pause_filter_build(&(database->options));
                 rc = db->truncate(db, d->txn, &count, 0);
+                resume_filter_build(&(database->options));
                 DBGCMD(d, "rc = %s (%d) count=%d\n", rc == 0 ? "ok" : bdberl_rc_to_atom_str(rc), rc, count);
 
                 if (rc != 0)
                 {
                     break;
                 }
+                invalidate_cached(d, i, NULL);
             }
         }
     }
@@ -1968,9 +3387,15 @@ static void do_async_truncate(void* arg)
         DB* db = G_DATABASES[d->async_dbref].db;
         u_int32_t count = 0;
         DBGCMD(d, "db->truncate(%p, %p, %p, 0) dbref=%d\n", db, d->txn, &count, d->async_dbref);
+        pause_filter_build(&(G_DATABASES[d->async_dbref].options));
         rc = db->truncate(db, d->txn, &count, 0);
+        resume_filter_build(&(G_DATABASES[d->async_dbref].options));
         DBGCMD(d, "rc = %s (%d) count=%d\n", rc == 0 ? "ok" : bdberl_rc_to_atom_str(rc),
                rc, count);
+        if (rc == 0)
+        {
+            invalidate_cached(d, d->async_dbref, NULL);
+        }
     }
 
     // If any error occurs while we have a txn action, abort it
@@ -1982,6 +3407,195 @@ static void do_async_truncate(void* arg)
     bdberl_async_cleanup_and_send_rc(d, rc);
 }
 
+// Account for the outcome of a worker operation against the database's counters. Lock
+// failures are also added to the global lock telemetry along with how long the op ran.
+static void update_db_counters(PortData* d, int dbref, int op, int rc, DBT* key, DBT* value)
+{
+    DbCounters* counters = &(G_DATABASES[dbref].counters);
+    unsigned int bytes = key->size + (value ? value->size : 0);
+    switch(op)
+    {
+    case CMD_GET:
+        DB_COUNTER_ADD(counters, gets, 1);
+        if (rc == 0)
+        {
+            DB_COUNTER_ADD(counters, get_hits, 1);
+            DB_COUNTER_ADD(counters, bytes_read, bytes);
+        }
+        else if (rc == DB_NOTFOUND)
+        {
+            DB_COUNTER_ADD(counters, get_misses, 1);
+        }
+        break;
+    case CMD_PUT:
+    case CMD_PUT_COMMIT:
+        DB_COUNTER_ADD(counters, puts, 1);
+        if (rc == 0)
+        {
+            DB_COUNTER_ADD(counters, bytes_written, bytes);
+        }
+        break;
+    case CMD_DEL:
+        DB_COUNTER_ADD(counters, dels, 1);
+        break;
+    default: // Cursor gets and moves
+        DB_COUNTER_ADD(counters, cursor_steps, 1);
+        if (rc == 0)
+        {
+            DB_COUNTER_ADD(counters, bytes_read, bytes);
+        }
+        break;
+    }
+
+    switch(rc)
+    {
+    case ERROR_INVALID_VALUE: DB_COUNTER_ADD(counters, crc_failures, 1);     break;
+    case DB_LOCK_DEADLOCK:    DB_COUNTER_ADD(counters, deadlocks, 1);        break;
+    case DB_LOCK_NOTGRANTED:  DB_COUNTER_ADD(counters, lock_not_granted, 1); break;
+    }
+
+    if ((rc == DB_LOCK_DEADLOCK || rc == DB_LOCK_NOTGRANTED) && d->async_job)
+    {
+        uint64_t waited = bdberl_now_usecs() - d->async_job->started_usecs;
+        __sync_fetch_and_add(&G_LOCK_TELEMETRY.lock_failures, 1);
+        __sync_fetch_and_add(&G_LOCK_TELEMETRY.lock_failure_usecs, waited);
+    }
+}
+
+// Record a completed operation in the worker's trace ring and report it to the logger as
+// {bdb_slow_op, Cmd, DbRef, KeySize, ValueSize, QueueUsecs, ServiceUsecs, Rc, InTxn} if it
+// took longer than G_SLOW_OP_USECS from enqueue to completion. Must be called on the worker
+// before the async op is cleaned up.
+static void trace_op(PortData* d, int dbref, int in_txn, int rc, DBT* key, DBT* value)
+{
+    struct timeval tv;
+    uint64_t now = bdberl_now_usecs();
+    TraceEntry entry;
+
+    gettimeofday(&tv, NULL);
+    entry.op = d->async_op;
+    entry.dbref = dbref;
+    entry.key_size = key ? key->size : 0;
+    entry.value_size = value ? value->size : 0;
+    entry.rc = rc;
+    entry.flags = in_txn ? TRACE_IN_TXN : 0;
+    entry.timestamp = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+    entry.queue_usecs = 0;
+    entry.service_usecs = 0;
+    if (d->async_job)
+    {
+        entry.queue_usecs = d->async_job->started_usecs - d->async_job->enqueued_usecs;
+        entry.service_usecs = now - d->async_job->started_usecs;
+    }
+    bdberl_trace_record(&entry);
+
+    if (entry.queue_usecs + entry.service_usecs >= G_SLOW_OP_USECS)
+    {
+        ErlDrvTermData rc_atom = rc == 0 ? ATOM(ok) : bdberl_rc_to_atom(rc);
+        if (rc_atom == 0)
+        {
+            rc_atom = ATOM(unknown);
+        }
+        ErlDrvTermData response[] = { ERL_DRV_ATOM, ATOM(bdb_slow_op),
+                                      ERL_DRV_ATOM, ATOM_AT(G_LATENCY_TAG_ATOMS[async_op_tag(entry.op)]),
+                                      ERL_DRV_INT, dbref,
+                                      ERL_DRV_UINT, entry.key_size,
+                                      ERL_DRV_UINT, entry.value_size,
+                                      ERL_DRV_UINT, entry.queue_usecs,
+                                      ERL_DRV_UINT, entry.service_usecs,
+                                      ERL_DRV_ATOM, rc_atom,
+                                      ERL_DRV_ATOM, in_txn ? ATOM(true) : ATOM(false),
+                                      ERL_DRV_TUPLE, 9};
+        send_log_message(response, sizeof(response));
+    }
+}
+
+// Append a request to the capture file. Payloads are checked against inbuf_sz since this
+// runs before the command validates anything; CMD_OPEN_DB is recorded once it completes.
+static void capture_request(PortData* d, unsigned int cmd, char* inbuf, int inbuf_sz)
+{
+    int dbref = -1;
+    unsigned int flags = 0;
+    char* key = NULL;
+    unsigned int key_size = 0;
+    unsigned int value_size = 0;
+
+    switch(cmd)
+    {
+    case CMD_PUT:
+    case CMD_PUT_COMMIT:
+    case CMD_GET:
+    case CMD_DEL:
+        // Inbuf is: <<DbRef:32, Flags:32, KeyLen:32, Key/bytes, [ValueLen:32, Value/bytes]>>
+        if (inbuf_sz < 12 || UNPACK_INT(inbuf, 8) < 0 || 12 + UNPACK_INT(inbuf, 8) > inbuf_sz)
+        {
+            return;
+        }
+        dbref = UNPACK_INT(inbuf, 0);
+        flags = UNPACK_INT(inbuf, 4);
+        key_size = UNPACK_INT(inbuf, 8);
+        key = UNPACK_BLOB(inbuf, 12);
+        if ((cmd == CMD_PUT || cmd == CMD_PUT_COMMIT) && 12 + key_size + 4 <= inbuf_sz)
+        {
+            value_size = UNPACK_INT(inbuf, 12 + key_size);
+        }
+        break;
+    case CMD_CLOSE_DB:
+    case CMD_CURSOR_OPEN:
+        // Inbuf is: <<DbRef:32, Flags:32>>
+        if (inbuf_sz < 8)
+        {
+            return;
+        }
+        dbref = UNPACK_INT(inbuf, 0);
+        flags = UNPACK_INT(inbuf, 4);
+        break;
+    case CMD_TRUNCATE:
+        if (inbuf_sz < 4)
+        {
+            return;
+        }
+        dbref = UNPACK_INT(inbuf, 0);
+        break;
+    case CMD_TXN_BEGIN:
+    case CMD_TXN_COMMIT:
+        flags = (inbuf_sz >= 4) ? UNPACK_INT(inbuf, 0) : 0;
+        break;
+    case CMD_TXN_ABORT:
+        break;
+    case CMD_CURSOR_GET:
+    case CMD_CURSOR_PUT:
+    case CMD_CURSOR_DEL:
+        // Inbuf is: <<Flags:32, KeyLen:32, Key/bytes>>
+        if (inbuf_sz < 8 || UNPACK_INT(inbuf, 4) < 0 || 8 + UNPACK_INT(inbuf, 4) > inbuf_sz)
+        {
+            return;
+        }
+        dbref = d->cursor ? d->cursor_dbref : -1;
+        flags = UNPACK_INT(inbuf, 0);
+        key_size = UNPACK_INT(inbuf, 4);
+        key = UNPACK_BLOB(inbuf, 8);
+        break;
+    case CMD_CURSOR_CURR:
+    case CMD_CURSOR_NEXT:
+    case CMD_CURSOR_PREV:
+    case CMD_CURSOR_COUNT:
+    case CMD_CURSOR_CLOSE:
+        dbref = d->cursor ? d->cursor_dbref : -1;
+        break;
+    case CMD_REMOVE_DB:
+        // Inbuf is: <<Name/bytes, 0:8>>
+        key = UNPACK_STRING(inbuf, 0);
+        key_size = strnlen(key, inbuf_sz);
+        break;
+    default:
+        // Stats and driver queries are not part of the workload
+        return;
+    }
+
+    bdberl_capture_record(d->port_id, cmd, dbref, flags, key, key_size, value_size);
+}
+
 static void do_sync_data_dirs_info(PortData *d)
 {
     // Get DB_HOME and find the real path
@@ -2056,53 +3670,346 @@ static void do_sync_driver_info(PortData *d)
     bdberl_tpool_job_count(G_TPOOL_GENERAL, &general_pending, &general_active);
     bdberl_tpool_job_count(G_TPOOL_TXNS, &txn_pending, &txn_active);
 
+    erl_drv_mutex_lock(G_LOCK_TELEMETRY_MUTEX);
+    LockTelemetry locks = G_LOCK_TELEMETRY;
+    erl_drv_mutex_unlock(G_LOCK_TELEMETRY_MUTEX);
+
+    uint64_t capture_records;
+    uint64_t capture_dropped;
+    bdberl_capture_counts(&capture_records, &capture_dropped);
+
     ErlDrvPort port = d->port;
     ErlDrvTermData pid = d->port_owner;
     ErlDrvTermData response[] = {
-        ERL_DRV_ATOM, driver_mk_atom("ok"),
+        ERL_DRV_ATOM, ATOM(ok),
         // Start of list
-        ERL_DRV_ATOM, driver_mk_atom("databases_size"),
+        ERL_DRV_ATOM, ATOM(databases_size),
         ERL_DRV_UINT, G_DATABASES_SIZE,
         ERL_DRV_TUPLE, 2,
-        ERL_DRV_ATOM, driver_mk_atom("deadlock_interval"),
+        ERL_DRV_ATOM, ATOM(deadlock_interval),
         ERL_DRV_UINT, G_DEADLOCK_CHECK_INTERVAL,
         ERL_DRV_TUPLE, 2,
-        ERL_DRV_ATOM, driver_mk_atom("trickle_interval"),
+        ERL_DRV_ATOM, ATOM(trickle_interval),
         ERL_DRV_UINT, G_TRICKLE_INTERVAL,
         ERL_DRV_TUPLE, 2,
-        ERL_DRV_ATOM, driver_mk_atom("trickle_percentage"),
+        ERL_DRV_ATOM, ATOM(trickle_percentage),
         ERL_DRV_UINT, G_TRICKLE_PERCENTAGE,
         ERL_DRV_TUPLE, 2,
-        ERL_DRV_ATOM, driver_mk_atom("checkpoint_interval"),
+        ERL_DRV_ATOM, ATOM(checkpoint_interval),
         ERL_DRV_UINT, G_CHECKPOINT_INTERVAL,
         ERL_DRV_TUPLE, 2,
-        ERL_DRV_ATOM, driver_mk_atom("num_general_threads"),
+        ERL_DRV_ATOM, ATOM(num_general_threads),
         ERL_DRV_UINT, G_NUM_GENERAL_THREADS,
         ERL_DRV_TUPLE, 2,
-        ERL_DRV_ATOM, driver_mk_atom("num_txn_threads"),
+        ERL_DRV_ATOM, ATOM(num_txn_threads),
         ERL_DRV_UINT, G_NUM_TXN_THREADS,
         ERL_DRV_TUPLE, 2,
-        ERL_DRV_ATOM, driver_mk_atom("general_jobs_pending"),
+        ERL_DRV_ATOM, ATOM(general_jobs_pending),
         ERL_DRV_UINT, general_pending,
         ERL_DRV_TUPLE, 2,
-        ERL_DRV_ATOM, driver_mk_atom("general_jobs_active"),
+        ERL_DRV_ATOM, ATOM(general_jobs_active),
         ERL_DRV_UINT, general_active,
         ERL_DRV_TUPLE, 2,
-        ERL_DRV_ATOM, driver_mk_atom("txn_jobs_pending"),
+        ERL_DRV_ATOM, ATOM(txn_jobs_pending),
         ERL_DRV_UINT, txn_pending,
         ERL_DRV_TUPLE, 2,
-        ERL_DRV_ATOM, driver_mk_atom("txn_jobs_active"),
+        ERL_DRV_ATOM, ATOM(txn_jobs_active),
         ERL_DRV_UINT, txn_active,
         ERL_DRV_TUPLE, 2,
+        ERL_DRV_ATOM, ATOM(max_general_pending),
+        ERL_DRV_UINT, G_MAX_GENERAL_PENDING,
+        ERL_DRV_TUPLE, 2,
+        ERL_DRV_ATOM, ATOM(max_txn_pending),
+        ERL_DRV_UINT, G_MAX_TXN_PENDING,
+        ERL_DRV_TUPLE, 2,
+        ERL_DRV_ATOM, ATOM(max_read_pending),
+        ERL_DRV_UINT, G_MAX_READ_PENDING,
+        ERL_DRV_TUPLE, 2,
+        ERL_DRV_ATOM, ATOM(max_write_pending),
+        ERL_DRV_UINT, G_MAX_WRITE_PENDING,
+        ERL_DRV_TUPLE, 2,
+        ERL_DRV_ATOM, ATOM(max_stat_pending),
+        ERL_DRV_UINT, G_MAX_STAT_PENDING,
+        ERL_DRV_TUPLE, 2,
+        ERL_DRV_ATOM, ATOM(sample_interval),
+        ERL_DRV_UINT, G_SAMPLE_INTERVAL,
+        ERL_DRV_TUPLE, 2,
+        ERL_DRV_ATOM, ATOM(sample_slots),
+        ERL_DRV_UINT, G_SAMPLE_SLOTS,
+        ERL_DRV_TUPLE, 2,
+        ERL_DRV_ATOM, ATOM(trace_entries),
+        ERL_DRV_UINT, G_TRACE_ENTRIES,
+        ERL_DRV_TUPLE, 2,
+        ERL_DRV_ATOM, ATOM(slow_op_usecs),
+        ERL_DRV_UINT, G_SLOW_OP_USECS,
+        ERL_DRV_TUPLE, 2,
+        ERL_DRV_ATOM, ATOM(capture_buffer_kb),
+        ERL_DRV_UINT, G_CAPTURE_BUFFER_KB,
+        ERL_DRV_TUPLE, 2,
+        ERL_DRV_ATOM, ATOM(capture_records),
+        ERL_DRV_UINT, (ErlDrvUInt)capture_records,
+        ERL_DRV_TUPLE, 2,
+        ERL_DRV_ATOM, ATOM(capture_dropped),
+        ERL_DRV_UINT, (ErlDrvUInt)capture_dropped,
+        ERL_DRV_TUPLE, 2,
+        ERL_DRV_ATOM, ATOM(crc32_impl),
+        ERL_DRV_ATOM, driver_mk_atom((char*)bdberl_crc32_impl()),
+        ERL_DRV_TUPLE, 2,
+        ERL_DRV_ATOM, ATOM(crc32c_impl),
+        ERL_DRV_ATOM, driver_mk_atom((char*)bdberl_crc32c_impl()),
+        ERL_DRV_TUPLE, 2,
+        ERL_DRV_ATOM, ATOM(lock_stat_interval),
+        ERL_DRV_UINT, G_LOCK_STAT_INTERVAL,
+        ERL_DRV_TUPLE, 2,
+        ERL_DRV_ATOM, ATOM(deadlocks),
+        ERL_DRV_UINT, (ErlDrvUInt)locks.deadlocks,
+        ERL_DRV_TUPLE, 2,
+        ERL_DRV_ATOM, ATOM(lock_failures),
+        ERL_DRV_UINT, (ErlDrvUInt)locks.lock_failures,
+        ERL_DRV_TUPLE, 2,
+        ERL_DRV_ATOM, ATOM(lock_failure_usecs),
+        ERL_DRV_UINT, (ErlDrvUInt)locks.lock_failure_usecs,
+        ERL_DRV_TUPLE, 2,
+        ERL_DRV_ATOM, ATOM(deadlock_rate),
+        ERL_DRV_FLOAT, (ErlDrvTermData)&locks.deadlock_rate,
+        ERL_DRV_TUPLE, 2,
+        ERL_DRV_ATOM, ATOM(lock_wait_rate),
+        ERL_DRV_FLOAT, (ErlDrvTermData)&locks.lock_wait_rate,
+        ERL_DRV_TUPLE, 2,
+        ERL_DRV_ATOM, ATOM(lock_nowait_rate),
+        ERL_DRV_FLOAT, (ErlDrvTermData)&locks.lock_nowait_rate,
+        ERL_DRV_TUPLE, 2,
+        ERL_DRV_ATOM, ATOM(lock_timeout_rate),
+        ERL_DRV_FLOAT, (ErlDrvTermData)&locks.lock_timeout_rate,
+        ERL_DRV_TUPLE, 2,
+        ERL_DRV_ATOM, ATOM(txn_timeout_rate),
+        ERL_DRV_FLOAT, (ErlDrvTermData)&locks.txn_timeout_rate,
+        ERL_DRV_TUPLE, 2,
+        ERL_DRV_ATOM, ATOM(lock_request_rate),
+        ERL_DRV_FLOAT, (ErlDrvTermData)&locks.lock_request_rate,
+        ERL_DRV_TUPLE, 2,
         // End of list
         ERL_DRV_NIL,
-        ERL_DRV_LIST, 11+1,
+        ERL_DRV_LIST, 35+1,
         ERL_DRV_TUPLE, 2
     };
     driver_send_term(port, pid, response, sizeof(response) / sizeof(response[0]));
 }
 
 
+// Push [{gets, N}, {get_hits, N}, ...] for one database onto spec, followed by its value
+// cache and key filter counters
+static int push_db_counters_spec(ErlDrvTermData* spec, int i, const DbCounters* counters,
+                                 const CacheStats* cache, const FilterStats* filter)
+{
+#define PUSH_DB_COUNTER(field)                                                  \
+    spec[i++] = ERL_DRV_ATOM; spec[i++] = ATOM(field);                          \
+    spec[i++] = ERL_DRV_UINT; spec[i++] = (ErlDrvUInt)(counters->field);         \
+    spec[i++] = ERL_DRV_TUPLE; spec[i++] = 2;
+
+    PUSH_DB_COUNTER(gets);
+    PUSH_DB_COUNTER(get_hits);
+    PUSH_DB_COUNTER(get_misses);
+    PUSH_DB_COUNTER(puts);
+    PUSH_DB_COUNTER(dels);
+    PUSH_DB_COUNTER(cursor_steps);
+    PUSH_DB_COUNTER(bytes_read);
+    PUSH_DB_COUNTER(bytes_written);
+    PUSH_DB_COUNTER(crc_failures);
+    PUSH_DB_COUNTER(deadlocks);
+    PUSH_DB_COUNTER(lock_not_granted);
+#undef PUSH_DB_COUNTER
+#define PUSH_CACHE_COUNTER(name, field)                                         \
+    spec[i++] = ERL_DRV_ATOM; spec[i++] = ATOM(name);                           \
+    spec[i++] = ERL_DRV_UINT; spec[i++] = (ErlDrvUInt)(cache->field);            \
+    spec[i++] = ERL_DRV_TUPLE; spec[i++] = 2;
+
+    PUSH_CACHE_COUNTER(value_cache_hits, hits);
+    PUSH_CACHE_COUNTER(value_cache_misses, misses);
+    PUSH_CACHE_COUNTER(value_cache_evictions, evictions);
+    PUSH_CACHE_COUNTER(value_cache_entries, entries);
+    PUSH_CACHE_COUNTER(value_cache_bytes, bytes);
+#undef PUSH_CACHE_COUNTER
+#define PUSH_FILTER_COUNTER(name, field)                                        \
+    spec[i++] = ERL_DRV_ATOM; spec[i++] = ATOM(name);                           \
+    spec[i++] = ERL_DRV_UINT; spec[i++] = (ErlDrvUInt)(filter->field);           \
+    spec[i++] = ERL_DRV_TUPLE; spec[i++] = 2;
+
+    PUSH_FILTER_COUNTER(key_filter_rejects, rejects);
+    PUSH_FILTER_COUNTER(key_filter_false_positives, false_positives);
+    PUSH_FILTER_COUNTER(key_filter_counters, counters);
+    PUSH_FILTER_COUNTER(key_filter_counters_set, counters_set);
+    PUSH_FILTER_COUNTER(key_filter_bytes, bytes);
+#undef PUSH_FILTER_COUNTER
+    spec[i++] = ERL_DRV_NIL;
+    spec[i++] = ERL_DRV_LIST; spec[i++] = 21+1;
+    return i;
+}
+
+// Send {ok, [{DbRef, Name, Counters}]} for one database or, if dbref is -1, every open
+// database. Counters are read without stopping the workers so they are only approximately
+// consistent with each other.
+static void do_sync_db_counters(PortData *d, int dbref)
+{
+    // Per database: DbRef (2) + Name (3) + counters (130) + tuple (2)
+    const int per_db = 140;
+    int first = dbref;
+    int last = dbref;
+    int i = 0;
+    int db;
+    int count = 0;
+
+    if (dbref == -1)
+    {
+        first = 0;
+        last = G_DATABASES_SIZE - 1;
+    }
+    else if (dbref < 0 || dbref >= G_DATABASES_SIZE)
+    {
+        bdberl_send_rc(d->port, d->port_owner, ERROR_INVALID_DBREF);
+        return;
+    }
+
+    LOCK_DATABASES(d->port);
+
+    int max_dbs = 0;
+    for (db = first; db <= last; db++)
+    {
+        if (G_DATABASES[db].db != NULL)
+        {
+            max_dbs++;
+        }
+    }
+
+    if (dbref != -1 && max_dbs == 0)
+    {
+        UNLOCK_DATABASES(d->port);
+        bdberl_send_rc(d->port, d->port_owner, ERROR_INVALID_DBREF);
+        return;
+    }
+
+    ErlDrvTermData* spec = driver_alloc(sizeof(ErlDrvTermData) * (max_dbs * per_db + 16));
+    spec[i++] = ERL_DRV_ATOM; spec[i++] = ATOM(ok);
+    for (db = first; db <= last; db++)
+    {
+        Database* database = &G_DATABASES[db];
+        if (database->db == NULL)
+        {
+            continue;
+        }
+
+        spec[i++] = ERL_DRV_INT;    spec[i++] = db;
+        spec[i++] = ERL_DRV_STRING; spec[i++] = (ErlDrvTermData)database->name;
+        spec[i++] = strlen(database->name);
+        CacheStats cache;
+        if (database->options.cache)
+        {
+            bdberl_cache_stats(database->options.cache, &cache);
+        }
+        else
+        {
+            memset(&cache, '\0', sizeof(CacheStats));
+        }
+        FilterStats filter;
+        if (database->options.filter)
+        {
+            bdberl_filter_stats(database->options.filter, &filter);
+        }
+        else
+        {
+            memset(&filter, '\0', sizeof(FilterStats));
+        }
+        i = push_db_counters_spec(spec, i, &(database->counters), &cache, &filter);
+        spec[i++] = ERL_DRV_TUPLE;  spec[i++] = 3;
+        count++;
+    }
+    spec[i++] = ERL_DRV_NIL;
+    spec[i++] = ERL_DRV_LIST; spec[i++] = count+1;
+    spec[i++] = ERL_DRV_TUPLE; spec[i++] = 2;
+
+    // driver_send_term copies the name strings, so the lock can be dropped afterwards
+    driver_send_term(d->port, d->port_owner, spec, i);
+    UNLOCK_DATABASES(d->port);
+
+    driver_free(spec);
+}
+
+// Push [{count, N}, {min, Usecs}, {mean, Usecs}, {p50, Usecs}, ..., {max, Usecs}] onto spec
+static int push_histo_spec(ErlDrvTermData* spec, int i, const Histo* h)
+{
+#define PUSH_HISTO_VALUE(name, value)                         \
+    spec[i++] = ERL_DRV_ATOM; spec[i++] = ATOM(name);           \
+    spec[i++] = ERL_DRV_UINT; spec[i++] = (ErlDrvUInt)(value);  \
+    spec[i++] = ERL_DRV_TUPLE; spec[i++] = 2;
+
+    PUSH_HISTO_VALUE(count,   h->count);
+    PUSH_HISTO_VALUE(min,     h->min);
+    PUSH_HISTO_VALUE(mean,    bdberl_histo_mean(h));
+    PUSH_HISTO_VALUE(p50,     bdberl_histo_percentile(h, 50.0));
+    PUSH_HISTO_VALUE(p90,     bdberl_histo_percentile(h, 90.0));
+    PUSH_HISTO_VALUE(p99,     bdberl_histo_percentile(h, 99.0));
+    PUSH_HISTO_VALUE(p999,    bdberl_histo_percentile(h, 99.9));
+    PUSH_HISTO_VALUE(max,     h->max);
+#undef PUSH_HISTO_VALUE
+    spec[i++] = ERL_DRV_NIL;
+    spec[i++] = ERL_DRV_LIST; spec[i++] = 8+1;
+    return i;
+}
+
+// Send {ok, [{Cmd, [{queue, Stats}, {service, Stats}]}]} for every command that has run since
+// the last reset. Latencies are in microseconds; percentiles are bucket upper bounds.
+static void do_sync_latency_stats(PortData *d, unsigned int flags)
+{
+    // Per tag: {Cmd, [{queue, S}, {service, S}]} where each S is 51 terms
+    ErlDrvTermData* spec = driver_alloc(sizeof(ErlDrvTermData) * (LATENCY_TAGS * 128 + 16));
+    Histo* queue_wait = driver_alloc(sizeof(Histo));
+    Histo* service = driver_alloc(sizeof(Histo));
+    int i = 0;
+    int tag;
+    int count = 0;
+
+    spec[i++] = ERL_DRV_ATOM; spec[i++] = ATOM(ok);
+    for (tag = 0; tag < LATENCY_TAGS; tag++)
+    {
+        bdberl_histo_reset(queue_wait);
+        bdberl_histo_reset(service);
+        bdberl_tpool_latency(G_TPOOL_GENERAL, tag, queue_wait, service);
+        bdberl_tpool_latency(G_TPOOL_TXNS, tag, queue_wait, service);
+        if (service->count == 0)
+        {
+            continue;
+        }
+
+        spec[i++] = ERL_DRV_ATOM; spec[i++] = ATOM_AT(G_LATENCY_TAG_ATOMS[tag]);
+        spec[i++] = ERL_DRV_ATOM; spec[i++] = ATOM(queue);
+        i = push_histo_spec(spec, i, queue_wait);
+        spec[i++] = ERL_DRV_TUPLE; spec[i++] = 2;
+        spec[i++] = ERL_DRV_ATOM; spec[i++] = ATOM(service);
+        i = push_histo_spec(spec, i, service);
+        spec[i++] = ERL_DRV_TUPLE; spec[i++] = 2;
+        spec[i++] = ERL_DRV_NIL;
+        spec[i++] = ERL_DRV_LIST; spec[i++] = 2+1;
+        spec[i++] = ERL_DRV_TUPLE; spec[i++] = 2;
+        count++;
+    }
+    spec[i++] = ERL_DRV_NIL;
+    spec[i++] = ERL_DRV_LIST; spec[i++] = count+1;
+    spec[i++] = ERL_DRV_TUPLE; spec[i++] = 2;
+
+    driver_send_term(d->port, d->port_owner, spec, i);
+
+    if (flags & LATENCY_STATS_RESET)
+    {
+        bdberl_tpool_latency_reset(G_TPOOL_GENERAL);
+        bdberl_tpool_latency_reset(G_TPOOL_TXNS);
+    }
+
+    driver_free(service);
+    driver_free(queue_wait);
+    driver_free(spec);
+}
+
+
 static void* driver_calloc(unsigned int size)
 {
     void* res = driver_alloc(size);
@@ -2359,8 +4266,78 @@ int util_thread_usleep(unsigned int usecs)
 /**
  * Thread function that runs the deadlock checker periodically
  */
+/**
+ * Cumulative lock counters at the time of the last lock_stat sample
+ */
+typedef struct
+{
+    uint64_t usecs;
+    uint64_t deadlocks;
+    uint64_t lock_wait;
+    uint64_t lock_nowait;
+    uint64_t lock_timeouts;
+    uint64_t txn_timeouts;
+    uint64_t requests;
+} LockSample;
+
+// Sample lock_stat, turn the change since the last sample into rates and send the deltas to
+// the logger as {bdb_lock_stats, IntervalMsecs, Deadlocks, LockWaits, LockNowaits,
+// LockTimeouts, TxnTimeouts, Requests}. The first sample only establishes a baseline.
+static void sample_lock_stats(LockSample* last)
+{
+    DB_LOCK_STAT *lsp = NULL;
+    int rc = G_DB_ENV->lock_stat(G_DB_ENV, &lsp, 0);
+    if (rc != 0)
+    {
+        DBG("lock_stat returned %s(%d)\n", db_strerror(rc), rc);
+        return;
+    }
+
+    LockSample now;
+    now.usecs         = bdberl_now_usecs();
+    now.deadlocks     = G_LOCK_TELEMETRY.deadlocks;
+    now.lock_wait     = lsp->st_lock_wait;
+    now.lock_nowait   = lsp->st_lock_nowait;
+    now.lock_timeouts = lsp->st_nlocktimeouts;
+    now.txn_timeouts  = lsp->st_ntxntimeouts;
+    now.requests      = lsp->st_nrequests;
+    driver_free(lsp);
+
+    if (last->usecs != 0 && now.usecs > last->usecs)
+    {
+        uint64_t elapsed = now.usecs - last->usecs;
+        double secs = elapsed / 1000000.0;
+
+        erl_drv_mutex_lock(G_LOCK_TELEMETRY_MUTEX);
+        G_LOCK_TELEMETRY.deadlock_rate     = (now.deadlocks - last->deadlocks) / secs;
+        G_LOCK_TELEMETRY.lock_wait_rate    = (now.lock_wait - last->lock_wait) / secs;
+        G_LOCK_TELEMETRY.lock_nowait_rate  = (now.lock_nowait - last->lock_nowait) / secs;
+        G_LOCK_TELEMETRY.lock_timeout_rate = (now.lock_timeouts - last->lock_timeouts) / secs;
+        G_LOCK_TELEMETRY.txn_timeout_rate  = (now.txn_timeouts - last->txn_timeouts) / secs;
+        G_LOCK_TELEMETRY.lock_request_rate = (now.requests - last->requests) / secs;
+        erl_drv_mutex_unlock(G_LOCK_TELEMETRY_MUTEX);
+
+        ErlDrvTermData response[] = { ERL_DRV_ATOM, ATOM(bdb_lock_stats),
+                                      ERL_DRV_UINT, elapsed / 1000,                      /* Interval in msecs */
+                                      ERL_DRV_UINT, now.deadlocks - last->deadlocks,     /* Detector rejections */
+                                      ERL_DRV_UINT, now.lock_wait - last->lock_wait,     /* Requests that waited */
+                                      ERL_DRV_UINT, now.lock_nowait - last->lock_nowait, /* Requests refused */
+                                      ERL_DRV_UINT, now.lock_timeouts - last->lock_timeouts,
+                                      ERL_DRV_UINT, now.txn_timeouts - last->txn_timeouts,
+                                      ERL_DRV_UINT, now.requests - last->requests,
+                                      ERL_DRV_TUPLE, 8};
+        send_log_message(response, sizeof(response));
+    }
+
+    *last = now;
+}
+
 static void* deadlock_check(void* arg)
 {
+    LockSample last_sample;
+    memset(&last_sample, '\0', sizeof(last_sample));
+    uint64_t next_sample_usecs = 0;
+
     while(G_DEADLOCK_CHECK_ACTIVE)
     {
         // Run the lock detection
@@ -2373,6 +4350,15 @@ static void* deadlock_check(void* arg)
         if (count > 0)
         {
             DBG("Rejected deadlocks: %d\n", count);
+            __sync_fetch_and_add(&G_LOCK_TELEMETRY.deadlocks, count);
+        }
+
+        // Periodically turn lock_stat into rates
+        uint64_t now = bdberl_now_usecs();
+        if (now >= next_sample_usecs)
+        {
+            sample_lock_stats(&last_sample);
+            next_sample_usecs = now + (uint64_t)G_LOCK_STAT_INTERVAL * 1000000;
         }
 
         if (G_DEADLOCK_CHECK_INTERVAL > 0)
@@ -2399,15 +4385,17 @@ static void* checkpointer(void* arg)
         if (now - last_checkpoint_time > G_CHECKPOINT_INTERVAL)
         {
             // Time to checkpoint and cleanup log files
+            BDBERL_PROBE0(checkpoint__start);
             int checkpoint_rc = G_DB_ENV->txn_checkpoint(G_DB_ENV, 0, 0, 0);
 
             // Mark the time before starting log_archive so we can know how long it took
             time_t log_now = time(0);
             int log_rc = G_DB_ENV->log_archive(G_DB_ENV, NULL, DB_ARCH_REMOVE);
             time_t finish_now = time(0);
+            BDBERL_PROBE2(checkpoint__done, checkpoint_rc, finish_now - now);
 
             // Bundle up the results and elapsed time into a message for the logger
-            ErlDrvTermData response[] = { ERL_DRV_ATOM, driver_mk_atom("bdb_checkpoint_stats"),
+            ErlDrvTermData response[] = { ERL_DRV_ATOM, ATOM(bdb_checkpoint_stats),
                                           ERL_DRV_UINT, log_now - now,        /* Elapsed seconds for checkpoint */
                                           ERL_DRV_UINT, finish_now - log_now, /* Elapsed seconds for log_archive */
                                           ERL_DRV_INT, checkpoint_rc,         /* Return code of checkpoint */
@@ -2422,11 +4410,13 @@ static void* checkpointer(void* arg)
         {
             // Time to run the trickle operation again
             int pages_wrote = 0;
+            BDBERL_PROBE1(trickle__start, G_TRICKLE_PERCENTAGE);
             int rc = G_DB_ENV->memp_trickle(G_DB_ENV, G_TRICKLE_PERCENTAGE, &pages_wrote);
             time_t finish_now = time(0);
+            BDBERL_PROBE2(trickle__done, rc, pages_wrote);
 
             // Bundle up the results and elapsed time into a message for the logger
-            ErlDrvTermData response[] = { ERL_DRV_ATOM, driver_mk_atom("bdb_trickle_stats"),
+            ErlDrvTermData response[] = { ERL_DRV_ATOM, ATOM(bdb_trickle_stats),
                                           ERL_DRV_UINT, finish_now - now,        /* Elapsed seconds for trickle */
                                           ERL_DRV_UINT, pages_wrote,             /* Number of pages flushed */
                                           ERL_DRV_INT, rc,                       /* Return code of checkpoint */
@@ -2446,7 +4436,7 @@ static void* checkpointer(void* arg)
 
 static void bdb_errcall(const DB_ENV* dbenv, const char* errpfx, const char* msg)
 {
-    ErlDrvTermData response[] = { ERL_DRV_ATOM, driver_mk_atom("bdb_error_log"),
+    ErlDrvTermData response[] = { ERL_DRV_ATOM, ATOM(bdb_error_log),
                                   ERL_DRV_STRING, (ErlDrvTermData)msg, (ErlDrvUInt)strlen(msg),
                                   ERL_DRV_TUPLE, 2};
     send_log_message(response, sizeof(response));
@@ -2455,7 +4445,7 @@ static void bdb_errcall(const DB_ENV* dbenv, const char* errpfx, const char* msg
 
 static void bdb_msgcall(const DB_ENV* dbenv, const char* msg)
 {
-    ErlDrvTermData response[] = { ERL_DRV_ATOM, driver_mk_atom("bdb_info_log"),
+    ErlDrvTermData response[] = { ERL_DRV_ATOM, ATOM(bdb_info_log),
                                   ERL_DRV_STRING, (ErlDrvTermData)msg, (ErlDrvUInt)strlen(msg),
                                   ERL_DRV_TUPLE, 2};
     send_log_message(response, sizeof(response));
@@ -2469,7 +4459,7 @@ static void bdb_eventcall(DB_ENV* dbenv, u_int32_t type, void* info)
     case DB_EVENT_PANIC:
     {
         const char *msg = "panic";
-        ErlDrvTermData response[] = { ERL_DRV_ATOM, driver_mk_atom("bdb_event_notify"),
+        ErlDrvTermData response[] = { ERL_DRV_ATOM, ATOM(bdb_event_notify),
                                       ERL_DRV_STRING, (ErlDrvTermData)msg, (ErlDrvUInt)strlen(msg),
                                       ERL_DRV_TUPLE, 2};
         // TODO clearly something should be done to shut things down cleanly and restart (how?)
@@ -2480,7 +4470,7 @@ static void bdb_eventcall(DB_ENV* dbenv, u_int32_t type, void* info)
     case DB_EVENT_WRITE_FAILED:
     {
         const char *msg = "write failed";
-        ErlDrvTermData response[] = { ERL_DRV_ATOM, driver_mk_atom("bdb_event_notify"),
+        ErlDrvTermData response[] = { ERL_DRV_ATOM, ATOM(bdb_event_notify),
                                       ERL_DRV_STRING, (ErlDrvTermData)msg, (ErlDrvUInt)strlen(msg),
                                       ERL_DRV_TUPLE, 2};
         send_log_message(response, sizeof(response));
@@ -32,6 +32,9 @@
 #include <db.h>
 #include "bdberl_tpool.h"
 #include "bdberl_crc32.h"
+#include "bdberl_value.h"
+#include "bdberl_cache.h"
+#include "bdberl_filter.h"
 #include "bin_helper.h"
 
 
@@ -77,6 +80,16 @@
 #define CMD_CURSOR_PUT       36
 #define CMD_CURSOR_DEL       37
 #define CMD_CURSOR_COUNT     38
+#define CMD_LATENCY_STATS    39
+#define CMD_DB_COUNTERS      40
+#define CMD_SAMPLES          41
+#define CMD_TRACE_DUMP       42
+#define CMD_CAPTURE          43
+
+/**
+ * Flags for CMD_LATENCY_STATS
+ */
+#define LATENCY_STATS_RESET  1
 
 /**
  * Command status values
@@ -110,6 +123,10 @@
 #define ERROR_INVALID_CMD   (-29008) /* Invalid command code requested */
 #define ERROR_INVALID_DB_TYPE  (-29009) /* Invalid database type */
 #define ERROR_INVALID_VALUE (-29010) /* Invalid CRC-32 on value */
+#define ERROR_OVERLOADED    (-29011) /* Thread pool queue limit reached; request refused */
+#define ERROR_INVALID_OPTION (-29012) /* Malformed or unknown database option */
+#define ERROR_FORMAT_MISMATCH (-29013) /* Raw request on a term database or the reverse */
+#define ERROR_INVALID_KEY   (-29014) /* Key the database's key codec can't store */
 
 /**
  * System information ids
@@ -118,6 +135,7 @@
 #define SYSP_TXN_TIMEOUT_GET             2
 #define SYSP_DATA_DIR_GET                3
 #define SYSP_LOG_DIR_GET                 4
+#define SYSP_TPOOL_LOAD_GET              5
 
 
 
@@ -135,14 +153,207 @@ typedef struct _PortList
 } PortList;
 
 
+/**
+ * Per-database operation counters, maintained by the async workers with atomic adds so
+ * that they can be read at any time without stopping traffic.
+ */
+typedef struct
+{
+    uint64_t gets;
+    uint64_t get_hits;
+    uint64_t get_misses;
+    uint64_t puts;
+    uint64_t dels;
+    uint64_t cursor_steps;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint64_t crc_failures;
+    uint64_t deadlocks;
+    uint64_t lock_not_granted;
+} DbCounters;
+
+#define DB_COUNTER_ADD(counters, field, n) __sync_fetch_and_add(&((counters)->field), (n))
+
+
+/**
+ * Per-database settings, sent after the name in CMD_OPEN_DB as a list of
+ * << Tag:8, Len:8, Value:Len/bytes >>; a Len of 255 is followed by the real length as
+ * << Len:32 >>. They are applied when the database is first opened; opening a database that
+ * is already open shares the settings it has.
+ */
+#define DB_OPTION_CHECKSUM  1   /* One byte, VALUE_CHECKSUM_* used for new values */
+#define DB_OPTION_VERIFY    2   /* One byte, VERIFY_* */
+#define DB_OPTION_FORMAT    3   /* One byte, FORMAT_* */
+#define DB_OPTION_COMPRESS  4   /* One byte, COMPRESS_* used for new values */
+#define DB_OPTION_DICT      5   /* Preset dictionary for COMPRESS_LZ */
+#define DB_OPTION_BT_COMPRESS 6 /* One byte, non-zero for BDB's btree compression */
+#define DB_OPTION_PAGE_SIZE 7   /* Four bytes, overrides BDBERL_PAGE_SIZE for this database */
+#define DB_OPTION_BT_MINKEY 8   /* Four bytes, DB->set_bt_minkey */
+#define DB_OPTION_H_FFACTOR 9   /* Four bytes, DB->set_h_ffactor */
+#define DB_OPTION_H_NELEM   10  /* Four bytes, DB->set_h_nelem */
+#define DB_OPTION_RE_LEN    11  /* Four bytes, DB->set_re_len */
+#define DB_OPTION_DUP       12  /* One byte, DUP_* */
+#define DB_OPTION_KEY_ORDER 13  /* One byte, KEY_ORDER_* */
+#define DB_OPTION_KEY_CODEC 14  /* One byte, KEY_CODEC_* */
+#define DB_OPTION_H_HASH    15  /* One byte, H_HASH_* */
+#define DB_OPTION_VALUE_CACHE 16 /* Four bytes, byte budget of the value cache; zero for none */
+#define DB_OPTION_KEY_FILTER 17 /* Four bytes, keys the key filter is sized for; zero for none */
+#define DB_OPTION_LEN_EXT   255
+
+/**
+ * Driver options carried in the top byte of the flags of put, get, del, cursor_open and
+ * cursor_get. BDB does not use these bits for those calls; they are masked off before
+ * calling it.
+ */
+#define BDBERL_OPT_MASK     0xFF000000
+#define BDBERL_OPT_DECODE   0x01000000  /* Reply with the key and value decoded into terms */
+#define BDBERL_OPT_RAW      0x02000000  /* Key and value are raw binaries, see FORMAT_RAW */
+#define BDBERL_OPT_FRAMED   0x04000000  /* Put value is BDBERL_FRAME_ROOM bytes, then the term */
+
+/**
+ * Room a BDBERL_OPT_FRAMED put leaves in front of the term binary, enough for the largest
+ * value header. The driver writes the header for the database's checksum into the end of it,
+ * so callers of databases without the default CRC-32 skip computing one that would only be
+ * checked and thrown away, and the value isn't copied to be framed.
+ */
+#define BDBERL_FRAME_ROOM   (VALUE_HEADER_BASE + 8)
+
+/**
+ * Who checks values on reads. By default the worker's check is the only one: replies carry
+ * the bare term binary tagged as verified. End to end sends the stored value so the caller
+ * can check the CRC-32 again after the value has crossed into the VM.
+ */
+#define VERIFY_DRIVER       0
+#define VERIFY_END_TO_END   1
+
+/**
+ * What keys and values hold. Term databases store term_to_binary output, with a checksum
+ * the caller computes for the default layout. Raw databases store keys and values as the
+ * caller gave them, so btree keys sort in byte order; the driver frames values with the
+ * database's checksum, and only requests carrying BDBERL_OPT_RAW are accepted. Replies from
+ * raw databases are {raw, Key, Value}, checked by the driver whatever the verify setting.
+ */
+#define FORMAT_TERM         0
+#define FORMAT_RAW          1
+
+/**
+ * Compression of new values in term databases. Values are compressed by the worker that puts
+ * them and inflated by the worker that reads them, so replies look the same either way; see
+ * bdberl_value.h for the layout. Values compressed against a dictionary need the same
+ * dictionary on later opens and fail with ERROR_INVALID_VALUE without it.
+ */
+#define COMPRESS_NONE       0
+#define COMPRESS_LZ         1
+
+/**
+ * Duplicate data items, set with DB->set_flags before the database is created
+ */
+#define DUP_NONE            0
+#define DUP_UNSORTED        1   /* DB_DUP */
+#define DUP_SORTED          2   /* DB_DUPSORT */
+
+/**
+ * Order of btree keys. BDB does not record comparison functions, so a database created with
+ * KEY_ORDER_TERM must be opened with it every time.
+ */
+#define KEY_ORDER_BYTES     0   /* memcmp of the external format, BDB's default */
+#define KEY_ORDER_TERM      1   /* Erlang term order, see bdberl_term_cmp.h */
+
+/**
+ * How keys of term databases are stored. Ordered keys are encoded by the worker on the way
+ * in and decoded on the way out, so requests and replies still carry term_to_binary keys;
+ * keys of other types are refused with ERROR_INVALID_KEY. Fixed for the life of the database.
+ */
+#define KEY_CODEC_NONE      0   /* term_to_binary output as sent */
+#define KEY_CODEC_ORDERED   1   /* bdberl_key.h; integers, atoms, binaries and tuples */
+
+/**
+ * Hash function of hash databases. BDB stores a check value of the function in the meta
+ * page when the database is created and refuses to open it with a different one (EINVAL).
+ */
+#define H_HASH_DEFAULT      0   /* BDB's own, FNV-1 over the key bytes */
+#define H_HASH_XXH64        1   /* XXH64 folded to 32 bits, see bdberl_xxhash.h */
+
+typedef struct
+{
+    int checksum;
+    int verify;
+    int format;
+    int compress;
+    const unsigned char* dict_data;     /* Points into the open request until the db opens */
+    unsigned int dict_size;
+    LzDict* dict;                       /* Built from dict_data on the first open */
+    int bt_compress;                    /* DB->set_bt_compress with the default codec */
+    unsigned int page_size;             /* Physical layout; zero leaves the BDB default */
+    unsigned int bt_minkey;
+    unsigned int h_ffactor;
+    unsigned int h_nelem;
+    unsigned int re_len;
+    int dup;
+    int key_order;
+    int key_codec;
+    int h_hash;
+    unsigned int cache_size;
+    ValueCache* cache;                  /* Built on the first open when cache_size is set */
+    unsigned int filter_capacity;
+    KeyFilter* volatile filter;         /* Published when its build finishes; NULL until then */
+    struct FilterBuild* filter_build;   /* From the first open until the db closes */
+} DbOptions;
+
+
 typedef struct
 {
     DB*  db;
     const char* name;
     PortList* ports;
+    DbCounters counters;
+    DbOptions options;
 } Database;
 
 
+/**
+ * The scan that fills a database's key filter, run as a job on the general pool after the
+ * first open so neither the open nor other ports wait on it. Puts made meanwhile log their
+ * key hashes in pending, and the job adds them with the keys it read before publishing the
+ * filter in options->filter; until then gets go to BDB.
+ */
+#define FILTER_BUILD_QUEUED  0
+#define FILTER_BUILD_RUNNING 1
+#define FILTER_BUILD_DONE    2
+
+#define FILTER_SCAN_RETRIES  100    /* Lock conflicts in a row before a build gives up */
+
+typedef struct FilterBuild
+{
+    ErlDrvMutex* lock;
+    ErlDrvCond* state_cv;       /* Signalled when the scan finishes or may start */
+    DB* db;
+    DbOptions* options;         /* Where the filter is published */
+    uint64_t* pending;
+    unsigned int pending_count;
+    unsigned int pending_size;
+    int state;                  /* FILTER_BUILD_* */
+    int paused;                 /* Truncates under way; BDB won't truncate with a cursor open */
+    volatile int canceled;      /* Set by close; the scan stops at its next key */
+} FilterBuild;
+
+
+/**
+ * A write made inside a transaction whose effect on the value cache or key filter waits
+ * until it commits
+ */
+#define TXN_WRITE_INVALIDATE 0  /* Drop the key from the value cache */
+#define TXN_WRITE_CLEAR      1  /* Drop the whole value cache, as truncate does */
+#define TXN_WRITE_UNFILTER   2  /* Remove the deleted key from the key filter */
+
+typedef struct
+{
+    int dbref;
+    int op;                     /* TXN_WRITE_* */
+    uint64_t hash;              /* bdberl_cache_hash or bdberl_filter_hash of the key */
+} TxnWrite;
+
+
 /**
  * Structure for holding port instance data
  */
@@ -162,6 +373,10 @@ typedef struct
 
     DBC* cursor;            /* Active cursor handle; each port may have only 1 cursor active */
 
+    int cursor_dbref;       /* Db reference the active cursor was opened on */
+
+    unsigned int cursor_options; /* BDBERL_OPT_* the active cursor was opened with */
+
     int async_dbref;            /* Db reference for async operations */
 
     int async_op;               /* Value indicating what async op is pending */
@@ -178,6 +393,14 @@ typedef struct
 
     unsigned int work_buffer_offset;
 
+    unsigned int port_id;       /* Sequence number identifying the port in request captures */
+
+    TxnWrite* txn_writes;       /* Writes of the open txn to databases with a cache or filter */
+
+    unsigned int txn_writes_count;
+
+    unsigned int txn_writes_size;
+
 } PortData;
 
 /**
@@ -191,11 +414,13 @@ void bdberl_async_cleanup_and_send_rc(PortData* d, int rc);
 char* bdberl_rc_to_atom_str(int rc);
 DB_ENV* bdberl_db_env(void);
 DB* bdberl_lookup_dbref(int dbref);
+Database* bdberl_lookup_database(int dbref);
 int bdberl_has_dbref(PortData* data, int dbref);
+int util_thread_usleep(unsigned int usecs);
 
-void bdberl_general_tpool_run(TPoolJobFunc main_fn,  PortData* d, TPoolJobFunc cancel_fn,
+int bdberl_general_tpool_run(TPoolJobFunc main_fn,  PortData* d, TPoolJobFunc cancel_fn,
     TPoolJob** job_ptr);
-void bdberl_txn_tpool_run(TPoolJobFunc main_fn,  PortData* d, TPoolJobFunc cancel_fn,
+int bdberl_txn_tpool_run(TPoolJobFunc main_fn,  PortData* d, TPoolJobFunc cancel_fn,
     TPoolJob** job_ptr);
 
 /**
@@ -0,0 +1,162 @@
+/* -------------------------------------------------------------------
+ *
+ * bdberl: Counting Bloom filter of the keys of a database
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ------------------------------------------------------------------- */
+
+#include <string.h>
+
+#include "erl_driver.h"
+#include "bdberl_filter.h"
+#include "bdberl_xxhash.h"
+
+#define FILTER_MIN_COUNTERS 1024
+#define FILTER_MAX_COUNTERS 0xFFFFFFF8ULL
+
+struct KeyFilter
+{
+    volatile uint32_t* words;
+    uint64_t counters;
+    volatile uint64_t counters_set;
+    volatile uint64_t rejects;
+    volatile uint64_t false_positives;
+};
+
+// Counter i of the key: double hashing over the two halves of the hash, then mapped onto
+// the table by multiplication rather than a modulo
+static inline uint32_t counter_of(KeyFilter* filter, uint64_t hash, unsigned int i)
+{
+    uint32_t h = (uint32_t)hash + i * ((uint32_t)(hash >> 32) | 1);
+    return (uint32_t)(((uint64_t)h * filter->counters) >> 32);
+}
+
+
+KeyFilter* bdberl_filter_create(uint64_t capacity)
+{
+    uint64_t counters = capacity * FILTER_COUNTERS_PER_KEY;
+    if (counters < FILTER_MIN_COUNTERS)
+    {
+        counters = FILTER_MIN_COUNTERS;
+    }
+    else if (counters > FILTER_MAX_COUNTERS)
+    {
+        counters = FILTER_MAX_COUNTERS;
+    }
+    counters = (counters + 7) & ~7ULL;
+
+    KeyFilter* filter = driver_alloc(sizeof(KeyFilter));
+    memset(filter, '\0', sizeof(KeyFilter));
+    filter->counters = counters;
+    filter->words = driver_alloc(counters / 2);
+    memset((void*)filter->words, '\0', counters / 2);
+    return filter;
+}
+
+void bdberl_filter_free(KeyFilter* filter)
+{
+    if (filter == NULL)
+    {
+        return;
+    }
+    driver_free((void*)filter->words);
+    driver_free(filter);
+}
+
+uint64_t bdberl_filter_hash(const void* key, unsigned int key_size)
+{
+    return bdberl_xxh64((const unsigned char*)key, key_size, 0);
+}
+
+void bdberl_filter_add(KeyFilter* filter, uint64_t hash)
+{
+    unsigned int i;
+    for (i = 0; i < FILTER_HASHES; i++)
+    {
+        uint32_t c = counter_of(filter, hash, i);
+        volatile uint32_t* word = &(filter->words[c >> 3]);
+        unsigned int shift = (c & 7) * 4;
+        uint32_t old;
+        unsigned int count;
+        do
+        {
+            old = *word;
+            count = (old >> shift) & 15;
+        } while (count < 15 && !__sync_bool_compare_and_swap(word, old, old + (1U << shift)));
+
+        if (count == 0)
+        {
+            __sync_fetch_and_add(&(filter->counters_set), 1);
+        }
+    }
+}
+
+void bdberl_filter_remove(KeyFilter* filter, uint64_t hash)
+{
+    unsigned int i;
+    for (i = 0; i < FILTER_HASHES; i++)
+    {
+        uint32_t c = counter_of(filter, hash, i);
+        volatile uint32_t* word = &(filter->words[c >> 3]);
+        unsigned int shift = (c & 7) * 4;
+        uint32_t old;
+        unsigned int count;
+        do
+        {
+            old = *word;
+            count = (old >> shift) & 15;
+        } while (count > 0 && count < 15 &&
+                 !__sync_bool_compare_and_swap(word, old, old - (1U << shift)));
+
+        if (count == 1)
+        {
+            __sync_fetch_and_sub(&(filter->counters_set), 1);
+        }
+    }
+}
+
+int bdberl_filter_may_contain(KeyFilter* filter, uint64_t hash)
+{
+    unsigned int i;
+    for (i = 0; i < FILTER_HASHES; i++)
+    {
+        uint32_t c = counter_of(filter, hash, i);
+        if (((filter->words[c >> 3] >> ((c & 7) * 4)) & 15) == 0)
+        {
+            __sync_fetch_and_add(&(filter->rejects), 1);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void bdberl_filter_false_positive(KeyFilter* filter)
+{
+    __sync_fetch_and_add(&(filter->false_positives), 1);
+}
+
+void bdberl_filter_stats(KeyFilter* filter, FilterStats* stats)
+{
+    stats->rejects = filter->rejects;
+    stats->false_positives = filter->false_positives;
+    stats->counters = filter->counters;
+    stats->counters_set = filter->counters_set;
+    stats->bytes = sizeof(KeyFilter) + filter->counters / 2;
+}
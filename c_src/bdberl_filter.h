@@ -0,0 +1,77 @@
+/* -------------------------------------------------------------------
+ *
+ * bdberl: Counting Bloom filter of the keys of a database
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ------------------------------------------------------------------- */
+#ifndef _BDBERL_FILTER
+#define _BDBERL_FILTER
+
+#include <stdint.h>
+
+/**
+ * Counting Bloom filter over the keys of a database, as BDB stores them, so gets of keys
+ * that were never written can be answered not_found without a BDB call.
+ *
+ * Each key sets FILTER_HASHES of 4-bit counters, FILTER_COUNTERS_PER_KEY counters a key at
+ * capacity, for a false positive rate of about 1% there. Counters are packed eight to a
+ * 32-bit word and changed with compare-and-swap, so adds and removes from the workers
+ * need no lock and lookups from the emulator threads only read.
+ *
+ * A key must be added before it is written to BDB and removed only once its delete is
+ * visible, so a reader that can find the key in BDB always finds its counters set. A
+ * counter that reaches 15 stays there. Keys put more than once are counted once a put, so
+ * their counters stay above zero after the delete; those are false positives, never
+ * false negatives.
+ */
+#define FILTER_HASHES           7
+#define FILTER_COUNTERS_PER_KEY 10
+
+typedef struct
+{
+    uint64_t rejects;           /* Lookups the filter answered not_found */
+    uint64_t false_positives;   /* Lookups it let through that BDB answered not_found */
+    uint64_t counters;
+    uint64_t counters_set;      /* Counters above zero */
+    uint64_t bytes;
+} FilterStats;
+
+typedef struct KeyFilter KeyFilter;
+
+/**
+ * Prototypes in bdberl_filter.c
+ */
+KeyFilter* bdberl_filter_create(uint64_t capacity);
+void       bdberl_filter_free(KeyFilter* filter);
+
+uint64_t   bdberl_filter_hash(const void* key, unsigned int key_size);
+
+void bdberl_filter_add(KeyFilter* filter, uint64_t hash);
+void bdberl_filter_remove(KeyFilter* filter, uint64_t hash);
+
+/**
+ * Zero if no key with this hash has been added, counting a reject; non-zero if it may have
+ */
+int  bdberl_filter_may_contain(KeyFilter* filter, uint64_t hash);
+void bdberl_filter_false_positive(KeyFilter* filter);
+
+void bdberl_filter_stats(KeyFilter* filter, FilterStats* stats);
+
+#endif // _BDBERL_FILTER
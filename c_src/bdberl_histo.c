@@ -0,0 +1,148 @@
+/* -------------------------------------------------------------------
+ *
+ * bdberl: Latency histograms
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ------------------------------------------------------------------- */
+
+#include "bdberl_histo.h"
+
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+// Index of the most significant set bit; v must be non-zero
+static inline int msb32(uint32_t v)
+{
+    return 31 - __builtin_clz(v);
+}
+
+// Values below HISTO_SUB_BUCKETS map directly; above that each power of two gets
+// HISTO_SUB_BUCKETS slots keyed on the bits just below the leading one.
+static inline unsigned int bucket_index(uint32_t v)
+{
+    if (v < HISTO_SUB_BUCKETS)
+    {
+        return v;
+    }
+    int shift = msb32(v) - HISTO_SUB_BITS;
+    return (shift * HISTO_SUB_BUCKETS) + (v >> shift);
+}
+
+// Highest value that lands in the given bucket -- used when reporting percentiles
+static inline uint64_t bucket_upper(unsigned int index)
+{
+    if (index < 2 * HISTO_SUB_BUCKETS)
+    {
+        return index;
+    }
+    int shift = (index / HISTO_SUB_BUCKETS) - 1;
+    uint64_t base = (uint64_t)(index - (shift * HISTO_SUB_BUCKETS)) << shift;
+    return base + ((uint64_t)1 << shift) - 1;
+}
+
+void bdberl_histo_reset(Histo* h)
+{
+    memset(h, '\0', sizeof(Histo));
+}
+
+void bdberl_histo_record(Histo* h, uint64_t usecs)
+{
+    uint32_t v = (usecs > UINT32_MAX) ? UINT32_MAX : (uint32_t)usecs;
+    if (h->count == 0 || v < h->min)
+    {
+        h->min = v;
+    }
+    if (v > h->max)
+    {
+        h->max = v;
+    }
+    h->count++;
+    h->sum += v;
+    h->buckets[bucket_index(v)]++;
+}
+
+void bdberl_histo_merge(Histo* dest, const Histo* src)
+{
+    int i;
+    if (src->count == 0)
+    {
+        return;
+    }
+    if (dest->count == 0 || src->min < dest->min)
+    {
+        dest->min = src->min;
+    }
+    if (src->max > dest->max)
+    {
+        dest->max = src->max;
+    }
+    dest->count += src->count;
+    dest->sum += src->sum;
+    for (i = 0; i < HISTO_BUCKETS; i++)
+    {
+        dest->buckets[i] += src->buckets[i];
+    }
+}
+
+// Return the (bucket-rounded) value below which percentile% of the samples fall
+uint64_t bdberl_histo_percentile(const Histo* h, double percentile)
+{
+    int i;
+    if (h->count == 0)
+    {
+        return 0;
+    }
+    uint64_t target = (uint64_t)((percentile / 100.0) * h->count + 0.5);
+    if (target == 0)
+    {
+        target = 1;
+    }
+    uint64_t seen = 0;
+    for (i = 0; i < HISTO_BUCKETS; i++)
+    {
+        seen += h->buckets[i];
+        if (seen >= target)
+        {
+            uint64_t upper = bucket_upper(i);
+            return (upper > h->max) ? h->max : upper;
+        }
+    }
+    return h->max;
+}
+
+uint64_t bdberl_histo_mean(const Histo* h)
+{
+    return (h->count == 0) ? 0 : h->sum / h->count;
+}
+
+uint64_t bdberl_now_usecs(void)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+    {
+        return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+    }
+#endif
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return ((uint64_t)tv.tv_sec * 1000000) + tv.tv_usec;
+}
@@ -0,0 +1,64 @@
+/* -------------------------------------------------------------------
+ *
+ * bdberl: Latency histograms
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ------------------------------------------------------------------- */
+#ifndef _BDBERL_HISTO
+#define _BDBERL_HISTO
+
+#include <stdint.h>
+
+/**
+ * Log-linear histogram of microsecond values. Each power of two is split into
+ * HISTO_SUB_BUCKETS linear buckets, so any recorded value is reported to within
+ * 1/HISTO_SUB_BUCKETS (12.5%) of its true value. Values at or above 2^32 usecs are
+ * clamped into the last bucket.
+ *
+ * A histogram is not locked; each writer is expected to own its histogram (one per
+ * thread) and readers merge them into a private copy.
+ */
+#define HISTO_SUB_BITS    3
+#define HISTO_SUB_BUCKETS (1 << HISTO_SUB_BITS)
+#define HISTO_BUCKETS     ((32 - HISTO_SUB_BITS) * HISTO_SUB_BUCKETS + HISTO_SUB_BUCKETS)
+
+typedef struct
+{
+    uint64_t count;
+    uint64_t sum;
+    uint32_t min;
+    uint32_t max;
+    uint32_t buckets[HISTO_BUCKETS];
+} Histo;
+
+void bdberl_histo_reset(Histo* h);
+
+void bdberl_histo_record(Histo* h, uint64_t usecs);
+
+void bdberl_histo_merge(Histo* dest, const Histo* src);
+
+uint64_t bdberl_histo_percentile(const Histo* h, double percentile);
+
+uint64_t bdberl_histo_mean(const Histo* h);
+
+/* Microseconds from a monotonic clock, where the platform has one */
+uint64_t bdberl_now_usecs(void);
+
+#endif // _BDBERL_HISTO
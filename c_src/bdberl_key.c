@@ -0,0 +1,579 @@
+/* -------------------------------------------------------------------
+ *
+ * bdberl: Order-preserving key encoding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ------------------------------------------------------------------- */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "erl_driver.h"
+#include "bdberl_key.h"
+
+#define VERSION_MAGIC           131
+#define SMALL_INTEGER_EXT       97
+#define INTEGER_EXT             98
+#define ATOM_EXT                100
+#define SMALL_TUPLE_EXT         104
+#define LARGE_TUPLE_EXT         105
+#define BINARY_EXT              109
+#define SMALL_BIG_EXT           110
+#define LARGE_BIG_EXT           111
+#define SMALL_ATOM_EXT          115
+#define ATOM_UTF8_EXT           118
+#define SMALL_ATOM_UTF8_EXT     119
+
+#define MAX_DEPTH               64
+
+// Bounded output; ok drops to zero on overflow and every later write is ignored
+typedef struct
+{
+    unsigned char* p;
+    unsigned char* end;
+    int ok;
+} Writer;
+
+typedef struct
+{
+    const unsigned char* p;
+    const unsigned char* end;
+} Reader;
+
+static int encode_term(Reader* r, Writer* w, int depth);
+static int decode_term(Reader* r, Writer* w, int depth);
+
+
+static inline int has(const Reader* r, size_t n)
+{
+    return (size_t)(r->end - r->p) >= n;
+}
+
+static inline uint32_t get16(const unsigned char* p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static inline uint32_t get32(const unsigned char* p)
+{
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static inline void put_byte(Writer* w, unsigned char b)
+{
+    if (w->p < w->end)
+    {
+        *w->p++ = b;
+    }
+    else
+    {
+        w->ok = 0;
+    }
+}
+
+static void put32(Writer* w, uint32_t v)
+{
+    put_byte(w, v >> 24);
+    put_byte(w, v >> 16);
+    put_byte(w, v >> 8);
+    put_byte(w, v);
+}
+
+static void put_escaped(Writer* w, const unsigned char* data, size_t size)
+{
+    size_t i;
+    for (i = 0; i < size; i++)
+    {
+        put_byte(w, data[i]);
+        if (data[i] == 0)
+        {
+            put_byte(w, 0xFF);
+        }
+    }
+    put_byte(w, 0);
+    put_byte(w, 0);
+}
+
+
+unsigned char* bdberl_key_encode(const unsigned char* term, unsigned int size,
+                                 unsigned int* key_size)
+{
+    if (size < 2 || term[0] != VERSION_MAGIC)
+    {
+        return NULL;
+    }
+
+    // Escaping and latin1 to UTF-8 at most double a field; the headers shrink or stay
+    size_t cap = 2 * (size_t)size + 16;
+    unsigned char* key = driver_alloc(cap);
+    Reader r = { term + 1, term + size };
+    Writer w = { key, key + cap, 1 };
+    if (!encode_term(&r, &w, 0) || !w.ok || r.p != r.end)
+    {
+        driver_free(key);
+        return NULL;
+    }
+    *key_size = w.p - key;
+    return key;
+}
+
+unsigned char* bdberl_key_decode(const unsigned char* key, unsigned int size,
+                                 unsigned int* term_size)
+{
+    // An integer may grow from 3 bytes to 5 and an empty binary from 3 to 5
+    size_t cap = 2 * (size_t)size + 16;
+    unsigned char* term = driver_alloc(cap);
+    Reader r = { key, key + size };
+    Writer w = { term, term + cap, 1 };
+    put_byte(&w, VERSION_MAGIC);
+    if (size == 0 || !decode_term(&r, &w, 0) || !w.ok || r.p != r.end)
+    {
+        driver_free(term);
+        return NULL;
+    }
+    *term_size = w.p - term;
+    return term;
+}
+
+
+// Integers from their sign and little endian magnitude, as the big encodings hold them
+static void encode_integer(Writer* w, int negative, const unsigned char* digits, size_t n)
+{
+    while (n > 0 && digits[n - 1] == 0)
+    {
+        n--;
+    }
+    if (n == 0)
+    {
+        put_byte(w, KEY_TAG_ZERO);
+        return;
+    }
+
+    unsigned char flip = negative ? 0xFF : 0;
+    if (n <= 8)
+    {
+        put_byte(w, negative ? KEY_TAG_ZERO - n : KEY_TAG_ZERO + n);
+    }
+    else
+    {
+        put_byte(w, negative ? KEY_TAG_NEG_BIG : KEY_TAG_POS_BIG);
+        put32(w, (uint32_t)n ^ (negative ? 0xFFFFFFFF : 0));
+    }
+    size_t i;
+    for (i = n; i > 0; i--)
+    {
+        put_byte(w, digits[i - 1] ^ flip);
+    }
+}
+
+static int encode_term(Reader* r, Writer* w, int depth)
+{
+    if (depth > MAX_DEPTH || !has(r, 1))
+    {
+        return 0;
+    }
+    unsigned char tag = *r->p++;
+    switch (tag)
+    {
+    case SMALL_INTEGER_EXT:
+        if (!has(r, 1))
+        {
+            return 0;
+        }
+        encode_integer(w, 0, r->p, 1);
+        r->p += 1;
+        return 1;
+    case INTEGER_EXT:
+    {
+        if (!has(r, 4))
+        {
+            return 0;
+        }
+        int64_t v = (int32_t)get32(r->p);
+        uint64_t mag = v < 0 ? (uint64_t)(-v) : (uint64_t)v;
+        unsigned char digits[4];
+        int i;
+        for (i = 0; i < 4; i++)
+        {
+            digits[i] = (unsigned char)(mag >> (8 * i));
+        }
+        encode_integer(w, v < 0, digits, 4);
+        r->p += 4;
+        return 1;
+    }
+    case SMALL_BIG_EXT:
+    case LARGE_BIG_EXT:
+    {
+        size_t head = tag == SMALL_BIG_EXT ? 2 : 5;
+        if (!has(r, head))
+        {
+            return 0;
+        }
+        size_t n = tag == SMALL_BIG_EXT ? r->p[0] : get32(r->p);
+        int negative = r->p[head - 1] != 0;
+        r->p += head;
+        if (!has(r, n))
+        {
+            return 0;
+        }
+        encode_integer(w, negative, r->p, n);
+        r->p += n;
+        return 1;
+    }
+    case ATOM_EXT:
+    case SMALL_ATOM_EXT:
+    case ATOM_UTF8_EXT:
+    case SMALL_ATOM_UTF8_EXT:
+    {
+        int small = tag == SMALL_ATOM_EXT || tag == SMALL_ATOM_UTF8_EXT;
+        if (!has(r, small ? 1 : 2))
+        {
+            return 0;
+        }
+        size_t len = small ? r->p[0] : get16(r->p);
+        r->p += small ? 1 : 2;
+        if (!has(r, len))
+        {
+            return 0;
+        }
+
+        // Names are stored in UTF-8 whatever encoding they came in
+        put_byte(w, KEY_TAG_ATOM);
+        if (tag == ATOM_UTF8_EXT || tag == SMALL_ATOM_UTF8_EXT)
+        {
+            put_escaped(w, r->p, len);
+        }
+        else
+        {
+            size_t i;
+            for (i = 0; i < len; i++)
+            {
+                unsigned char ch = r->p[i];
+                if (ch < 0x80)
+                {
+                    put_byte(w, ch);
+                    if (ch == 0)
+                    {
+                        put_byte(w, 0xFF);
+                    }
+                }
+                else
+                {
+                    put_byte(w, 0xC0 | (ch >> 6));
+                    put_byte(w, 0x80 | (ch & 0x3F));
+                }
+            }
+            put_byte(w, 0);
+            put_byte(w, 0);
+        }
+        r->p += len;
+        return 1;
+    }
+    case BINARY_EXT:
+    {
+        if (!has(r, 4) || !has(r, 4 + (size_t)get32(r->p)))
+        {
+            return 0;
+        }
+        size_t len = get32(r->p);
+        put_byte(w, KEY_TAG_BINARY);
+        put_escaped(w, r->p + 4, len);
+        r->p += 4 + len;
+        return 1;
+    }
+    case SMALL_TUPLE_EXT:
+    case LARGE_TUPLE_EXT:
+    {
+        int small = tag == SMALL_TUPLE_EXT;
+        if (!has(r, small ? 1 : 4))
+        {
+            return 0;
+        }
+        uint32_t arity = small ? r->p[0] : get32(r->p);
+        r->p += small ? 1 : 4;
+
+        put_byte(w, KEY_TAG_TUPLE);
+        if (arity < 255)
+        {
+            put_byte(w, arity);
+        }
+        else
+        {
+            put_byte(w, 255);
+            put32(w, arity);
+        }
+        uint32_t i;
+        for (i = 0; i < arity; i++)
+        {
+            if (!encode_term(r, w, depth + 1))
+            {
+                return 0;
+            }
+        }
+        return 1;
+    }
+    default:
+        return 0;
+    }
+}
+
+
+// Read escaped data into a scratch copy without the escapes; returns its length or -1
+static long read_escaped(Reader* r, unsigned char* out, size_t cap)
+{
+    size_t n = 0;
+    for (;;)
+    {
+        if (!has(r, 1))
+        {
+            return -1;
+        }
+        unsigned char b = *r->p++;
+        if (b == 0)
+        {
+            if (!has(r, 1))
+            {
+                return -1;
+            }
+            unsigned char next = *r->p++;
+            if (next == 0)
+            {
+                return (long)n;
+            }
+            if (next != 0xFF)
+            {
+                return -1;
+            }
+        }
+        if (n >= cap)
+        {
+            return -1;
+        }
+        out[n++] = b;
+    }
+}
+
+static int decode_integer(Reader* r, Writer* w, unsigned char tag)
+{
+    if (tag == KEY_TAG_ZERO)
+    {
+        put_byte(w, SMALL_INTEGER_EXT);
+        put_byte(w, 0);
+        return 1;
+    }
+
+    int negative = tag < KEY_TAG_ZERO;
+    unsigned char flip = negative ? 0xFF : 0;
+    size_t n;
+    if (tag == KEY_TAG_NEG_BIG || tag == KEY_TAG_POS_BIG)
+    {
+        if (!has(r, 4))
+        {
+            return 0;
+        }
+        n = get32(r->p) ^ (negative ? 0xFFFFFFFF : 0);
+        r->p += 4;
+        if (n <= 8)
+        {
+            return 0;
+        }
+    }
+    else
+    {
+        n = negative ? KEY_TAG_ZERO - tag : tag - KEY_TAG_ZERO;
+    }
+    if (!has(r, n) || (r->p[0] ^ flip) == 0)
+    {
+        return 0;
+    }
+
+    // Back to the smallest encoding term_to_binary would use
+    const unsigned char* mag = r->p;
+    r->p += n;
+    if (n <= 4)
+    {
+        uint64_t v = 0;
+        size_t i;
+        for (i = 0; i < n; i++)
+        {
+            v = (v << 8) | (mag[i] ^ flip);
+        }
+        if (!negative && v < 256)
+        {
+            put_byte(w, SMALL_INTEGER_EXT);
+            put_byte(w, (unsigned char)v);
+            return 1;
+        }
+        if (v <= (negative ? 0x80000000ULL : 0x7FFFFFFFULL))
+        {
+            int64_t s = negative ? -(int64_t)v : (int64_t)v;
+            put_byte(w, INTEGER_EXT);
+            put32(w, (uint32_t)(int32_t)s);
+            return 1;
+        }
+    }
+    if (n < 256)
+    {
+        put_byte(w, SMALL_BIG_EXT);
+        put_byte(w, (unsigned char)n);
+    }
+    else
+    {
+        put_byte(w, LARGE_BIG_EXT);
+        put32(w, (uint32_t)n);
+    }
+    put_byte(w, negative);
+    size_t i;
+    for (i = n; i > 0; i--)
+    {
+        put_byte(w, mag[i - 1] ^ flip);
+    }
+    return 1;
+}
+
+static int decode_term(Reader* r, Writer* w, int depth)
+{
+    if (depth > MAX_DEPTH || !has(r, 1))
+    {
+        return 0;
+    }
+    unsigned char tag = *r->p++;
+    if (tag >= KEY_TAG_NEG_BIG && tag <= KEY_TAG_POS_BIG)
+    {
+        return decode_integer(r, w, tag);
+    }
+
+    switch (tag)
+    {
+    case KEY_TAG_ATOM:
+    case KEY_TAG_BINARY:
+    {
+        // The unescaped data is never longer than what is left of the key
+        size_t cap = r->end - r->p;
+        unsigned char* data = w->p;
+        size_t head = tag == KEY_TAG_BINARY ? 5 : 3;
+        if ((size_t)(w->end - w->p) < head + cap)
+        {
+            return 0;
+        }
+        long len = read_escaped(r, data + head, cap);
+        if (len < 0)
+        {
+            return 0;
+        }
+        if (tag == KEY_TAG_BINARY)
+        {
+            data[0] = BINARY_EXT;
+            data[1] = (unsigned char)(len >> 24);
+            data[2] = (unsigned char)(len >> 16);
+            data[3] = (unsigned char)(len >> 8);
+            data[4] = (unsigned char)len;
+            w->p += head + len;
+            return 1;
+        }
+
+        // Latin1 when every character fits, as the VM writes atoms; UTF-8 otherwise
+        unsigned char* name = data + head;
+        int latin1 = 1;
+        long i;
+        for (i = 0; i < len && latin1; i++)
+        {
+            if (name[i] >= 0x80)
+            {
+                latin1 = (name[i] == 0xC2 || name[i] == 0xC3) && i + 1 < len &&
+                    (name[i + 1] & 0xC0) == 0x80;
+                i++;
+            }
+        }
+        long out = len;
+        if (latin1)
+        {
+            out = 0;
+            for (i = 0; i < len; i++)
+            {
+                if (name[i] < 0x80)
+                {
+                    name[out++] = name[i];
+                }
+                else
+                {
+                    name[out++] = ((name[i] & 0x03) << 6) | (name[i + 1] & 0x3F);
+                    i++;
+                }
+            }
+        }
+        if (out > 0xFFFF)
+        {
+            return 0;
+        }
+        if (!latin1 && out < 256)
+        {
+            data[0] = SMALL_ATOM_UTF8_EXT;
+            data[1] = (unsigned char)out;
+            memmove(data + 2, name, out);
+            w->p += 2 + out;
+            return 1;
+        }
+        data[0] = latin1 ? ATOM_EXT : ATOM_UTF8_EXT;
+        data[1] = (unsigned char)(out >> 8);
+        data[2] = (unsigned char)out;
+        w->p += head + out;
+        return 1;
+    }
+    case KEY_TAG_TUPLE:
+    {
+        if (!has(r, 1))
+        {
+            return 0;
+        }
+        uint32_t arity = *r->p++;
+        if (arity == 255)
+        {
+            if (!has(r, 4))
+            {
+                return 0;
+            }
+            arity = get32(r->p);
+            r->p += 4;
+        }
+        if (arity < 256)
+        {
+            put_byte(w, SMALL_TUPLE_EXT);
+            put_byte(w, (unsigned char)arity);
+        }
+        else
+        {
+            put_byte(w, LARGE_TUPLE_EXT);
+            put32(w, arity);
+        }
+        uint32_t i;
+        for (i = 0; i < arity; i++)
+        {
+            if (!decode_term(r, w, depth + 1))
+            {
+                return 0;
+            }
+        }
+        return 1;
+    }
+    default:
+        return 0;
+    }
+}
@@ -0,0 +1,69 @@
+/* -------------------------------------------------------------------
+ *
+ * bdberl: Order-preserving key encoding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ------------------------------------------------------------------- */
+#ifndef _BDBERL_KEY
+#define _BDBERL_KEY
+
+/**
+ * A key encoding whose byte order is Erlang term order, so BDB's default memcmp comparison
+ * sorts keys as Erlang would without a comparison function. It covers integers, atoms,
+ * binaries and tuples of these, and is usually shorter than term_to_binary:
+ *
+ *   integer    KEY_TAG_ZERO, or KEY_TAG_ZERO +/- N followed by the N byte big endian
+ *              magnitude (complemented when negative) for N up to 8, or KEY_TAG_POS_BIG /
+ *              KEY_TAG_NEG_BIG followed by << N:32 >> and the magnitude, both complemented
+ *              when negative
+ *   atom       KEY_TAG_ATOM, the name in UTF-8, escaped
+ *   tuple      KEY_TAG_TUPLE, << Arity:8 >> (or << 255, Arity:32 >>), the elements
+ *   binary     KEY_TAG_BINARY, the bytes, escaped
+ *
+ * Escaped data has each 0 byte written as << 0, 255 >> and ends with << 0, 0 >>, which
+ * keeps shorter strings first. The tags are in term order: number < atom < tuple < binary.
+ */
+#define KEY_TAG_NEG_BIG     0x0F
+#define KEY_TAG_ZERO        0x18
+#define KEY_TAG_POS_BIG     0x21
+#define KEY_TAG_ATOM        0x30
+#define KEY_TAG_TUPLE       0x50
+#define KEY_TAG_BINARY      0x60
+
+/**
+ * Prototypes in bdberl_key.c
+ */
+
+/**
+ * Encode a term_to_binary key; returns a driver_alloc'd key and sets *key_size, or NULL
+ * when the term holds something other than integers, atoms, binaries and tuples.
+ */
+unsigned char* bdberl_key_encode(const unsigned char* term, unsigned int size,
+                                 unsigned int* key_size);
+
+/**
+ * Turn an encoded key back into term_to_binary output; atoms are written in latin1 where
+ * their names allow, as the VM does. Returns a driver_alloc'd binary and sets *term_size,
+ * or NULL when the key is malformed.
+ */
+unsigned char* bdberl_key_decode(const unsigned char* key, unsigned int size,
+                                 unsigned int* term_size);
+
+#endif // _BDBERL_KEY
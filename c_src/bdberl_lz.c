@@ -0,0 +1,330 @@
+/* -------------------------------------------------------------------
+ *
+ * bdberl: LZ77 value compression
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ------------------------------------------------------------------- */
+
+#include <string.h>
+
+#include "erl_driver.h"
+#include "bdberl_lz.h"
+#include "bdberl_crc32.h"
+
+static inline uint32_t read32(const unsigned char* p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint32_t lz_hash(uint32_t seq)
+{
+    return (seq * 2654435761U) >> (32 - LZ_HASH_LOG);
+}
+
+// Write a length extension: runs of 255 and the remainder. Returns NULL if it won't fit.
+static unsigned char* put_length(unsigned char* op, unsigned char* oend, unsigned int len)
+{
+    while (len >= 255)
+    {
+        if (op >= oend)
+        {
+            return NULL;
+        }
+        *op++ = 255;
+        len -= 255;
+    }
+    if (op >= oend)
+    {
+        return NULL;
+    }
+    *op++ = (unsigned char)len;
+    return op;
+}
+
+// Emit one sequence; a match_len of 0 marks the final literals-only sequence
+static unsigned char* put_sequence(unsigned char* op, unsigned char* oend,
+                                   const unsigned char* literals, unsigned int literal_len,
+                                   unsigned int offset, unsigned int match_len)
+{
+    if (op >= oend)
+    {
+        return NULL;
+    }
+    unsigned char* token = op++;
+    *token = (unsigned char)((literal_len >= 15 ? 15 : literal_len) << 4);
+    if (literal_len >= 15 && (op = put_length(op, oend, literal_len - 15)) == NULL)
+    {
+        return NULL;
+    }
+    if ((unsigned int)(oend - op) < literal_len)
+    {
+        return NULL;
+    }
+    memcpy(op, literals, literal_len);
+    op += literal_len;
+
+    if (match_len == 0)
+    {
+        return op;
+    }
+
+    if (oend - op < 2)
+    {
+        return NULL;
+    }
+    *op++ = (unsigned char)(offset & 0xFF);
+    *op++ = (unsigned char)(offset >> 8);
+    unsigned int ml = match_len - LZ_MIN_MATCH;
+    *token |= (unsigned char)(ml >= 15 ? 15 : ml);
+    if (ml >= 15 && (op = put_length(op, oend, ml - 15)) == NULL)
+    {
+        return NULL;
+    }
+    return op;
+}
+
+
+LzDict* bdberl_lz_dict_create(const unsigned char* data, unsigned int size)
+{
+    if (size == 0)
+    {
+        return NULL;
+    }
+    if (size > LZ_MAX_DICT)
+    {
+        data += size - LZ_MAX_DICT;
+        size = LZ_MAX_DICT;
+    }
+
+    LzDict* dict = driver_alloc(sizeof(LzDict) + size);
+    memset(dict->table, '\0', sizeof(dict->table));
+    memcpy(dict->data, data, size);
+    dict->size = size;
+    dict->id = bdberl_crc32(data, size) & 0xFFFFFF;
+    if (dict->id == 0)
+    {
+        dict->id = 1;
+    }
+
+    unsigned int i;
+    for (i = 0; i + LZ_MIN_MATCH <= size; i++)
+    {
+        dict->table[lz_hash(read32(data + i))] = i + 1;
+    }
+    return dict;
+}
+
+void bdberl_lz_dict_free(LzDict* dict)
+{
+    if (dict != NULL)
+    {
+        driver_free(dict);
+    }
+}
+
+// Positions are in a virtual space where the dictionary's bytes come first and the input
+// starts at dict_size
+unsigned int bdberl_lz_compress(const unsigned char* src, unsigned int size, const LzDict* dict,
+                                unsigned char* dst, unsigned int dst_cap)
+{
+    uint32_t table[LZ_HASH_SIZE];
+    unsigned int dict_size = 0;
+    if (dict != NULL)
+    {
+        memcpy(table, dict->table, sizeof(table));
+        dict_size = dict->size;
+    }
+    else
+    {
+        memset(table, '\0', sizeof(table));
+    }
+
+    unsigned char* op = dst;
+    unsigned char* oend = dst + dst_cap;
+    unsigned int ip = 0;
+    unsigned int anchor = 0;
+    unsigned int match_limit = size > LZ_MATCH_LIMIT ? size - LZ_MATCH_LIMIT : 0;
+    unsigned int end_limit = size - LZ_LAST_LITERALS;
+
+    while (ip < match_limit)
+    {
+        uint32_t seq = read32(src + ip);
+        uint32_t h = lz_hash(seq);
+        unsigned int cur = dict_size + ip;
+        unsigned int candidate = table[h];
+        table[h] = cur + 1;
+
+        // Entries hold position + 1; check the candidate really matches and is in range
+        if (candidate == 0 || cur - (candidate - 1) > LZ_MAX_OFFSET)
+        {
+            // Skip ahead faster through data that doesn't match
+            ip += 1 + ((ip - anchor) >> 6);
+            continue;
+        }
+        candidate--;
+        const unsigned char* ref;
+        unsigned int ref_avail;
+        if (candidate < dict_size)
+        {
+            ref = dict->data + candidate;
+            ref_avail = dict_size - candidate;
+            if (ref_avail < LZ_MIN_MATCH)
+            {
+                ip++;
+                continue;
+            }
+        }
+        else
+        {
+            ref = src + (candidate - dict_size);
+            ref_avail = end_limit - (candidate - dict_size);
+        }
+        if (read32(ref) != seq)
+        {
+            ip += 1 + ((ip - anchor) >> 6);
+            continue;
+        }
+
+        // Extend the match, stopping at the end of the dictionary or the last literals
+        unsigned int len = LZ_MIN_MATCH;
+        unsigned int max_len = end_limit - ip;
+        if (ref_avail < max_len)
+        {
+            max_len = ref_avail;
+        }
+        while (len < max_len && ref[len] == src[ip + len])
+        {
+            len++;
+        }
+
+        op = put_sequence(op, oend, src + anchor, ip - anchor, cur - candidate, len);
+        if (op == NULL)
+        {
+            return 0;
+        }
+        ip += len;
+        anchor = ip;
+
+        // Index a position inside the match so the next search has something recent
+        if (ip >= 2 && ip - 2 + LZ_MIN_MATCH <= size)
+        {
+            table[lz_hash(read32(src + ip - 2))] = dict_size + ip - 2 + 1;
+        }
+    }
+
+    op = put_sequence(op, oend, src + anchor, size - anchor, 0, 0);
+    return op == NULL ? 0 : (unsigned int)(op - dst);
+}
+
+int bdberl_lz_decompress(const unsigned char* src, unsigned int size, const LzDict* dict,
+                         unsigned char* dst, unsigned int dst_size)
+{
+    const unsigned char* ip = src;
+    const unsigned char* iend = src + size;
+    unsigned char* op = dst;
+    unsigned char* oend = dst + dst_size;
+    unsigned int dict_size = dict != NULL ? dict->size : 0;
+
+    while (ip < iend)
+    {
+        unsigned int token = *ip++;
+
+        // Literals
+        unsigned int len = token >> 4;
+        if (len == 15)
+        {
+            unsigned int b;
+            do
+            {
+                if (ip >= iend)
+                {
+                    return 0;
+                }
+                b = *ip++;
+                len += b;
+            } while (b == 255);
+        }
+        if ((unsigned int)(iend - ip) < len || (unsigned int)(oend - op) < len)
+        {
+            return 0;
+        }
+        memcpy(op, ip, len);
+        ip += len;
+        op += len;
+
+        // The last sequence has no match
+        if (ip == iend)
+        {
+            break;
+        }
+
+        // Match
+        if (iend - ip < 2)
+        {
+            return 0;
+        }
+        unsigned int offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        len = token & 15;
+        if (len == 15)
+        {
+            unsigned int b;
+            do
+            {
+                if (ip >= iend)
+                {
+                    return 0;
+                }
+                b = *ip++;
+                len += b;
+            } while (b == 255);
+        }
+        len += LZ_MIN_MATCH;
+
+        unsigned int produced = (unsigned int)(op - dst);
+        if (offset == 0 || offset > produced + dict_size || (unsigned int)(oend - op) < len)
+        {
+            return 0;
+        }
+
+        // Copy the part of the match that lies in the dictionary, then the rest byte by
+        // byte since the match may overlap the output it is producing
+        if (offset > produced)
+        {
+            unsigned int from = dict_size - (offset - produced);
+            unsigned int n = dict_size - from;
+            if (n > len)
+            {
+                n = len;
+            }
+            memcpy(op, dict->data + from, n);
+            op += n;
+            len -= n;
+        }
+        const unsigned char* ref = op - offset;
+        while (len-- > 0)
+        {
+            *op++ = *ref++;
+        }
+    }
+    return op == oend;
+}
@@ -0,0 +1,82 @@
+/* -------------------------------------------------------------------
+ *
+ * bdberl: LZ77 value compression
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ------------------------------------------------------------------- */
+#ifndef _BDBERL_LZ
+#define _BDBERL_LZ
+
+#include <stdint.h>
+
+/**
+ * A small LZ77 codec in the LZ4 block format: each sequence is a token byte holding the
+ * literal and match lengths (extended with 255-runs), the literals, and a two byte little
+ * endian offset of at most 65535. The last sequence is literals only, and matches stop
+ * LZ_LAST_LITERALS bytes before the end. Compression is greedy with a single-entry hash
+ * table, which is fast and good enough for term_to_binary output.
+ *
+ * A preset dictionary acts as data preceding the input, so matches can reach back into it;
+ * that is what lets values of a few hundred bytes compress. Its hash table is built once
+ * when the dictionary is loaded and copied for each compression.
+ */
+#define LZ_HASH_LOG        12
+#define LZ_HASH_SIZE       (1 << LZ_HASH_LOG)
+#define LZ_MIN_MATCH       4
+#define LZ_LAST_LITERALS   5
+#define LZ_MATCH_LIMIT     12       /* No match may start in the last 12 bytes */
+#define LZ_MAX_OFFSET      65535
+#define LZ_MAX_DICT        65536    /* Only the last 64K of a dictionary is reachable */
+
+typedef struct
+{
+    unsigned int   size;
+    uint32_t       id;          /* 24 bit id recorded with values compressed against it */
+    uint32_t       table[LZ_HASH_SIZE]; /* Dictionary positions + 1 by hash; 0 is empty */
+    unsigned char  data[];
+} LzDict;
+
+/**
+ * Prototypes in bdberl_lz.c
+ */
+
+/**
+ * Copy a dictionary and index it; dictionaries over LZ_MAX_DICT keep their last
+ * LZ_MAX_DICT bytes. Returns NULL for an empty dictionary.
+ */
+LzDict* bdberl_lz_dict_create(const unsigned char* data, unsigned int size);
+void bdberl_lz_dict_free(LzDict* dict);
+
+/**
+ * Compress size bytes into dst, using dict when it is not NULL. Returns the compressed
+ * size, or 0 when the result would not fit in dst_cap bytes.
+ */
+unsigned int bdberl_lz_compress(const unsigned char* src, unsigned int size, const LzDict* dict,
+                                unsigned char* dst, unsigned int dst_cap);
+
+/**
+ * Decompress size bytes from src into dst with the dictionary they were compressed
+ * against. Returns 1 when the input is well formed and decodes to exactly dst_size bytes;
+ * never reads or writes out of bounds on corrupt input.
+ */
+int bdberl_lz_decompress(const unsigned char* src, unsigned int size, const LzDict* dict,
+                         unsigned char* dst, unsigned int dst_size);
+
+#endif // _BDBERL_LZ
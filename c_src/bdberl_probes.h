@@ -0,0 +1,71 @@
+/* -------------------------------------------------------------------
+ *
+ * bdberl: Static tracepoints
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ------------------------------------------------------------------- */
+#ifndef _BDBERL_PROBES
+#define _BDBERL_PROBES
+
+/**
+ * USDT probes for the "bdberl" provider. When <sys/sdt.h> (systemtap-sdt-dev) is available
+ * the probes compile to a single nop plus an ELF note, so they cost next to nothing until a
+ * tracer (bpftrace, perf, systemtap) attaches. Define BDBERL_USDT to require them, or
+ * BDBERL_NO_USDT to leave them out. See tools/bpftrace for scripts that use them.
+ *
+ *   command(port, cmd)                       control command received
+ *   job__enqueue(job, class, tag, pending)   job queued on a pool
+ *   job__reject(class, tag, pending)         job refused with ERROR_OVERLOADED
+ *   job__start(job, tag, queue_usecs)        pool thread picked the job up
+ *   job__done(job, tag, service_usecs)       job returned
+ *   async__entry(port, cmd)                  do_async_* started on a pool thread
+ *   async__exit(port, cmd)                   do_async_* finished and released the port
+ *   checkpoint__start()
+ *   checkpoint__done(rc, secs)
+ *   trickle__start(percent)
+ *   trickle__done(rc, pages)
+ */
+#if !defined(BDBERL_USDT) && !defined(BDBERL_NO_USDT) && defined(__linux__) && defined(__has_include)
+#  if __has_include(<sys/sdt.h>)
+#    define BDBERL_USDT 1
+#  endif
+#endif
+
+#if defined(BDBERL_USDT) && !defined(BDBERL_NO_USDT)
+
+#include <sys/sdt.h>
+
+#define BDBERL_PROBE0(name)                      DTRACE_PROBE(bdberl, name)
+#define BDBERL_PROBE1(name, a1)                  DTRACE_PROBE1(bdberl, name, a1)
+#define BDBERL_PROBE2(name, a1, a2)              DTRACE_PROBE2(bdberl, name, a1, a2)
+#define BDBERL_PROBE3(name, a1, a2, a3)          DTRACE_PROBE3(bdberl, name, a1, a2, a3)
+#define BDBERL_PROBE4(name, a1, a2, a3, a4)      DTRACE_PROBE4(bdberl, name, a1, a2, a3, a4)
+
+#else
+
+#define BDBERL_PROBE0(name)                      do { } while (0)
+#define BDBERL_PROBE1(name, a1)                  do { } while (0)
+#define BDBERL_PROBE2(name, a1, a2)              do { } while (0)
+#define BDBERL_PROBE3(name, a1, a2, a3)          do { } while (0)
+#define BDBERL_PROBE4(name, a1, a2, a3, a4)      do { } while (0)
+
+#endif
+
+#endif // _BDBERL_PROBES
@@ -0,0 +1,393 @@
+/* -------------------------------------------------------------------
+ *
+ * bdberl: Background stats sampler
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "bdberl_drv.h"
+#include "bdberl_histo.h"
+#include "bdberl_sampler.h"
+
+/**
+ * One snapshot of the raw (cumulative) counters
+ */
+typedef struct
+{
+    uint64_t timestamp;         /* Wall clock, usecs since the epoch */
+    uint64_t mono;              /* Monotonic clock, usecs */
+    uint64_t values[SAMPLE_FIELDS];
+} Sample;
+
+static ErlDrvTid    G_SAMPLER_THREAD   = 0;
+static ErlDrvMutex* G_SAMPLER_LOCK     = 0;
+static unsigned int G_SAMPLER_ACTIVE   = 0;
+static unsigned int G_SAMPLER_INTERVAL = 0;
+
+// Ring of samples; G_SAMPLES_NEXT is the slot the next sample goes into and G_SAMPLES_COUNT
+// the number of valid slots. All protected by G_SAMPLER_LOCK.
+static Sample*      G_SAMPLES       = 0;
+static unsigned int G_SAMPLES_SIZE  = 0;
+static unsigned int G_SAMPLES_NEXT  = 0;
+static unsigned int G_SAMPLES_COUNT = 0;
+
+static TPool*       G_SAMPLER_GENERAL_POOL = 0;
+static TPool*       G_SAMPLER_TXN_POOL     = 0;
+
+// Optional rotating file; only touched from the sampler thread
+static char*        G_SAMPLE_FILE          = 0;
+static char*        G_SAMPLE_FILE_ROTATED  = 0;
+static FILE*        G_SAMPLE_FP            = 0;
+static unsigned int G_SAMPLE_FILE_MAX      = 0;
+
+static void* sampler(void* arg);
+static void take_env_sample(Sample* s);
+static void take_pool_sample(Sample* s);
+static void push_sample(BinHelper* bh, Sample* prev, Sample* cur);
+static void write_sample(Sample* prev, Sample* cur);
+static char* copy_string(const char* str, const char* suffix);
+
+
+void bdberl_sampler_start(unsigned int interval_secs, unsigned int slots,
+                          const char* file, unsigned int file_max_bytes,
+                          TPool* general_pool, TPool* txn_pool)
+{
+    // Keep one extra slot so a full ring still yields `slots' deltas
+    G_SAMPLES_SIZE = slots + 1;
+    G_SAMPLES = driver_alloc(sizeof(Sample) * G_SAMPLES_SIZE);
+    memset(G_SAMPLES, '\0', sizeof(Sample) * G_SAMPLES_SIZE);
+    G_SAMPLES_NEXT = 0;
+    G_SAMPLES_COUNT = 0;
+
+    G_SAMPLER_INTERVAL = interval_secs;
+    G_SAMPLER_GENERAL_POOL = general_pool;
+    G_SAMPLER_TXN_POOL = txn_pool;
+
+    if (file != NULL)
+    {
+        G_SAMPLE_FILE = copy_string(file, "");
+        G_SAMPLE_FILE_ROTATED = copy_string(file, ".1");
+        G_SAMPLE_FILE_MAX = file_max_bytes;
+    }
+
+    G_SAMPLER_LOCK = erl_drv_mutex_create("bdberl_drv: G_SAMPLER_LOCK");
+    G_SAMPLER_ACTIVE = 1;
+    erl_drv_thread_create("bdberl_drv_sampler", &G_SAMPLER_THREAD, &sampler, 0, 0);
+}
+
+void bdberl_sampler_stop(void)
+{
+    if (G_SAMPLER_LOCK == NULL)
+    {
+        return;
+    }
+
+    // Once this returns the thread no longer looks at the pools
+    erl_drv_mutex_lock(G_SAMPLER_LOCK);
+    G_SAMPLER_ACTIVE = 0;
+    G_SAMPLER_GENERAL_POOL = 0;
+    G_SAMPLER_TXN_POOL = 0;
+    erl_drv_mutex_unlock(G_SAMPLER_LOCK);
+}
+
+void bdberl_sampler_join(void)
+{
+    if (G_SAMPLER_THREAD != 0)
+    {
+        erl_drv_thread_join(G_SAMPLER_THREAD, 0);
+        G_SAMPLER_THREAD = 0;
+    }
+
+    if (G_SAMPLE_FP != NULL)
+    {
+        fclose(G_SAMPLE_FP);
+        G_SAMPLE_FP = NULL;
+    }
+
+    if (G_SAMPLE_FILE != NULL)
+    {
+        driver_free(G_SAMPLE_FILE);
+        driver_free(G_SAMPLE_FILE_ROTATED);
+        G_SAMPLE_FILE = G_SAMPLE_FILE_ROTATED = NULL;
+    }
+
+    if (G_SAMPLER_LOCK != NULL)
+    {
+        erl_drv_mutex_destroy(G_SAMPLER_LOCK);
+        G_SAMPLER_LOCK = NULL;
+    }
+
+    if (G_SAMPLES != NULL)
+    {
+        driver_free(G_SAMPLES);
+        G_SAMPLES = NULL;
+    }
+    G_SAMPLES_SIZE = G_SAMPLES_COUNT = G_SAMPLES_NEXT = 0;
+}
+
+void bdberl_sampler_series(BinHelper* bh, unsigned int max_samples)
+{
+    bin_helper_init(bh);
+
+    if (G_SAMPLER_LOCK == NULL)
+    {
+        bin_helper_push_int32(bh, SAMPLE_SERIES_VERSION);
+        bin_helper_push_int32(bh, SAMPLE_FIELDS);
+        bin_helper_push_int32(bh, 0);
+        bin_helper_push_int32(bh, SAMPLE_GAUGES);
+        bin_helper_push_int32(bh, 0);
+        return;
+    }
+
+    erl_drv_mutex_lock(G_SAMPLER_LOCK);
+
+    // The oldest sample in the ring only serves as the baseline for the next one
+    unsigned int count = G_SAMPLES_COUNT > 0 ? G_SAMPLES_COUNT - 1 : 0;
+    if (max_samples > 0 && max_samples < count)
+    {
+        count = max_samples;
+    }
+
+    bin_helper_reserve(bh, 5 * 4 + count * (2 + SAMPLE_FIELDS) * 8);
+    bin_helper_push_int32(bh, SAMPLE_SERIES_VERSION);
+    bin_helper_push_int32(bh, SAMPLE_FIELDS);
+    bin_helper_push_int32(bh, G_SAMPLER_INTERVAL);
+    bin_helper_push_int32(bh, SAMPLE_GAUGES);
+    bin_helper_push_int32(bh, count);
+
+    // Walk from the oldest requested sample to the newest
+    unsigned int i;
+    for (i = count; i > 0; i--)
+    {
+        unsigned int cur  = (G_SAMPLES_NEXT + G_SAMPLES_SIZE - i) % G_SAMPLES_SIZE;
+        unsigned int prev = (cur + G_SAMPLES_SIZE - 1) % G_SAMPLES_SIZE;
+        push_sample(bh, &G_SAMPLES[prev], &G_SAMPLES[cur]);
+    }
+
+    erl_drv_mutex_unlock(G_SAMPLER_LOCK);
+}
+
+
+static void* sampler(void* arg)
+{
+    Sample s;
+    do
+    {
+        erl_drv_mutex_lock(G_SAMPLER_LOCK);
+        if (!G_SAMPLER_ACTIVE)
+        {
+            erl_drv_mutex_unlock(G_SAMPLER_LOCK);
+            break;
+        }
+
+        unsigned int prev = (G_SAMPLES_NEXT + G_SAMPLES_SIZE - 1) % G_SAMPLES_SIZE;
+        int have_prev = (G_SAMPLES_COUNT > 0);
+        Sample prev_sample = G_SAMPLES[prev];
+        erl_drv_mutex_unlock(G_SAMPLER_LOCK);
+
+        // Start from the previous values so a stat call that fails reads as no change. The
+        // stat calls take BDB region mutexes, so they run unlocked and a slow one never
+        // holds up bdberl_sampler_series in the control call.
+        s = prev_sample;
+        take_env_sample(&s);
+
+        // Only this thread writes the ring, so prev is still the newest sample
+        erl_drv_mutex_lock(G_SAMPLER_LOCK);
+        if (!G_SAMPLER_ACTIVE)
+        {
+            erl_drv_mutex_unlock(G_SAMPLER_LOCK);
+            break;
+        }
+        take_pool_sample(&s);
+        G_SAMPLES[G_SAMPLES_NEXT] = s;
+        G_SAMPLES_NEXT = (G_SAMPLES_NEXT + 1) % G_SAMPLES_SIZE;
+        if (G_SAMPLES_COUNT < G_SAMPLES_SIZE)
+        {
+            G_SAMPLES_COUNT++;
+        }
+        erl_drv_mutex_unlock(G_SAMPLER_LOCK);
+
+        // File I/O happens outside the lock so readers never wait on the disk
+        if (G_SAMPLE_FILE && have_prev)
+        {
+            write_sample(&prev_sample, &s);
+        }
+    } while (!util_thread_usleep(G_SAMPLER_INTERVAL * 1000000));
+
+    DBG("Sampler exiting.\n");
+    return 0;
+}
+
+// Snapshot the environment counters; called without G_SAMPLER_LOCK. Stats that fail to come
+// back keep whatever values the sample already holds rather than dropping the whole sample.
+// The environment outlives the thread (bdberl_sampler_join comes before it is closed).
+static void take_env_sample(Sample* s)
+{
+    DB_ENV* env = bdberl_db_env();
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    s->timestamp = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+    s->mono = bdberl_now_usecs();
+
+    DB_MPOOL_STAT* msp = NULL;
+    if (env->memp_stat(env, &msp, NULL, 0) == 0)
+    {
+        s->values[SAMPLE_CACHE_HIT]   = msp->st_cache_hit;
+        s->values[SAMPLE_CACHE_MISS]  = msp->st_cache_miss;
+        s->values[SAMPLE_PAGE_IN]     = msp->st_page_in;
+        s->values[SAMPLE_PAGE_OUT]    = msp->st_page_out;
+        s->values[SAMPLE_RO_EVICT]    = msp->st_ro_evict;
+        s->values[SAMPLE_RW_EVICT]    = msp->st_rw_evict;
+        s->values[SAMPLE_PAGE_DIRTY]  = msp->st_page_dirty;
+        driver_free(msp);
+    }
+
+    DB_LOCK_STAT* lsp = NULL;
+    if (env->lock_stat(env, &lsp, 0) == 0)
+    {
+        s->values[SAMPLE_LOCK_REQUESTS] = lsp->st_nrequests;
+        s->values[SAMPLE_LOCK_WAITS]    = lsp->st_lock_wait;
+        s->values[SAMPLE_LOCK_NOWAITS]  = lsp->st_lock_nowait;
+        s->values[SAMPLE_DEADLOCKS]     = lsp->st_ndeadlocks;
+        s->values[SAMPLE_LOCK_TIMEOUTS] = (uint64_t)lsp->st_nlocktimeouts + lsp->st_ntxntimeouts;
+        s->values[SAMPLE_LOCKS]         = lsp->st_nlocks;
+        driver_free(lsp);
+    }
+
+    DB_LOG_STAT* gsp = NULL;
+    if (env->log_stat(env, &gsp, 0) == 0)
+    {
+        s->values[SAMPLE_LOG_BYTES]  = (uint64_t)gsp->st_w_mbytes * 1024 * 1024 + gsp->st_w_bytes;
+        s->values[SAMPLE_LOG_WRITES] = gsp->st_wcount;
+        s->values[SAMPLE_LOG_SYNCS]  = gsp->st_scount;
+        driver_free(gsp);
+    }
+
+    DB_TXN_STAT* tsp = NULL;
+    if (env->txn_stat(env, &tsp, 0) == 0)
+    {
+        s->values[SAMPLE_TXN_BEGINS]  = tsp->st_nbegins;
+        s->values[SAMPLE_TXN_COMMITS] = tsp->st_ncommits;
+        s->values[SAMPLE_TXN_ABORTS]  = tsp->st_naborts;
+        s->values[SAMPLE_TXN_ACTIVE]  = tsp->st_nactive;
+        driver_free(tsp);
+    }
+}
+
+// Snapshot the pool queue depths; called with G_SAMPLER_LOCK held, as bdberl_sampler_stop
+// clears the pools under it before they are stopped
+static void take_pool_sample(Sample* s)
+{
+    unsigned int pending, active;
+    if (G_SAMPLER_GENERAL_POOL)
+    {
+        bdberl_tpool_job_count(G_SAMPLER_GENERAL_POOL, &pending, &active);
+        s->values[SAMPLE_GENERAL_PENDING] = pending;
+        s->values[SAMPLE_GENERAL_ACTIVE]  = active;
+    }
+    if (G_SAMPLER_TXN_POOL)
+    {
+        bdberl_tpool_job_count(G_SAMPLER_TXN_POOL, &pending, &active);
+        s->values[SAMPLE_TXN_PENDING]     = pending;
+        s->values[SAMPLE_TXN_ACTIVE_JOBS] = active;
+    }
+}
+
+// Value of a field as reported in the series -- gauges as is, counters as the change since
+// prev. A counter that went backwards was reset (stat with DB_STAT_CLEAR) so its current
+// value is the change.
+static uint64_t sample_value(Sample* prev, Sample* cur, int field)
+{
+    if ((SAMPLE_GAUGES & (1 << field)) || cur->values[field] < prev->values[field])
+    {
+        return cur->values[field];
+    }
+    return cur->values[field] - prev->values[field];
+}
+
+static void push_sample(BinHelper* bh, Sample* prev, Sample* cur)
+{
+    bin_helper_push_uint64(bh, cur->timestamp);
+    bin_helper_push_uint64(bh, cur->mono - prev->mono);
+
+    int i;
+    for (i = 0; i < SAMPLE_FIELDS; i++)
+    {
+        bin_helper_push_uint64(bh, sample_value(prev, cur, i));
+    }
+}
+
+// Append a sample to the file in the same layout as the series records, writing the series
+// header (with a zero count) whenever a new file is started
+static void write_sample(Sample* prev, Sample* cur)
+{
+    if (G_SAMPLE_FP != NULL && G_SAMPLE_FILE_MAX > 0 && ftell(G_SAMPLE_FP) >= G_SAMPLE_FILE_MAX)
+    {
+        fclose(G_SAMPLE_FP);
+        G_SAMPLE_FP = NULL;
+        if (rename(G_SAMPLE_FILE, G_SAMPLE_FILE_ROTATED) != 0)
+        {
+            DBG("Unable to rotate sample file %s\n", G_SAMPLE_FILE);
+        }
+    }
+
+    if (G_SAMPLE_FP == NULL)
+    {
+        G_SAMPLE_FP = fopen(G_SAMPLE_FILE, "ab");
+        if (G_SAMPLE_FP == NULL)
+        {
+            DBG("Unable to open sample file %s\n", G_SAMPLE_FILE);
+            return;
+        }
+
+        if (ftell(G_SAMPLE_FP) == 0)
+        {
+            uint32_t header[5] = { SAMPLE_SERIES_VERSION, SAMPLE_FIELDS, G_SAMPLER_INTERVAL,
+                                   SAMPLE_GAUGES, 0 };
+            fwrite(header, sizeof(header), 1, G_SAMPLE_FP);
+        }
+    }
+
+    uint64_t record[2 + SAMPLE_FIELDS];
+    record[0] = cur->timestamp;
+    record[1] = cur->mono - prev->mono;
+    int i;
+    for (i = 0; i < SAMPLE_FIELDS; i++)
+    {
+        record[2 + i] = sample_value(prev, cur, i);
+    }
+    fwrite(record, sizeof(record), 1, G_SAMPLE_FP);
+    fflush(G_SAMPLE_FP);
+}
+
+static char* copy_string(const char* str, const char* suffix)
+{
+    int len = strlen(str);
+    int suffix_len = strlen(suffix);
+    char* copy = driver_alloc(len + suffix_len + 1);
+    memcpy(copy, str, len);
+    memcpy(copy + len, suffix, suffix_len + 1);
+    return copy;
+}
@@ -0,0 +1,103 @@
+/* -------------------------------------------------------------------
+ *
+ * bdberl: Background stats sampler
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ------------------------------------------------------------------- */
+#ifndef _BDBERL_SAMPLER
+#define _BDBERL_SAMPLER
+
+#include "bdberl_tpool.h"
+#include "bin_helper.h"
+
+/**
+ * Fields captured by each sample. The order is part of the series format and must match
+ * ?SAMPLE_FIELDS in bdberl.erl; new fields are only ever appended. Gauges are reported as
+ * is, everything else is a cumulative counter and is reported as the change since the
+ * previous sample.
+ */
+#define SAMPLE_CACHE_HIT        0       /* memp: pages found in the cache */
+#define SAMPLE_CACHE_MISS       1       /* memp: pages not found in the cache */
+#define SAMPLE_PAGE_IN          2       /* memp: pages read in */
+#define SAMPLE_PAGE_OUT         3       /* memp: pages written out */
+#define SAMPLE_RO_EVICT         4       /* memp: clean pages forced from the cache */
+#define SAMPLE_RW_EVICT         5       /* memp: dirty pages forced from the cache */
+#define SAMPLE_PAGE_DIRTY       6       /* memp: dirty pages (gauge) */
+#define SAMPLE_LOCK_REQUESTS    7       /* lock: lock gets */
+#define SAMPLE_LOCK_WAITS       8       /* lock: conflicts that waited */
+#define SAMPLE_LOCK_NOWAITS     9       /* lock: conflicts refused without waiting */
+#define SAMPLE_DEADLOCKS        10      /* lock: deadlocks */
+#define SAMPLE_LOCK_TIMEOUTS    11      /* lock: lock and txn timeouts */
+#define SAMPLE_LOCKS            12      /* lock: current locks (gauge) */
+#define SAMPLE_LOG_BYTES        13      /* log: bytes written */
+#define SAMPLE_LOG_WRITES       14      /* log: write calls */
+#define SAMPLE_LOG_SYNCS        15      /* log: fsyncs */
+#define SAMPLE_TXN_BEGINS       16      /* txn: transactions begun */
+#define SAMPLE_TXN_COMMITS      17      /* txn: transactions committed */
+#define SAMPLE_TXN_ABORTS       18      /* txn: transactions aborted */
+#define SAMPLE_TXN_ACTIVE       19      /* txn: active transactions (gauge) */
+#define SAMPLE_GENERAL_PENDING  20      /* general pool queue depth (gauge) */
+#define SAMPLE_GENERAL_ACTIVE   21      /* general pool running jobs (gauge) */
+#define SAMPLE_TXN_PENDING      22      /* txn pool queue depth (gauge) */
+#define SAMPLE_TXN_ACTIVE_JOBS  23      /* txn pool running jobs (gauge) */
+#define SAMPLE_FIELDS           24
+
+#define SAMPLE_GAUGES ((1 << SAMPLE_PAGE_DIRTY) | (1 << SAMPLE_LOCKS) | (1 << SAMPLE_TXN_ACTIVE) | \
+                       (1 << SAMPLE_GENERAL_PENDING) | (1 << SAMPLE_GENERAL_ACTIVE) |          \
+                       (1 << SAMPLE_TXN_PENDING) | (1 << SAMPLE_TXN_ACTIVE_JOBS))
+
+#define SAMPLE_SERIES_VERSION   1
+
+/**
+ * Prototypes in bdberl_sampler.c
+ */
+
+/**
+ * Start the sampler thread. Every interval_secs it snapshots the environment and pool
+ * counters into a ring of the given number of slots. If file is not NULL each sample is
+ * also appended to that file, which is rotated to file.1 once it grows past file_max_bytes.
+ */
+void bdberl_sampler_start(unsigned int interval_secs, unsigned int slots,
+                          const char* file, unsigned int file_max_bytes,
+                          TPool* general_pool, TPool* txn_pool);
+
+/**
+ * Stop taking samples. Must be called before the pools handed to bdberl_sampler_start are
+ * stopped; the thread itself exits once the utility thread pipe is closed.
+ */
+void bdberl_sampler_stop(void);
+
+/**
+ * Wait for the sampler thread to exit and release the ring.
+ */
+void bdberl_sampler_join(void);
+
+/**
+ * Write up to max_samples of the most recent samples (0 for all) into the helper as a series:
+ *
+ *   << Version:32, Fields:32, IntervalSecs:32, GaugeMask:32, Count:32,
+ *      Count * << TimestampUsecs:64, ElapsedUsecs:64, Fields * Value:64 >> >>
+ *
+ * All integers are native endian. Counter values are deltas against the previous sample
+ * and ElapsedUsecs is the time between the two, so rates are Value / ElapsedUsecs.
+ */
+void bdberl_sampler_series(BinHelper* bh, unsigned int max_samples);
+
+#endif // _BDBERL_SAMPLER
@@ -29,7 +29,9 @@
 #include <assert.h>
 #include <string.h>
 #include "bdberl_drv.h"
+#include "bdberl_atoms.h"
 #include "bdberl_stats.h"
+#include "bdberl_probes.h"
 
 /**
  * Function prototypes
@@ -43,11 +45,22 @@ static void do_async_mutex_stat(void* arg);
 static void do_async_txn_stat(void* arg);
 
 
+// Cache traffic for the database's file, from the memory pool's per-file stats. These count
+// since the environment was opened (or last cleared), so compare readings taken over time.
+#define FILE_STATS_TUPLES(fsp)                                                                 \
+    ERL_DRV_ATOM, ATOM(cache_hit), ERL_DRV_UINT, (fsp)->st_cache_hit, ERL_DRV_TUPLE, 2,       \
+    ERL_DRV_ATOM, ATOM(cache_miss), ERL_DRV_UINT, (fsp)->st_cache_miss, ERL_DRV_TUPLE, 2,     \
+    ERL_DRV_ATOM, ATOM(page_in), ERL_DRV_UINT, (fsp)->st_page_in, ERL_DRV_TUPLE, 2,           \
+    ERL_DRV_ATOM, ATOM(page_out), ERL_DRV_UINT, (fsp)->st_page_out, ERL_DRV_TUPLE, 2
+#define FILE_STATS_COUNT 4
+
 #define BT_STATS_TUPLE(base, member)                       \
-    ERL_DRV_ATOM, driver_mk_atom(#member),              \
+    ERL_DRV_ATOM, ATOM(member),                        \
         ERL_DRV_UINT, (base)->bt_##member,                   \
         ERL_DRV_TUPLE, 2
-static void async_cleanup_and_send_btree_stats(PortData* d, char *type, DB_BTREE_STAT *bsp)
+
+static void async_cleanup_and_send_btree_stats(PortData* d, ErlDrvTermData type, DB_BTREE_STAT *bsp,
+                                               int bt_compress, DB_MPOOL_FSTAT *fsp)
 {
     // Save the port and pid references -- we need copies independent from the PortData
     // structure. Once we release the port_lock after clearing the cmd, it's possible that
@@ -59,10 +72,10 @@ static void async_cleanup_and_send_btree_stats(PortData* d, char *type, DB_BTREE
     bdberl_async_cleanup(d);
 
     ErlDrvTermData response[] = {
-        ERL_DRV_ATOM, driver_mk_atom("ok"),
+        ERL_DRV_ATOM, ATOM(ok),
         // Start of list
-            ERL_DRV_ATOM, driver_mk_atom("type"),
-            ERL_DRV_ATOM, driver_mk_atom(type),
+            ERL_DRV_ATOM, ATOM(type),
+            ERL_DRV_ATOM, type,
             ERL_DRV_TUPLE, 2,
         BT_STATS_TUPLE(bsp, magic),             /* Magic number. */
         BT_STATS_TUPLE(bsp, version),           /* Version number. */
@@ -85,9 +98,13 @@ static void async_cleanup_and_send_btree_stats(PortData* d, char *type, DB_BTREE
         BT_STATS_TUPLE(bsp, leaf_pgfree),       /* Bytes free in leaf pages. */
         BT_STATS_TUPLE(bsp, dup_pgfree),        /* Bytes free in duplicate pages. */
         BT_STATS_TUPLE(bsp, over_pgfree),       /* Bytes free in overflow pages. */
+            ERL_DRV_ATOM, ATOM(bt_compress),    /* Open option; not read from the file. */
+            ERL_DRV_ATOM, bt_compress ? ATOM(true) : ATOM(false),
+            ERL_DRV_TUPLE, 2,
+        FILE_STATS_TUPLES(fsp),
         // End of list
         ERL_DRV_NIL,
-        ERL_DRV_LIST, 21+2,
+        ERL_DRV_LIST, 21+3+FILE_STATS_COUNT,
         ERL_DRV_TUPLE, 2
     };
     driver_send_term(port, pid, response, sizeof(response) / sizeof(response[0]));
@@ -96,11 +113,12 @@ static void async_cleanup_and_send_btree_stats(PortData* d, char *type, DB_BTREE
 
 
 #define HASH_STATS_TUPLE(base, member)                       \
-    ERL_DRV_ATOM, driver_mk_atom(#member),              \
+    ERL_DRV_ATOM, ATOM(member),                        \
         ERL_DRV_UINT, (base)->hash_##member,                   \
         ERL_DRV_TUPLE, 2
 
-static void async_cleanup_and_send_hash_stats(PortData* d, DB_HASH_STAT *hsp)
+static void async_cleanup_and_send_hash_stats(PortData* d, DB_HASH_STAT *hsp, int h_hash,
+                                              DB_MPOOL_FSTAT *fsp)
 {
     // Save the port and pid references -- we need copies independent from the PortData
     // structure. Once we release the port_lock after clearing the cmd, it's possible that
@@ -112,10 +130,10 @@ static void async_cleanup_and_send_hash_stats(PortData* d, DB_HASH_STAT *hsp)
     bdberl_async_cleanup(d);
 
     ErlDrvTermData response[] = {
-        ERL_DRV_ATOM, driver_mk_atom("ok"),
+        ERL_DRV_ATOM, ATOM(ok),
         // Start of list
-            ERL_DRV_ATOM, driver_mk_atom("type"),
-            ERL_DRV_ATOM, driver_mk_atom("hash"),
+            ERL_DRV_ATOM, ATOM(type),
+            ERL_DRV_ATOM, ATOM(hash),
             ERL_DRV_TUPLE, 2,
         HASH_STATS_TUPLE(hsp, magic),           /* Magic number. */
         HASH_STATS_TUPLE(hsp, version),         /* Version number. */
@@ -134,9 +152,13 @@ static void async_cleanup_and_send_hash_stats(PortData* d, DB_HASH_STAT *hsp)
         HASH_STATS_TUPLE(hsp, ovfl_free),       /* Bytes free on ovfl pages. */
         HASH_STATS_TUPLE(hsp, dup),             /* Number of dup pages. */
         HASH_STATS_TUPLE(hsp, dup_free),        /* Bytes free on duplicate pages. */
+            ERL_DRV_ATOM, ATOM(h_hash),         /* Hash function the database uses. */
+            ERL_DRV_ATOM, h_hash == H_HASH_XXH64 ? ATOM(xxh64) : ATOM(default),
+            ERL_DRV_TUPLE, 2,
+        FILE_STATS_TUPLES(fsp),
         // End of list
         ERL_DRV_NIL,
-        ERL_DRV_LIST, 17+2,
+        ERL_DRV_LIST, 17+3+FILE_STATS_COUNT,
         ERL_DRV_TUPLE, 2
     };
     driver_send_term(port, pid, response, sizeof(response) / sizeof(response[0]));
@@ -146,7 +168,7 @@ static void async_cleanup_and_send_hash_stats(PortData* d, DB_HASH_STAT *hsp)
 #ifdef ENABLE_QUEUE // If we ever decide to support Queues
 
 #define QS_STATS_TUPLE(base, member)                       \
-    ERL_DRV_ATOM, driver_mk_atom(#member),              \
+    ERL_DRV_ATOM, ATOM(member),                        \
         ERL_DRV_UINT, (base)->qs_##member,                   \
         ERL_DRV_TUPLE, 2
 static void async_cleanup_and_send_queue_stats(PortData* d, DB_QUEUE_STAT *qsp)
@@ -161,10 +183,10 @@ static void async_cleanup_and_send_queue_stats(PortData* d, DB_QUEUE_STAT *qsp)
     bdberl_async_cleanup(d);
 
     ErlDrvTermData response[] = {
-        ERL_DRV_ATOM, driver_mk_atom("ok"),
+        ERL_DRV_ATOM, ATOM(ok),
         // Start of list
-            ERL_DRV_ATOM, driver_mk_atom("type"),
-            ERL_DRV_ATOM, driver_mk_atom("queue"),
+            ERL_DRV_ATOM, ATOM(type),
+            ERL_DRV_ATOM, ATOM(queue),
             ERL_DRV_TUPLE, 2,
         QS_STAT_TUPLE(qsp, qs_magic),           /* Magic number. */
         QS_STAT_TUPLE(qsp, version),            /* Version number. */
@@ -190,12 +212,12 @@ static void async_cleanup_and_send_queue_stats(PortData* d, DB_QUEUE_STAT *qsp)
 #endif // ENABLE_QUEUE
 
 #define ST_STATS_TUPLE(base, member)                       \
-    ERL_DRV_ATOM, driver_mk_atom(#member),              \
+    ERL_DRV_ATOM, ATOM(member),                        \
         ERL_DRV_UINT, (base)->st_##member,                   \
         ERL_DRV_TUPLE, 2
 
 #define ST_STATS_INT_TUPLE(base, member)                       \
-    ERL_DRV_ATOM, driver_mk_atom(#member),              \
+    ERL_DRV_ATOM, ATOM(member),                        \
         ERL_DRV_INT, (base)->st_##member,                   \
         ERL_DRV_TUPLE, 2
 
@@ -211,7 +233,7 @@ static void async_cleanup_and_send_lock_stats(PortData* d, DB_LOCK_STAT *lsp)
     bdberl_async_cleanup(d);
 
     ErlDrvTermData response[] = {
-        ERL_DRV_ATOM, driver_mk_atom("ok"),
+        ERL_DRV_ATOM, ATOM(ok),
         // Start of list
         ST_STATS_TUPLE(lsp, id),                /* Last allocated locker ID. */
         ST_STATS_TUPLE(lsp, cur_maxid), /* Current maximum unused ID. */
@@ -276,7 +298,7 @@ static void async_cleanup_and_send_log_stats(PortData* d, DB_LOG_STAT *lsp)
     bdberl_async_cleanup(d);
 
     ErlDrvTermData response[] = {
-        ERL_DRV_ATOM, driver_mk_atom("ok"),
+        ERL_DRV_ATOM, ATOM(ok),
         // Start of list
         ST_STATS_TUPLE(lsp, magic),     /* Log file magic number. */
         ST_STATS_TUPLE(lsp, version),   /* Log file version number. */
@@ -315,9 +337,9 @@ static void send_mpool_fstat(ErlDrvPort port, ErlDrvTermData pid, DB_MPOOL_FSTAT
     char *name = fsp->file_name ? fsp->file_name : "<null>";
     int name_len = strlen(name);
     ErlDrvTermData response[] = {
-        ERL_DRV_ATOM, driver_mk_atom("fstat"),
+        ERL_DRV_ATOM, ATOM(fstat),
         // Start of list
-            ERL_DRV_ATOM, driver_mk_atom("name"),
+            ERL_DRV_ATOM, ATOM(name),
             ERL_DRV_STRING, (ErlDrvTermData) name, name_len,
             ERL_DRV_TUPLE, 2,
         ST_STATS_TUPLE(fsp, map),               /* Pages from mapped files. */
@@ -355,7 +377,7 @@ static void async_cleanup_and_send_memp_stats(PortData* d, DB_MPOOL_STAT *gsp,
 
     // Then send the global stats
     ErlDrvTermData response[] = {
-        ERL_DRV_ATOM, driver_mk_atom("ok"),
+        ERL_DRV_ATOM, ATOM(ok),
         // Start of list
         ST_STATS_TUPLE(gsp, gbytes),            /* Total cache size: GB. */
         ST_STATS_TUPLE(gsp, bytes),             /* Total cache size: B. */
@@ -419,7 +441,7 @@ static void async_cleanup_and_send_mutex_stats(PortData* d, DB_MUTEX_STAT *msp)
     bdberl_async_cleanup(d);
 
     ErlDrvTermData response[] = {
-        ERL_DRV_ATOM, driver_mk_atom("ok"),
+        ERL_DRV_ATOM, ATOM(ok),
         // Start of list
         ST_STATS_TUPLE(msp, mutex_align),       /* Mutex alignment */
         ST_STATS_TUPLE(msp, mutex_tas_spins),   /* Mutex test-and-set spins */
@@ -439,12 +461,12 @@ static void async_cleanup_and_send_mutex_stats(PortData* d, DB_MUTEX_STAT *msp)
 }
 
 #define STATS_TUPLE(base, member)                       \
-    ERL_DRV_ATOM, driver_mk_atom(#member),              \
+    ERL_DRV_ATOM, ATOM(member),                        \
         ERL_DRV_UINT, (base)->member,                   \
         ERL_DRV_TUPLE, 2
 
 #define STATS_LSN_TUPLE(base, member)                               \
-    ERL_DRV_ATOM, driver_mk_atom(#member),                          \
+    ERL_DRV_ATOM, ATOM(member),                                    \
         ERL_DRV_UINT, (base)->member.file,                          \
         ERL_DRV_UINT, (base)->member.offset,                        \
         ERL_DRV_TUPLE, 2,                                           \
@@ -455,34 +477,34 @@ static void send_txn_tstat(ErlDrvPort port, ErlDrvTermData pid, DB_TXN_ACTIVE *t
     char *name = tasp->name ? tasp->name : "<null>";
     int name_len = strlen(name);
     char tid_str[32];
-    char *status_str;
+    ErlDrvTermData status;
     switch (tasp->status)
     {
         case TXN_ABORTED:
-            status_str = "aborted";
+            status = ATOM(aborted);
             break;
         case TXN_COMMITTED:
-            status_str = "committed";
+            status = ATOM(committed);
             break;
         case TXN_PREPARED:
-            status_str = "prepared";
+            status = ATOM(prepared);
             break;
         case TXN_RUNNING:
-            status_str = "running";
+            status = ATOM(running);
             break;
         default:
-            status_str = "undefined";
+            status = ATOM(undefined);
             break;
     }
 
     int tid_str_len = snprintf(tid_str, sizeof(tid_str), "%lu", (unsigned long) tasp->tid);
 
     ErlDrvTermData response[] = {
-        ERL_DRV_ATOM, driver_mk_atom("txn"),
+        ERL_DRV_ATOM, ATOM(txn),
         STATS_TUPLE(tasp, txnid),               /* Transaction ID */
         STATS_TUPLE(tasp, parentid),            /* Transaction ID of parent */
         STATS_TUPLE(tasp, pid),                 /* Process owning txn ID - pid_t */
-            ERL_DRV_ATOM, driver_mk_atom("tid"),/* OSX has 32-bit ints in erlang, so return as */
+            ERL_DRV_ATOM, ATOM(tid),/* OSX has 32-bit ints in erlang, so return as */
             ERL_DRV_STRING, (ErlDrvTermData) tid_str, tid_str_len, /* a string */
         ERL_DRV_TUPLE, 2,
         STATS_LSN_TUPLE(tasp, lsn),             /* LSN when transaction began */
@@ -490,11 +512,11 @@ static void send_txn_tstat(ErlDrvPort port, ErlDrvTermData pid, DB_TXN_ACTIVE *t
         STATS_TUPLE(tasp, mvcc_ref),            /* MVCC reference count */
 
         // Start of list
-            ERL_DRV_ATOM, driver_mk_atom("status"),
-            ERL_DRV_ATOM, driver_mk_atom(status_str),
+            ERL_DRV_ATOM, ATOM(status),
+            ERL_DRV_ATOM, status,
         ERL_DRV_TUPLE, 2,
 
-            ERL_DRV_ATOM, driver_mk_atom("name"),
+            ERL_DRV_ATOM, ATOM(name),
             ERL_DRV_STRING, (ErlDrvTermData) name, name_len,
         ERL_DRV_TUPLE, 2,
 
@@ -508,7 +530,7 @@ static void send_txn_tstat(ErlDrvPort port, ErlDrvTermData pid, DB_TXN_ACTIVE *t
 }
 
 #define ST_STATS_LSN_TUPLE(base, member)                            \
-    ERL_DRV_ATOM, driver_mk_atom(#member),                          \
+    ERL_DRV_ATOM, ATOM(member),                                    \
         ERL_DRV_UINT, (base)->st_##member.file,                     \
         ERL_DRV_UINT, (base)->st_##member.offset,                   \
         ERL_DRV_TUPLE, 2,                                           \
@@ -534,7 +556,7 @@ static void async_cleanup_and_send_txn_stats(PortData* d, DB_TXN_STAT *tsp)
 
     // Then send the global stats
     ErlDrvTermData response[] = {
-        ERL_DRV_ATOM, driver_mk_atom("ok"),
+        ERL_DRV_ATOM, ATOM(ok),
         // Start of list
         ST_STATS_TUPLE(tsp, nrestores),         /* number of restored transactions
                                                    after recovery. */
@@ -561,10 +583,36 @@ static void async_cleanup_and_send_txn_stats(PortData* d, DB_TXN_STAT *tsp)
 }
 
 
+// Find the memory pool stats of the database's file; all zeros if it has no pages cached
+static void db_file_stats(int dbref, DB_MPOOL_FSTAT *fstat)
+{
+    memset(fstat, '\0', sizeof(DB_MPOOL_FSTAT));
+
+    DB_MPOOL_FSTAT **fsp = NULL;
+    const char* name = bdberl_lookup_database(dbref)->name;
+    if (bdberl_db_env()->memp_stat(bdberl_db_env(), NULL, &fsp, 0) != 0 || fsp == NULL)
+    {
+        return;
+    }
+
+    int i;
+    for (i = 0; fsp[i] != NULL; i++)
+    {
+        if (fsp[i]->file_name != NULL && strcmp(fsp[i]->file_name, name) == 0)
+        {
+            *fstat = *fsp[i];
+            fstat->file_name = NULL;
+            break;
+        }
+    }
+    driver_free(fsp);
+}
+
 static void do_async_stat(void* arg)
 {
     // Payload is: << DbRef:32, Flags:32 >>
     PortData* d = (PortData*)arg;
+    BDBERL_PROBE2(async__entry, d->port, d->async_op);
 
     // Get the database object, using the provided ref
     DB* db = bdberl_lookup_dbref(d->async_dbref);
@@ -584,14 +632,18 @@ static void do_async_stat(void* arg)
     }
     else
     {
+        DB_MPOOL_FSTAT fstat;
+        db_file_stats(d->async_dbref, &fstat);
+        DbOptions* options = &(bdberl_lookup_database(d->async_dbref)->options);
         switch(type)
         {
             case DB_BTREE: /*FALLTHRU*/
             case DB_RECNO:
-                async_cleanup_and_send_btree_stats(d, type == DB_BTREE ? "btree" :"recno", sp);
+                async_cleanup_and_send_btree_stats(d, type == DB_BTREE ? ATOM(btree) : ATOM(recno), sp,
+                                                   options->bt_compress, &fstat);
                 break;
             case DB_HASH:
-                async_cleanup_and_send_hash_stats(d, sp);
+                async_cleanup_and_send_hash_stats(d, sp, options->h_hash, &fstat);
                 break;
 #ifdef ENABLE_QUEUE
             case DB_QUEUE:
@@ -615,6 +667,7 @@ static void do_async_lock_stat(void* arg)
 {
     // Payload is: <<Flags:32 >>
     PortData* d = (PortData*)arg;
+    BDBERL_PROBE2(async__entry, d->port, d->async_op);
 
     DB_LOCK_STAT *lsp = NULL;
     int rc = bdberl_db_env()->lock_stat(bdberl_db_env(), &lsp, d->async_flags);
@@ -638,6 +691,7 @@ static void do_async_log_stat(void* arg)
 {
     // Payload is: <<Flags:32 >>
     PortData* d = (PortData*)arg;
+    BDBERL_PROBE2(async__entry, d->port, d->async_op);
 
     DB_LOG_STAT *lsp = NULL;
     int rc = bdberl_db_env()->log_stat(bdberl_db_env(), &lsp, d->async_flags);
@@ -661,6 +715,7 @@ static void do_async_memp_stat(void* arg)
 {
     // Payload is: <<Flags:32 >>
     PortData* d = (PortData*)arg;
+    BDBERL_PROBE2(async__entry, d->port, d->async_op);
 
     DB_MPOOL_STAT *gsp = NULL;
     DB_MPOOL_FSTAT **fsp = NULL;
@@ -689,6 +744,7 @@ static void do_async_mutex_stat(void* arg)
 {
     // Payload is: <<Flags:32 >>
     PortData* d = (PortData*)arg;
+    BDBERL_PROBE2(async__entry, d->port, d->async_op);
 
     DB_MUTEX_STAT *msp = NULL;
     int rc = bdberl_db_env()->mutex_stat(bdberl_db_env(), &msp, d->async_flags);
@@ -713,6 +769,7 @@ static void do_async_txn_stat(void* arg)
 {
     // Payload is: <<Flags:32 >>
     PortData* d = (PortData*)arg;
+    BDBERL_PROBE2(async__entry, d->port, d->async_op);
 
     DB_TXN_STAT *tsp = NULL;
     int rc = bdberl_db_env()->txn_stat(bdberl_db_env(), &tsp, d->async_flags);
@@ -755,11 +812,11 @@ int bdberl_stats_control(PortData* d, unsigned int cmd,
                 d->async_dbref = dbref;
                 d->async_op = cmd;
                 d->async_flags = UNPACK_INT(inbuf, 4);
-                bdberl_general_tpool_run(&do_async_stat, d, 0, &d->async_job);
+                int rc = bdberl_general_tpool_run(&do_async_stat, d, 0, &d->async_job);
 
-                // Let caller know that the operation is in progress
-                // Outbuf is: <<0:32>>
-                RETURN_INT(0, outbuf);
+                // Let caller know that the operation is in progress (or was refused)
+                // Outbuf is: <<Rc:32>>
+                RETURN_INT(rc, outbuf);
             }
             else
             {
@@ -812,11 +869,11 @@ int bdberl_stats_control(PortData* d, unsigned int cmd,
             // Mark the port as busy and then schedule the appropriate async operation
             d->async_op = cmd;
             d->async_flags = UNPACK_INT(inbuf, 0);
-            bdberl_general_tpool_run(&do_async_lock_stat, d, 0, &d->async_job);
+            int rc = bdberl_general_tpool_run(&do_async_lock_stat, d, 0, &d->async_job);
 
-            // Let caller know that the operation is in progress
-            // Outbuf is: <<0:32>>
-            RETURN_INT(0, outbuf);
+            // Let caller know that the operation is in progress (or was refused)
+            // Outbuf is: <<Rc:32>>
+            RETURN_INT(rc, outbuf);
         }
         case CMD_LOCK_STAT_PRINT:
         {
@@ -840,11 +897,11 @@ int bdberl_stats_control(PortData* d, unsigned int cmd,
             // Mark the port as busy and then schedule the appropriate async operation
             d->async_op = cmd;
             d->async_flags = UNPACK_INT(inbuf, 0);
-            bdberl_general_tpool_run(&do_async_log_stat, d, 0, &d->async_job);
+            int rc = bdberl_general_tpool_run(&do_async_log_stat, d, 0, &d->async_job);
 
-            // Let caller know that the operation is in progress
-            // Outbuf is: <<0:32>>
-            RETURN_INT(0, outbuf);
+            // Let caller know that the operation is in progress (or was refused)
+            // Outbuf is: <<Rc:32>>
+            RETURN_INT(rc, outbuf);
         }
         case CMD_LOG_STAT_PRINT:
         {
@@ -868,11 +925,11 @@ int bdberl_stats_control(PortData* d, unsigned int cmd,
             // Mark the port as busy and then schedule the appropriate async operation
             d->async_op = cmd;
             d->async_flags = UNPACK_INT(inbuf, 0);
-            bdberl_general_tpool_run(&do_async_memp_stat, d, 0, &d->async_job);
+            int rc = bdberl_general_tpool_run(&do_async_memp_stat, d, 0, &d->async_job);
 
-            // Let caller know that the operation is in progress
-            // Outbuf is: <<0:32>>
-            RETURN_INT(0, outbuf);
+            // Let caller know that the operation is in progress (or was refused)
+            // Outbuf is: <<Rc:32>>
+            RETURN_INT(rc, outbuf);
         }
         case CMD_MEMP_STAT_PRINT:
         {
@@ -896,11 +953,11 @@ int bdberl_stats_control(PortData* d, unsigned int cmd,
             // Mark the port as busy and then schedule the appropriate async operation
             d->async_op = cmd;
             d->async_flags = UNPACK_INT(inbuf, 0);
-            bdberl_general_tpool_run(&do_async_mutex_stat, d, 0, &d->async_job);
+            int rc = bdberl_general_tpool_run(&do_async_mutex_stat, d, 0, &d->async_job);
 
-            // Let caller know that the operation is in progress
-            // Outbuf is: <<0:32>>
-            RETURN_INT(0, outbuf);
+            // Let caller know that the operation is in progress (or was refused)
+            // Outbuf is: <<Rc:32>>
+            RETURN_INT(rc, outbuf);
         }
         case CMD_MUTEX_STAT_PRINT:
         {
@@ -923,11 +980,11 @@ int bdberl_stats_control(PortData* d, unsigned int cmd,
             // Mark the port as busy and then schedule the appropriate async operation
             d->async_op = cmd;
             d->async_flags = UNPACK_INT(inbuf, 0);
-            bdberl_general_tpool_run(&do_async_txn_stat, d, 0, &d->async_job);
+            int rc = bdberl_general_tpool_run(&do_async_txn_stat, d, 0, &d->async_job);
 
-            // Let caller know that the operation is in progress
-            // Outbuf is: <<0:32>>
-            RETURN_INT(0, outbuf);
+            // Let caller know that the operation is in progress (or was refused)
+            // Outbuf is: <<Rc:32>>
+            RETURN_INT(rc, outbuf);
         }
         case CMD_TXN_STAT_PRINT:
         {
@@ -0,0 +1,893 @@
+/* -------------------------------------------------------------------
+ *
+ * bdberl: Erlang term order for external format keys
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ------------------------------------------------------------------- */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bdberl_term_cmp.h"
+
+#define VERSION_MAGIC           131
+
+#define NEW_FLOAT_EXT           70
+#define BIT_BINARY_EXT          77
+#define NEW_PID_EXT             88
+#define NEW_PORT_EXT            89
+#define NEWER_REFERENCE_EXT     90
+#define SMALL_INTEGER_EXT       97
+#define INTEGER_EXT             98
+#define FLOAT_EXT               99
+#define ATOM_EXT                100
+#define REFERENCE_EXT           101
+#define PORT_EXT                102
+#define PID_EXT                 103
+#define SMALL_TUPLE_EXT         104
+#define LARGE_TUPLE_EXT         105
+#define NIL_EXT                 106
+#define STRING_EXT              107
+#define LIST_EXT                108
+#define BINARY_EXT              109
+#define SMALL_BIG_EXT           110
+#define LARGE_BIG_EXT           111
+#define NEW_FUN_EXT             112
+#define EXPORT_EXT              113
+#define NEW_REFERENCE_EXT       114
+#define SMALL_ATOM_EXT          115
+#define MAP_EXT                 116
+#define FUN_EXT                 117
+#define ATOM_UTF8_EXT           118
+#define SMALL_ATOM_UTF8_EXT     119
+#define V4_PORT_EXT             120
+
+#define MAX_DEPTH               256     /* Deeper keys compare by bytes */
+
+// Term order of the kinds of term
+enum
+{
+    CLASS_NUMBER, CLASS_ATOM, CLASS_REF, CLASS_FUN, CLASS_PORT, CLASS_PID, CLASS_TUPLE,
+    CLASS_MAP, CLASS_NIL, CLASS_LIST, CLASS_BITSTRING, CLASS_INVALID
+};
+
+typedef struct
+{
+    const unsigned char* p;
+    const unsigned char* end;
+} Cursor;
+
+// An integer as sign and little endian magnitude, as the big encodings hold it, or a float
+typedef struct
+{
+    int is_float;
+    double f;
+    int negative;
+    const unsigned char* digits;
+    unsigned int n;
+    unsigned char small[8];
+} Number;
+
+typedef struct
+{
+    Cursor* c;                  /* Elements of a LIST_EXT, then its tail */
+    int string;                 /* Elements are the bytes at s */
+    const unsigned char* s;
+    uint32_t remaining;
+} ListIter;
+
+#define LIST_ELEM  0
+#define LIST_END   1
+#define LIST_TAIL  2            /* Improper tail at c->p */
+#define LIST_ERROR 3
+
+static int compare_terms(Cursor* a, Cursor* b, int depth, int* err);
+static int skip_term(Cursor* c, int depth);
+
+
+static inline int has(const Cursor* c, size_t n)
+{
+    return (size_t)(c->end - c->p) >= n;
+}
+
+static inline uint32_t get16(const unsigned char* p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static inline uint32_t get32(const unsigned char* p)
+{
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static inline int sign(int64_t v)
+{
+    return v < 0 ? -1 : (v > 0 ? 1 : 0);
+}
+
+static int compare_bytes(const unsigned char* a, size_t a_size,
+                         const unsigned char* b, size_t b_size)
+{
+    int r = memcmp(a, b, a_size < b_size ? a_size : b_size);
+    if (r != 0)
+    {
+        return r < 0 ? -1 : 1;
+    }
+    return a_size < b_size ? -1 : (a_size > b_size ? 1 : 0);
+}
+
+static int term_class(unsigned char tag)
+{
+    switch (tag)
+    {
+    case SMALL_INTEGER_EXT: case INTEGER_EXT: case SMALL_BIG_EXT: case LARGE_BIG_EXT:
+    case NEW_FLOAT_EXT: case FLOAT_EXT:
+        return CLASS_NUMBER;
+    case ATOM_EXT: case SMALL_ATOM_EXT: case ATOM_UTF8_EXT: case SMALL_ATOM_UTF8_EXT:
+        return CLASS_ATOM;
+    case REFERENCE_EXT: case NEW_REFERENCE_EXT: case NEWER_REFERENCE_EXT:
+        return CLASS_REF;
+    case NEW_FUN_EXT: case EXPORT_EXT: case FUN_EXT:
+        return CLASS_FUN;
+    case PORT_EXT: case NEW_PORT_EXT: case V4_PORT_EXT:
+        return CLASS_PORT;
+    case PID_EXT: case NEW_PID_EXT:
+        return CLASS_PID;
+    case SMALL_TUPLE_EXT: case LARGE_TUPLE_EXT:
+        return CLASS_TUPLE;
+    case MAP_EXT:
+        return CLASS_MAP;
+    case NIL_EXT:
+        return CLASS_NIL;
+    case STRING_EXT: case LIST_EXT:
+        return CLASS_LIST;
+    case BINARY_EXT: case BIT_BINARY_EXT:
+        return CLASS_BITSTRING;
+    default:
+        return CLASS_INVALID;
+    }
+}
+
+
+int bdberl_term_compare(const unsigned char* a, unsigned int a_size,
+                        const unsigned char* b, unsigned int b_size)
+{
+    if (a_size < 2 || b_size < 2 || a[0] != VERSION_MAGIC || b[0] != VERSION_MAGIC)
+    {
+        return compare_bytes(a, a_size, b, b_size);
+    }
+
+    // Fast paths: two small integers, or two binaries
+    if (a[1] == SMALL_INTEGER_EXT && b[1] == SMALL_INTEGER_EXT && a_size == 3 && b_size == 3)
+    {
+        return sign((int)a[2] - (int)b[2]);
+    }
+    if (a[1] == BINARY_EXT && b[1] == BINARY_EXT && a_size >= 6 && b_size >= 6 &&
+        get32(a + 2) == a_size - 6 && get32(b + 2) == b_size - 6)
+    {
+        return compare_bytes(a + 6, a_size - 6, b + 6, b_size - 6);
+    }
+
+    Cursor ca = { a + 1, a + a_size };
+    Cursor cb = { b + 1, b + b_size };
+    int err = 0;
+    int r = compare_terms(&ca, &cb, 0, &err);
+    if (err || r == 0)
+    {
+        return compare_bytes(a, a_size, b, b_size);
+    }
+    return r;
+}
+
+
+// Skip an atom of any encoding
+static int skip_atom(Cursor* c)
+{
+    if (!has(c, 1))
+    {
+        return 0;
+    }
+    unsigned char tag = *c->p;
+    size_t len;
+    if ((tag == ATOM_EXT || tag == ATOM_UTF8_EXT) && has(c, 3))
+    {
+        len = 3 + get16(c->p + 1);
+    }
+    else if ((tag == SMALL_ATOM_EXT || tag == SMALL_ATOM_UTF8_EXT) && has(c, 2))
+    {
+        len = 2 + c->p[1];
+    }
+    else
+    {
+        return 0;
+    }
+    if (!has(c, len))
+    {
+        return 0;
+    }
+    c->p += len;
+    return 1;
+}
+
+// Skip fixed size fields after the tag, an atom at the front when atom_first is set
+static int skip_fixed(Cursor* c, int atom_first, size_t len)
+{
+    if (atom_first && !skip_atom(c))
+    {
+        return 0;
+    }
+    if (!has(c, len))
+    {
+        return 0;
+    }
+    c->p += len;
+    return 1;
+}
+
+static int skip_terms(Cursor* c, uint32_t count, int depth)
+{
+    while (count-- > 0)
+    {
+        if (!skip_term(c, depth))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Move the cursor past one term; zero when it is malformed or too deep
+static int skip_term(Cursor* c, int depth)
+{
+    if (depth > MAX_DEPTH || !has(c, 1))
+    {
+        return 0;
+    }
+    unsigned char tag = *c->p;
+    switch (tag)
+    {
+    case ATOM_EXT: case SMALL_ATOM_EXT: case ATOM_UTF8_EXT: case SMALL_ATOM_UTF8_EXT:
+        return skip_atom(c);
+    }
+
+    c->p++;
+    switch (tag)
+    {
+    case SMALL_INTEGER_EXT:     return skip_fixed(c, 0, 1);
+    case INTEGER_EXT:           return skip_fixed(c, 0, 4);
+    case NEW_FLOAT_EXT:         return skip_fixed(c, 0, 8);
+    case FLOAT_EXT:             return skip_fixed(c, 0, 31);
+    case NIL_EXT:               return 1;
+    case SMALL_BIG_EXT:         return has(c, 1) && skip_fixed(c, 0, 2 + c->p[0]);
+    case LARGE_BIG_EXT:         return has(c, 4) && skip_fixed(c, 0, 5 + (size_t)get32(c->p));
+    case STRING_EXT:            return has(c, 2) && skip_fixed(c, 0, 2 + get16(c->p));
+    case BINARY_EXT:            return has(c, 4) && skip_fixed(c, 0, 4 + (size_t)get32(c->p));
+    case BIT_BINARY_EXT:        return has(c, 4) && skip_fixed(c, 0, 5 + (size_t)get32(c->p));
+    case REFERENCE_EXT:         return skip_fixed(c, 1, 5);
+    case PORT_EXT:              return skip_fixed(c, 1, 5);
+    case NEW_PORT_EXT:          return skip_fixed(c, 1, 8);
+    case V4_PORT_EXT:           return skip_fixed(c, 1, 12);
+    case PID_EXT:               return skip_fixed(c, 1, 9);
+    case NEW_PID_EXT:           return skip_fixed(c, 1, 12);
+    case NEW_FUN_EXT:           return has(c, 4) && get32(c->p) >= 4 && skip_fixed(c, 0, get32(c->p));
+    case EXPORT_EXT:            return skip_terms(c, 3, depth + 1);
+    case NEW_REFERENCE_EXT:
+    case NEWER_REFERENCE_EXT:
+    {
+        if (!has(c, 2))
+        {
+            return 0;
+        }
+        size_t ids = 4 * (size_t)get16(c->p);
+        c->p += 2;
+        return skip_fixed(c, 1, (tag == NEW_REFERENCE_EXT ? 1 : 4) + ids);
+    }
+    case SMALL_TUPLE_EXT:
+        return has(c, 1) && skip_fixed(c, 0, 1) && skip_terms(c, c->p[-1], depth + 1);
+    case LARGE_TUPLE_EXT:
+        return has(c, 4) && skip_fixed(c, 0, 4) && skip_terms(c, get32(c->p - 4), depth + 1);
+    case LIST_EXT:
+        return has(c, 4) && skip_fixed(c, 0, 4) &&
+            skip_terms(c, get32(c->p - 4), depth + 1) && skip_term(c, depth + 1);
+    case MAP_EXT:
+    {
+        if (!has(c, 4))
+        {
+            return 0;
+        }
+        uint32_t pairs = get32(c->p);
+        c->p += 4;
+        return skip_terms(c, pairs, depth + 1) && skip_terms(c, pairs, depth + 1);
+    }
+    case FUN_EXT:
+    {
+        if (!has(c, 4))
+        {
+            return 0;
+        }
+        uint32_t num_free = get32(c->p);
+        c->p += 4;
+        return skip_terms(c, 4, depth + 1) && skip_terms(c, num_free, depth + 1);
+    }
+    default:
+        return 0;
+    }
+}
+
+// Terms of the same class that are only grouped, not ordered like the VM does
+static int compare_encoded(Cursor* a, Cursor* b, int depth, int* err)
+{
+    const unsigned char* a_start = a->p;
+    const unsigned char* b_start = b->p;
+    if (!skip_term(a, depth) || !skip_term(b, depth))
+    {
+        *err = 1;
+        return 0;
+    }
+    return compare_bytes(a_start, a->p - a_start, b_start, b->p - b_start);
+}
+
+
+static int parse_number(Cursor* c, Number* n)
+{
+    memset(n, '\0', sizeof(Number));
+    unsigned char tag = *c->p++;
+    switch (tag)
+    {
+    case SMALL_INTEGER_EXT:
+        if (!has(c, 1))
+        {
+            return 0;
+        }
+        n->small[0] = *c->p++;
+        n->digits = n->small;
+        n->n = 1;
+        break;
+    case INTEGER_EXT:
+    {
+        if (!has(c, 4))
+        {
+            return 0;
+        }
+        int64_t v = (int32_t)get32(c->p);
+        c->p += 4;
+        n->negative = v < 0;
+        uint64_t mag = v < 0 ? (uint64_t)(-v) : (uint64_t)v;
+        int i;
+        for (i = 0; i < 8; i++)
+        {
+            n->small[i] = (unsigned char)(mag >> (8 * i));
+        }
+        n->digits = n->small;
+        n->n = 8;
+        break;
+    }
+    case SMALL_BIG_EXT:
+    case LARGE_BIG_EXT:
+    {
+        size_t head = tag == SMALL_BIG_EXT ? 2 : 5;
+        if (!has(c, head))
+        {
+            return 0;
+        }
+        n->n = tag == SMALL_BIG_EXT ? c->p[0] : get32(c->p);
+        n->negative = c->p[head - 1] != 0;
+        c->p += head;
+        if (!has(c, n->n))
+        {
+            return 0;
+        }
+        n->digits = c->p;
+        c->p += n->n;
+        break;
+    }
+    case NEW_FLOAT_EXT:
+    {
+        if (!has(c, 8))
+        {
+            return 0;
+        }
+        uint64_t bits = ((uint64_t)get32(c->p) << 32) | get32(c->p + 4);
+        memcpy(&n->f, &bits, 8);
+        n->is_float = 1;
+        c->p += 8;
+        break;
+    }
+    case FLOAT_EXT:
+    {
+        if (!has(c, 31))
+        {
+            return 0;
+        }
+        char buf[32];
+        memcpy(buf, c->p, 31);
+        buf[31] = '\0';
+        n->f = strtod(buf, NULL);
+        n->is_float = 1;
+        c->p += 31;
+        break;
+    }
+    default:
+        return 0;
+    }
+
+    // Drop leading zero digits so magnitudes compare by length
+    while (n->n > 0 && n->digits[n->n - 1] == 0)
+    {
+        n->n--;
+    }
+    return 1;
+}
+
+static double number_to_double(const Number* n)
+{
+    if (n->is_float)
+    {
+        return n->f;
+    }
+    double d = 0;
+    unsigned int i;
+    for (i = n->n; i > 0; i--)
+    {
+        d = d * 256 + n->digits[i - 1];
+    }
+    return n->negative ? -d : d;
+}
+
+static int compare_integers(const Number* a, const Number* b)
+{
+    int sa = a->n == 0 ? 0 : (a->negative ? -1 : 1);
+    int sb = b->n == 0 ? 0 : (b->negative ? -1 : 1);
+    if (sa != sb)
+    {
+        return sa < sb ? -1 : 1;
+    }
+
+    int mag = 0;
+    if (a->n != b->n)
+    {
+        mag = a->n < b->n ? -1 : 1;
+    }
+    else
+    {
+        unsigned int i;
+        for (i = a->n; i > 0 && mag == 0; i--)
+        {
+            if (a->digits[i - 1] != b->digits[i - 1])
+            {
+                mag = a->digits[i - 1] < b->digits[i - 1] ? -1 : 1;
+            }
+        }
+    }
+    return mag * sa;
+}
+
+// Compare an integer with a float exactly, as Erlang does; going through doubles rounds
+// integers above 2^53 and makes the order intransitive. Doubles hold every integer below
+// 2^53 and only integers from there up, so below it both sides compare as doubles and
+// from there up the float compares as the integer it is.
+static int compare_integer_float(const Number* a, double f)
+{
+    int sa = a->n == 0 ? 0 : (a->negative ? -1 : 1);
+    int sf = f < 0 ? -1 : (f > 0 ? 1 : 0);
+    if (sa != sf)
+    {
+        return sa < sf ? -1 : 1;
+    }
+    if (sa == 0)
+    {
+        return 0;
+    }
+
+    uint64_t bits;
+    memcpy(&bits, &f, 8);
+    int exponent = (int)((bits >> 52) & 0x7FF);
+    if (exponent == 0x7FF)
+    {
+        // Infinity is further from zero than any integer
+        return -sf;
+    }
+    if (exponent < 1076)
+    {
+        // |f| < 2^53; an integer of 2^53 or more is further from zero, anything less is a
+        // double exactly
+        if (a->n > 7 || (a->n == 7 && a->digits[6] >= 0x20))
+        {
+            return sa;
+        }
+        double x = number_to_double(a);
+        return x < f ? -1 : (x > f ? 1 : 0);
+    }
+
+    // |f| is the 53 bit mantissa shifted up exponent - 1075 places, at least one
+    unsigned char digits[8 + 2048 / 8];
+    Number b;
+    memset(&b, '\0', sizeof(Number));
+    memset(digits, '\0', sizeof(digits));
+    unsigned int shift = exponent - 1075;
+    uint64_t mantissa = ((bits & 0xFFFFFFFFFFFFFULL) | (1ULL << 52)) << (shift % 8);
+    unsigned int i;
+    for (i = 0; i < 8; i++)
+    {
+        digits[shift / 8 + i] = (unsigned char)(mantissa >> (8 * i));
+    }
+    b.negative = sf < 0;
+    b.digits = digits;
+    b.n = shift / 8 + 8;
+    while (b.n > 0 && b.digits[b.n - 1] == 0)
+    {
+        b.n--;
+    }
+    return compare_integers(a, &b);
+}
+
+static int compare_numbers(const Number* a, const Number* b)
+{
+    if (a->is_float && b->is_float)
+    {
+        return a->f < b->f ? -1 : (a->f > b->f ? 1 : 0);
+    }
+    if (a->is_float)
+    {
+        return -compare_integer_float(b, a->f);
+    }
+    if (b->is_float)
+    {
+        return compare_integer_float(a, b->f);
+    }
+    return compare_integers(a, b);
+}
+
+
+// Next character of an atom; UTF-8 is decoded leniently since only order matters
+static uint32_t next_char(const unsigned char** p, const unsigned char* end, int utf8)
+{
+    uint32_t ch = *(*p)++;
+    if (!utf8 || ch < 0xC0)
+    {
+        return ch;
+    }
+    int extra = ch >= 0xF0 ? 3 : (ch >= 0xE0 ? 2 : 1);
+    ch &= 0x3F >> extra;
+    while (extra-- > 0 && *p < end && (**p & 0xC0) == 0x80)
+    {
+        ch = (ch << 6) | (*(*p)++ & 0x3F);
+    }
+    return ch;
+}
+
+static int compare_atoms(Cursor* a, Cursor* b, int* err)
+{
+    const unsigned char* start[2] = { a->p, b->p };
+    if (!skip_atom(a) || !skip_atom(b))
+    {
+        *err = 1;
+        return 0;
+    }
+
+    const unsigned char* text[2];
+    const unsigned char* end[2] = { a->p, b->p };
+    int utf8[2];
+    int i;
+    for (i = 0; i < 2; i++)
+    {
+        unsigned char tag = start[i][0];
+        text[i] = start[i] + ((tag == ATOM_EXT || tag == ATOM_UTF8_EXT) ? 3 : 2);
+        utf8[i] = tag == ATOM_UTF8_EXT || tag == SMALL_ATOM_UTF8_EXT;
+    }
+
+    // UTF-8 sorts like the characters it encodes, as latin1 does
+    if (utf8[0] == utf8[1])
+    {
+        return compare_bytes(text[0], end[0] - text[0], text[1], end[1] - text[1]);
+    }
+    while (text[0] < end[0] && text[1] < end[1])
+    {
+        uint32_t x = next_char(&text[0], end[0], utf8[0]);
+        uint32_t y = next_char(&text[1], end[1], utf8[1]);
+        if (x != y)
+        {
+            return x < y ? -1 : 1;
+        }
+    }
+    return text[0] < end[0] ? 1 : (text[1] < end[1] ? -1 : 0);
+}
+
+static int compare_bitstrings(Cursor* a, Cursor* b, int* err)
+{
+    const unsigned char* data[2];
+    uint64_t bits[2];
+    Cursor* c[2] = { a, b };
+    int i;
+    for (i = 0; i < 2; i++)
+    {
+        const unsigned char* start = c[i]->p;
+        if (!skip_term(c[i], 0))
+        {
+            *err = 1;
+            return 0;
+        }
+        uint32_t len = get32(start + 1);
+        if (start[0] == BINARY_EXT)
+        {
+            data[i] = start + 5;
+            bits[i] = (uint64_t)len * 8;
+        }
+        else
+        {
+            unsigned int last = start[5];
+            data[i] = start + 6;
+            bits[i] = len == 0 ? 0 : (uint64_t)(len - 1) * 8 + (last ? last : 8);
+        }
+    }
+
+    uint64_t common = bits[0] < bits[1] ? bits[0] : bits[1];
+    int r = memcmp(data[0], data[1], common / 8);
+    if (r != 0)
+    {
+        return r < 0 ? -1 : 1;
+    }
+    if (common % 8)
+    {
+        unsigned char mask = (unsigned char)(0xFF << (8 - common % 8));
+        unsigned char x = data[0][common / 8] & mask;
+        unsigned char y = data[1][common / 8] & mask;
+        if (x != y)
+        {
+            return x < y ? -1 : 1;
+        }
+    }
+    return bits[0] < bits[1] ? -1 : (bits[0] > bits[1] ? 1 : 0);
+}
+
+
+// Start iterating the list whose tag is at c->p
+static int list_init(ListIter* it, Cursor* c)
+{
+    it->c = c;
+    it->string = 0;
+    it->remaining = 0;
+    unsigned char tag = *c->p++;
+    if (tag == STRING_EXT)
+    {
+        if (!has(c, 2) || !has(c, 2 + (size_t)get16(c->p)))
+        {
+            return 0;
+        }
+        it->string = 1;
+        it->remaining = get16(c->p);
+        it->s = c->p + 2;
+        c->p += 2 + it->remaining;
+    }
+    else if (tag == LIST_EXT)
+    {
+        if (!has(c, 4))
+        {
+            return 0;
+        }
+        it->remaining = get32(c->p);
+        c->p += 4;
+    }
+    else
+    {
+        return 0;
+    }
+    return 1;
+}
+
+// What the iterator holds next; a list in the tail of a list carries on the same list
+static int list_state(ListIter* it)
+{
+    for (;;)
+    {
+        if (it->remaining > 0)
+        {
+            return LIST_ELEM;
+        }
+        if (it->string)
+        {
+            return LIST_END;
+        }
+        if (!has(it->c, 1))
+        {
+            return LIST_ERROR;
+        }
+        unsigned char tag = *it->c->p;
+        if (tag == NIL_EXT)
+        {
+            it->c->p++;
+            return LIST_END;
+        }
+        if (tag != STRING_EXT && tag != LIST_EXT)
+        {
+            return LIST_TAIL;
+        }
+        if (!list_init(it, it->c))
+        {
+            return LIST_ERROR;
+        }
+    }
+}
+
+static int list_rest_class(ListIter* it, int state)
+{
+    switch (state)
+    {
+    case LIST_ELEM: return CLASS_LIST;
+    case LIST_END:  return CLASS_NIL;
+    default:        return term_class(*it->c->p);
+    }
+}
+
+static int compare_lists(Cursor* a, Cursor* b, int depth, int* err)
+{
+    ListIter ia;
+    ListIter ib;
+    if (!list_init(&ia, a) || !list_init(&ib, b))
+    {
+        *err = 1;
+        return 0;
+    }
+
+    for (;;)
+    {
+        int sa = list_state(&ia);
+        int sb = list_state(&ib);
+        if (sa == LIST_ERROR || sb == LIST_ERROR)
+        {
+            *err = 1;
+            return 0;
+        }
+
+        if (sa == LIST_ELEM && sb == LIST_ELEM)
+        {
+            // Bytes of a string are small integers
+            unsigned char tmp[2][2];
+            Cursor elem[2];
+            Cursor* e[2];
+            ListIter* it[2] = { &ia, &ib };
+            int i;
+            for (i = 0; i < 2; i++)
+            {
+                if (it[i]->string)
+                {
+                    tmp[i][0] = SMALL_INTEGER_EXT;
+                    tmp[i][1] = *it[i]->s++;
+                    elem[i].p = tmp[i];
+                    elem[i].end = tmp[i] + 2;
+                    e[i] = &elem[i];
+                }
+                else
+                {
+                    e[i] = it[i]->c;
+                }
+                it[i]->remaining--;
+            }
+            int r = compare_terms(e[0], e[1], depth + 1, err);
+            if (r != 0 || *err)
+            {
+                return r;
+            }
+            continue;
+        }
+
+        if (sa == LIST_END && sb == LIST_END)
+        {
+            return 0;
+        }
+        if (sa == LIST_TAIL && sb == LIST_TAIL)
+        {
+            return compare_terms(ia.c, ib.c, depth + 1, err);
+        }
+
+        // Only one list goes on, or ends in an improper tail
+        int ca = list_rest_class(&ia, sa);
+        int cb = list_rest_class(&ib, sb);
+        if (ca == CLASS_INVALID || cb == CLASS_INVALID)
+        {
+            *err = 1;
+            return 0;
+        }
+        return ca < cb ? -1 : (ca > cb ? 1 : 0);
+    }
+}
+
+
+// Compare the terms at a->p and b->p. When they are equal both cursors end up past them;
+// otherwise the cursors are left wherever the difference was found.
+static int compare_terms(Cursor* a, Cursor* b, int depth, int* err)
+{
+    if (depth > MAX_DEPTH || !has(a, 1) || !has(b, 1))
+    {
+        *err = 1;
+        return 0;
+    }
+
+    int ca = term_class(*a->p);
+    int cb = term_class(*b->p);
+    if (ca == CLASS_INVALID || cb == CLASS_INVALID)
+    {
+        *err = 1;
+        return 0;
+    }
+    if (ca != cb)
+    {
+        return ca < cb ? -1 : 1;
+    }
+
+    switch (ca)
+    {
+    case CLASS_NUMBER:
+    {
+        Number na;
+        Number nb;
+        if (!parse_number(a, &na) || !parse_number(b, &nb))
+        {
+            *err = 1;
+            return 0;
+        }
+        return compare_numbers(&na, &nb);
+    }
+    case CLASS_ATOM:
+        return compare_atoms(a, b, err);
+    case CLASS_TUPLE:
+    {
+        uint32_t arity[2];
+        Cursor* c[2] = { a, b };
+        int i;
+        for (i = 0; i < 2; i++)
+        {
+            int small = *c[i]->p++ == SMALL_TUPLE_EXT;
+            if (!has(c[i], small ? 1 : 4))
+            {
+                *err = 1;
+                return 0;
+            }
+            arity[i] = small ? c[i]->p[0] : get32(c[i]->p);
+            c[i]->p += small ? 1 : 4;
+        }
+        if (arity[0] != arity[1])
+        {
+            return arity[0] < arity[1] ? -1 : 1;
+        }
+        uint32_t n;
+        for (n = 0; n < arity[0]; n++)
+        {
+            int r = compare_terms(a, b, depth + 1, err);
+            if (r != 0 || *err)
+            {
+                return r;
+            }
+        }
+        return 0;
+    }
+    case CLASS_NIL:
+        a->p++;
+        b->p++;
+        return 0;
+    case CLASS_LIST:
+        return compare_lists(a, b, depth, err);
+    case CLASS_BITSTRING:
+        return compare_bitstrings(a, b, err);
+    default:
+        return compare_encoded(a, b, depth, err);
+    }
+}
@@ -0,0 +1,46 @@
+/* -------------------------------------------------------------------
+ *
+ * bdberl: Erlang term order for external format keys
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ------------------------------------------------------------------- */
+#ifndef _BDBERL_TERM_CMP
+#define _BDBERL_TERM_CMP
+
+/**
+ * Compare two term_to_binary encodings in Erlang term order:
+ *
+ *   number < atom < reference < fun < port < pid < tuple < map < nil < list < bitstring
+ *
+ * Integers and floats compare by value, atoms by their characters, tuples by size and then
+ * element by element, lists and bitstrings lexicographically. References, funs, ports, pids
+ * and maps of the same kind compare by their encoding, which keeps them grouped but is not
+ * the VM's order within the group. Terms that are equal in term order but encoded
+ * differently (1 and 1.0, or an atom in latin1 and utf8) are ordered by their bytes, so
+ * distinct keys never compare equal. Encodings that can't be decoded, including compressed
+ * ones, compare by bytes.
+ *
+ * Small integers and binaries, the common key types, are compared without the general
+ * decoder.
+ */
+int bdberl_term_compare(const unsigned char* a, unsigned int a_size,
+                        const unsigned char* b, unsigned int b_size);
+
+#endif // _BDBERL_TERM_CMP
@@ -29,6 +29,7 @@
 #include <db.h>
 #include "bdberl_drv.h"
 #include "bdberl_tpool.h"
+#include "bdberl_probes.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -36,12 +37,14 @@
 #include <signal.h>
 #include <errno.h>
 #include <pthread.h>
+#include <assert.h>
 
 static void* bdberl_tpool_main(void* tpool);
 static TPoolJob* next_job(TPool* tpool);
 static int remove_pending_job(TPool* tpool, TPoolJob* job);
 static void cleanup_job(TPool* tpool, TPoolJob* job);
 static int is_active_job(TPool* tpool, TPoolJob* job);
+static void record_latency(TPoolThreadStats* stats, TPoolJob* job, uint64_t finished_usecs);
 
 #define LOCK(tpool) erl_drv_mutex_lock(tpool->lock)
 #define UNLOCK(tpool) erl_drv_mutex_unlock(tpool->lock)
@@ -57,13 +60,16 @@ TPool* bdberl_tpool_start(unsigned int thread_count)
     tpool->work_cv      = erl_drv_cond_create("bdberl_tpool_work_cv");
     tpool->cancel_cv    = erl_drv_cond_create("bdberl_tpool_cancel_cv");
     tpool->threads      = driver_alloc(sizeof(ErlDrvTid) * thread_count);
+    tpool->thread_stats = driver_alloc(sizeof(TPoolThreadStats) * thread_count);
     tpool->thread_count = thread_count;
+    memset(tpool->thread_stats, '\0', sizeof(TPoolThreadStats) * thread_count);
 
     // Startup all the threads
     int i;
     for (i = 0; i < thread_count; i++)
     {
-        int rc = erl_drv_thread_create("bdberl_tpool_thread", &(tpool->threads[i]), &bdberl_tpool_main, (void*)tpool, 0);
+        tpool->thread_stats[i].tpool = tpool;
+        int rc = erl_drv_thread_create("bdberl_tpool_thread", &(tpool->threads[i]), &bdberl_tpool_main, (void*)&(tpool->thread_stats[i]), 0);
         if (0 != rc) {
             // TODO: Figure out good way to deal with errors in this situation (should be rare, but still...)
             fprintf(stderr, "Failed to spawn an erlang thread for the BDB thread pools! %s\n", erl_errno_id(rc));
@@ -100,24 +106,49 @@ void bdberl_tpool_stop(TPool* tpool)
     erl_drv_cond_destroy(tpool->work_cv);
     erl_drv_cond_destroy(tpool->cancel_cv);
     driver_free(tpool->threads);
+    driver_free(tpool->thread_stats);
     UNLOCK(tpool);
     erl_drv_mutex_destroy(tpool->lock);
     driver_free(tpool);
 }
 
-void bdberl_tpool_run(TPool* tpool, TPoolJobFunc main_fn, void* arg, TPoolJobFunc cancel_fn,
-                      TPoolJob** job_ptr)
+int bdberl_tpool_run(TPool* tpool, unsigned int job_class, unsigned int job_tag,
+                     TPoolJobFunc main_fn, void* arg, TPoolJobFunc cancel_fn, TPoolJob** job_ptr)
 {
+    assert(job_class < TPOOL_MAX_CLASSES);
+    assert(job_tag < TPOOL_MAX_TAGS);
+
     // Allocate and fill a new job structure
-    TPoolJob* job = *job_ptr = driver_alloc(sizeof(TPoolJob));
+    TPoolJob* job = driver_alloc(sizeof(TPoolJob));
     memset(job, '\0', sizeof(TPoolJob));
     job->main_fn = main_fn;
     job->arg = arg;
     job->cancel_fn = cancel_fn;
+    job->job_class = job_class;
+    job->job_tag = job_tag;
+    job->enqueued_usecs = bdberl_now_usecs();
 
     // Sync up with the tpool and add the job to the pending queue
     LOCK(tpool);
 
+    // Refuse the job if either the pool or the job's class already has a full queue. Failing
+    // here is cheap for the caller; letting the queue grow just makes every request slower.
+    if (job_class != TPOOL_CLASS_TXN_END &&
+        ((tpool->max_pending > 0 && tpool->pending_job_count >= tpool->max_pending) ||
+         (tpool->class_max_pending[job_class] > 0 &&
+          tpool->class_pending_count[job_class] >= tpool->class_max_pending[job_class])))
+    {
+        tpool->rejected_job_count++;
+        BDBERL_PROBE3(job__reject, job_class, job_tag, tpool->pending_job_count);
+        UNLOCK(tpool);
+
+        driver_free(job);
+        *job_ptr = 0;
+        return ERROR_OVERLOADED;
+    }
+
+    *job_ptr = job;
+
     if (tpool->pending_jobs)
     {
         // Make sure the current last job points to this one next
@@ -131,12 +162,15 @@ void bdberl_tpool_run(TPool* tpool, TPoolJobFunc main_fn, void* arg, TPoolJobFun
 
     tpool->last_pending_job = job;
     tpool->pending_job_count++;
+    tpool->class_pending_count[job_class]++;
+    BDBERL_PROBE4(job__enqueue, job, job_class, job_tag, tpool->pending_job_count);
 
     // Generate a notification that there is work todo.
     // TODO: I think this may not be necessary, in the case where there are already other
     // pending jobs. Not sure ATM, however, so will be on safe side
     erl_drv_cond_broadcast(tpool->work_cv);
     UNLOCK(tpool);
+    return 0;
 }
 
 void bdberl_tpool_cancel(TPool* tpool, TPoolJob* job)
@@ -183,7 +217,8 @@ void bdberl_tpool_cancel(TPool* tpool, TPoolJob* job)
 
 static void* bdberl_tpool_main(void* arg)
 {
-    TPool* tpool = (TPool*)arg;
+    TPoolThreadStats* stats = (TPoolThreadStats*)arg;
+    TPool* tpool = stats->tpool;
 
     LOCK(tpool);
 
@@ -207,8 +242,13 @@ static void* bdberl_tpool_main(void* arg)
             // Unlock to avoid blocking others
             UNLOCK(tpool);
 
-            // Invoke the function
+            // Invoke the function, timing how long it waited and how long it ran
+            job->started_usecs = bdberl_now_usecs();
+            BDBERL_PROBE3(job__start, job, job->job_tag, job->started_usecs - job->enqueued_usecs);
             (*(job->main_fn))(job->arg);
+            uint64_t finished_usecs = bdberl_now_usecs();
+            BDBERL_PROBE3(job__done, job, job->job_tag, finished_usecs - job->started_usecs);
+            record_latency(stats, job, finished_usecs);
 
             // Relock
             LOCK(tpool);
@@ -265,6 +305,7 @@ static TPoolJob* next_job(TPool* tpool)
 
         // Update counters
         tpool->pending_job_count--;
+        tpool->class_pending_count[job->job_class]--;
         tpool->active_job_count++;
 
         return job;
@@ -299,6 +340,7 @@ static int remove_pending_job(TPool* tpool, TPoolJob* job)
             }
 
             tpool->pending_job_count--;
+            tpool->class_pending_count[job->job_class]--;
             return 1;
         }
 
@@ -357,6 +399,46 @@ static int is_active_job(TPool* tpool, TPoolJob* job)
     return 0;
 }
 
+// Record the queue wait and service time of a finished job into the worker's own histograms
+static void record_latency(TPoolThreadStats* stats, TPoolJob* job, uint64_t finished_usecs)
+{
+    unsigned int generation = stats->tpool->stats_generation;
+    if (stats->generation != generation)
+    {
+        memset(stats->queue_wait, '\0', sizeof(stats->queue_wait));
+        memset(stats->service, '\0', sizeof(stats->service));
+        stats->generation = generation;
+    }
+
+    bdberl_histo_record(&(stats->queue_wait[job->job_tag]), job->started_usecs - job->enqueued_usecs);
+    bdberl_histo_record(&(stats->service[job->job_tag]), finished_usecs - job->started_usecs);
+}
+
+// Merge every worker's histograms for a tag into queue_wait/service. Workers which have not
+// recorded anything since the last reset still hold old data and are skipped.
+void bdberl_tpool_latency(TPool* tpool, unsigned int job_tag, Histo* queue_wait, Histo* service)
+{
+    int i;
+    assert(job_tag < TPOOL_MAX_TAGS);
+    unsigned int generation = tpool->stats_generation;
+    for (i = 0; i < tpool->thread_count; i++)
+    {
+        TPoolThreadStats* stats = &(tpool->thread_stats[i]);
+        if (stats->generation == generation)
+        {
+            bdberl_histo_merge(queue_wait, &(stats->queue_wait[job_tag]));
+            bdberl_histo_merge(service, &(stats->service[job_tag]));
+        }
+    }
+}
+
+void bdberl_tpool_latency_reset(TPool* tpool)
+{
+    LOCK(tpool);
+    tpool->stats_generation++;
+    UNLOCK(tpool);
+}
+
 // Return the number of pending and active jobs
 void bdberl_tpool_job_count(TPool* tpool, unsigned int *pending_count_ptr,
                              unsigned int *active_count_ptr)
@@ -367,6 +449,44 @@ void bdberl_tpool_job_count(TPool* tpool, unsigned int *pending_count_ptr,
     UNLOCK(tpool);
 }
 
+// Set the maximum number of pending jobs for the pool; 0 removes the limit
+void bdberl_tpool_set_max_pending(TPool* tpool, unsigned int max_pending)
+{
+    LOCK(tpool);
+    tpool->max_pending = max_pending;
+    UNLOCK(tpool);
+}
+
+// Set the maximum number of pending jobs for one admission class; 0 removes the limit
+void bdberl_tpool_set_class_max_pending(TPool* tpool, unsigned int job_class,
+                                        unsigned int max_pending)
+{
+    assert(job_class < TPOOL_MAX_CLASSES);
+    LOCK(tpool);
+    tpool->class_max_pending[job_class] = max_pending;
+    UNLOCK(tpool);
+}
+
+// Append a snapshot of the pool load to the binhelper:
+// <<Threads:32, Pending:32, Active:32, MaxPending:32, Rejected:32,
+//   [ClassPending:32, ClassMaxPending:32] * TPOOL_MAX_CLASSES>>
+void bdberl_tpool_load(TPool* tpool, BinHelper* bh)
+{
+    int i;
+    LOCK(tpool);
+    bin_helper_push_int32(bh, tpool->thread_count);
+    bin_helper_push_int32(bh, tpool->pending_job_count);
+    bin_helper_push_int32(bh, tpool->active_job_count);
+    bin_helper_push_int32(bh, tpool->max_pending);
+    bin_helper_push_int32(bh, tpool->rejected_job_count);
+    for (i = 0; i < TPOOL_MAX_CLASSES; i++)
+    {
+        bin_helper_push_int32(bh, tpool->class_pending_count[i]);
+        bin_helper_push_int32(bh, tpool->class_max_pending[i]);
+    }
+    UNLOCK(tpool);
+}
+
 // Returns a unique identifier pair for the current thread of control
 void bdberl_tpool_thread_id(DB_ENV *env, pid_t *pid, db_threadid_t *tid)
 {
@@ -29,9 +29,29 @@
 #define _BDBERL_TPOOL_DRV
 
 #include "erl_driver.h"
+#include "bin_helper.h"
+#include "bdberl_histo.h"
 
 typedef void (*TPoolJobFunc)(void* arg);
 
+/**
+ * Admission classes -- each job is counted against one class so that a flood of one kind
+ * of request (e.g. stats) can be bounded independently of the others. TXN_END jobs finish
+ * work that was already admitted (commit/abort release locks) and are never refused.
+ */
+#define TPOOL_CLASS_READ     0
+#define TPOOL_CLASS_WRITE    1
+#define TPOOL_CLASS_TXN      2
+#define TPOOL_CLASS_STAT     3
+#define TPOOL_CLASS_TXN_END  4
+#define TPOOL_MAX_CLASSES    5
+
+/**
+ * Latency tags -- callers label each job with a tag (< TPOOL_MAX_TAGS) and the pool keeps
+ * queue wait and service time histograms per tag.
+ */
+#define TPOOL_MAX_TAGS      16
+
 typedef struct _TPoolJob
 {
     TPoolJobFunc main_fn;      /* Function to invoke for this job */
@@ -44,12 +64,40 @@ typedef struct _TPoolJob
 
     unsigned int canceled;      /* Flag indicating if the job was canceled */
 
+    unsigned int job_class;     /* Admission class the job is counted against */
+
+    unsigned int job_tag;       /* Latency histogram the job is recorded against */
+
+    uint64_t enqueued_usecs;    /* Time the job was added to the pending queue */
+
+    uint64_t started_usecs;     /* Time a worker picked the job up */
+
     struct _TPoolJob* next;     /* Next job in the queue */
 
 } TPoolJob;
 
 
+struct _TPool;
+
+/**
+ * Per-thread latency histograms. Only the owning worker writes to these, so recording takes
+ * no locks; readers merge across threads. A reset bumps the pool's stats_generation and each
+ * worker clears its own histograms the next time it records.
+ */
 typedef struct
+{
+    struct _TPool* tpool;
+
+    volatile unsigned int generation;
+
+    Histo queue_wait[TPOOL_MAX_TAGS];
+
+    Histo service[TPOOL_MAX_TAGS];
+
+} TPoolThreadStats;
+
+
+typedef struct _TPool
 {
     ErlDrvMutex* lock;
 
@@ -67,8 +115,20 @@ typedef struct
 
     unsigned int active_job_count;
 
+    unsigned int max_pending;   /* Max jobs allowed in the pending queue; 0 is unbounded */
+
+    unsigned int class_pending_count[TPOOL_MAX_CLASSES];
+
+    unsigned int class_max_pending[TPOOL_MAX_CLASSES]; /* Per-class pending limits; 0 is unbounded */
+
+    unsigned int rejected_job_count; /* Jobs refused because a limit was hit */
+
     ErlDrvTid* threads;
 
+    TPoolThreadStats* thread_stats;
+
+    volatile unsigned int stats_generation;
+
     unsigned int thread_count;
 
     unsigned int active_threads;
@@ -81,14 +141,25 @@ TPool* bdberl_tpool_start(unsigned int thread_count);
 
 void   bdberl_tpool_stop(TPool* tpool);
 
-void bdberl_tpool_run(TPool* tpool, TPoolJobFunc main_fn, void* arg, TPoolJobFunc cancel_fn,
-    TPoolJob** job_ptr);
+int  bdberl_tpool_run(TPool* tpool, unsigned int job_class, unsigned int job_tag,
+    TPoolJobFunc main_fn, void* arg, TPoolJobFunc cancel_fn, TPoolJob** job_ptr);
 
 void bdberl_tpool_cancel(TPool* tpool, TPoolJob* job);
 
 void bdberl_tpool_job_count(TPool* tpool, unsigned int *pending_count_ptr,
                             unsigned int *active_count_ptr);
 
+void bdberl_tpool_set_max_pending(TPool* tpool, unsigned int max_pending);
+
+void bdberl_tpool_set_class_max_pending(TPool* tpool, unsigned int job_class,
+                                        unsigned int max_pending);
+
+void bdberl_tpool_load(TPool* tpool, BinHelper* bh);
+
+void bdberl_tpool_latency(TPool* tpool, unsigned int job_tag, Histo* queue_wait, Histo* service);
+
+void bdberl_tpool_latency_reset(TPool* tpool);
+
 void bdberl_tpool_thread_id(DB_ENV *env, pid_t *pid, db_threadid_t *tid);
 
 char *bdberl_tpool_thread_id_string(DB_ENV *dbenv, pid_t pid, db_threadid_t tid, char *buf);
@@ -0,0 +1,185 @@
+/* -------------------------------------------------------------------
+ *
+ * bdberl: Per-thread operation trace rings
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ------------------------------------------------------------------- */
+
+#include <string.h>
+
+#include "erl_driver.h"
+#include "bdberl_trace.h"
+
+#define TRACE_MAX_RINGS 256
+
+typedef struct
+{
+    volatile unsigned int head; /* Number of entries ever recorded */
+    unsigned int size;
+    TraceEntry entries[];
+} TraceRing;
+
+static ErlDrvTSDKey  G_TRACE_KEY;
+static ErlDrvMutex*  G_TRACE_LOCK  = 0;
+static unsigned int  G_TRACE_SIZE  = 0;
+
+// Rings are registered the first time a thread records and live until the driver finishes.
+// Registration and dumps hold G_TRACE_LOCK; recording never does.
+static TraceRing*    G_TRACE_RINGS[TRACE_MAX_RINGS];
+static unsigned int  G_TRACE_RING_COUNT = 0;
+
+static TraceRing* thread_ring(void);
+
+
+void bdberl_trace_init(unsigned int entries_per_thread)
+{
+    G_TRACE_SIZE = entries_per_thread;
+    G_TRACE_RING_COUNT = 0;
+    G_TRACE_LOCK = erl_drv_mutex_create("bdberl_drv: G_TRACE_LOCK");
+    erl_drv_tsd_key_create("bdberl_drv: G_TRACE_KEY", &G_TRACE_KEY);
+}
+
+void bdberl_trace_finish(void)
+{
+    if (G_TRACE_LOCK == NULL)
+    {
+        return;
+    }
+
+    unsigned int i;
+    for (i = 0; i < G_TRACE_RING_COUNT; i++)
+    {
+        driver_free(G_TRACE_RINGS[i]);
+        G_TRACE_RINGS[i] = NULL;
+    }
+    G_TRACE_RING_COUNT = 0;
+
+    erl_drv_tsd_key_destroy(G_TRACE_KEY);
+    erl_drv_mutex_destroy(G_TRACE_LOCK);
+    G_TRACE_LOCK = NULL;
+}
+
+void bdberl_trace_record(TraceEntry* entry)
+{
+    TraceRing* ring = thread_ring();
+    if (ring == NULL)
+    {
+        return;
+    }
+
+    unsigned int n = ring->head;
+    TraceEntry* e = &(ring->entries[n % ring->size]);
+
+    e->seq = n * 2 + 1;
+    __sync_synchronize();
+    e->op            = entry->op;
+    e->dbref         = entry->dbref;
+    e->key_size      = entry->key_size;
+    e->value_size    = entry->value_size;
+    e->rc            = entry->rc;
+    e->flags         = entry->flags;
+    e->timestamp     = entry->timestamp;
+    e->queue_usecs   = entry->queue_usecs;
+    e->service_usecs = entry->service_usecs;
+    __sync_synchronize();
+    e->seq = n * 2 + 2;
+    ring->head = n + 1;
+}
+
+void bdberl_trace_dump(BinHelper* bh)
+{
+    bin_helper_init(bh);
+    bin_helper_push_int32(bh, TRACE_DUMP_VERSION);
+    bin_helper_push_int32(bh, 0);       /* Count -- filled in below */
+
+    if (G_TRACE_LOCK == NULL)
+    {
+        return;
+    }
+
+    unsigned int count = 0;
+    erl_drv_mutex_lock(G_TRACE_LOCK);
+    bin_helper_reserve(bh, G_TRACE_RING_COUNT * G_TRACE_SIZE * (3 * 8 + 7 * 4));
+
+    unsigned int t;
+    for (t = 0; t < G_TRACE_RING_COUNT; t++)
+    {
+        TraceRing* ring = G_TRACE_RINGS[t];
+        unsigned int head = ring->head;
+        unsigned int n = head > ring->size ? head - ring->size : 0;
+        for (; n < head; n++)
+        {
+            TraceEntry* e = &(ring->entries[n % ring->size]);
+
+            // Skip entries being written or already reused by the owning thread
+            unsigned int seq = e->seq;
+            if (seq != n * 2 + 2)
+            {
+                continue;
+            }
+            __sync_synchronize();
+            TraceEntry copy = *e;
+            __sync_synchronize();
+            if (e->seq != seq)
+            {
+                continue;
+            }
+
+            bin_helper_push_uint64(bh, copy.timestamp);
+            bin_helper_push_uint64(bh, copy.queue_usecs);
+            bin_helper_push_uint64(bh, copy.service_usecs);
+            bin_helper_push_int32(bh, copy.op);
+            bin_helper_push_int32(bh, copy.dbref);
+            bin_helper_push_int32(bh, copy.key_size);
+            bin_helper_push_int32(bh, copy.value_size);
+            bin_helper_push_int32(bh, copy.rc);
+            bin_helper_push_int32(bh, copy.flags);
+            bin_helper_push_int32(bh, t);
+            count++;
+        }
+    }
+    erl_drv_mutex_unlock(G_TRACE_LOCK);
+
+    memcpy(bh->bin->orig_bytes + 4, &count, 4);
+}
+
+
+// Find the calling thread's ring, registering a new one on first use. Returns NULL once
+// TRACE_MAX_RINGS threads have registered.
+static TraceRing* thread_ring(void)
+{
+    TraceRing* ring = (TraceRing*)erl_drv_tsd_get(G_TRACE_KEY);
+    if (ring != NULL)
+    {
+        return ring;
+    }
+
+    erl_drv_mutex_lock(G_TRACE_LOCK);
+    if (G_TRACE_RING_COUNT < TRACE_MAX_RINGS)
+    {
+        ring = driver_alloc(sizeof(TraceRing) + sizeof(TraceEntry) * G_TRACE_SIZE);
+        memset(ring, '\0', sizeof(TraceRing) + sizeof(TraceEntry) * G_TRACE_SIZE);
+        ring->size = G_TRACE_SIZE;
+        G_TRACE_RINGS[G_TRACE_RING_COUNT++] = ring;
+        erl_drv_tsd_set(G_TRACE_KEY, ring);
+    }
+    erl_drv_mutex_unlock(G_TRACE_LOCK);
+    return ring;
+}
@@ -0,0 +1,73 @@
+/* -------------------------------------------------------------------
+ *
+ * bdberl: Per-thread operation trace rings
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ------------------------------------------------------------------- */
+#ifndef _BDBERL_TRACE
+#define _BDBERL_TRACE
+
+#include <stdint.h>
+#include "bin_helper.h"
+
+/**
+ * One completed operation. Each worker thread owns a ring of these and is the only writer,
+ * so recording takes no locks; readers detect entries overwritten under them with seq.
+ */
+typedef struct
+{
+    volatile unsigned int seq;  /* Odd while being written */
+    unsigned int op;            /* CMD_* of the operation */
+    int          dbref;         /* -1 when the op is not tied to a database */
+    unsigned int key_size;
+    unsigned int value_size;
+    int          rc;
+    unsigned int flags;         /* TRACE_* */
+    uint64_t     timestamp;     /* Wall clock at completion, usecs since the epoch */
+    uint64_t     queue_usecs;   /* Time spent waiting for a pool thread */
+    uint64_t     service_usecs; /* Time spent in BDB */
+} TraceEntry;
+
+#define TRACE_IN_TXN      1     /* The op ran inside a port transaction */
+
+#define TRACE_DUMP_VERSION 1
+
+/**
+ * Prototypes in bdberl_trace.c
+ */
+void bdberl_trace_init(unsigned int entries_per_thread);
+void bdberl_trace_finish(void);
+
+/**
+ * Copy the entry into the calling thread's ring; the seq field is filled in here
+ */
+void bdberl_trace_record(TraceEntry* entry);
+
+/**
+ * Write the entries of every thread's ring into the helper:
+ *
+ *   << Version:32, Count:32, Count * << Timestamp:64, QueueUsecs:64, ServiceUsecs:64,
+ *      Op:32, DbRef:32, KeySize:32, ValueSize:32, Rc:32, Flags:32, Thread:32 >> >>
+ *
+ * All integers are native endian. Entries are grouped by thread, oldest first.
+ */
+void bdberl_trace_dump(BinHelper* bh);
+
+#endif // _BDBERL_TRACE
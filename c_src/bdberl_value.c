@@ -0,0 +1,260 @@
+/* -------------------------------------------------------------------
+ *
+ * bdberl: Stored value layout
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ------------------------------------------------------------------- */
+
+#include <string.h>
+#include <stdint.h>
+
+#include "erl_driver.h"
+#include "bdberl_value.h"
+#include "bdberl_crc32.h"
+#include "bdberl_xxhash.h"
+
+static void write_versioned_header(unsigned char* value, int checksum, unsigned int flags,
+                                   uint32_t dict_id, unsigned int payload_size);
+static int verify_header(const unsigned char* value, unsigned int size,
+                         unsigned int* payload_offset);
+static int verify_legacy(const unsigned char* value, unsigned int size,
+                         unsigned int* payload_offset);
+
+
+static unsigned int checksum_size(int checksum)
+{
+    switch (checksum)
+    {
+    case VALUE_CHECKSUM_CRC32:
+    case VALUE_CHECKSUM_CRC32C:
+        return 4;
+    case VALUE_CHECKSUM_XXH64:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+unsigned int bdberl_value_header_size(int checksum)
+{
+    if (checksum == VALUE_CHECKSUM_CRC32)
+    {
+        return VALUE_LEGACY_PREFIX;
+    }
+    return VALUE_HEADER_BASE + checksum_size(checksum);
+}
+
+void bdberl_value_write_header(unsigned char* value, int checksum, unsigned int payload_size)
+{
+    unsigned int header_size = bdberl_value_header_size(checksum);
+    const unsigned char* payload = value + header_size;
+
+    if (checksum == VALUE_CHECKSUM_CRC32)
+    {
+        uint32_t crc = bdberl_crc32(payload, payload_size);
+        memcpy(value, &crc, 4);
+        return;
+    }
+
+    write_versioned_header(value, checksum, 0, 0, payload_size);
+}
+
+unsigned int bdberl_value_raw_header_size(int checksum)
+{
+    return checksum == VALUE_CHECKSUM_NONE ? 0 : bdberl_value_header_size(checksum);
+}
+
+int bdberl_value_verify(const unsigned char* value, unsigned int size,
+                        unsigned int* payload_offset)
+{
+    if (size > VALUE_HEADER_BASE && value[0] == VALUE_MAGIC && value[4] != VALUE_TERM_TAG)
+    {
+        return verify_header(value, size, payload_offset);
+    }
+    return verify_legacy(value, size, payload_offset);
+}
+
+int bdberl_value_verify_raw(const unsigned char* value, unsigned int size, int checksum,
+                            unsigned int* payload_offset)
+{
+    switch (checksum)
+    {
+    case VALUE_CHECKSUM_NONE:
+        *payload_offset = 0;
+        return 1;
+    case VALUE_CHECKSUM_CRC32:
+        return verify_legacy(value, size, payload_offset);
+    default:
+        return size >= VALUE_HEADER_BASE && value[0] == VALUE_MAGIC &&
+            verify_header(value, size, payload_offset);
+    }
+}
+
+unsigned char* bdberl_value_compress(const unsigned char* payload, unsigned int payload_size,
+                                     int checksum, const LzDict* dict,
+                                     unsigned int* value_size)
+{
+    // Only worth storing when it beats the uncompressed payload, RawSize included
+    if (payload_size <= VALUE_LZ_PREFIX + 1)
+    {
+        return NULL;
+    }
+    unsigned int header_size = VALUE_HEADER_BASE + checksum_size(checksum);
+    unsigned int cap = payload_size - VALUE_LZ_PREFIX - 1;
+    unsigned char* value = driver_alloc(header_size + VALUE_LZ_PREFIX + cap);
+
+    unsigned int block_size = bdberl_lz_compress(payload, payload_size, dict,
+                                                 value + header_size + VALUE_LZ_PREFIX, cap);
+    if (block_size == 0)
+    {
+        driver_free(value);
+        return NULL;
+    }
+
+    uint32_t raw_size = payload_size;
+    memcpy(value + header_size, &raw_size, 4);
+    write_versioned_header(value, checksum, VALUE_FLAG_LZ, dict != NULL ? dict->id : 0,
+                           VALUE_LZ_PREFIX + block_size);
+    *value_size = header_size + VALUE_LZ_PREFIX + block_size;
+    return value;
+}
+
+int bdberl_value_is_compressed(const unsigned char* value, unsigned int size)
+{
+    return size > VALUE_HEADER_BASE && value[0] == VALUE_MAGIC &&
+        value[4] != VALUE_TERM_TAG && (value[3] & VALUE_FLAG_LZ);
+}
+
+unsigned char* bdberl_value_inflate(const unsigned char* value, unsigned int size,
+                                    const LzDict* dict, unsigned int* inflated_size)
+{
+    unsigned int header_size = value[4];
+    uint32_t dict_id = value[5] | (value[6] << 8) | (value[7] << 16);
+    if (size < header_size + VALUE_LZ_PREFIX ||
+        dict_id != (dict != NULL ? dict->id : 0))
+    {
+        return NULL;
+    }
+
+    // A block expands at most 255 times (plus change), which bounds what a damaged RawSize
+    // can make us allocate when the value has no checksum
+    uint32_t raw_size;
+    memcpy(&raw_size, value + header_size, 4);
+    const unsigned char* block = value + header_size + VALUE_LZ_PREFIX;
+    unsigned int block_size = size - header_size - VALUE_LZ_PREFIX;
+    if ((uint64_t)raw_size > (uint64_t)block_size * 255 + 16)
+    {
+        return NULL;
+    }
+
+    unsigned char* inflated = driver_alloc(VALUE_HEADER_BASE + raw_size);
+    if (!bdberl_lz_decompress(block, block_size, dict,
+                              inflated + VALUE_HEADER_BASE, raw_size))
+    {
+        driver_free(inflated);
+        return NULL;
+    }
+    write_versioned_header(inflated, VALUE_CHECKSUM_NONE, 0, 0, raw_size);
+    *inflated_size = VALUE_HEADER_BASE + raw_size;
+    return inflated;
+}
+
+
+// The header layout, whatever the checksum; the payload is already in place behind it
+static void write_versioned_header(unsigned char* value, int checksum, unsigned int flags,
+                                   uint32_t dict_id, unsigned int payload_size)
+{
+    unsigned int header_size = VALUE_HEADER_BASE + checksum_size(checksum);
+    const unsigned char* payload = value + header_size;
+
+    value[0] = VALUE_MAGIC;
+    value[1] = VALUE_VERSION;
+    value[2] = (unsigned char)checksum;
+    value[3] = (unsigned char)flags;
+    value[4] = (unsigned char)header_size;
+    value[5] = (unsigned char)(dict_id & 0xFF);
+    value[6] = (unsigned char)((dict_id >> 8) & 0xFF);
+    value[7] = (unsigned char)((dict_id >> 16) & 0xFF);
+
+    if (checksum == VALUE_CHECKSUM_CRC32)
+    {
+        uint32_t crc = bdberl_crc32(payload, payload_size);
+        memcpy(value + VALUE_HEADER_BASE, &crc, 4);
+    }
+    else if (checksum == VALUE_CHECKSUM_CRC32C)
+    {
+        uint32_t crc = bdberl_crc32c(payload, payload_size);
+        memcpy(value + VALUE_HEADER_BASE, &crc, 4);
+    }
+    else if (checksum == VALUE_CHECKSUM_XXH64)
+    {
+        uint64_t sum = bdberl_xxh64(payload, payload_size, 0);
+        memcpy(value + VALUE_HEADER_BASE, &sum, 8);
+    }
+}
+
+static int verify_header(const unsigned char* value, unsigned int size,
+                         unsigned int* payload_offset)
+{
+    int checksum = value[2];
+    unsigned int header_size = value[4];
+    if (value[1] != VALUE_VERSION || checksum > VALUE_CHECKSUM_MAX ||
+        header_size != VALUE_HEADER_BASE + checksum_size(checksum) || header_size > size)
+    {
+        return 0;
+    }
+
+    const unsigned char* payload = value + header_size;
+    unsigned int payload_size = size - header_size;
+    *payload_offset = header_size;
+    switch (checksum)
+    {
+    case VALUE_CHECKSUM_CRC32:
+    {
+        uint32_t crc = bdberl_crc32(payload, payload_size);
+        return memcmp(value + VALUE_HEADER_BASE, &crc, 4) == 0;
+    }
+    case VALUE_CHECKSUM_CRC32C:
+    {
+        uint32_t crc = bdberl_crc32c(payload, payload_size);
+        return memcmp(value + VALUE_HEADER_BASE, &crc, 4) == 0;
+    }
+    case VALUE_CHECKSUM_XXH64:
+    {
+        uint64_t sum = bdberl_xxh64(payload, payload_size, 0);
+        return memcmp(value + VALUE_HEADER_BASE, &sum, 8) == 0;
+    }
+    default:
+        return 1;
+    }
+}
+
+// Original layout -- first 4 bytes are CRC of rest of bytes
+static int verify_legacy(const unsigned char* value, unsigned int size,
+                         unsigned int* payload_offset)
+{
+    if (size < VALUE_LEGACY_PREFIX)
+    {
+        return 0;
+    }
+    uint32_t crc = bdberl_crc32(value + VALUE_LEGACY_PREFIX, size - VALUE_LEGACY_PREFIX);
+    *payload_offset = VALUE_LEGACY_PREFIX;
+    return memcmp(value, &crc, 4) == 0;
+}
@@ -0,0 +1,135 @@
+/* -------------------------------------------------------------------
+ *
+ * bdberl: Stored value layout
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ------------------------------------------------------------------- */
+#ifndef _BDBERL_VALUE
+#define _BDBERL_VALUE
+
+#include "bdberl_lz.h"
+
+/**
+ * Databases opened with the default checksum keep the original value layout that bdberl:put
+ * builds:
+ *
+ *   << Crc32:32, TermBinary/bytes >>
+ *
+ * Any other checksum stores the value behind a versioned header written by the driver:
+ *
+ *   << 16#BD:8, Version:8, Checksum:8, Flags:8, HeaderSize:8, 0:24, Sum/bytes, Payload/bytes >>
+ *
+ * HeaderSize is the size of the whole header including Sum (0, 4 or 8 bytes). A term binary
+ * always starts with 131, so a value is in the original layout unless it starts with
+ * VALUE_MAGIC and its fifth byte is not 131. Sums are native endian, like the original CRC,
+ * and cover the payload. Reads dispatch on the layout of each value, so a database can
+ * change checksum between opens and still read everything it holds.
+ *
+ * Databases opened with compression store values that shrink behind the header, with
+ * VALUE_FLAG_LZ in Flags and the payload replaced by
+ *
+ *   << RawSize:32, LzBlock/bytes >>
+ *
+ * where LzBlock is the bdberl_lz encoding of the RawSize byte term binary. The three zero
+ * bytes after HeaderSize hold the id of the dictionary the block was compressed against, or
+ * zero. The sum covers the stored payload, so a value is checked before it is inflated.
+ * Compressed values use the header even with crc32, whose sum is then the CRC-32 of the
+ * stored payload. Values that don't shrink are stored as they would be without compression.
+ *
+ * Raw databases hold values that are not term binaries, so the layout can't be told from
+ * the value. They use the layout of the database's checksum: the value as given for none,
+ * the CRC-32 prefix for crc32 and the header for the others. Their checksum is fixed for
+ * the life of the database.
+ */
+#define VALUE_MAGIC           0xBD
+#define VALUE_VERSION         1
+#define VALUE_HEADER_BASE     8         /* Header size without the sum */
+#define VALUE_LEGACY_PREFIX   4         /* The CRC-32 in front of original layout values */
+#define VALUE_TERM_TAG        131       /* First byte of term_to_binary output */
+
+#define VALUE_CHECKSUM_NONE   0         /* For caches that can be regenerated */
+#define VALUE_CHECKSUM_CRC32  1         /* The default; written in the original layout */
+#define VALUE_CHECKSUM_CRC32C 2
+#define VALUE_CHECKSUM_XXH64  3
+#define VALUE_CHECKSUM_MAX    VALUE_CHECKSUM_XXH64
+
+#define VALUE_FLAG_LZ         0x01      /* Payload is << RawSize:32, LzBlock >> */
+#define VALUE_LZ_PREFIX       4         /* The RawSize in front of a compressed payload */
+
+/**
+ * Prototypes in bdberl_value.c
+ */
+
+/**
+ * Size of the header written for a checksum; VALUE_CHECKSUM_CRC32 gives the original
+ * layout's four byte prefix
+ */
+unsigned int bdberl_value_header_size(int checksum);
+
+/**
+ * Fill in the bdberl_value_header_size(checksum) bytes in front of a payload that has
+ * already been copied to value + bdberl_value_header_size(checksum)
+ */
+void bdberl_value_write_header(unsigned char* value, int checksum, unsigned int payload_size);
+
+/**
+ * Size of the framing in front of a raw value; zero for VALUE_CHECKSUM_NONE, which stores
+ * the value as given
+ */
+unsigned int bdberl_value_raw_header_size(int checksum);
+
+/**
+ * Check a stored value of either layout; returns 1 when it is intact and sets
+ * *payload_offset to where the term binary starts
+ */
+int bdberl_value_verify(const unsigned char* value, unsigned int size,
+                        unsigned int* payload_offset);
+
+/**
+ * Check a value stored in a raw database with the given checksum; returns 1 when it is
+ * intact and sets *payload_offset to where the raw value starts
+ */
+int bdberl_value_verify_raw(const unsigned char* value, unsigned int size, int checksum,
+                            unsigned int* payload_offset);
+
+/**
+ * Compress a term binary into a header layout value for the checksum, using dict when it is
+ * not NULL. Returns a driver_alloc'd value and sets *value_size, or NULL when compression
+ * would not make the value smaller.
+ */
+unsigned char* bdberl_value_compress(const unsigned char* payload, unsigned int payload_size,
+                                     int checksum, const LzDict* dict,
+                                     unsigned int* value_size);
+
+/**
+ * True when a value that passed bdberl_value_verify holds a compressed payload
+ */
+int bdberl_value_is_compressed(const unsigned char* value, unsigned int size);
+
+/**
+ * Inflate a verified, compressed value into a driver_alloc'd value with the same payload
+ * uncompressed behind a header with VALUE_CHECKSUM_NONE, since the driver has already checked
+ * it. Returns NULL when the value was compressed against another dictionary or the block
+ * doesn't decode to RawSize bytes.
+ */
+unsigned char* bdberl_value_inflate(const unsigned char* value, unsigned int size,
+                                    const LzDict* dict, unsigned int* inflated_size);
+
+#endif // _BDBERL_VALUE
@@ -0,0 +1,183 @@
+/* -------------------------------------------------------------------
+ *
+ * bdberl: CRC32 microbenchmark
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "bdberl_crc32.h"
+#include "bdberl_xxhash.h"
+#include "bench_util.h"
+
+/**
+ * Measures the throughput of each value checksum implementation for each value size. Each
+ * size is hashed over a buffer larger than the L2 cache so the numbers include loading the
+ * data, as they would for a value just copied out of BDB. The implementations are first
+ * checked against the standard check value, and those with a reference against it at every
+ * length and alignment up to 1KB.
+ *
+ * Usage: bench_crc32 [-z Size,...] [-b TotalMegabytes]
+ */
+
+#define BUFFER_SIZE (16 * 1024 * 1024)
+
+typedef struct
+{
+    const char* name;
+    uint32_t (*fun)(const unsigned char*, unsigned int);
+    uint32_t check;                                     /* Of "123456789" */
+    uint32_t (*ref)(const unsigned char*, unsigned int);
+} CrcImpl;
+
+// Low half only; the check value is that of XXH64("123456789", seed 0)
+static uint32_t xxh64_low(const unsigned char* buf, unsigned int len)
+{
+    return (uint32_t)bdberl_xxh64(buf, len, 0);
+}
+
+static int verify(CrcImpl* impls, unsigned int impl_count, const unsigned char* buffer)
+{
+    unsigned int i, offset, len;
+    for (i = 0; i < impl_count; i++)
+    {
+        if (impls[i].fun((const unsigned char*)"123456789", 9) != impls[i].check)
+        {
+            fprintf(stderr, "%s: wrong check value\n", impls[i].name);
+            return 0;
+        }
+        for (offset = 0; impls[i].ref && offset < 16; offset++)
+        {
+            for (len = 0; len <= 1024; len++)
+            {
+                if (impls[i].fun(buffer + offset, len) != impls[i].ref(buffer + offset, len))
+                {
+                    fprintf(stderr, "%s: mismatch at offset %u length %u\n",
+                            impls[i].name, offset, len);
+                    return 0;
+                }
+            }
+        }
+    }
+    return 1;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned int sizes[32] = { 8, 16, 64, 256, 1024, 4096, 16384, 65536, 1048576 };
+    unsigned int size_count = 9;
+    unsigned long total_mb = 512;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "z:b:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'z':
+            size_count = bench_parse_list(optarg, sizes, 32);
+            break;
+        case 'b':
+            total_mb = strtoul(optarg, 0, 10) > 0 ? strtoul(optarg, 0, 10) : 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-z Size,...] [-b TotalMegabytes]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    unsigned char* buffer = malloc(BUFFER_SIZE);
+    uint32_t seed = 2463534242u;
+    unsigned int i;
+    for (i = 0; i < BUFFER_SIZE; i++)
+    {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        buffer[i] = (unsigned char)seed;
+    }
+
+    bdberl_crc32_init();
+    CrcImpl impls[6];
+    unsigned int impl_count = 0;
+    CrcImpl bytewise = { "bytewise", bdberl_crc32_bytewise, 0xCBF43926, NULL };
+    CrcImpl slice8   = { "slice8",   bdberl_crc32_slice8,   0xCBF43926, bdberl_crc32_bytewise };
+    CrcImpl pclmul   = { "pclmul",   bdberl_crc32_pclmul,   0xCBF43926, bdberl_crc32_bytewise };
+    CrcImpl c_slice8 = { "crc32c-s8", bdberl_crc32c_slice8, 0xE3069283, NULL };
+    CrcImpl c_sse42  = { "crc32c",   bdberl_crc32c,         0xE3069283, bdberl_crc32c_slice8 };
+    CrcImpl xxh64    = { "xxh64",    xxh64_low,             0x40E6AE83, NULL };
+    impls[impl_count++] = bytewise;
+    impls[impl_count++] = slice8;
+    if (bdberl_crc32_have_pclmul())
+    {
+        impls[impl_count++] = pclmul;
+    }
+    impls[impl_count++] = c_slice8;
+    if (bdberl_crc32c_have_sse42())
+    {
+        impls[impl_count++] = c_sse42;
+    }
+    impls[impl_count++] = xxh64;
+    printf("bdberl_crc32 uses %s, bdberl_crc32c uses %s\n",
+           bdberl_crc32_impl(), bdberl_crc32c_impl());
+    if (!verify(impls, impl_count, buffer))
+    {
+        return 1;
+    }
+
+    unsigned int j;
+    for (j = 0; j < impl_count; j++)
+    {
+        for (i = 0; i < size_count; i++)
+        {
+            unsigned int size = sizes[i] < BUFFER_SIZE ? sizes[i] : BUFFER_SIZE;
+            unsigned long calls = (total_mb * 1024 * 1024) / size;
+            if (calls == 0)
+            {
+                calls = 1;
+            }
+
+            uint32_t sink = 0;
+            unsigned long offset = 0;
+            unsigned long n;
+            uint64_t start = bench_now_nsecs();
+            for (n = 0; n < calls; n++)
+            {
+                if (offset + size > BUFFER_SIZE)
+                {
+                    offset = 0;
+                }
+                sink += impls[j].fun(buffer + offset, size);
+                offset += size;
+            }
+            uint64_t elapsed = bench_now_nsecs() - start;
+
+            printf("%-9s size=%-8u calls=%-9lu %9.1f MB/s %9.1f ns/call (%08x)\n",
+                   impls[j].name, size, calls,
+                   ((double)calls * size / (1024 * 1024)) / (elapsed / 1e9),
+                   (double)elapsed / calls, sink);
+        }
+    }
+
+    free(buffer);
+    return 0;
+}
@@ -0,0 +1,344 @@
+/* -------------------------------------------------------------------
+ *
+ * bdberl: Hash database hash function benchmark
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <db.h>
+
+#include "bdberl_xxhash.h"
+#include "bench_util.h"
+
+/**
+ * Compares BDB's default hash function with the {h_hash, xxh64} one the driver installs, on
+ * keys shaped like term_to_binary output. For each key shape and count:
+ *
+ *   spread  -- bucket loads when the keys are mapped the way BDB's linear hashing does it:
+ *              the fullest bucket, the share of empty buckets and chi^2 per bucket against
+ *              the load an ideal hash gives each bucket, which is about 1 for a random
+ *              spread, below it for a better than random one and grows with clustering
+ *   hash    -- ns to hash one key
+ *   bdb     -- an in-memory DB_HASH database loaded with the keys: overflow pages, then
+ *              ns per get of every key in random order
+ *
+ * Usage: bench_h_hash [-k Keys,...] [-f FillFactor]
+ */
+
+#define KEY_LEN 32
+
+typedef struct
+{
+    const char* name;
+    u_int32_t (*fun)(DB*, const void*, u_int32_t);
+} HashImpl;
+
+typedef struct
+{
+    unsigned int count;
+    unsigned char* keys;
+    unsigned int* sizes;
+} KeySet;
+
+// __ham_func5 from BDB's hash/hash_func.c, FNV-1 from a zero basis, which DB_HASH uses
+// unless the application sets its own
+static u_int32_t bdb_default_hash(DB* db, const void* key, u_int32_t len)
+{
+    const unsigned char* k = key;
+    const unsigned char* e = k + len;
+    u_int32_t h;
+    for (h = 0; k < e; ++k)
+    {
+        h *= 16777619;
+        h ^= *k;
+    }
+    return h;
+}
+
+// As xxh64_hash in bdberl_drv.c
+static u_int32_t xxh64_hash(DB* db, const void* key, u_int32_t len)
+{
+    uint64_t h = bdberl_xxh64((const unsigned char*)key, len, 0);
+    return (u_int32_t)(h ^ (h >> 32));
+}
+
+static HashImpl IMPLS[] = {
+    { "default", bdb_default_hash },
+    { "xxh64",   xxh64_hash }
+};
+
+#define IMPL_COUNT (sizeof(IMPLS) / sizeof(IMPLS[0]))
+
+// term_to_binary of a non-negative integer
+static unsigned int encode_int(unsigned char* p, unsigned int n)
+{
+    if (n < 256)
+    {
+        p[0] = 97;
+        p[1] = n;
+        return 2;
+    }
+    p[0] = 98;
+    p[1] = n >> 24;
+    p[2] = n >> 16;
+    p[3] = n >> 8;
+    p[4] = n;
+    return 5;
+}
+
+static void keyset_init(KeySet* ks, const char* shape, unsigned int count)
+{
+    ks->count = count;
+    ks->keys = malloc((size_t)count * KEY_LEN);
+    ks->sizes = malloc(sizeof(unsigned int) * count);
+    unsigned int i;
+    for (i = 0; i < count; i++)
+    {
+        unsigned char* p = ks->keys + (size_t)i * KEY_LEN;
+        unsigned int n = 0;
+        p[n++] = 131;
+        if (strcmp(shape, "int") == 0)
+        {
+            // 1, 2, 3, ...
+            n += encode_int(p + n, i);
+        }
+        else if (strcmp(shape, "binary") == 0)
+        {
+            // <<"user_00000001">>, ...
+            char name[16];
+            snprintf(name, sizeof(name), "user_%08u", i);
+            p[n++] = 109;
+            p[n++] = 0;
+            p[n++] = 0;
+            p[n++] = 0;
+            p[n++] = strlen(name);
+            memcpy(p + n, name, strlen(name));
+            n += strlen(name);
+        }
+        else
+        {
+            // {obj, 1}, {obj, 2}, ...
+            memcpy(p + n, "\x68\x02\x64\x00\x03obj", 8);
+            n += 8;
+            n += encode_int(p + n, i);
+        }
+        ks->sizes[i] = n;
+    }
+}
+
+static inline const unsigned char* keyset_get(KeySet* ks, unsigned int i)
+{
+    return ks->keys + (size_t)i * KEY_LEN;
+}
+
+// Bucket of a hash value in a table of max_bucket + 1 buckets, as __ham_call_hash does it
+static inline unsigned int bucket_of(u_int32_t h, unsigned int max_bucket,
+                                     unsigned int high_mask, unsigned int low_mask)
+{
+    unsigned int bucket = h & high_mask;
+    return bucket > max_bucket ? bucket & low_mask : bucket;
+}
+
+static void bench_spread(HashImpl* impl, const char* shape, KeySet* ks, unsigned int ffactor)
+{
+    unsigned int buckets = (ks->count + ffactor - 1) / ffactor;
+    unsigned int high_mask = 1;
+    while (high_mask < buckets)
+    {
+        high_mask <<= 1;
+    }
+    high_mask -= 1;
+
+    unsigned int* loads = calloc(buckets, sizeof(unsigned int));
+    unsigned int i;
+    for (i = 0; i < ks->count; i++)
+    {
+        u_int32_t h = impl->fun(NULL, keyset_get(ks, i), ks->sizes[i]);
+        loads[bucket_of(h, buckets - 1, high_mask, high_mask >> 1)]++;
+    }
+
+    // Buckets below the last power of two that have not split yet take the hash values of
+    // their unborn partner as well, so an ideal hash fills them twice as full
+    unsigned int half = (high_mask + 1) / 2;
+    double chi2 = 0;
+    unsigned int max = 0, empty = 0;
+    for (i = 0; i < buckets; i++)
+    {
+        unsigned int slots = (i >= buckets - half && i < half) ? 2 : 1;
+        double expected = (double)ks->count * slots / (high_mask + 1);
+        chi2 += (loads[i] - expected) * (loads[i] - expected) / expected;
+        max = loads[i] > max ? loads[i] : max;
+        empty += loads[i] == 0;
+    }
+    printf("h_hash %-7s %-6s keys=%-8u spread  buckets=%-7u max=%-5u empty=%5.1f%% chi2/bucket=%.2f\n",
+           impl->name, shape, ks->count, buckets, max, 100.0 * empty / buckets, chi2 / buckets);
+    free(loads);
+}
+
+static void bench_hash(HashImpl* impl, const char* shape, KeySet* ks)
+{
+    unsigned int rounds = 1 + 10000000 / ks->count;
+    u_int32_t sink = 0;
+    uint64_t start = bench_now_nsecs();
+    unsigned int r, i;
+    for (r = 0; r < rounds; r++)
+    {
+        for (i = 0; i < ks->count; i++)
+        {
+            sink ^= impl->fun(NULL, keyset_get(ks, i), ks->sizes[i]);
+        }
+    }
+    uint64_t nsecs = bench_now_nsecs() - start;
+    printf("h_hash %-7s %-6s keys=%-8u hash    %8.2f ns/key (%08x)\n",
+           impl->name, shape, ks->count, (double)nsecs / ((double)rounds * ks->count), sink);
+}
+
+static void bench_bdb(HashImpl* impl, const char* shape, KeySet* ks, unsigned int ffactor,
+                      unsigned int* order)
+{
+    DB* db;
+    int rc = db_create(&db, NULL, 0);
+    if (rc != 0)
+    {
+        fprintf(stderr, "db_create: %s\n", db_strerror(rc));
+        return;
+    }
+    db->set_cachesize(db, 0, 256 * 1024 * 1024, 1);
+    db->set_h_ffactor(db, ffactor);
+    if (impl->fun != bdb_default_hash)
+    {
+        db->set_h_hash(db, impl->fun);
+    }
+    if ((rc = db->open(db, NULL, NULL, NULL, DB_HASH, DB_CREATE, 0)) != 0)
+    {
+        fprintf(stderr, "DB->open: %s\n", db_strerror(rc));
+        db->close(db, 0);
+        return;
+    }
+
+    DBT key, value;
+    memset(&key, '\0', sizeof(DBT));
+    memset(&value, '\0', sizeof(DBT));
+    value.data = "value";
+    value.size = 5;
+    unsigned int i;
+    for (i = 0; i < ks->count; i++)
+    {
+        key.data = (void*)keyset_get(ks, i);
+        key.size = ks->sizes[i];
+        db->put(db, NULL, &key, &value, 0);
+    }
+
+    DB_HASH_STAT* hsp = NULL;
+    unsigned int overflows = 0;
+    if (db->stat(db, NULL, &hsp, 0) == 0)
+    {
+        overflows = hsp->hash_overflows;
+        free(hsp);
+    }
+
+    unsigned int found = 0;
+    value.flags = DB_DBT_USERMEM;
+    char buf[16];
+    value.data = buf;
+    value.ulen = sizeof(buf);
+    uint64_t start = bench_now_nsecs();
+    for (i = 0; i < ks->count; i++)
+    {
+        key.data = (void*)keyset_get(ks, order[i]);
+        key.size = ks->sizes[order[i]];
+        found += db->get(db, NULL, &key, &value, 0) == 0;
+    }
+    uint64_t nsecs = bench_now_nsecs() - start;
+    printf("h_hash %-7s %-6s keys=%-8u bdb     overflows=%-6u %8.1f ns/get\n",
+           impl->name, shape, ks->count, overflows, (double)nsecs / ks->count);
+    if (found != ks->count)
+    {
+        fprintf(stderr, "%s %s: expected %u hits, found %u\n", impl->name, shape, ks->count, found);
+    }
+    db->close(db, 0);
+}
+
+int main(int argc, char** argv)
+{
+    unsigned int key_counts[16] = { 10000, 100000, 1000000 };
+    unsigned int key_count_len = 3;
+    unsigned int ffactor = 40;
+    const char* shapes[] = { "int", "binary", "tuple" };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "k:f:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'k':
+            key_count_len = bench_parse_list(optarg, key_counts, 16);
+            break;
+        case 'f':
+            ffactor = atoi(optarg) > 0 ? atoi(optarg) : ffactor;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-k Keys,...] [-f FillFactor]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    unsigned int s, k, i;
+    for (k = 0; k < key_count_len; k++)
+    {
+        unsigned int count = key_counts[k];
+
+        // Random probe order so lookups do not walk the buckets in insertion order
+        unsigned int* order = malloc(sizeof(unsigned int) * count);
+        for (i = 0; i < count; i++)
+        {
+            order[i] = i;
+        }
+        srandom(count);
+        for (i = count - 1; i > 0; i--)
+        {
+            unsigned int j = random() % (i + 1);
+            unsigned int t = order[i];
+            order[i] = order[j];
+            order[j] = t;
+        }
+
+        for (s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++)
+        {
+            KeySet ks;
+            keyset_init(&ks, shapes[s], count);
+            for (i = 0; i < IMPL_COUNT; i++)
+            {
+                bench_spread(&IMPLS[i], shapes[s], &ks, ffactor);
+                bench_hash(&IMPLS[i], shapes[s], &ks);
+                bench_bdb(&IMPLS[i], shapes[s], &ks, ffactor, order);
+            }
+            free(ks.keys);
+            free(ks.sizes);
+        }
+        free(order);
+    }
+    return 0;
+}
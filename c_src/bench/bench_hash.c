@@ -0,0 +1,192 @@
+/* -------------------------------------------------------------------
+ *
+ * bdberl: hive_hash microbenchmark
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ------------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hive_hash.h"
+#include "bench_util.h"
+
+/**
+ * Measures hive_hash with keys shaped like the database names the driver stores in it.
+ * For each table size:
+ *
+ *   add        -- insert every key into a table created with a small capacity (includes growth)
+ *   get_hit    -- look up every key in random order
+ *   get_miss   -- look up the same number of absent keys
+ *   churn      -- remove a key and add a new one, as opening and closing databases does;
+ *                 removed slots keep their hash so probe chains grow
+ *   get_churn  -- get_hit again after the churn
+ *
+ * Usage: bench_hash [-k Keys,...] [-c ChurnRounds]
+ */
+
+#define KEY_LEN 32
+
+typedef struct
+{
+    unsigned int count;
+    char* names;
+} KeySet;
+
+static void keyset_init(KeySet* ks, unsigned int count, const char* prefix)
+{
+    ks->count = count;
+    ks->names = malloc((size_t)count * KEY_LEN);
+    unsigned int i;
+    for (i = 0; i < count; i++)
+    {
+        snprintf(ks->names + (size_t)i * KEY_LEN, KEY_LEN, "%s_%u.bdb", prefix, i);
+    }
+}
+
+static inline const char* keyset_get(KeySet* ks, unsigned int i)
+{
+    return ks->names + (size_t)i * KEY_LEN;
+}
+
+static void report(const char* phase, unsigned int keys, unsigned long ops, uint64_t nsecs)
+{
+    printf("hash keys=%-8u %-10s ops=%-9lu %8.1f ns/op %12.0f ops/s\n",
+           keys, phase, ops, (double)nsecs / ops, ops / (nsecs / 1e9));
+}
+
+static void bench_keys(unsigned int keys, unsigned int churn_rounds)
+{
+    KeySet present, absent, churn;
+    keyset_init(&present, keys, "database");
+    keyset_init(&absent, keys, "missing");
+    keyset_init(&churn, keys, "reopened");
+
+    // Random probe order so lookups do not walk the table sequentially
+    unsigned int* order = malloc(sizeof(unsigned int) * keys);
+    unsigned int i;
+    for (i = 0; i < keys; i++)
+    {
+        order[i] = i;
+    }
+    srandom(keys);
+    for (i = keys - 1; i > 0; i--)
+    {
+        unsigned int j = random() % (i + 1);
+        unsigned int t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+
+    hive_hash* h = hive_hash_new(16);
+    uint64_t start = bench_now_nsecs();
+    for (i = 0; i < keys; i++)
+    {
+        hive_hash_add(h, keyset_get(&present, i), (void*)keyset_get(&present, i));
+    }
+    report("add", keys, keys, bench_now_nsecs() - start);
+
+    unsigned long found = 0;
+    start = bench_now_nsecs();
+    for (i = 0; i < keys; i++)
+    {
+        found += hive_hash_get(h, keyset_get(&present, order[i])) != NULL;
+    }
+    report("get_hit", keys, keys, bench_now_nsecs() - start);
+
+    start = bench_now_nsecs();
+    for (i = 0; i < keys; i++)
+    {
+        found += hive_hash_get(h, keyset_get(&absent, order[i])) != NULL;
+    }
+    report("get_miss", keys, keys, bench_now_nsecs() - start);
+
+    // Swap each present key for its churn counterpart and back again
+    unsigned long churn_ops = 0;
+    start = bench_now_nsecs();
+    unsigned int r;
+    for (r = 0; r < churn_rounds; r++)
+    {
+        KeySet* from = (r % 2 == 0) ? &present : &churn;
+        KeySet* to   = (r % 2 == 0) ? &churn : &present;
+        for (i = 0; i < keys; i++)
+        {
+            hive_hash_remove(h, keyset_get(from, order[i]));
+            hive_hash_add(h, keyset_get(to, order[i]), (void*)keyset_get(to, order[i]));
+            churn_ops++;
+        }
+    }
+    if (churn_ops > 0)
+    {
+        report("churn", keys, churn_ops, bench_now_nsecs() - start);
+    }
+
+    KeySet* live = (churn_rounds % 2 == 0) ? &present : &churn;
+    start = bench_now_nsecs();
+    for (i = 0; i < keys; i++)
+    {
+        found += hive_hash_get(h, keyset_get(live, order[i])) != NULL;
+    }
+    report("get_churn", keys, keys, bench_now_nsecs() - start);
+
+    if (found != (unsigned long)keys * 2)
+    {
+        fprintf(stderr, "hash keys=%u: expected %u hits, found %lu\n", keys, keys * 2, found);
+    }
+
+    hive_hash_destroy(h);
+    free(order);
+    free(present.names);
+    free(absent.names);
+    free(churn.names);
+}
+
+int main(int argc, char** argv)
+{
+    unsigned int key_counts[16] = { 64, 1024, 16384, 262144 };
+    unsigned int key_count_len = 4;
+    unsigned int churn_rounds = 4;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "k:c:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'k':
+            key_count_len = bench_parse_list(optarg, key_counts, 16);
+            break;
+        case 'c':
+            churn_rounds = atoi(optarg) >= 0 ? atoi(optarg) : 0;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-k Keys,...] [-c ChurnRounds]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    unsigned int i;
+    for (i = 0; i < key_count_len; i++)
+    {
+        bench_keys(key_counts[i], churn_rounds);
+    }
+    return 0;
+}
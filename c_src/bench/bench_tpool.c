@@ -0,0 +1,229 @@
+/* -------------------------------------------------------------------
+ *
+ * bdberl: Thread pool microbenchmark
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ------------------------------------------------------------------- */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <db.h>
+#include "bdberl_tpool.h"
+#include "bench_util.h"
+
+/**
+ * Measures bdberl_tpool_run against the pool as the driver uses it:
+ *
+ *   throughput -- producers queue no-op jobs as fast as they can; reports the enqueue rate
+ *                 and the end-to-end rate until the last job finished
+ *   wakeup     -- a single job is queued on an idle pool and the time until a worker starts
+ *                 running it is recorded; repeated for percentiles
+ *
+ * Usage: bench_tpool [-t Threads,...] [-p Producers] [-n Jobs] [-s Samples]
+ */
+
+typedef struct
+{
+    volatile uint64_t started_nsecs;
+    volatile unsigned int done;
+} WakeupJob;
+
+static pthread_mutex_t G_DONE_LOCK = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  G_DONE_CV   = PTHREAD_COND_INITIALIZER;
+static volatile unsigned long G_JOBS_LEFT = 0;
+
+typedef struct
+{
+    TPool* tpool;
+    unsigned long jobs;
+    unsigned long rejected;
+    uint64_t enqueue_nsecs;
+} Producer;
+
+static void noop_job(void* arg)
+{
+    if (__sync_sub_and_fetch(&G_JOBS_LEFT, 1) == 0)
+    {
+        pthread_mutex_lock(&G_DONE_LOCK);
+        pthread_cond_signal(&G_DONE_CV);
+        pthread_mutex_unlock(&G_DONE_LOCK);
+    }
+}
+
+static void wakeup_job(void* arg)
+{
+    WakeupJob* job = (WakeupJob*)arg;
+    job->started_nsecs = bench_now_nsecs();
+    __sync_synchronize();
+    job->done = 1;
+}
+
+static void* producer_main(void* arg)
+{
+    Producer* p = (Producer*)arg;
+    uint64_t start = bench_now_nsecs();
+    unsigned long i;
+    for (i = 0; i < p->jobs; i++)
+    {
+        TPoolJob* job;
+        if (bdberl_tpool_run(p->tpool, TPOOL_CLASS_READ, 0, &noop_job, 0, 0, &job) != 0)
+        {
+            p->rejected++;
+            noop_job(0);
+        }
+    }
+    p->enqueue_nsecs = bench_now_nsecs() - start;
+    return 0;
+}
+
+static void bench_throughput(unsigned int threads, unsigned int producers, unsigned long jobs)
+{
+    TPool* tpool = bdberl_tpool_start(threads);
+    Producer* ps = calloc(producers, sizeof(Producer));
+    pthread_t* tids = calloc(producers, sizeof(pthread_t));
+    unsigned long per_producer = jobs / producers;
+
+    G_JOBS_LEFT = per_producer * producers;
+    uint64_t start = bench_now_nsecs();
+
+    unsigned int i;
+    for (i = 0; i < producers; i++)
+    {
+        ps[i].tpool = tpool;
+        ps[i].jobs = per_producer;
+        pthread_create(&tids[i], NULL, &producer_main, &ps[i]);
+    }
+
+    uint64_t enqueue_nsecs = 0;
+    unsigned long rejected = 0;
+    for (i = 0; i < producers; i++)
+    {
+        pthread_join(tids[i], NULL);
+        enqueue_nsecs += ps[i].enqueue_nsecs;
+        rejected += ps[i].rejected;
+    }
+
+    pthread_mutex_lock(&G_DONE_LOCK);
+    while (G_JOBS_LEFT > 0)
+    {
+        pthread_cond_wait(&G_DONE_CV, &G_DONE_LOCK);
+    }
+    pthread_mutex_unlock(&G_DONE_LOCK);
+    uint64_t elapsed = bench_now_nsecs() - start;
+
+    unsigned long total = per_producer * producers;
+    printf("throughput threads=%-3u producers=%-3u jobs=%-9lu enqueue=%10.0f/s "
+           "end_to_end=%10.0f/s ns_per_job=%7.1f rejected=%lu\n",
+           threads, producers, total,
+           total / (enqueue_nsecs / 1e9 / producers),
+           total / (elapsed / 1e9),
+           (double)elapsed / total, rejected);
+
+    bdberl_tpool_stop(tpool);
+    free(tids);
+    free(ps);
+}
+
+static void bench_wakeup(unsigned int threads, unsigned int samples)
+{
+    TPool* tpool = bdberl_tpool_start(threads);
+    uint64_t* latencies = calloc(samples, sizeof(uint64_t));
+
+    // Let the workers reach their cond wait so every sample measures a real wakeup
+    usleep(10000);
+
+    unsigned int i;
+    for (i = 0; i < samples; i++)
+    {
+        WakeupJob w = { 0, 0 };
+        TPoolJob* job;
+        uint64_t queued = bench_now_nsecs();
+        bdberl_tpool_run(tpool, TPOOL_CLASS_READ, 0, &wakeup_job, &w, 0, &job);
+        while (!w.done)
+        {
+            sched_yield();
+        }
+        latencies[i] = w.started_nsecs - queued;
+
+        // Give the worker time to go back to sleep
+        usleep(50);
+    }
+
+    bench_sort(latencies, samples);
+    printf("wakeup     threads=%-3u samples=%-7u p50=%7.1fus p90=%7.1fus p99=%7.1fus "
+           "p99.9=%7.1fus max=%7.1fus\n",
+           threads, samples,
+           bench_percentile(latencies, samples, 50.0) / 1e3,
+           bench_percentile(latencies, samples, 90.0) / 1e3,
+           bench_percentile(latencies, samples, 99.0) / 1e3,
+           bench_percentile(latencies, samples, 99.9) / 1e3,
+           latencies[samples - 1] / 1e3);
+
+    bdberl_tpool_stop(tpool);
+    free(latencies);
+}
+
+int main(int argc, char** argv)
+{
+    unsigned int thread_counts[16] = { 1, 2, 4, 8, 16 };
+    unsigned int thread_count_len = 5;
+    unsigned int producers = 1;
+    unsigned long jobs = 1000000;
+    unsigned int samples = 10000;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:p:n:s:")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            thread_count_len = bench_parse_list(optarg, thread_counts, 16);
+            break;
+        case 'p':
+            producers = atoi(optarg) > 0 ? atoi(optarg) : 1;
+            break;
+        case 'n':
+            jobs = strtoul(optarg, 0, 10);
+            break;
+        case 's':
+            samples = atoi(optarg) > 0 ? atoi(optarg) : 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-t Threads,...] [-p Producers] [-n Jobs] [-s Samples]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    unsigned int i;
+    for (i = 0; i < thread_count_len; i++)
+    {
+        bench_throughput(thread_counts[i], producers, jobs);
+    }
+    for (i = 0; i < thread_count_len; i++)
+    {
+        bench_wakeup(thread_counts[i], samples);
+    }
+    return 0;
+}
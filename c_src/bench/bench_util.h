@@ -0,0 +1,83 @@
+/* -------------------------------------------------------------------
+ *
+ * bdberl: Timing helpers shared by the C microbenchmarks
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ------------------------------------------------------------------- */
+#ifndef _BDBERL_BENCH_UTIL
+#define _BDBERL_BENCH_UTIL
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Nanoseconds from the monotonic clock */
+static inline uint64_t bench_now_nsecs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int bench_cmp_u64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static inline void bench_sort(uint64_t* samples, unsigned int count)
+{
+    qsort(samples, count, sizeof(uint64_t), bench_cmp_u64);
+}
+
+/* Value at percentile (0..100) of samples already sorted with bench_sort */
+static inline uint64_t bench_percentile(const uint64_t* samples, unsigned int count, double percentile)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+    unsigned int i = (unsigned int)((percentile / 100.0) * (count - 1) + 0.5);
+    return samples[i];
+}
+
+/* Parse a comma separated list of positive integers; returns the number parsed */
+static inline unsigned int bench_parse_list(const char* arg, unsigned int* values, unsigned int max)
+{
+    unsigned int n = 0;
+    while (*arg && n < max)
+    {
+        char* end;
+        unsigned long v = strtoul(arg, &end, 10);
+        if (end == arg)
+        {
+            break;
+        }
+        if (v > 0)
+        {
+            values[n++] = (unsigned int)v;
+        }
+        arg = (*end == ',') ? end + 1 : end;
+    }
+    return n;
+}
+
+#endif // _BDBERL_BENCH_UTIL
@@ -0,0 +1,81 @@
+/* -------------------------------------------------------------------
+ *
+ * bdberl: Stand-in for erl_driver.h used by the C microbenchmarks
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ------------------------------------------------------------------- */
+#ifndef _BDBERL_BENCH_ERL_DRIVER
+#define _BDBERL_BENCH_ERL_DRIVER
+
+/**
+ * Only the parts of the driver API that the thread pool, bin_helper, histo, crc32 and
+ * hive_hash sources touch, implemented on pthreads and malloc in erl_driver_stub.c. The
+ * declarations match erl_driver.h so the driver sources compile unchanged.
+ */
+#include <stddef.h>
+
+typedef long          ErlDrvSInt;
+typedef unsigned long ErlDrvUInt;
+typedef unsigned long ErlDrvTermData;
+
+typedef struct _erl_drv_port*        ErlDrvPort;
+typedef struct _erl_drv_mutex        ErlDrvMutex;
+typedef struct _erl_drv_cond         ErlDrvCond;
+typedef struct _erl_drv_tid*         ErlDrvTid;
+typedef struct _erl_drv_thread_opts  ErlDrvThreadOpts;
+typedef int                          ErlDrvTSDKey;
+
+typedef struct erl_drv_binary
+{
+    ErlDrvSInt orig_size;
+    char orig_bytes[1];
+} ErlDrvBinary;
+
+void* driver_alloc(size_t size);
+void* driver_realloc(void* ptr, size_t size);
+void  driver_free(void* ptr);
+
+ErlDrvBinary* driver_alloc_binary(ErlDrvSInt size);
+ErlDrvBinary* driver_realloc_binary(ErlDrvBinary* bin, ErlDrvSInt size);
+void          driver_free_binary(ErlDrvBinary* bin);
+
+ErlDrvMutex* erl_drv_mutex_create(char* name);
+void erl_drv_mutex_destroy(ErlDrvMutex* mtx);
+void erl_drv_mutex_lock(ErlDrvMutex* mtx);
+void erl_drv_mutex_unlock(ErlDrvMutex* mtx);
+
+ErlDrvCond* erl_drv_cond_create(char* name);
+void erl_drv_cond_destroy(ErlDrvCond* cnd);
+void erl_drv_cond_signal(ErlDrvCond* cnd);
+void erl_drv_cond_broadcast(ErlDrvCond* cnd);
+void erl_drv_cond_wait(ErlDrvCond* cnd, ErlDrvMutex* mtx);
+
+int  erl_drv_thread_create(char* name, ErlDrvTid* tid, void* (*func)(void*), void* args,
+                           ErlDrvThreadOpts* opts);
+int  erl_drv_thread_join(ErlDrvTid tid, void** respp);
+
+int   erl_drv_tsd_key_create(char* name, ErlDrvTSDKey* key);
+void  erl_drv_tsd_key_destroy(ErlDrvTSDKey key);
+void  erl_drv_tsd_set(ErlDrvTSDKey key, void* data);
+void* erl_drv_tsd_get(ErlDrvTSDKey key);
+
+char* erl_errno_id(int error);
+
+#endif // _BDBERL_BENCH_ERL_DRIVER
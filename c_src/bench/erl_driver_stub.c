@@ -0,0 +1,198 @@
+/* -------------------------------------------------------------------
+ *
+ * bdberl: pthread and malloc implementation of the erl_driver stand-in
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * ------------------------------------------------------------------- */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "erl_driver.h"
+
+#define STUB_MAX_TSD_KEYS 64
+
+struct _erl_drv_mutex
+{
+    pthread_mutex_t m;
+};
+
+struct _erl_drv_cond
+{
+    pthread_cond_t c;
+};
+
+struct _erl_drv_tid
+{
+    pthread_t t;
+};
+
+static pthread_key_t G_TSD_KEYS[STUB_MAX_TSD_KEYS];
+static int           G_TSD_KEY_COUNT = 0;
+
+
+void* driver_alloc(size_t size)
+{
+    return malloc(size);
+}
+
+void* driver_realloc(void* ptr, size_t size)
+{
+    return realloc(ptr, size);
+}
+
+void driver_free(void* ptr)
+{
+    free(ptr);
+}
+
+ErlDrvBinary* driver_alloc_binary(ErlDrvSInt size)
+{
+    ErlDrvBinary* bin = malloc(sizeof(ErlDrvBinary) + size);
+    if (bin != NULL)
+    {
+        bin->orig_size = size;
+    }
+    return bin;
+}
+
+ErlDrvBinary* driver_realloc_binary(ErlDrvBinary* bin, ErlDrvSInt size)
+{
+    ErlDrvBinary* new_bin = realloc(bin, sizeof(ErlDrvBinary) + size);
+    if (new_bin != NULL)
+    {
+        new_bin->orig_size = size;
+    }
+    return new_bin;
+}
+
+void driver_free_binary(ErlDrvBinary* bin)
+{
+    free(bin);
+}
+
+ErlDrvMutex* erl_drv_mutex_create(char* name)
+{
+    ErlDrvMutex* mtx = malloc(sizeof(ErlDrvMutex));
+    pthread_mutex_init(&(mtx->m), NULL);
+    return mtx;
+}
+
+void erl_drv_mutex_destroy(ErlDrvMutex* mtx)
+{
+    pthread_mutex_destroy(&(mtx->m));
+    free(mtx);
+}
+
+void erl_drv_mutex_lock(ErlDrvMutex* mtx)
+{
+    pthread_mutex_lock(&(mtx->m));
+}
+
+void erl_drv_mutex_unlock(ErlDrvMutex* mtx)
+{
+    pthread_mutex_unlock(&(mtx->m));
+}
+
+ErlDrvCond* erl_drv_cond_create(char* name)
+{
+    ErlDrvCond* cnd = malloc(sizeof(ErlDrvCond));
+    pthread_cond_init(&(cnd->c), NULL);
+    return cnd;
+}
+
+void erl_drv_cond_destroy(ErlDrvCond* cnd)
+{
+    pthread_cond_destroy(&(cnd->c));
+    free(cnd);
+}
+
+void erl_drv_cond_signal(ErlDrvCond* cnd)
+{
+    pthread_cond_signal(&(cnd->c));
+}
+
+void erl_drv_cond_broadcast(ErlDrvCond* cnd)
+{
+    pthread_cond_broadcast(&(cnd->c));
+}
+
+void erl_drv_cond_wait(ErlDrvCond* cnd, ErlDrvMutex* mtx)
+{
+    pthread_cond_wait(&(cnd->c), &(mtx->m));
+}
+
+int erl_drv_thread_create(char* name, ErlDrvTid* tid, void* (*func)(void*), void* args,
+                          ErlDrvThreadOpts* opts)
+{
+    ErlDrvTid t = malloc(sizeof(struct _erl_drv_tid));
+    int rc = pthread_create(&(t->t), NULL, func, args);
+    if (rc != 0)
+    {
+        free(t);
+        return rc;
+    }
+    *tid = t;
+    return 0;
+}
+
+int erl_drv_thread_join(ErlDrvTid tid, void** respp)
+{
+    int rc = pthread_join(tid->t, respp);
+    free(tid);
+    return rc;
+}
+
+// Keys are never reused; the benchmarks create a handful per run
+int erl_drv_tsd_key_create(char* name, ErlDrvTSDKey* key)
+{
+    if (G_TSD_KEY_COUNT == STUB_MAX_TSD_KEYS)
+    {
+        return ENOMEM;
+    }
+    int rc = pthread_key_create(&G_TSD_KEYS[G_TSD_KEY_COUNT], NULL);
+    if (rc == 0)
+    {
+        *key = G_TSD_KEY_COUNT++;
+    }
+    return rc;
+}
+
+void erl_drv_tsd_key_destroy(ErlDrvTSDKey key)
+{
+    pthread_key_delete(G_TSD_KEYS[key]);
+}
+
+void erl_drv_tsd_set(ErlDrvTSDKey key, void* data)
+{
+    pthread_setspecific(G_TSD_KEYS[key], data);
+}
+
+void* erl_drv_tsd_get(ErlDrvTSDKey key)
+{
+    return pthread_getspecific(G_TSD_KEYS[key]);
+}
+
+char* erl_errno_id(int error)
+{
+    return strerror(error);
+}
@@ -49,6 +49,12 @@ void bin_helper_init(BinHelper* bh)
     bh->offset = 0;
 }
 
+// Make room for a known amount of upcoming data in one allocation
+void bin_helper_reserve(BinHelper* bh, int space_needed)
+{
+    bin_helper_check_size(bh, space_needed);
+}
+
 void bin_helper_push_byte(BinHelper* bh, int value)
 {
     bin_helper_check_size(bh, 1);
@@ -63,6 +69,13 @@ void bin_helper_push_int32(BinHelper* bh, int value)
     bh->offset += 4;
 }
 
+void bin_helper_push_uint64(BinHelper* bh, unsigned long long value)
+{
+    bin_helper_check_size(bh, 8);
+    memcpy(bh->bin->orig_bytes+(bh->offset), (char*)&value, 8);
+    bh->offset += 8;
+}
+
 void bin_helper_push_string(BinHelper* bh, const char* string)
 {
     if (NULL == string)
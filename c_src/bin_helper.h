@@ -37,8 +37,10 @@ typedef struct
 } BinHelper;
 
 void bin_helper_init(BinHelper* bh);
+void bin_helper_reserve(BinHelper* bh, int space_needed);
 void bin_helper_push_byte(BinHelper* bh, int value);
 void bin_helper_push_int32(BinHelper* bh, int value);
+void bin_helper_push_uint64(BinHelper* bh, unsigned long long value);
 void bin_helper_push_string(BinHelper* bh, const char* string);
 
 #endif
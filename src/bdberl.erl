@@ -34,6 +34,7 @@
 -module(bdberl).
 
 -export([open/2, open/3,
+         train_dict/2,
          close/1, close/2,
          txn_begin/0, txn_begin/1,
          txn_commit/0, txn_commit/1, txn_abort/0,
@@ -64,12 +65,22 @@
          get_r/2, get_r/3,
          update/3, update/4, update/5, update/6, update/7,
          del/2,
+         put_raw/3, put_raw/4,
+         get_raw/2, get_raw/3,
+         del_raw/2,
          truncate/0, truncate/1,
          delete_database/1,
-         cursor_open/1, cursor_next/0, cursor_prev/0, cursor_current/0, cursor_close/0,
-         cursor_get/0, cursor_get/1, cursor_get/2, %TODO: cursor_del/2, cursor_del/3, cursor_put/2, cursor_put/3,
+         cursor_open/1, cursor_open/2, cursor_next/0, cursor_prev/0, cursor_current/0, cursor_close/0,
+         cursor_get/0, cursor_get/1, cursor_get/2,
+         cursor_get_raw/1, cursor_get_raw/2, %TODO: cursor_del/2, cursor_del/3, cursor_put/2, cursor_put/3,
          cursor_count/0,
          driver_info/0,
+         pool_load/0,
+         latency_stats/0, latency_stats/1,
+         db_counters/0, db_counters/1,
+         samples/0, samples/1,
+         trace_dump/0,
+         capture_start/1, capture_stop/0,
          register_logger/0,
          stop/0]).
 
@@ -77,10 +88,27 @@
 
 -define(is_lock_error(Error), (Error =:= deadlock orelse Error =:= lock_not_granted)).
 
+%% Fields of a sampler series, in the order defined in bdberl_sampler.h
+-define(SAMPLE_FIELDS, [cache_hit, cache_miss, page_in, page_out, ro_evict, rw_evict,
+                        page_dirty, lock_requests, lock_waits, lock_nowaits, deadlocks,
+                        lock_timeouts, locks, log_bytes, log_writes, log_syncs,
+                        txn_begins, txn_commits, txn_aborts, txn_active,
+                        general_pending, general_active, txn_pending, txn_active_jobs]).
+
 -type db() :: integer().
 -type db_name() :: [byte(),...].
 -type db_type() :: btree | hash.
 -type db_flags() :: [atom()].
+-type db_checksum() :: crc32 | crc32c | xxh64 | none.
+-type db_open_opts() :: [atom() | {checksum, db_checksum()} | {verify, driver | end_to_end} |
+                        {format, term | raw} | {compress, none | lz} |
+                        {compress_dict, binary()} | {bt_compress, boolean()} |
+                        {page_size, pos_integer()} | {bt_minkey, pos_integer()} |
+                        {h_ffactor, pos_integer()} | {h_nelem, pos_integer()} |
+                        {re_len, pos_integer()} | {duplicates, none | unsorted | sorted} |
+                        {key_order, bytes | term} | {key_codec, none | ordered} |
+                        {h_hash, default | xxh64} | {value_cache, non_neg_integer()} |
+                        {key_filter, non_neg_integer()}].
 -type db_fsid() :: binary().
 -type db_key() :: term().
 -type db_mbytes() :: non_neg_integer().
@@ -166,8 +194,143 @@ open(Name, Type) ->
 %%   <dt>truncate</dt>
 %%   <dd>Physically truncate the underlying file, discarding all
 %%       previous databases it might have held.</dd>
+%%   <dt>{checksum, crc32 | crc32c | xxh64 | none}</dt>
+%%   <dd>Checksum stored with new values. `crc32' (the default) keeps the
+%%       original value layout. The others are computed by the driver and
+%%       stored behind a small versioned header: `crc32c' uses the SSE4.2
+%%       crc32 instruction where available, `xxh64' is a 64-bit hash, and
+%%       `none' skips checksums for caches that can be regenerated. Reads
+%%       check each value by the header it was written with, so the
+%%       setting can change between opens. It applies when the database is
+%%       first opened; later opens of an open database share its setting.
+%%       Puts from a process that opened the database with a checksum
+%%       other than `crc32' skip the CRC-32 the caller computes for the
+%%       original layout.</dd>
+%%   <dt>{verify, driver | end_to_end}</dt>
+%%   <dd>Where values are checked on reads. With `driver' (the default)
+%%       the check made by the driver thread is authoritative and the
+%%       value arrives without its checksum. With `end_to_end' the stored
+%%       value is returned and its CRC-32 is checked again in the calling
+%%       process, which also covers the copy into the VM. Values written
+%%       with another checksum are only checked by the driver.</dd>
+%%   <dt>{format, term | raw}</dt>
+%%   <dd>What the database holds. `term' (the default) databases store
+%%       any Erlang term through put/3 and friends. `raw' databases store
+%%       binary keys and values exactly as given through put_raw/3,
+%%       get_raw/2, del_raw/2 and cursor_get_raw/1, without the external
+%%       term wrapper, so btree keys sort in byte order. The driver frames
+%%       raw values with the database's checksum, or stores them as given
+%%       with `{checksum, none}'; unlike term databases the checksum can't
+%%       change between opens. Calls of the other format return
+%%       `{error, format_mismatch}'.</dd>
+%%   <dt>{compress, none | lz}</dt>
+%%   <dd>Compression of new values in `term' databases. With `lz' the
+%%       driver thread that stores a value compresses it with a fast
+%%       built-in LZ77 codec and the thread that reads it inflates it, so
+%%       callers see the same values either way. Values that don't shrink
+%%       are stored as they are, and databases may mix compressed and
+%%       uncompressed values. Not available for `raw' databases.</dd>
+%%   <dt>{compress_dict, Dict}</dt>
+%%   <dd>Preset dictionary for `lz', which lets small values compress by
+%%       matching against data typical of them; see train_dict/2. Only the
+%%       last 64KB are used. Values record which dictionary they were
+%%       compressed with, and reading them without it returns
+%%       `{error, invalid_value}', so pass the same dictionary on every
+%%       open.</dd>
+%%   <dt>{bt_compress, true | false}</dt>
+%%   <dd>Berkeley DB's own btree compression, which stores each key as
+%%       its difference from the one before it on the page, so keys with
+%%       long common prefixes take less room and more of them fit in the
+%%       cache. Only for `btree' databases, and it is fixed when the
+%%       database is created: open an existing database with the setting
+%%       it was created with. stat/1 reports the option as given to the
+%%       open that opened the database, as `bt_compress', next to the page
+%%       counts and cache hits of the database's file; it is not read back
+%%       from the file.</dd>
+%%   <dt>{page_size, Bytes}</dt>
+%%   <dd>Page size of a new database, a power of two from 512 to 65536,
+%%       in place of the `BDBERL_PAGE_SIZE' default. Values that don't fit
+%%       on a page go to overflow pages, so databases of large values do
+%%       better with larger pages.</dd>
+%%   <dt>{bt_minkey, N}</dt>
+%%   <dd>Minimum number of keys stored on each btree page; keys and
+%%       values bigger than about a `N'th of a page go to overflow
+%%       pages.</dd>
+%%   <dt>{h_ffactor, N}</dt>
+%%   <dd>Hash fill factor, the number of items per bucket the table aims
+%%       for before it splits.</dd>
+%%   <dt>{h_nelem, N}</dt>
+%%   <dd>Expected number of items in a hash database, used to size the
+%%       table when it is created so a bulk load doesn't split buckets all
+%%       the way up.</dd>
+%%   <dt>{re_len, Bytes}</dt>
+%%   <dd>Length of the fixed-length records of a `recno' or `queue'
+%%       database.</dd>
+%%   <dt>{duplicates, none | unsorted | sorted}</dt>
+%%   <dd>Whether a key may hold several data items, kept in insertion
+%%       order (`DB_DUP') or sorted (`DB_DUPSORT').</dd>
+%%   <dt>{key_order, bytes | term}</dt>
+%%   <dd>Order of the keys of a `btree' `term' database. `bytes' (the
+%%       default) orders them by their external format, so `256' sorts
+%%       before `1' and strings before tuples. `term' installs a comparison
+%%       function that orders keys as Erlang compares them, so
+%%       `db_set_range' scans stop where they would on a sorted list of
+%%       the keys; tuples still compare by size first, so lists make the
+%%       better composite keys for prefix scans. Berkeley DB does not
+%%       record the comparison function in the database, so a database
+%%       created with `term' must be opened with it every time.</dd>
+%%   <dt>{key_codec, none | ordered}</dt>
+%%   <dd>How the keys of a `term' database are stored. `ordered' stores
+%%       them in a compact encoding whose byte order is Erlang term order,
+%%       so plain `bytes' ordering sorts `256' after `1' without a
+%%       comparison function and integer keys take a few bytes less. Only
+%%       integers, atoms, binaries and tuples of these can be encoded; any
+%%       other key is refused with `invalid_key'. Keys still go in and
+%%       come out as terms. The codec is part of the stored format, so a
+%%       database must always be opened with the same setting, and it
+%%       can't be combined with `{key_order, term}'.</dd>
+%%   <dt>{h_hash, default | xxh64}</dt>
+%%   <dd>Hash function of a `hash' database. `default' is Berkeley DB's
+%%       own FNV-1; `xxh64' is XXH64, which spreads any set of keys like a
+%%       random function and is faster on keys of more than a few words.
+%%       Berkeley DB keeps a check value of the function in the database
+%%       and refuses to open it with another one, so the choice is made
+%%       when the database is created; `db_stat' reports it as
+%%       `{h_hash, Fun}'.</dd>
+%%   <dt>{value_cache, Bytes}</dt>
+%%   <dd>Keep up to `Bytes' of recently read values in the driver, so
+%%       gets of hot keys are answered from the port's control call
+%%       without waiting on a pool thread and Berkeley DB. Writes through
+%%       the driver invalidate the keys they touch; writes in a
+%%       transaction do so when it commits. Gets inside a transaction or
+%%       with flags go to Berkeley DB. The cache lives while the database
+%%       is open and is sized by the open that opened it; `db_counters'
+%%       reports its hits, misses and hit ratio. The default is 0, no
+%%       cache.</dd>
+%%   <dt>{key_filter, Keys}</dt>
+%%   <dd>Keep a counting Bloom filter of the database's keys, sized for
+%%       `Keys' keys or twice the keys already there, whichever is more,
+%%       at about five bytes a key. Gets of keys the filter rules out are
+%%       answered `not_found' from the port's control call without a
+%%       Berkeley DB lookup; about 1% of absent keys get through to it
+%%       while the database holds no more keys than the filter was sized
+%%       for. The filter is built on a pool thread by scanning the keys
+%%       once the database is first opened; gets go to Berkeley DB until
+%%       the scan finishes, and puts made meanwhile are added to the
+%%       filter when it does. A scan that keeps running into writers'
+%%       locks gives up, leaving the database unfiltered until it is next
+%%       opened. The filter is kept up to date by puts and deletes after
+%%       that. Keys put more than once, keys deleted during the scan and
+%%       keys removed by `truncate' keep counters set, so the share that
+%%       gets through grows until the database is next opened;
+%%       `db_counters' reports it with the filter's size, which stays 0
+%%       until the scan finishes. The default is 0, no filter.</dd>
 %% </dl>
 %%
+%% The layout options apply when the database is created and are read back
+%% from the file on later opens. Berkeley DB refuses values that are out of
+%% range or don't suit the access method, and the open returns an error.
+%%
 %% Additionally, the driver supports the `auto_commit' and `threaded'
 %% flags which are always enabled. Specifying either flag in `Opts' is
 %% safe, but does not alter the behavior of bdberl.
@@ -176,12 +339,21 @@ open(Name, Type) ->
 %% where
 %%    Name = string()
 %%    Type = btree | hash | unknown
-%%    Opts = [atom()]
+%%    Opts = [atom() | {checksum, crc32 | crc32c | xxh64 | none} |
+%%            {verify, driver | end_to_end} | {format, term | raw} |
+%%            {compress, none | lz} | {compress_dict, binary()} |
+%%            {bt_compress, boolean()} | {page_size, integer()} |
+%%            {bt_minkey, integer()} | {h_ffactor, integer()} |
+%%            {h_nelem, integer()} | {re_len, integer()} |
+%%            {duplicates, none | unsorted | sorted} |
+%%            {key_order, bytes | term} | {key_codec, none | ordered} |
+%%            {h_hash, default | xxh64} | {value_cache, integer()} |
+%%            {key_filter, integer()}]
 %%    Db = integer()
 %%
 %% @end
 %%--------------------------------------------------------------------
--spec open(Name :: db_name(), Type :: db_type() | unknown, Opts :: db_flags()) ->
+-spec open(Name :: db_name(), Type :: db_type() | unknown, Opts :: db_open_opts()) ->
     {ok, db()} | {error, integer()}.
 
 open(Name, Type, Opts) ->
@@ -193,10 +365,59 @@ open(Name, Type, Opts) ->
         queue  -> TypeCode = ?DB_TYPE_QUEUE;
         unknown -> TypeCode = ?DB_TYPE_UNKNOWN %% BDB automatically determines if file exists
     end,
-    Flags = process_flags(lists:umerge(Opts, [auto_commit, threaded])),
-    Cmd = <<Flags:32/native, TypeCode:8/signed-native, (list_to_binary(Name))/bytes, 0:8/native>>,
+    {FlagOpts, DbOpts} = lists:partition(fun is_atom/1, Opts),
+    Flags = process_flags(lists:umerge(FlagOpts, [auto_commit, threaded])),
+    OptBin = db_options(DbOpts),
+    Cmd = <<Flags:32/native, TypeCode:8/signed-native, (list_to_binary(Name))/bytes, 0:8/native,
+           OptBin/bytes>>,
     <<Result:32/signed-native>> = erlang:port_control(get_port(), ?CMD_OPEN_DB, Cmd),
-    recv_val(Result).
+    case recv_val(Result) of
+        {ok, Db} ->
+            %% Puts to databases without the original layout let the driver frame the
+            %% value. Should another open have set the database up with crc32 the
+            %% driver computes the CRC-32 itself, so this only ever costs time.
+            case proplists:get_value(checksum, DbOpts, crc32) of
+                crc32 -> erlang:erase({bdb_framed, Db});
+                _     -> erlang:put({bdb_framed, Db}, true)
+            end,
+            {ok, Db};
+        Error ->
+            Error
+    end.
+
+
+%%--------------------------------------------------------------------
+%% @doc
+%% Build a compression dictionary from sample values.
+%%
+%% The samples are values like those the database will hold. Runs of 16
+%% bytes that start every 8 bytes of their stored form are counted, once
+%% per sample, and those found in at least two samples are joined with
+%% the most common last, where the codec reaches them with the shortest
+%% offsets, until the dictionary would exceed `MaxSize' bytes. The result
+%% is meant for the `{compress_dict, Dict}' open option; a few hundred
+%% samples and a `MaxSize' of 4KB to 64KB are typical.
+%%
+%% @spec train_dict(Samples, MaxSize) -> Dict
+%% where
+%%    Samples = [term()]
+%%    MaxSize = integer()
+%%    Dict = binary()
+%%
+%% @end
+%%--------------------------------------------------------------------
+-spec train_dict(Samples :: [db_value()], MaxSize :: pos_integer()) -> binary().
+
+train_dict(Samples, MaxSize) ->
+    Counts = lists:foldl(fun(Sample, Acc) ->
+                                 {_, Bin} = to_binary(Sample),
+                                 lists:foldl(fun(Seg, Acc2) ->
+                                                     dict:update_counter(Seg, 1, Acc2)
+                                             end, Acc, lists:usort(dict_segments(Bin, 0)))
+                         end, dict:new(), Samples),
+    Common = lists:reverse(lists:keysort(2, [{Seg, N} || {Seg, N} <- dict:to_list(Counts),
+                                                         N >= 2])),
+    dict_take(Common, MaxSize, []).
 
 
 %%--------------------------------------------------------------------
@@ -257,6 +478,7 @@ close(Db) ->
 close(Db, Opts) ->
     Flags = process_flags(Opts),
     Cmd = <<Db:32/signed-native, Flags:32/native>>,
+    erlang:erase({bdb_framed, Db}),
     <<Result:32/signed-native>> = erlang:port_control(get_port(), ?CMD_CLOSE_DB, Cmd),
     recv_ok(Result).
 
@@ -874,6 +1096,11 @@ get(Db, Key) ->
 %%       its own read-modify-write cycle, will not result in deadlock.
 %%       This option is meaningful only in the presence of transactions.
 %%       </dd>
+%%   <dt>decode</dt>
+%%   <dd>Have the driver build the value directly in the caller's heap
+%%       rather than sending a binary to decode with binary_to_term.
+%%       Saves a binary allocation and a copy for small values. Ignored
+%%       for databases opened with `{verify, end_to_end}'.</dd>
 %% </dl>
 %%
 %% @spec get(Db, Key, Opts) -> not_found | {ok, Value} | {error, Error}
@@ -895,15 +1122,12 @@ get(Db, Key, Opts) ->
     case decode_rc(Result) of
         ok ->
             receive
+                {term, _, Value} ->
+                    {ok, Value};
+                {verified, _, Payload} ->
+                    {ok, binary_to_term(Payload)};
                 {ok, _, Bin} ->
-                    <<Crc:32/native, Payload/binary>> = Bin,
-                    case erlang:crc32(Payload) of
-                        Crc ->
-                            {ok, binary_to_term(Payload)};
-                        CrcOther ->
-                            lager:warning("Invalid CRC: ~p ~p\n", [Crc, CrcOther]),
-                            {error, invalid_crc}
-                    end;
+                    decode_value(Bin);
                 not_found -> not_found;
                 {error, Reason} -> {error, Reason}
             end;
@@ -1003,6 +1227,143 @@ del(Db, Key) ->
     end.
 
 
+%%--------------------------------------------------------------------
+%% @doc
+%% Store a binary value under a binary key in a raw database.
+%%
+%% @spec put_raw(Db, Key, Value) -> ok | {error, Error}
+%% where
+%%    Db = integer()
+%%    Key = binary()
+%%    Value = binary()
+%%
+%% @equiv put_raw(Db, Key, Value, [])
+%% @see put_raw/4
+%% @end
+%%--------------------------------------------------------------------
+-spec put_raw(Db :: db(), Key :: binary(), Value :: binary()) -> ok | db_error().
+
+put_raw(Db, Key, Value) ->
+    put_raw(Db, Key, Value, []).
+
+
+%%--------------------------------------------------------------------
+%% @doc
+%% Store a binary value under a binary key in a raw database.
+%%
+%% The key and value are stored as given, without term_to_binary, so
+%% btree keys sort in byte order. The database must have been opened
+%% with `{format, raw}'; see open/3. Accepts the options of put/4, and
+%% `commit' to commit the port's transaction after the put as
+%% put_commit/4 does.
+%%
+%% @spec put_raw(Db, Key, Value, Opts) -> ok | {error, Error}
+%% where
+%%    Db = integer()
+%%    Key = binary()
+%%    Value = binary()
+%%    Opts = [atom()]
+%%
+%% @end
+%%--------------------------------------------------------------------
+-spec put_raw(Db :: db(), Key :: binary(), Value :: binary(), Opts :: db_flags()) ->
+    ok | db_error().
+
+put_raw(Db, Key, Value, Opts) when is_binary(Key), is_binary(Value) ->
+    case lists:member(commit, Opts) of
+        true  -> Action = ?CMD_PUT_COMMIT;
+        false -> Action = ?CMD_PUT
+    end,
+    Flags = process_flags(lists:delete(commit, Opts)) bor ?BDBERL_OPT_RAW,
+    send_put(Action, Db, Key, Value, Flags).
+
+
+%%--------------------------------------------------------------------
+%% @doc
+%% Retrieve a binary value based on a binary key from a raw database.
+%%
+%% @spec get_raw(Db, Key) -> not_found | {ok, Value} | {error, Error}
+%% where
+%%    Db = integer()
+%%    Key = binary()
+%%    Value = binary()
+%%
+%% @equiv get_raw(Db, Key, [])
+%% @see get_raw/3
+%% @end
+%%--------------------------------------------------------------------
+-spec get_raw(Db :: db(), Key :: binary()) -> not_found | {ok, binary()} | db_error().
+
+get_raw(Db, Key) ->
+    get_raw(Db, Key, []).
+
+
+%%--------------------------------------------------------------------
+%% @doc
+%% Retrieve a binary value based on a binary key from a raw database.
+%%
+%% The value has been checked by the driver with the database's
+%% checksum and comes back as stored by put_raw/4. Accepts the options
+%% of get/3 other than `decode'.
+%%
+%% @spec get_raw(Db, Key, Opts) -> not_found | {ok, Value} | {error, Error}
+%% where
+%%    Db = integer()
+%%    Key = binary()
+%%    Opts = [atom()]
+%%    Value = binary()
+%%
+%% @end
+%%--------------------------------------------------------------------
+-spec get_raw(Db :: db(), Key :: binary(), Opts :: db_flags()) ->
+    not_found | {ok, binary()} | db_error().
+
+get_raw(Db, Key, Opts) when is_binary(Key) ->
+    Flags = process_flags(Opts) bor ?BDBERL_OPT_RAW,
+    Cmd = <<Db:32/signed-native, Flags:32/native, (size(Key)):32/native, Key/bytes>>,
+    <<Result:32/signed-native>> = erlang:port_control(get_port(), ?CMD_GET, Cmd),
+    case decode_rc(Result) of
+        ok ->
+            receive
+                {raw, _, Value} -> {ok, Value};
+                not_found -> not_found;
+                {error, Reason} -> {error, Reason}
+            end;
+        Error ->
+            {error, Error}
+    end.
+
+
+%%--------------------------------------------------------------------
+%% @doc
+%% Delete a value based on a binary key from a raw database.
+%%
+%% @spec del_raw(Db, Key) -> ok | not_found | {error, Reason}
+%% where
+%%    Db = integer()
+%%    Key = binary()
+%%
+%% @see del/2
+%% @end
+%%--------------------------------------------------------------------
+-spec del_raw(Db :: db(), Key :: binary()) ->
+    ok | not_found | {error, Reason :: db_error()}.
+
+del_raw(Db, Key) when is_binary(Key) ->
+    Cmd = <<Db:32/signed-native, ?BDBERL_OPT_RAW:32/native, (size(Key)):32/native, Key/bytes>>,
+    <<Result:32/signed-native>> = erlang:port_control(get_port(), ?CMD_DEL, Cmd),
+    case decode_rc(Result) of
+        ok ->
+            receive
+                ok -> ok;
+                not_found -> not_found;
+                {error, Reason} -> {error, Reason}
+            end;
+        Error ->
+            {error, Error}
+    end.
+
+
 %%--------------------------------------------------------------------
 %% @doc
 %% Updates the value of a key by executing a fun.
@@ -1192,7 +1553,37 @@ truncate(Db) ->
 -spec cursor_open(Db :: db()) -> ok | db_error().
 
 cursor_open(Db) ->
-    Cmd = <<Db:32/signed-native, 0:32/native>>,
+    cursor_open(Db, []).
+
+%%--------------------------------------------------------------------
+%% @doc
+%% Opens a cursor on a database with options.
+%%
+%% === Options ===
+%%
+%% <dl>
+%%   <dt>decode</dt>
+%%   <dd>Every key and value the cursor returns is built directly in the
+%%       caller's heap by the driver, as with the `decode' option of
+%%       get/3.</dd>
+%%   <dt>read_committed</dt>
+%%   <dd>Reads through the cursor have degree 2 isolation.</dd>
+%%   <dt>read_uncommitted</dt>
+%%   <dd>Reads through the cursor have degree 1 isolation.</dd>
+%% </dl>
+%%
+%% @spec cursor_open(Db, Opts) -> ok | {error, Error}
+%% where
+%%    Db = integer()
+%%    Opts = [atom()]
+%%
+%% @end
+%%--------------------------------------------------------------------
+-spec cursor_open(Db :: db(), Opts :: db_flags()) -> ok | db_error().
+
+cursor_open(Db, Opts) ->
+    Flags = process_flags(Opts),
+    Cmd = <<Db:32/signed-native, Flags:32/native>>,
     <<Result:32/signed-native>> = erlang:port_control(get_port(), ?CMD_CURSOR_OPEN, Cmd),
     recv_ok(Result).
 
@@ -1359,6 +1750,9 @@ cursor_get(Key) ->
 %%   <dd></dd>
 %%   <dt>db_set_rance</dt>
 %%   <dd>TODO... finish the doc, add other DB_?? flags</dd>
+%%   <dt>decode</dt>
+%%   <dd>Have the driver build the value directly in the caller's heap,
+%%       as with the `decode' option of get/3.</dd>
 %% </dl>
 %%
 %% @spec cursor_get(Key, Opts) -> not_found | {ok, Key, Value} | {error, Error}
@@ -1384,15 +1778,72 @@ cursor_get(Key, Opts) ->
     case decode_rc(Result) of
         ok ->
             receive
+                {term, _, Value} ->
+                    {ok, Value};
+                {verified, _, Payload} ->
+                    {ok, binary_to_term(Payload)};
                 {ok, _, Bin} ->
-                    <<Crc:32/native, Payload/binary>> = Bin,
-                    case erlang:crc32(Payload) of
-                        Crc ->
-                            {ok, binary_to_term(Payload)};
-                        CrcOther ->
-                            lager:warning("Invalid CRC: ~p ~p\n", [Crc, CrcOther]),
-                            {error, invalid_crc}
-                    end;
+                    decode_value(Bin);
+                not_found -> not_found;
+                {error, Reason} -> {error, Reason}
+            end;
+        Error ->
+            {error, Error}
+    end.
+
+
+%%--------------------------------------------------------------------
+%% @doc
+%% Positions the cursor at a binary key in a raw database and retrieves
+%% that key/data pair.
+%%
+%% @spec cursor_get_raw(Key) -> not_found | {ok, Value} | {error, Error}
+%% where
+%%    Key = binary()
+%%    Value = binary()
+%%
+%% @equiv cursor_get_raw(Key, [db_set])
+%% @see cursor_get_raw/2
+%% @end
+%%--------------------------------------------------------------------
+-spec cursor_get_raw(Key :: binary()) -> not_found | {ok, binary()} | db_error().
+
+cursor_get_raw(Key) ->
+    cursor_get_raw(Key, [db_set]).
+
+
+%%--------------------------------------------------------------------
+%% @doc
+%% Positions the cursor at a binary key in a raw database and retrieves
+%% that key/data pair.
+%%
+%% Takes the options of cursor_get/2. Raw keys sort in byte order, so
+%% `db_set_range' with a prefix followed by cursor_next/0 scans the keys
+%% starting with it; cursor moves on a raw database return binaries.
+%%
+%% @spec cursor_get_raw(Key, Opts) -> not_found | {ok, Value} | {error, Error}
+%% where
+%%    Key = binary() | undefined
+%%    Opts = [atom()]
+%%    Value = binary()
+%%
+%% @end
+%%--------------------------------------------------------------------
+-spec cursor_get_raw(Key :: binary() | undefined, Opts :: db_flags()) ->
+    not_found | {ok, binary()} | db_error().
+
+cursor_get_raw(Key, Opts) ->
+    case Key of
+        undefined -> KeyBin = <<>>;
+        _         -> KeyBin = Key
+    end,
+    Flags = process_flags(Opts) bor ?BDBERL_OPT_RAW,
+    Cmd = <<Flags:32/native, (size(KeyBin)):32/native, KeyBin/bytes>>,
+    <<Result:32/signed-native>> = erlang:port_control(get_port(), ?CMD_CURSOR_GET, Cmd),
+    case decode_rc(Result) of
+        ok ->
+            receive
+                {raw, _, Value} -> {ok, Value};
                 not_found -> not_found;
                 {error, Reason} -> {error, Reason}
             end;
@@ -1621,7 +2072,11 @@ get_txn_timeout() ->
 %% @doc
 %% Retrieve database stats
 %%
-%% This function retrieves database statistics
+%% This function retrieves database statistics. Besides the counts Berkeley
+%% DB keeps for the database, the list carries the `cache_hit',
+%% `cache_miss', `page_in' and `page_out' counts of the database's file in
+%% the memory pool since the environment was opened, and for btrees
+%% the `bt_compress' option the database was opened with.
 %%
 %% === Options ===
 %%
@@ -2247,18 +2702,330 @@ env_stat_print() ->
 %% @doc
 %% Retrieve driver info
 %%
-%% @spec driver_info() -> {ok, [{atom(), number()}]} | {error, Error}
+%% Besides the thread pool configuration this includes the lock telemetry
+%% kept by the deadlock checker: `deadlocks' (requests rejected by the
+%% detector), `lock_failures' and `lock_failure_usecs' (operations that
+%% failed with deadlock or lock_not_granted, and the time they ran), and
+%% per-second rates from the last lock_stat sample (`deadlock_rate',
+%% `lock_wait_rate', `lock_nowait_rate', `lock_timeout_rate',
+%% `txn_timeout_rate', `lock_request_rate'). The sample interval is set
+%% with BDBERL_LOCK_STAT_INTERVAL (seconds, default 10). While requests
+%% are being captured (see capture_start/1) `capture_records' and
+%% `capture_dropped' count the records written and lost. `crc32_impl' names
+%% the value checksum implementation picked for this CPU: `pclmul',
+%% `slice8' or `bytewise'.
+%%
+%% @spec driver_info() -> {ok, [{atom(), number() | atom()}]} | {error, Error}
 %%
 %% @end
 %%--------------------------------------------------------------------
 -spec driver_info() ->
-    {ok, [{atom(), number()}]} | db_error().
+    {ok, [{atom(), number() | atom()}]} | db_error().
 
 driver_info() ->
     <<Result:32/signed-native>> = erlang:port_control(get_port(), ?CMD_DRIVER_INFO, <<>>),
     recv_val(Result).
 
 
+%%--------------------------------------------------------------------
+%% @doc
+%% Retrieve the queue depth and load of the driver thread pools.
+%%
+%% This is answered synchronously from the pool counters, so it is cheap
+%% enough to call before every request when shedding load. Load is the
+%% number of pending plus active jobs per pool thread. Requests that would
+%% push a pool or class past its configured limit (see the
+%% BDBERL_MAX_*_PENDING environment variables) fail with
+%% `{error, overloaded}'.
+%%
+%% @spec pool_load() -> {ok, [{Pool, [{atom(), term()}]}]} | {error, Error}
+%% where
+%%    Pool = general | txn
+%%
+%% @end
+%%--------------------------------------------------------------------
+-spec pool_load() ->
+    {ok, [{general | txn, [{atom(), term()}]}]} | db_error().
+
+pool_load() ->
+    Cmd = <<?SYSP_TPOOL_LOAD_GET:32/signed-native>>,
+    <<Result:32/signed-native, Rest/bytes>> = erlang:port_control(get_port(), ?CMD_GETINFO, Cmd),
+    case decode_rc(Result) of
+        ok ->
+            {General, Rest1} = decode_pool_load(Rest),
+            {Txn, <<>>} = decode_pool_load(Rest1),
+            {ok, [{general, General}, {txn, Txn}]};
+        Reason ->
+            {error, Reason}
+    end.
+
+
+%%--------------------------------------------------------------------
+%% @doc
+%% Retrieve the operation counters of every open database.
+%%
+%% The counters are kept by the driver workers and cover gets (split into
+%% hits and misses), puts, deletes, cursor steps, bytes read and written,
+%% CRC failures, deadlocks and lock-not-granted results since the
+%% database was opened. Reading them is a single synchronous call.
+%%
+%% The `value_cache_*' counters cover the database's value cache: hits,
+%% misses, evictions, and the entries and bytes it holds.
+%% `value_cache_hit_ratio' is the share of cache lookups that hit, 0.0
+%% before the first one.
+%%
+%% The `key_filter_*' counters cover the database's key filter: gets it
+%% answered `not_found' (rejects), gets it let through that Berkeley DB
+%% answered `not_found' (false positives), its counters, how many of them
+%% are set, and its size in bytes. `key_filter_fp_rate' is the share of
+%% gets of absent keys the filter let through; `key_filter_est_fp_rate'
+%% is the rate the filter's fill predicts for keys never looked up.
+%%
+%% @spec db_counters() -> {ok, [{Db, Name, Counters}]} | {error, Error}
+%% where
+%%    Db = integer()
+%%    Name = string()
+%%    Counters = [{atom(), number()}]
+%%
+%% @end
+%%--------------------------------------------------------------------
+-spec db_counters() ->
+    {ok, [{db(), string(), [{atom(), number()}]}]} | db_error().
+
+db_counters() ->
+    Cmd = <<-1:32/signed-native>>,
+    <<Result:32/signed-native>> = erlang:port_control(get_port(), ?CMD_DB_COUNTERS, Cmd),
+    case recv_val(Result) of
+        {ok, Dbs} ->
+            {ok, [{Db, Name, add_ratios(Counters)} || {Db, Name, Counters} <- Dbs]};
+        Error ->
+            Error
+    end.
+
+
+%%--------------------------------------------------------------------
+%% @doc
+%% Retrieve the operation counters of one open database.
+%%
+%% @spec db_counters(Db) -> {ok, Counters} | {error, Error}
+%% where
+%%    Db = integer()
+%%    Counters = [{atom(), number()}]
+%%
+%% @see db_counters/0
+%% @end
+%%--------------------------------------------------------------------
+-spec db_counters(Db :: db()) ->
+    {ok, [{atom(), number()}]} | db_error().
+
+db_counters(Db) ->
+    Cmd = <<Db:32/signed-native>>,
+    <<Result:32/signed-native>> = erlang:port_control(get_port(), ?CMD_DB_COUNTERS, Cmd),
+    case recv_val(Result) of
+        {ok, [{Db, _Name, Counters}]} ->
+            {ok, add_ratios(Counters)};
+        Error ->
+            Error
+    end.
+
+
+%%--------------------------------------------------------------------
+%% @doc
+%% Retrieve driver latency histograms with empty flags
+%%
+%% @spec latency_stats() -> {ok, [{atom(), [{queue | service, [{atom(), integer()}]}]}]} |
+%%                          {error, Error}
+%%
+%% @equiv latency_stats([])
+%% @see latency_stats/1
+%% @end
+%%--------------------------------------------------------------------
+-spec latency_stats() ->
+    {ok, [{atom(), [{queue | service, [{atom(), non_neg_integer()}]}]}]} | db_error().
+
+latency_stats() ->
+    latency_stats([]).
+
+
+%%--------------------------------------------------------------------
+%% @doc
+%% Retrieve driver latency histograms
+%%
+%% Every async command is timed in two parts: queue, the time spent
+%% waiting for a pool thread, and service, the time the thread spent
+%% running it. For each command run since the last reset the count, min,
+%% mean, p50, p90, p99, p999 and max are returned in microseconds.
+%% Percentiles are accurate to within 12.5%.
+%%
+%% Passing `reset' clears the histograms after they have been read.
+%%
+%% @spec latency_stats(Opts) -> {ok, [{Cmd, [{queue | service, Stats}]}]} |
+%%                              {error, Error}
+%% where
+%%    Opts = [reset]
+%%    Cmd = atom()
+%%    Stats = [{atom(), integer()}]
+%%
+%% @end
+%%--------------------------------------------------------------------
+-spec latency_stats(Opts :: [reset]) ->
+    {ok, [{atom(), [{queue | service, [{atom(), non_neg_integer()}]}]}]} | db_error().
+
+latency_stats(Opts) ->
+    Flags = case lists:member(reset, Opts) of
+                true  -> ?LATENCY_STATS_RESET;
+                false -> 0
+            end,
+    Cmd = <<Flags:32/native>>,
+    <<Result:32/signed-native>> = erlang:port_control(get_port(), ?CMD_LATENCY_STATS, Cmd),
+    recv_val(Result).
+
+
+%%--------------------------------------------------------------------
+%% @doc
+%% Retrieve every sample held by the background stats sampler
+%%
+%% @spec samples() -> {ok, [Sample]}
+%%
+%% @equiv samples([])
+%% @see samples/1
+%% @end
+%%--------------------------------------------------------------------
+-spec samples() -> {ok, [[{atom(), term()}]]}.
+
+samples() ->
+    samples([]).
+
+
+%%--------------------------------------------------------------------
+%% @doc
+%% Retrieve samples from the background stats sampler.
+%%
+%% A driver thread snapshots the memory pool, lock, log and transaction
+%% counters and the thread pool queue depths every
+%% BDBERL_SAMPLE_INTERVAL seconds (default 10) into a ring of
+%% BDBERL_SAMPLE_SLOTS samples (default 360). Reading the ring is a
+%% single synchronous call that does not touch BDB or a pool thread. When
+%% BDBERL_SAMPLE_FILE is set every sample is also appended to that file
+%% in the binary series format, rotating it to File.1 after
+%% BDBERL_SAMPLE_FILE_KB kilobytes (default 1024).
+%%
+%% Each sample is returned oldest first as a proplist with the wall clock
+%% `timestamp' (microseconds since the epoch), `elapsed_usecs' since the
+%% previous sample, `deltas' for the counters, `rates' per second for the
+%% counters and `gauges' for point in time values.
+%%
+%% Passing `{last, N}' limits the result to the N most recent samples.
+%% Passing `binary' returns the series undecoded; the layout is described
+%% in bdberl_sampler.h.
+%%
+%% @spec samples(Opts) -> {ok, [Sample]} | {ok, binary()}
+%% where
+%%    Opts = [{last, integer()} | binary]
+%%    Sample = [{atom(), term()}]
+%%
+%% @end
+%%--------------------------------------------------------------------
+-spec samples(Opts :: [{last, non_neg_integer()} | binary]) ->
+    {ok, [[{atom(), term()}]]} | {ok, binary()}.
+
+samples(Opts) ->
+    Last = proplists:get_value(last, Opts, 0),
+    Cmd = <<Last:32/native>>,
+    Series = erlang:port_control(get_port(), ?CMD_SAMPLES, Cmd),
+    case proplists:get_bool(binary, Opts) of
+        true ->
+            {ok, Series};
+        false ->
+            {ok, decode_samples(Series)}
+    end.
+
+
+%%--------------------------------------------------------------------
+%% @doc
+%% Retrieve the recent operations recorded by the driver worker threads.
+%%
+%% Every data operation and transaction begin/commit/abort is recorded in a
+%% ring of BDBERL_TRACE_ENTRIES entries (default 256) owned by the worker
+%% thread that ran it. Operations that take longer than
+%% BDBERL_SLOW_OP_USECS (default one second) from enqueue to completion are
+%% also reported to the registered logger. Entries are returned oldest
+%% first; `queue_usecs' is the time spent waiting for a pool thread and
+%% `service_usecs' the time spent in BDB.
+%%
+%% @spec trace_dump() -> {ok, [Entry]}
+%% where
+%%    Entry = [{atom(), term()}]
+%%
+%% @end
+%%--------------------------------------------------------------------
+-spec trace_dump() -> {ok, [[{atom(), term()}]]}.
+
+trace_dump() ->
+    <<1:32/native, _Count:32/native, Entries/bytes>> =
+        erlang:port_control(get_port(), ?CMD_TRACE_DUMP, <<>>),
+    Decoded = [[{timestamp, Timestamp},
+                {thread, Thread},
+                {cmd, cmd_name(Op)},
+                {db, DbRef},
+                {key_size, KeySize},
+                {value_size, ValueSize},
+                {queue_usecs, Queue},
+                {service_usecs, Service},
+                {rc, decode_rc(Rc)},
+                {txn, Flags band 1 =:= 1}]
+               || <<Timestamp:64/native, Queue:64/native, Service:64/native,
+                    Op:32/native, DbRef:32/signed-native, KeySize:32/native,
+                    ValueSize:32/native, Rc:32/signed-native, Flags:32/native,
+                    Thread:32/native>> <= Entries],
+    {ok, lists:sort(fun(A, B) ->
+                            proplists:get_value(timestamp, A) =< proplists:get_value(timestamp, B)
+                    end, Decoded)}.
+
+
+%%--------------------------------------------------------------------
+%% @doc
+%% Start capturing every data and transaction request into a file.
+%%
+%% Each request is recorded with its arrival time, originating port,
+%% command, database, flags, key and value size (see c_src/bdberl_capture.h
+%% for the format); values themselves are not kept. Any capture already in
+%% progress is stopped first. Records are buffered and written by a
+%% background thread; when it falls behind they are dropped and counted in
+%% driver_info. That thread also opens the file, and this returns once it
+%% has, within about 100ms. Setting BDBERL_CAPTURE_FILE captures from driver startup.
+%% bench/bdberl_replay.erl replays a capture.
+%%
+%% @spec capture_start(File) -> ok | {error, Error}
+%% where
+%%    File = string()
+%%
+%% @end
+%%--------------------------------------------------------------------
+-spec capture_start(File :: string()) -> ok | db_error().
+
+capture_start(File) ->
+    Path = list_to_binary(File),
+    Cmd = <<1:32/native, Path/bytes, 0:8>>,
+    <<Result:32/signed-native>> = erlang:port_control(get_port(), ?CMD_CAPTURE, Cmd),
+    recv_ok(Result).
+
+
+%%--------------------------------------------------------------------
+%% @doc
+%% Stop capturing requests, writing out everything recorded so far.
+%%
+%% @spec capture_stop() -> ok
+%%
+%% @end
+%%--------------------------------------------------------------------
+-spec capture_stop() -> ok | db_error().
+
+capture_stop() ->
+    <<Result:32/signed-native>> = erlang:port_control(get_port(), ?CMD_CAPTURE, <<0:32/native>>),
+    recv_ok(Result).
+
+
 %%--------------------------------------------------------------------
 %% @doc
 %% Registers the port owner pid to receive any BDB err/msg events. Note
@@ -2348,6 +3115,10 @@ decode_rc(?ERROR_TXN_OPEN)           -> transaction_open;
 decode_rc(?ERROR_NO_TXN)             -> no_txn;
 decode_rc(?ERROR_CURSOR_OPEN)        -> cursor_open;
 decode_rc(?ERROR_NO_CURSOR)          -> no_cursor;
+decode_rc(?ERROR_OVERLOADED)         -> overloaded;
+decode_rc(?ERROR_INVALID_OPTION)     -> invalid_option;
+decode_rc(?ERROR_FORMAT_MISMATCH)    -> format_mismatch;
+decode_rc(?ERROR_INVALID_KEY)        -> invalid_key;
 decode_rc(?DB_BUFFER_SMALL)          -> buffer_small;
 decode_rc(?DB_KEYEMPTY)              -> key_empty;
 decode_rc(?DB_KEYEXIST)              -> key_exist;
@@ -2362,6 +3133,64 @@ decode_rc(?DB_VERIFY_BAD)            -> verify_bad;
 decode_rc(?DB_VERSION_MISMATCH)      -> version_mismatch;
 decode_rc(Rc) when is_integer(Rc)    -> {unknown, Rc}.
 
+%%
+%% Name of a traced command
+%%
+cmd_name(?CMD_TXN_BEGIN)   -> txn_begin;
+cmd_name(?CMD_TXN_COMMIT)  -> txn_commit;
+cmd_name(?CMD_TXN_ABORT)   -> txn_abort;
+cmd_name(?CMD_GET)         -> get;
+cmd_name(?CMD_PUT)         -> put;
+cmd_name(?CMD_DEL)         -> del;
+cmd_name(?CMD_CURSOR_CURR) -> cursor_curr;
+cmd_name(?CMD_CURSOR_NEXT) -> cursor_next;
+cmd_name(?CMD_CURSOR_PREV) -> cursor_prev;
+cmd_name(?CMD_PUT_COMMIT)  -> put_commit;
+cmd_name(?CMD_CURSOR_GET)  -> cursor_get;
+cmd_name(Cmd)              -> Cmd.
+
+%%
+%% Decode one pool's load snapshot; the class order matches TPOOL_CLASS_* in
+%% bdberl_tpool.h
+%%
+decode_pool_load(<<Threads:32/native, Pending:32/native, Active:32/native,
+                   MaxPending:32/native, Rejected:32/native, Rest/bytes>>) ->
+    {Classes, Rest1} = decode_pool_classes([read, write, txn, stat, txn_end], Rest, []),
+    {[{threads, Threads},
+      {pending, Pending},
+      {active, Active},
+      {max_pending, MaxPending},
+      {rejected, Rejected},
+      {load, (Pending + Active) / erlang:max(Threads, 1)},
+      {classes, Classes}], Rest1}.
+
+decode_pool_classes([], Rest, Acc) ->
+    {lists:reverse(Acc), Rest};
+decode_pool_classes([Class | Classes], <<Pending:32/native, MaxPending:32/native, Rest/bytes>>, Acc) ->
+    decode_pool_classes(Classes, Rest, [{Class, [{pending, Pending}, {max_pending, MaxPending}]} | Acc]).
+
+%%
+%% Decode a sampler series into proplists, splitting the counters from the gauges and
+%% computing per-second rates from the elapsed time
+%%
+decode_samples(<<1:32/native, NFields:32/native, _Interval:32/native, GaugeMask:32/native,
+                 _Count:32/native, Records/bytes>>) ->
+    Fields = lists:sublist(?SAMPLE_FIELDS, NFields),
+    Gauges = [Field || {Field, Bit} <- lists:zip(Fields, lists:seq(0, length(Fields) - 1)),
+                       GaugeMask band (1 bsl Bit) =/= 0],
+    RecordSize = (2 + NFields) * 8,
+    [decode_sample(Record, Fields, Gauges) || <<Record:RecordSize/bytes>> <= Records].
+
+decode_sample(<<Timestamp:64/native, Elapsed:64/native, Values/bytes>>, Fields, Gauges) ->
+    Pairs = lists:zip(Fields, lists:sublist([V || <<V:64/native>> <= Values], length(Fields))),
+    {GaugeValues, Deltas} = lists:partition(fun({F, _}) -> lists:member(F, Gauges) end, Pairs),
+    Secs = erlang:max(Elapsed, 1) / 1000000,
+    [{timestamp, Timestamp},
+     {elapsed_usecs, Elapsed},
+     {deltas, Deltas},
+     {rates, [{F, V / Secs} || {F, V} <- Deltas]},
+     {gauges, GaugeValues}].
+
 %%
 %% Convert a term into a binary, returning a tuple with the binary and the length of the binary
 %%
@@ -2431,22 +3260,165 @@ flag_value(Flag) ->
         db_prev_dup       -> ?DB_PREV_DUP;
         db_prev_nodup     -> ?DB_PREV_NODUP;
         db_set            -> ?DB_SET;
-        db_set_range      -> ?DB_SET_RANGE
+        db_set_range      -> ?DB_SET_RANGE;
+        decode            -> ?BDBERL_OPT_DECODE
     end.
 
 
+%%
+%% Encode the {Option, Value} open options as << Tag:8, Len:8, Value:Len/bytes >>
+%%
+db_options(Opts) ->
+    << <<(db_option(Opt))/bytes>> || Opt <- Opts >>.
+
+db_option({checksum, Alg}) ->
+    Code = case Alg of
+               none   -> ?VALUE_CHECKSUM_NONE;
+               crc32  -> ?VALUE_CHECKSUM_CRC32;
+               crc32c -> ?VALUE_CHECKSUM_CRC32C;
+               xxh64  -> ?VALUE_CHECKSUM_XXH64
+           end,
+    <<?DB_OPTION_CHECKSUM:8, 1:8, Code:8>>;
+db_option({verify, Mode}) ->
+    Code = case Mode of
+               driver     -> ?VERIFY_DRIVER;
+               end_to_end -> ?VERIFY_END_TO_END
+           end,
+    <<?DB_OPTION_VERIFY:8, 1:8, Code:8>>;
+db_option({format, Format}) ->
+    Code = case Format of
+               term -> ?FORMAT_TERM;
+               raw  -> ?FORMAT_RAW
+           end,
+    <<?DB_OPTION_FORMAT:8, 1:8, Code:8>>;
+db_option({compress, Codec}) ->
+    Code = case Codec of
+               none -> ?COMPRESS_NONE;
+               lz   -> ?COMPRESS_LZ
+           end,
+    <<?DB_OPTION_COMPRESS:8, 1:8, Code:8>>;
+db_option({compress_dict, Dict}) when is_binary(Dict) ->
+    <<?DB_OPTION_DICT:8, ?DB_OPTION_LEN_EXT:8, (byte_size(Dict)):32/native, Dict/bytes>>;
+db_option({bt_compress, Enabled}) ->
+    Code = case Enabled of
+               true  -> 1;
+               false -> 0
+           end,
+    <<?DB_OPTION_BT_COMPRESS:8, 1:8, Code:8>>;
+db_option({page_size, N}) ->
+    <<?DB_OPTION_PAGE_SIZE:8, 4:8, N:32/native>>;
+db_option({bt_minkey, N}) ->
+    <<?DB_OPTION_BT_MINKEY:8, 4:8, N:32/native>>;
+db_option({h_ffactor, N}) ->
+    <<?DB_OPTION_H_FFACTOR:8, 4:8, N:32/native>>;
+db_option({h_nelem, N}) ->
+    <<?DB_OPTION_H_NELEM:8, 4:8, N:32/native>>;
+db_option({re_len, N}) ->
+    <<?DB_OPTION_RE_LEN:8, 4:8, N:32/native>>;
+db_option({duplicates, Dup}) ->
+    Code = case Dup of
+               none     -> ?DUP_NONE;
+               unsorted -> ?DUP_UNSORTED;
+               sorted   -> ?DUP_SORTED
+           end,
+    <<?DB_OPTION_DUP:8, 1:8, Code:8>>;
+db_option({key_order, Order}) ->
+    Code = case Order of
+               bytes -> ?KEY_ORDER_BYTES;
+               term  -> ?KEY_ORDER_TERM
+           end,
+    <<?DB_OPTION_KEY_ORDER:8, 1:8, Code:8>>;
+db_option({key_codec, Codec}) ->
+    Code = case Codec of
+               none    -> ?KEY_CODEC_NONE;
+               ordered -> ?KEY_CODEC_ORDERED
+           end,
+    <<?DB_OPTION_KEY_CODEC:8, 1:8, Code:8>>;
+db_option({h_hash, Fun}) ->
+    Code = case Fun of
+               default -> ?H_HASH_DEFAULT;
+               xxh64   -> ?H_HASH_XXH64
+           end,
+    <<?DB_OPTION_H_HASH:8, 1:8, Code:8>>;
+db_option({value_cache, Bytes}) ->
+    <<?DB_OPTION_VALUE_CACHE:8, 4:8, Bytes:32/native>>;
+db_option({key_filter, Keys}) ->
+    <<?DB_OPTION_KEY_FILTER:8, 4:8, Keys:32/native>>.
+
+%%
+%% Append the value cache hit ratio and the key filter false positive
+%% rates to the counters of a database
+%%
+add_ratios(Counters) ->
+    Get = fun(Name) -> proplists:get_value(Name, Counters, 0) end,
+    HitRatio = ratio(Get(value_cache_hits), Get(value_cache_misses)),
+    FpRate = ratio(Get(key_filter_false_positives), Get(key_filter_rejects)),
+    EstFpRate = case Get(key_filter_counters) of
+                    0 -> 0.0;
+                    N -> math:pow(Get(key_filter_counters_set) / N, ?KEY_FILTER_HASHES)
+                end,
+    Counters ++ [{value_cache_hit_ratio, HitRatio},
+                 {key_filter_fp_rate, FpRate},
+                 {key_filter_est_fp_rate, EstFpRate}].
+
+ratio(0, 0) -> 0.0;
+ratio(A, B) -> A / (A + B).
+
+%%
+%% Segments of a sample counted by train_dict/2, and the most common of
+%% them joined most common last
+%%
+dict_segments(Bin, Pos) when Pos + 16 =< byte_size(Bin) ->
+    <<_:Pos/bytes, Seg:16/bytes, _/binary>> = Bin,
+    [Seg | dict_segments(Bin, Pos + 8)];
+dict_segments(_Bin, _Pos) ->
+    [].
+
+dict_take([{Seg, _} | Rest], Room, Acc) when Room >= 16 ->
+    dict_take(Rest, Room - 16, [Seg | Acc]);
+dict_take(_Segs, _Room, Acc) ->
+    list_to_binary(Acc).
+
+%%
+%% Unwrap a stored value sent for an end_to_end check. Values in the
+%% original layout carry a CRC-32 of the term, checked here; values behind
+%% the versioned header (fifth byte is the header size, never the 131 that
+%% starts a term) were checked by the driver, which has the other checksum
+%% implementations.
+%%
+decode_value(<<16#BD:8, _:3/bytes, HeaderSize:8, _/binary>> = Bin) when HeaderSize =/= 131 ->
+    <<_:HeaderSize/bytes, Payload/binary>> = Bin,
+    {ok, binary_to_term(Payload)};
+decode_value(<<Crc:32/native, Payload/binary>>) ->
+    case erlang:crc32(Payload) of
+        Crc ->
+            {ok, binary_to_term(Payload)};
+        CrcOther ->
+            lager:warning("Invalid CRC: ~p ~p\n", [Crc, CrcOther]),
+            {error, invalid_crc}
+    end.
+
 %%
 %% Execute a PUT, using the provide "Action" to determine if it's a PUT or PUT_COMMIT
 %%
 do_put(Action, Db, Key, Value, Opts) ->
-    {KeyLen, KeyBin} = to_binary(Key),
+    {_, KeyBin} = to_binary(Key),
     {_, ValBin} = to_binary(Value),
-    Crc = erlang:crc32(ValBin),
-    FinalValBin = <<Crc:32/native, ValBin/binary>>,
-    FinalValBinLen = size(FinalValBin),
-    Flags = process_flags(Opts),
-    Cmd = <<Db:32/signed-native, Flags:32/native, KeyLen:32/native, KeyBin/bytes,
-           FinalValBinLen:32/native, FinalValBin/bytes>>,
+    case erlang:get({bdb_framed, Db}) of
+        true ->
+            send_put(Action, Db, KeyBin, <<0:?BDBERL_FRAME_ROOM/unit:8, ValBin/binary>>,
+                     process_flags(Opts) bor ?BDBERL_OPT_FRAMED);
+        undefined ->
+            Crc = erlang:crc32(ValBin),
+            send_put(Action, Db, KeyBin, <<Crc:32/native, ValBin/binary>>, process_flags(Opts))
+    end.
+
+%%
+%% Send an encoded key and value to be stored
+%%
+send_put(Action, Db, KeyBin, ValBin, Flags) ->
+    Cmd = <<Db:32/signed-native, Flags:32/native, (size(KeyBin)):32/native, KeyBin/bytes,
+           (size(ValBin)):32/native, ValBin/bytes>>,
     <<Result:32/signed-native>> = erlang:port_control(get_port(), Action, Cmd),
     recv_ok(Result).
 
@@ -2458,14 +3430,18 @@ do_cursor_move(Direction) ->
     case decode_rc(Result) of
         ok ->
             receive
+                {term, Key, Value} ->
+                    {ok, Key, Value};
+                {raw, KeyBin, ValueBin} ->
+                    {ok, KeyBin, ValueBin};
+                {verified, KeyBin, Payload} ->
+                    {ok, binary_to_term(KeyBin), binary_to_term(Payload)};
                 {ok, KeyBin, ValueBin} ->
-                    <<Crc:32/native, Payload/binary>> = ValueBin,
-                    case erlang:crc32(Payload) of
-                        Crc ->
-                            {ok, binary_to_term(KeyBin), binary_to_term(Payload)};
-                        CrcOther ->
-                            lager:warning("Invalid CRC on cursor: ~p ~p\n", [Crc, CrcOther]),
-                            {error, invalid_crc}
+                    case decode_value(ValueBin) of
+                        {ok, Value} ->
+                            {ok, binary_to_term(KeyBin), Value};
+                        Error ->
+                            Error
                     end;
                 not_found ->
                     not_found;
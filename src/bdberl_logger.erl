@@ -46,6 +46,9 @@
 %% Macro for incrementing a counter
 -define(SNMP_INC(Key), (snmp_generic:variable_inc({Key, volatile}, 1))).
 
+%% Macro for adding to a counter
+-define(SNMP_ADD(Key, N), (snmp_generic:variable_inc({Key, volatile}, N))).
+
 %% ====================================================================
 %% API
 %% ====================================================================
@@ -115,6 +118,36 @@ handle_info({bdb_trickle_stats, _ElapsedSecs, _Pages, Rc}, State) ->
     lager:error("BDB Trickle Write: ~w\n", [Rc]),
     {noreply, State};
 
+handle_info({bdb_lock_stats, IntervalMsecs, Deadlocks, LockWaits, LockNowaits,
+             LockTimeouts, TxnTimeouts, Requests}, State) ->
+    case Deadlocks + LockTimeouts + TxnTimeouts > 0 of
+        true ->
+            lager:warning("BDB Locks: ~w deadlocks, ~w lock timeouts, ~w txn timeouts "
+                          "in ~w ms (~w waits, ~w nowaits, ~w requests)\n",
+                          [Deadlocks, LockTimeouts, TxnTimeouts, IntervalMsecs,
+                           LockWaits, LockNowaits, Requests]);
+        false ->
+            ok
+    end,
+    case is_snmp_running() of
+        true ->
+            ?SNMP_ADD(bdbDeadlocks, Deadlocks),
+            ?SNMP_ADD(bdbLockWaits, LockWaits),
+            ?SNMP_ADD(bdbLockNowaits, LockNowaits),
+            ?SNMP_ADD(bdbLockTimeouts, LockTimeouts + TxnTimeouts),
+            ?SNMP_SET(bdbLockRequestsPerSec, per_sec(Requests, IntervalMsecs)),
+            ?SNMP_SET(bdbLockWaitsPerSec, per_sec(LockWaits, IntervalMsecs));
+        false ->
+            ok
+    end,
+    {noreply, State};
+
+handle_info({bdb_slow_op, Cmd, Db, KeySize, ValueSize, QueueUsecs, ServiceUsecs, Rc, InTxn}, State) ->
+    lager:warning("BDB slow ~p on db ~p: ~p us queued + ~p us in BDB, "
+                  "key ~p bytes, value ~p bytes, txn ~p, result ~p\n",
+                  [Cmd, Db, QueueUsecs, ServiceUsecs, KeySize, ValueSize, InTxn, Rc]),
+    {noreply, State};
+
 handle_info(Msg, State) ->
     lager:info("Unexpected message: ~p\n", [Msg]),
     {noreply, State}.
@@ -148,3 +181,11 @@ load_mibs([Mib | Rest]) ->
             ok = snmpa:load_mibs([MibFile]),
             load_mibs(Rest)
     end.
+
+%%
+%% Convert a count over an interval in milliseconds into a whole per-second rate
+%%
+per_sec(_Count, 0) ->
+    0;
+per_sec(Count, IntervalMsecs) ->
+    (Count * 1000) div IntervalMsecs.
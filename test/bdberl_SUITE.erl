@@ -36,6 +36,7 @@
 -compile(export_all).
 
 -include_lib("common_test/include/ct.hrl").
+-include("../include/bdberl.hrl").
 
 all() ->
     [open_should_create_database_if_none_exists,
@@ -72,6 +73,25 @@ all() ->
      txn_stat_should_report_on_success,
      data_dirs_info_should_report_on_success,
      lg_dir_info_should_report_on_success,
+     pool_load_should_report_queue_depth,
+     latency_stats_should_report_and_reset,
+     db_counters_should_track_operations,
+     crc32_should_match_erlang_crc32,
+     checksum_option_should_round_trip_values,
+     decode_option_should_return_terms,
+     raw_format_should_store_binaries_as_given,
+     compress_option_should_round_trip_values,
+     bt_compress_option_should_be_reported,
+     layout_options_should_shape_databases,
+     term_key_order_should_match_erlang_order,
+     key_codec_should_order_keys_and_round_trip,
+     h_hash_option_should_be_checked_on_open,
+     value_cache_should_track_writes,
+     key_filter_should_reject_absent_keys,
+     lock_telemetry_should_be_reported,
+     samples_should_decode_series,
+     trace_dump_should_record_operations,
+     capture_should_record_requests,
      start_after_stop_should_be_safe].
 
 
@@ -88,6 +108,7 @@ dbconfig(Config) ->
 init_per_suite(Config) ->
     DbHome = ?config(priv_dir, Config),
     os:putenv("DB_HOME", DbHome),
+    os:putenv("BDBERL_SAMPLE_INTERVAL", "1"),
     ok = file:write_file(DbHome ++ "DB_CONFIG", dbconfig(Config)),
     Config.
 
@@ -411,6 +432,453 @@ data_dirs_info_should_report_on_success(_Config) ->
 lg_dir_info_should_report_on_success(_Config) ->
     {ok, _LgDir, _Fsid, _MBytesAvail} = bdberl:get_lg_dir_info().
 
+pool_load_should_report_queue_depth(_Config) ->
+    {ok, Pools} = bdberl:pool_load(),
+    General = proplists:get_value(general, Pools),
+    Txn = proplists:get_value(txn, Pools),
+    true = proplists:get_value(threads, General) > 0,
+    true = proplists:get_value(threads, Txn) > 0,
+    %% No limits are configured by the suite, so nothing should be refused
+    0 = proplists:get_value(max_pending, General),
+    0 = proplists:get_value(rejected, General),
+    [read, write, txn, stat, txn_end] = [C || {C, _} <- proplists:get_value(classes, General)],
+    {ok, Info} = bdberl:driver_info(),
+    0 = proplists:get_value(max_general_pending, Info),
+    done.
+
+latency_stats_should_report_and_reset(Config) ->
+    Db = ?config(db, Config),
+    {ok, _} = bdberl:latency_stats([reset]),
+    ok = bdberl:put(Db, mykey, avalue),
+    {ok, avalue} = bdberl:get(Db, mykey),
+    {ok, Stats} = wait_for_latency([put, get], 20),
+    Get = proplists:get_value(get, Stats),
+    1 = proplists:get_value(count, proplists:get_value(service, Get)),
+    1 = proplists:get_value(count, proplists:get_value(queue, Get)),
+    false = proplists:is_defined(del, Stats),
+    {ok, _} = bdberl:latency_stats([reset]),
+    {ok, []} = bdberl:latency_stats(),
+    done.
+
+%% Workers record a job's latency once it returns, after its reply has gone out;
+%% poll until every op has been recorded
+wait_for_latency(_Ops, 0) ->
+    timeout;
+wait_for_latency(Ops, Tries) ->
+    {ok, Stats} = bdberl:latency_stats(),
+    case lists:all(fun(Op) -> proplists:is_defined(Op, Stats) end, Ops) of
+        true ->
+            {ok, Stats};
+        false ->
+            timer:sleep(50),
+            wait_for_latency(Ops, Tries - 1)
+    end.
+
+db_counters_should_track_operations(Config) ->
+    Db = ?config(db, Config),
+    ok = bdberl:put(Db, mykey, avalue),
+    {ok, avalue} = bdberl:get(Db, mykey),
+    not_found = bdberl:get(Db, otherkey),
+    ok = bdberl:del(Db, mykey),
+    {ok, Counters} = bdberl:db_counters(Db),
+    2 = proplists:get_value(gets, Counters),
+    1 = proplists:get_value(get_hits, Counters),
+    1 = proplists:get_value(get_misses, Counters),
+    1 = proplists:get_value(puts, Counters),
+    1 = proplists:get_value(dels, Counters),
+    true = proplists:get_value(bytes_written, Counters) > 0,
+    0 = proplists:get_value(crc_failures, Counters),
+    {ok, All} = bdberl:db_counters(),
+    {Db, "api_test.db", Counters} = lists:keyfind(Db, 1, All),
+    {error, invalid_db} = bdberl:db_counters(21000),
+    done.
+
+%% Values long enough to take the folding path, at every tail length
+crc32_should_match_erlang_crc32(Config) ->
+    Db = ?config(db, Config),
+    {ok, Info} = bdberl:driver_info(),
+    true = lists:member(proplists:get_value(crc32_impl, Info), [pclmul, slice8, bytewise]),
+    Values = [list_to_binary([I rem 256 || I <- lists:seq(1, Len)]) || Len <- lists:seq(100, 140)],
+    [ok = bdberl:put(Db, {crc, size(V)}, V) || V <- Values],
+    [{ok, V} = bdberl:get(Db, {crc, size(V)}) || V <- Values],
+    {ok, Counters} = bdberl:db_counters(Db),
+    0 = proplists:get_value(crc_failures, Counters),
+    done.
+
+checksum_option_should_round_trip_values(_Config) ->
+    F = fun({Alg, Verify}) ->
+                Name = "checksum_" ++ atom_to_list(Alg) ++ ".db",
+                {ok, Db} = bdberl:open(Name, btree, [create, {checksum, Alg}, {verify, Verify}]),
+                Value = {Alg, lists:seq(1, 100)},
+                ok = bdberl:put(Db, key1, Value),
+                ok = bdberl:put(Db, key2, value2),
+                {ok, Value} = bdberl:get(Db, key1),
+                ok = bdberl:cursor_open(Db),
+                {ok, Value} = bdberl:cursor_get(key1),
+                {ok, key2, value2} = bdberl:cursor_next(),
+                ok = bdberl:cursor_close(),
+                {ok, Counters} = bdberl:db_counters(Db),
+                0 = proplists:get_value(crc_failures, Counters),
+                ok = bdberl:close(Db),
+                ok = bdberl:delete_database(Name)
+        end,
+    [F({Alg, Verify}) || Alg <- [crc32, crc32c, xxh64, none], Verify <- [driver, end_to_end]],
+
+    %% Framed puts still store a CRC-32 when the database was set up with it
+    {ok, Db} = bdberl:open("checksum_mixed.db", btree, [create]),
+    {ok, Db} = bdberl:open("checksum_mixed.db", btree, [create, {checksum, none}]),
+    ok = bdberl:put(Db, key1, value1),
+    {ok, value1} = bdberl:get(Db, key1),
+    {ok, Counters} = bdberl:db_counters(Db),
+    0 = proplists:get_value(crc_failures, Counters),
+    ok = bdberl:close(Db),
+    ok = bdberl:delete_database("checksum_mixed.db"),
+    done.
+
+decode_option_should_return_terms(Config) ->
+    Db = ?config(db, Config),
+    Value = {record, <<"bin">>, [1.5, "str", atom]},
+    ok = bdberl:put(Db, key1, Value),
+    ok = bdberl:put(Db, {key, 2}, value2),
+    {ok, Value} = bdberl:get(Db, key1, [decode]),
+    not_found = bdberl:get(Db, key3, [decode]),
+    ok = bdberl:cursor_open(Db, [decode]),
+    {ok, Value} = bdberl:cursor_get(key1),
+    {ok, {key, 2}, value2} = bdberl:cursor_next(),
+    {ok, key1, Value} = bdberl:cursor_prev(),
+    ok = bdberl:cursor_close(),
+    done.
+
+raw_format_should_store_binaries_as_given(Config) ->
+    TermDb = ?config(db, Config),
+    F = fun(Alg) ->
+                Name = "raw_" ++ atom_to_list(Alg) ++ ".db",
+                {ok, Db} = bdberl:open(Name, btree, [create, {format, raw}, {checksum, Alg}]),
+                ok = bdberl:put_raw(Db, <<"b/2">>, <<"two">>),
+                ok = bdberl:put_raw(Db, <<"a/1">>, <<131, 0, 1>>),
+                ok = bdberl:put_raw(Db, <<"b/1">>, <<>>),
+                {ok, <<131, 0, 1>>} = bdberl:get_raw(Db, <<"a/1">>),
+                {ok, <<>>} = bdberl:get_raw(Db, <<"b/1">>),
+                not_found = bdberl:get_raw(Db, <<"c">>),
+
+                %% Keys sort in byte order
+                ok = bdberl:cursor_open(Db),
+                {ok, <<>>} = bdberl:cursor_get_raw(<<"b/">>, [db_set_range]),
+                {ok, <<"b/2">>, <<"two">>} = bdberl:cursor_next(),
+                not_found = bdberl:cursor_next(),
+                ok = bdberl:cursor_close(),
+
+                ok = bdberl:del_raw(Db, <<"b/2">>),
+                not_found = bdberl:get_raw(Db, <<"b/2">>),
+                {error, format_mismatch} = bdberl:put(Db, key, value),
+                {error, format_mismatch} = bdberl:get(Db, <<"a/1">>),
+                {error, format_mismatch} = bdberl:put_raw(TermDb, <<"k">>, <<"v">>),
+                ok = bdberl:close(Db),
+                ok = bdberl:delete_database(Name)
+        end,
+    [F(Alg) || Alg <- [none, crc32, crc32c, xxh64]],
+    done.
+
+compress_option_should_round_trip_values(_Config) ->
+    Samples = [{user, N, <<"name-", (list_to_binary(integer_to_list(N)))/binary>>,
+                [active, {roles, [reader, writer]}]} || N <- lists:seq(1, 200)],
+    Dict = bdberl:train_dict(Samples, 4096),
+    true = byte_size(Dict) > 0 andalso byte_size(Dict) =< 4096,
+    Big = lists:duplicate(100, {repeated, <<"payload">>}),
+    F = fun({Alg, Opts}) ->
+                Name = "compress_" ++ atom_to_list(Alg) ++ "_" ++
+                    integer_to_list(length(Opts)) ++ ".db",
+                {ok, Db} = bdberl:open(Name, btree, [create, {compress, lz}, {checksum, Alg} | Opts]),
+                [ok = bdberl:put(Db, N, S) || {user, N, _, _} = S <- Samples],
+                ok = bdberl:put(Db, big, Big),
+                ok = bdberl:put(Db, small, x),
+                {ok, Big} = bdberl:get(Db, big),
+                {ok, x} = bdberl:get(Db, small),
+                {ok, Big} = bdberl:get(Db, big, [decode]),
+                Sample = lists:nth(17, Samples),
+                {ok, Sample} = bdberl:get(Db, 17),
+                ok = bdberl:cursor_open(Db),
+                {ok, Sample} = bdberl:cursor_get(17),
+                {ok, 18, _} = bdberl:cursor_next(),
+                ok = bdberl:cursor_close(),
+                ok = bdberl:close(Db),
+                ok = bdberl:delete_database(Name)
+        end,
+    [F({Alg, Opts}) || Alg <- [crc32, xxh64, none], Opts <- [[], [{compress_dict, Dict}]]],
+    {error, invalid_option} = bdberl:open("compress_raw.db", btree,
+                                          [create, {format, raw}, {compress, lz}]),
+    done.
+
+bt_compress_option_should_be_reported(_Config) ->
+    {ok, Db} = bdberl:open("bt_compress.db", btree, [create, {bt_compress, true}]),
+    [ok = bdberl:put(Db, {account, <<"prefix">>, N}, N) || N <- lists:seq(1, 500)],
+    {ok, 250} = bdberl:get(Db, {account, <<"prefix">>, 250}),
+    {ok, Stats} = bdberl:stat(Db),
+    true = proplists:get_value(bt_compress, Stats),
+    500 = proplists:get_value(nkeys, Stats),
+    true = proplists:get_value(cache_hit, Stats) > 0,
+    true = is_integer(proplists:get_value(page_in, Stats)),
+    ok = bdberl:close(Db),
+    ok = bdberl:delete_database("bt_compress.db"),
+    {error, invalid_option} = bdberl:open("bt_compress_hash.db", hash,
+                                          [create, {bt_compress, true}]),
+    done.
+
+layout_options_should_shape_databases(_Config) ->
+    {ok, Bt} = bdberl:open("layout_btree.db", btree,
+                           [create, {page_size, 65536}, {bt_minkey, 4},
+                            {duplicates, sorted}]),
+    ok = bdberl:put(Bt, key, b),
+    ok = bdberl:put(Bt, key, a),
+    {ok, BtStats} = bdberl:stat(Bt),
+    65536 = proplists:get_value(pagesize, BtStats),
+    4 = proplists:get_value(minkey, BtStats),
+    1 = proplists:get_value(nkeys, BtStats),
+    2 = proplists:get_value(ndata, BtStats),
+    ok = bdberl:close(Bt),
+    ok = bdberl:delete_database("layout_btree.db"),
+
+    {ok, H} = bdberl:open("layout_hash.db", hash,
+                          [create, {page_size, 4096}, {h_ffactor, 40}, {h_nelem, 10000}]),
+    {ok, HStats} = bdberl:stat(H),
+    4096 = proplists:get_value(pagesize, HStats),
+    40 = proplists:get_value(ffactor, HStats),
+    true = proplists:get_value(buckets, HStats) >= 10000 div 40,
+    ok = bdberl:close(H),
+    ok = bdberl:delete_database("layout_hash.db"),
+
+    {error, _} = bdberl:open("layout_bad.db", btree, [create, {page_size, 1000}]),
+    done.
+
+term_key_order_should_match_erlang_order(_Config) ->
+    Keys = [1, 256, 70000, -5, 1 bsl 70, -(1 bsl 70), 2.5, 1.5, abc, ab, zz, "str", [1, 2],
+            [1 | 2], [], <<"bin">>, <<>>, {t, 1}, {t, 1, 2}, {a, 2}, self(),
+            %% Integers and floats compare exactly, past where doubles round
+            (1 bsl 53) + 1, 9007199254740994.0, -((1 bsl 53) + 1), -9007199254740994.0,
+            {1 bsl 53, z}, {9007199254740992.0, m}, {(1 bsl 53) + 1, a},
+            {100000000000000000001, n}, {1.0e20, n}, {1 bsl 1100, n}],
+    {ok, Db} = bdberl:open("term_order.db", btree, [create, {key_order, term}]),
+    [ok = bdberl:put(Db, K, K) || K <- Keys],
+    {ok, abc} = bdberl:get(Db, abc),
+    ok = bdberl:cursor_open(Db),
+    {ok, First} = bdberl:cursor_get(undefined, [db_first]),
+    Stored = [First | cursor_values()],
+    ok = bdberl:cursor_close(),
+    true = Stored =:= lists:sort(Keys),
+
+    %% Ranges stop at the bound in term order
+    ok = bdberl:cursor_open(Db),
+    {ok, 70000} = bdberl:cursor_get(300, [db_set_range]),
+    ok = bdberl:cursor_close(),
+    ok = bdberl:close(Db),
+    ok = bdberl:delete_database("term_order.db"),
+    {error, invalid_option} = bdberl:open("term_order_hash.db", hash,
+                                          [create, {key_order, term}]),
+    done.
+
+key_codec_should_order_keys_and_round_trip(_Config) ->
+    Keys = [1, 256, 70000, -5, 0, 1 bsl 70, -(1 bsl 70), abc, ab, <<"bin">>, <<0, 1>>, <<>>,
+            {t, 1}, {t, <<"x">>, -2}, {}],
+    {ok, Db} = bdberl:open("key_codec.db", btree, [create, {key_codec, ordered}]),
+    [ok = bdberl:put(Db, K, K) || K <- Keys],
+    {ok, {t, 1}} = bdberl:get(Db, {t, 1}),
+    ok = bdberl:cursor_open(Db),
+    {ok, First} = bdberl:cursor_get(undefined, [db_first]),
+    Stored = [First | cursor_values()],
+    {ok, 70000} = bdberl:cursor_get(300, [db_set_range]),
+    {ok, 1 bsl 70, 1 bsl 70} = bdberl:cursor_next(),
+    ok = bdberl:cursor_close(),
+    true = Stored =:= lists:sort(Keys),
+
+    %% Keys the codec can't store are refused
+    {error, invalid_key} = bdberl:put(Db, [1, 2], value),
+    {error, invalid_key} = bdberl:get(Db, 1.5),
+    ok = bdberl:del(Db, abc),
+    not_found = bdberl:get(Db, abc),
+    ok = bdberl:close(Db),
+    ok = bdberl:delete_database("key_codec.db"),
+    {error, invalid_option} = bdberl:open("key_codec_raw.db", btree,
+                                          [create, {format, raw}, {key_codec, ordered}]),
+    done.
+
+h_hash_option_should_be_checked_on_open(_Config) ->
+    {ok, Db} = bdberl:open("h_hash.db", hash, [create, {h_hash, xxh64}]),
+    [ok = bdberl:put(Db, {obj, N}, N) || N <- lists:seq(1, 1000)],
+    {ok, 500} = bdberl:get(Db, {obj, 500}),
+    {ok, Stats} = bdberl:stat(Db),
+    xxh64 = proplists:get_value(h_hash, Stats),
+    1000 = proplists:get_value(nkeys, Stats),
+    ok = bdberl:close(Db),
+
+    %% The file remembers its hash function
+    {error, _} = bdberl:open("h_hash.db", hash, [create]),
+    {ok, Db1} = bdberl:open("h_hash.db", hash, [create, {h_hash, xxh64}]),
+    {ok, 1000} = bdberl:get(Db1, {obj, 1000}),
+    ok = bdberl:close(Db1),
+    ok = bdberl:delete_database("h_hash.db"),
+    {error, invalid_option} = bdberl:open("h_hash_btree.db", btree,
+                                          [create, {h_hash, xxh64}]),
+    done.
+
+value_cache_should_track_writes(_Config) ->
+    {ok, Db} = bdberl:open("value_cache.db", btree, [create, {value_cache, 1 bsl 20}]),
+    ok = bdberl:put(Db, hot, 1),
+    {ok, 1} = bdberl:get(Db, hot),
+    {ok, 1} = bdberl:get(Db, hot),
+    {ok, Counters} = bdberl:db_counters(Db),
+    true = proplists:get_value(value_cache_hits, Counters) >= 1,
+    1 = proplists:get_value(value_cache_entries, Counters),
+    true = proplists:get_value(value_cache_hit_ratio, Counters) > 0.0,
+
+    %% Writes replace what the cache holds
+    ok = bdberl:put(Db, hot, 2),
+    {ok, 2} = bdberl:get(Db, hot),
+    ok = bdberl:del(Db, hot),
+    not_found = bdberl:get(Db, hot),
+    ok = bdberl:put(Db, hot, 3),
+    {ok, 3} = bdberl:get(Db, hot),
+
+    %% Transactions invalidate at commit; aborted writes never show
+    ok = bdberl:txn_begin(),
+    ok = bdberl:put(Db, hot, 4),
+    ok = bdberl:txn_commit(),
+    {ok, 4} = bdberl:get(Db, hot),
+    ok = bdberl:txn_begin(),
+    ok = bdberl:put(Db, hot, 5),
+    ok = bdberl:txn_abort(),
+    {ok, 4} = bdberl:get(Db, hot),
+
+    ok = bdberl:truncate(Db),
+    not_found = bdberl:get(Db, hot),
+    {ok, Counters1} = bdberl:db_counters(Db),
+    0 = proplists:get_value(value_cache_entries, Counters1),
+    ok = bdberl:close(Db),
+    ok = bdberl:delete_database("value_cache.db"),
+    done.
+
+key_filter_should_reject_absent_keys(_Config) ->
+    {ok, Db} = bdberl:open("key_filter.db", btree, [create, {key_filter, 1000}]),
+    %% Puts made while the filter is built still reach it
+    [ok = bdberl:put(Db, N, N) || N <- lists:seq(1, 100)],
+    ok = wait_for_key_filter(Db, 20),
+    {ok, 50} = bdberl:get(Db, 50),
+    [not_found = bdberl:get(Db, N) || N <- lists:seq(1001, 2000)],
+    {ok, Counters} = bdberl:db_counters(Db),
+    true = proplists:get_value(key_filter_rejects, Counters) > 900,
+    true = proplists:get_value(key_filter_bytes, Counters) > 0,
+    true = proplists:get_value(key_filter_fp_rate, Counters) < 0.1,
+
+    %% Gets in a transaction or with flags go to BDB, which locks the absent key
+    Rejects = proplists:get_value(key_filter_rejects, Counters),
+    ok = bdberl:txn_begin(),
+    not_found = bdberl:get(Db, 1999),
+    not_found = bdberl:get_r(Db, 1998, [rmw]),
+    ok = bdberl:txn_commit(),
+    {ok, Counters1} = bdberl:db_counters(Db),
+    Rejects = proplists:get_value(key_filter_rejects, Counters1),
+
+    %% Puts and deletes keep it current; aborted deletes leave the key
+    ok = bdberl:put(Db, 1500, 1500),
+    {ok, 1500} = bdberl:get(Db, 1500),
+    ok = bdberl:del(Db, 50),
+    not_found = bdberl:get(Db, 50),
+    ok = bdberl:txn_begin(),
+    ok = bdberl:del(Db, 70),
+    ok = bdberl:txn_abort(),
+    {ok, 70} = bdberl:get(Db, 70),
+    ok = bdberl:close(Db),
+
+    %% Reopening rebuilds it from the keys on disk
+    {ok, Db1} = bdberl:open("key_filter.db", btree, [create, {key_filter, 1000}]),
+    ok = wait_for_key_filter(Db1, 20),
+    {ok, 60} = bdberl:get(Db1, 60),
+    {ok, 1500} = bdberl:get(Db1, 1500),
+    not_found = bdberl:get(Db1, 50),
+    ok = bdberl:close(Db1),
+    ok = bdberl:delete_database("key_filter.db"),
+    done.
+
+%% The filter is built on a pool thread after the open; poll until it is published
+wait_for_key_filter(_Db, 0) ->
+    timeout;
+wait_for_key_filter(Db, Tries) ->
+    {ok, Counters} = bdberl:db_counters(Db),
+    case proplists:get_value(key_filter_bytes, Counters) of
+        0 ->
+            timer:sleep(50),
+            wait_for_key_filter(Db, Tries - 1);
+        _ ->
+            ok
+    end.
+
+cursor_values() ->
+    case bdberl:cursor_next() of
+        {ok, _Key, Value} -> [Value | cursor_values()];
+        not_found         -> []
+    end.
+
+lock_telemetry_should_be_reported(_Config) ->
+    {ok, Info} = bdberl:driver_info(),
+    true = is_integer(proplists:get_value(deadlocks, Info)),
+    true = is_integer(proplists:get_value(lock_failures, Info)),
+    true = is_integer(proplists:get_value(lock_failure_usecs, Info)),
+    true = is_float(proplists:get_value(lock_wait_rate, Info)),
+    true = is_float(proplists:get_value(deadlock_rate, Info)),
+    done.
+
+samples_should_decode_series(_Config) ->
+    %% The first sample is only a baseline; wait for one with deltas
+    ok = wait_for_samples(20),
+    {ok, <<1:32/native, 24:32/native, _Interval:32/native, _Gauges:32/native,
+           Count:32/native, Records/bytes>>} = bdberl:samples([binary]),
+    Count = size(Records) div ((2 + 24) * 8),
+    {ok, Samples} = bdberl:samples(),
+    {ok, [_]} = bdberl:samples([{last, 1}]),
+    [_ | _] = Samples,
+    [true = proplists:is_defined(rates, S) || S <- Samples],
+    done.
+
+wait_for_samples(0) ->
+    timeout;
+wait_for_samples(Tries) ->
+    case bdberl:samples([{last, 1}]) of
+        {ok, [_]} ->
+            ok;
+        {ok, []} ->
+            timer:sleep(250),
+            wait_for_samples(Tries - 1)
+    end.
+
+trace_dump_should_record_operations(Config) ->
+    Db = ?config(db, Config),
+    ok = bdberl:put(Db, trace_key, trace_value),
+    {ok, trace_value} = bdberl:get(Db, trace_key),
+    {ok, Entries} = bdberl:trace_dump(),
+    [Get | _] = [E || E <- lists:reverse(Entries),
+                      proplists:get_value(cmd, E) =:= get,
+                      proplists:get_value(db, E) =:= Db],
+    ok = proplists:get_value(rc, Get),
+    false = proplists:get_value(txn, Get),
+    true = proplists:get_value(key_size, Get) > 0,
+    done.
+
+capture_should_record_requests(Config) ->
+    Db = ?config(db, Config),
+    File = filename:join([?config(priv_dir, Config), "requests.capture"]),
+    ok = bdberl:capture_start(File),
+    ok = bdberl:put(Db, capture_key, capture_value),
+    {ok, capture_value} = bdberl:get(Db, capture_key),
+    ok = bdberl:capture_stop(),
+    {ok, <<"BDBC", 1:32/native, _Start:64/native, Records/bytes>>} = file:read_file(File),
+    KeyBin = term_to_binary(capture_key),
+    KeySize = size(KeyBin),
+    Cmds = [Cmd || <<_Ts:64/native, _Port:32/native, Cmd:32/native, Ref:32/signed-native,
+                     _Flags:32/native, KeySize0:32/native, _ValueSize:32/native,
+                     Key:KeySize0/bytes>> <= Records,
+                   Ref =:= Db, KeySize0 =:= KeySize, Key =:= KeyBin],
+    [?CMD_PUT, ?CMD_GET] = Cmds,
+    done.
+
 %% Check the bdberl_logger gets reinstalled after stopping
 start_after_stop_should_be_safe(_Config) ->
 